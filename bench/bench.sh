@@ -0,0 +1,278 @@
+#!/bin/bash
+# BENCH - loopback benchmark matrix for the server and the client
+#
+# Each scenario starts a fresh server on loopback, runs the client
+# against it, and turns the last --stats-file snapshot of both into
+# one CSV line. Files from two versions can then be compared with
+# bench/compare.sh.
+#
+# Scenarios:
+#   storm     many connections opened at once: connect latency; also with
+#             the io_uring back-end (storm-uring)
+#   idle      many connections trickling a few messages: memory per connection
+#   rate      closed-loop 64-byte messages: messages per second, CPU and
+#             server syscalls per message; also with the io_uring back-end
+#             (rate-uring) and with every message's CRC32C checked (rate-crc)
+#   bulk      closed-loop 64 KiB chunks: Gbit/s, CPU per byte; also sent
+#             with MSG_ZEROCOPY (bulk-zerocopy) or sendfile() (bulk-sendfile),
+#             received with splice() (bulk-splice), over TLS with OpenSSL
+#             records (bulk-tls) or kernel records (bulk-ktls), and with
+#             every chunk's CRC32C checked (bulk-crc)
+#   pingpong  framed request/response: round-trip time percentiles; also
+#             with the io_uring back-end (pingpong-uring), over TLS
+#             (pingpong-tls, pingpong-ktls), and one connection per thread
+#             answered by a pinned worker that sleeps in epoll_pwait()
+#             (pingpong-pinned) or spins instead (pingpong-busypoll)
+#   churn     one connection per request (--reconnect): transaction time
+#             and server wake-ups, plain, with TCP_DEFER_ACCEPT (churn-defer)
+#             and with TCP Fast Open on top (churn-tfo)
+#   unix      rate, bulk and pingpong over a Unix-domain socket (rate-unix,
+#             bulk-unix, pingpong-unix) and through shared-memory rings
+#             (rate-shm, bulk-shm, pingpong-shm), next to loopback TCP
+#   steer     ping-pong over many connections with the workers pinned,
+#             spread by the kernel hash (steer-hash) or sent to the worker
+#             on the CPU that received them (steer-cpu): share of clients
+#             whose packets and worker share a CPU
+#   udp       closed-loop 1200-byte datagrams (--udp): datagrams received
+#             per second, loss in the errors column; batched with
+#             sendmmsg(), and with UDP_SEGMENT on top (udp-gso)
+#
+# Each scenario is run with 1, 2, 4... threads on both sides, up to the
+# number of online CPUs. The *-ktls scenarios are skipped when the kernel
+# has no TLS support (no "tls" in net.ipv4.tcp_available_ulp).
+#
+# Environment (all optional):
+#   BENCH_SCENARIOS  scenarios to run (default: all of the above)
+#   BENCH_THREADS    thread counts (default: 1 2 4 ... nproc)
+#   BENCH_DURATION   seconds per run (default: 5)
+#   BENCH_PORT       TCP port of the server (default: 5555)
+#   BENCH_OUT        CSV file to write (default: bench/results/VERSION.csv)
+
+set -u
+
+TOP=$(cd "$(dirname "$0")/.." && pwd)
+SERVER=$TOP/server/server
+CLIENT=$TOP/client/client
+HOST=127.0.0.1
+
+VERSION=$(git -C "$TOP" describe --always --dirty 2>/dev/null || echo unknown)
+SCENARIOS=${BENCH_SCENARIOS:-storm storm-uring idle rate rate-uring rate-crc bulk bulk-zerocopy bulk-sendfile bulk-splice bulk-crc bulk-tls bulk-ktls pingpong pingpong-uring pingpong-pinned pingpong-busypoll pingpong-tls pingpong-ktls rate-unix rate-shm bulk-unix bulk-shm pingpong-unix pingpong-shm churn churn-defer churn-tfo steer-hash steer-cpu udp udp-gso}
+DURATION=${BENCH_DURATION:-5}
+PORT=${BENCH_PORT:-5555}
+OUT=${BENCH_OUT:-$TOP/bench/results/$VERSION.csv}
+
+if [ -z "${BENCH_THREADS:-}" ]; then
+    ncpus=$(nproc)
+    BENCH_THREADS=""
+    for ((t = 1; t < ncpus; t *= 2)); do
+        BENCH_THREADS+="$t "
+    done
+    BENCH_THREADS+="$ncpus"
+fi
+
+RED=$'\033[1;31m'
+GREEN=$'\033[1;32m'
+CYAN=$'\033[1;36m'
+NORMAL=$'\033[0m'
+
+WORK=$(mktemp -d)
+SOCK=$WORK/server.sock     # --unix path of the *-unix and *-shm scenarios
+SERVER_PID=
+
+cleanup()
+{
+    [ -n "$SERVER_PID" ] && kill -INT "$SERVER_PID" 2>/dev/null && wait "$SERVER_PID" 2>/dev/null
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+# prom FILE SERIES - value of SERIES in a stats file, summed over its
+# per-thread series if SERIES has no labels (0 if absent).
+prom()
+{
+    awk -v name="$2" '
+        $1 == name || index($1, name "{") == 1 { sum += $2 }
+        END                                    { printf "%.9g\n", sum + 0 }' "$1" 2>/dev/null || echo 0
+}
+
+# calc EXPRESSION - floating-point arithmetic
+calc()
+{
+    awk "BEGIN { printf \"%.6g\n\", ($1) }"
+}
+
+# ktls_available - whether the kernel can take over TLS records
+ktls_available()
+{
+    grep -qw tls /proc/sys/net/ipv4/tcp_available_ulp 2>/dev/null && return 0
+    modprobe -q tls 2>/dev/null
+    grep -qw tls /proc/sys/net/ipv4/tcp_available_ulp 2>/dev/null
+}
+
+# server_start THREADS ARGS... - start a server and wait for its first snapshot
+server_start()
+{
+    local threads=$1
+    shift
+
+    rm -f "$WORK/server.prom"
+    "$SERVER" -q -w "$threads" -s "$WORK/server.prom" --stats-interval=0.2 "$@" "$PORT" \
+        > "$WORK/server.log" 2>&1 &
+    SERVER_PID=$!
+
+    for ((i = 0; i < 100; i++)); do
+        [ -s "$WORK/server.prom" ] && return 0
+        kill -0 "$SERVER_PID" 2>/dev/null || break
+        sleep 0.05
+    done
+
+    echo "${RED}Server did not start:${NORMAL}" >&2
+    cat "$WORK/server.log" >&2
+    exit 1
+}
+
+# server_stop - stop the server; it writes a final snapshot on its way out
+server_stop()
+{
+    kill -INT "$SERVER_PID"
+    wait "$SERVER_PID"
+    SERVER_PID=
+}
+
+# run SCENARIO THREADS CONNS MSG_SIZE SERVER_ARGS -- CLIENT_ARGS...
+#
+# The client connects to DEST, "$HOST $PORT" unless set for the call
+# (e.g. DEST=unix:PATH run ...).
+run()
+{
+    local scenario=$1 threads=$2 conns=$3 msg_size=$4
+    local server_args=()
+    shift 4
+    while [ "$1" != "--" ]; do
+        server_args+=("$1")
+        shift
+    done
+    shift
+
+    printf "%s%-13s threads=%-3s conns=%-6s%s " "$CYAN" "$scenario" "$threads" "$conns" "$NORMAL"
+
+    server_start "$threads" "${server_args[@]}"
+    local rss_base
+    rss_base=$(prom "$WORK/server.prom" process_resident_memory_bytes)
+
+    rm -f "$WORK/client.prom"
+    "$CLIENT" -q -j "$threads" -c "$conns" -m "$msg_size" -d "$DURATION" \
+        --stats-file="$WORK/client.prom" "$@" ${DEST:-$HOST $PORT} > "$WORK/client.log" 2>&1
+    local status=$?
+
+    server_stop
+
+    local s=$WORK/server.prom c=$WORK/client.prom
+    local connected failed msgs bytes rtt_p50 rtt_p99 connect_p99 server_cpu client_cpu rss_max wakeups syscalls local remote errors
+    connected=$(prom "$c" client_connected_total)
+    failed=$(prom "$c" client_connect_failed_total)
+    msgs=$(prom "$c" client_msgs_out_total)
+    bytes=$(prom "$c" client_bytes_out_total)
+    if [[ $scenario == udp* ]]; then
+        # Datagrams sent are not datagrams delivered: count what arrived.
+        msgs=$(prom "$s" server_datagrams_in_total)
+        bytes=$(calc "$msgs * $msg_size")
+    fi
+    rtt_p50=$(prom "$c" 'client_rtt_seconds{quantile="0.5"}')
+    rtt_p99=$(prom "$c" 'client_rtt_seconds{quantile="0.99"}')
+    connect_p99=$(prom "$c" 'client_connect_seconds{quantile="0.99"}')
+    client_cpu=$(prom "$c" process_cpu_seconds_total)
+    server_cpu=$(prom "$s" process_cpu_seconds_total)
+    rss_max=$(prom "$s" process_resident_memory_max_bytes)
+    wakeups=$(prom "$s" server_batch_seconds_count)
+    # Each wake-up is one epoll_pwait() or io_uring_enter(), and echoes
+    # are send() calls with both back-ends. io_uring recv completions
+    # cost no syscall of their own.
+    syscalls=$(calc "$wakeups + $(prom "$s" server_send_calls_total)")
+    if [[ $scenario != *-uring ]]; then
+        syscalls=$(calc "$syscalls + $(prom "$s" server_recv_calls_total)")
+    fi
+    local=$(prom "$s" server_cpu_local_total)
+    remote=$(prom "$s" server_cpu_remote_total)
+    errors=$(calc "$(prom "$c" client_bad_frames_total) + $(prom "$s" server_datagrams_lost) + $(prom "$s" server_crc_errors_total)")
+
+    local msgs_per_s gbit_s rtt_p50_us rtt_p99_us connect_p99_us cpu_us_per_msg bytes_per_conn wakeups_per_msg syscalls_per_msg cpu_ns_per_byte local_cpu_pct
+    msgs_per_s=$(calc "$msgs / $DURATION")
+    gbit_s=$(calc "$bytes * 8 / $DURATION / 1e9")
+    rtt_p50_us=$(calc "$rtt_p50 * 1e6")
+    rtt_p99_us=$(calc "$rtt_p99 * 1e6")
+    connect_p99_us=$(calc "$connect_p99 * 1e6")
+    cpu_us_per_msg=$(calc "$msgs > 0 ? ($server_cpu + $client_cpu) * 1e6 / $msgs : 0")
+    wakeups_per_msg=$(calc "$msgs > 0 ? $wakeups / $msgs : 0")
+    syscalls_per_msg=$(calc "$msgs > 0 ? $syscalls / $msgs : 0")
+    cpu_ns_per_byte=$(calc "$bytes > 0 ? ($server_cpu + $client_cpu) * 1e9 / $bytes : 0")
+    local_cpu_pct=$(calc "$local + $remote > 0 ? $local * 100 / ($local + $remote) : 0")
+    bytes_per_conn=$(calc "$connected > 0 && $rss_max > $rss_base ? ($rss_max - $rss_base) / $connected : 0")
+
+    echo "$VERSION,$scenario,$threads,$conns,$msg_size,$DURATION,$connected,$failed,$msgs_per_s,$gbit_s,$rtt_p50_us,$rtt_p99_us,$connect_p99_us,$cpu_us_per_msg,$wakeups_per_msg,$server_cpu,$client_cpu,$(calc "$rss_max / 1024"),$bytes_per_conn,$local_cpu_pct,$errors,$syscalls_per_msg,$cpu_ns_per_byte" >> "$OUT"
+
+    if [ $status -ne 0 ]; then
+        echo "${RED}client failed:${NORMAL}"
+        tail -n 5 "$WORK/client.log"
+    else
+        echo "${GREEN}$msgs_per_s msgs/s, $gbit_s Gbit/s, $cpu_us_per_msg us CPU/msg, rtt p50 $rtt_p50_us us p99 $rtt_p99_us us, connect $connect_p99_us us${NORMAL}"
+    fi
+}
+
+for prog in "$SERVER" "$CLIENT"; do
+    if [ ! -x "$prog" ]; then
+        echo "${RED}$prog is missing: run make first${NORMAL}" >&2
+        exit 1
+    fi
+done
+
+mkdir -p "$(dirname "$OUT")"
+echo "version,scenario,threads,conns,msg_size,duration_s,connected,connect_failed,msgs_per_s,gbit_s,rtt_p50_us,rtt_p99_us,connect_p99_us,cpu_us_per_msg,server_wakeups_per_msg,server_cpu_s,client_cpu_s,server_rss_max_kib,server_bytes_per_conn,server_local_cpu_pct,errors,server_syscalls_per_msg,cpu_ns_per_byte" > "$OUT"
+
+echo "${CYAN}Benchmarking $VERSION on $HOST:$PORT, $DURATION s per run, threads: $BENCH_THREADS${NORMAL}"
+
+for scenario in $SCENARIOS; do
+    if [[ $scenario == *-ktls ]] && ! ktls_available; then
+        echo "${CYAN}$scenario skipped: this kernel has no TLS support${NORMAL}"
+        continue
+    fi
+    for threads in $BENCH_THREADS; do
+        case $scenario in
+        storm)         run storm         "$threads" 5000              64    --                                  -r 1 -C 10 ;;
+        storm-uring)   run storm-uring   "$threads" 5000              64    --io=uring --                       -r 1 -C 10 ;;
+        idle)          run idle          "$threads" 10000             64    --                                  -r 1000 -C 10 ;;
+        rate)          run rate          "$threads" $((threads * 4))  64    --                                  ;;
+        rate-uring)    run rate-uring    "$threads" $((threads * 4))  64    --io=uring --                       ;;
+        rate-crc)      run rate-crc      "$threads" $((threads * 4))  64    --crc=64 --                         --crc ;;
+        bulk)          run bulk          "$threads" "$threads"        65536 --                                  --bulk ;;
+        bulk-zerocopy) run bulk-zerocopy "$threads" "$threads"        65536 --                                  --bulk=zerocopy ;;
+        bulk-sendfile) run bulk-sendfile "$threads" "$threads"        65536 --                                  --bulk=sendfile ;;
+        bulk-splice)   run bulk-splice   "$threads" "$threads"        65536 --sink=splice --                    --bulk ;;
+        bulk-crc)      run bulk-crc      "$threads" "$threads"        65536 --crc=65536 --                      --bulk --crc ;;
+        bulk-tls)      run bulk-tls      "$threads" "$threads"        65536 --tls=user --                       --bulk --tls=user ;;
+        bulk-ktls)     run bulk-ktls     "$threads" "$threads"        65536 --tls --                            --bulk --tls ;;
+        pingpong)      run pingpong      "$threads" $((threads * 4))  64    --echo --framed --                  -P -f ;;
+        pingpong-uring) run pingpong-uring "$threads" $((threads * 4)) 64   --echo --framed --io=uring --       -P -f ;;
+        pingpong-pinned)   run pingpong-pinned   "$threads" "$threads" 64 --echo --framed --pin --             -P -f ;;
+        pingpong-busypoll) run pingpong-busypoll "$threads" "$threads" 64 --echo --framed --busy-poll --pin -- -P -f ;;
+        pingpong-tls)  run pingpong-tls  "$threads" $((threads * 4))  64    --echo --framed --tls=user --       -P -f --tls=user ;;
+        pingpong-ktls) run pingpong-ktls "$threads" $((threads * 4))  64    --echo --framed --tls --            -P -f --tls ;;
+        rate-unix)     DEST=unix:$SOCK run rate-unix     "$threads" $((threads * 4)) 64    --unix="$SOCK" --                 ;;
+        rate-shm)      DEST=unix:$SOCK run rate-shm      "$threads" $((threads * 4)) 64    --unix="$SOCK" --                 --shm ;;
+        bulk-unix)     DEST=unix:$SOCK run bulk-unix     "$threads" "$threads"       65536 --unix="$SOCK" --                 --bulk ;;
+        bulk-shm)      DEST=unix:$SOCK run bulk-shm      "$threads" "$threads"       65536 --unix="$SOCK" --                 --bulk --shm ;;
+        pingpong-unix) DEST=unix:$SOCK run pingpong-unix "$threads" $((threads * 4)) 64    --echo --framed --unix="$SOCK" -- -P -f ;;
+        pingpong-shm)  DEST=unix:$SOCK run pingpong-shm  "$threads" $((threads * 4)) 64    --echo --framed --unix="$SOCK" -- -P -f --shm ;;
+        churn)         run churn         "$threads" $((threads * 4))  64    --echo --                           --reconnect ;;
+        churn-defer)   run churn-defer   "$threads" $((threads * 4))  64    --echo --defer-accept --            --reconnect ;;
+        churn-tfo)     run churn-tfo     "$threads" $((threads * 4))  64    --echo --defer-accept --fastopen -- --reconnect --fastopen ;;
+        steer-hash)    run steer-hash    "$threads" $((threads * 16)) 64    --echo --steer=hash --              -P ;;
+        steer-cpu)     run steer-cpu     "$threads" $((threads * 16)) 64    --echo --steer=cpu --               -P ;;
+        udp)           run udp           "$threads" $((threads * 4))  1200  --udp --                            --udp ;;
+        udp-gso)       run udp-gso       "$threads" $((threads * 4))  1200  --udp --                            --udp --gso ;;
+        *)             echo "${RED}Unknown scenario: $scenario${NORMAL}" >&2; exit 1 ;;
+        esac
+    done
+done
+
+echo "${GREEN}Results written to $OUT${NORMAL}"
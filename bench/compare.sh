@@ -0,0 +1,80 @@
+#!/bin/bash
+# BENCH - compare two result files written by bench/bench.sh
+#
+# Usage: bench/compare.sh OLD.csv NEW.csv [THRESHOLD%]
+#
+# Prints, for every run found in both files (same scenario, threads,
+# connections and message size), each metric that moved by more than
+# THRESHOLD percent (default: 5): in red when it got worse, in green
+# when it got better. Exits with 1 if anything got worse.
+
+set -u
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 OLD.csv NEW.csv [THRESHOLD%]" >&2
+    exit 2
+fi
+
+awk -F, -v threshold="${3:-5}" -v red=$'\033[1;31m' -v green=$'\033[1;32m' -v normal=$'\033[0m' '
+    # Which way is better for each metric: +1 higher, -1 lower.
+    BEGIN {
+        better["msgs_per_s"]            = +1
+        better["gbit_s"]                = +1
+        better["rtt_p50_us"]            = -1
+        better["rtt_p99_us"]            = -1
+        better["connect_p99_us"]        = -1
+        better["cpu_us_per_msg"]        = -1
+        better["server_wakeups_per_msg"] = -1
+        better["server_syscalls_per_msg"] = -1
+        better["cpu_ns_per_byte"]       = -1
+        better["server_bytes_per_conn"] = -1
+        better["server_local_cpu_pct"]  = +1
+        better["connect_failed"]        = -1
+        better["errors"]                = -1
+    }
+
+    FNR == 1 {
+        for (i = 1; i <= NF; i++)
+            col[$i] = i
+        next
+    }
+
+    {
+        key = $col["scenario"] " threads=" $col["threads"] " conns=" $col["conns"] " msg_size=" $col["msg_size"]
+    }
+
+    NR == FNR {
+        old_version = $col["version"]
+        for (m in better)
+            old[key, m] = $col[m]
+        next
+    }
+
+    {
+        new_version = $col["version"]
+        if (!((key, "msgs_per_s") in old))
+            next
+
+        for (m in better)
+        {
+            o = old[key, m] + 0
+            n = $col[m] + 0
+            if (o == n)
+                continue
+
+            change = o != 0 ? (n - o) * 100 / o : (n > o ? 100 : -100)
+            if (change < threshold && change > -threshold)
+                continue
+
+            worse = change * better[m] < 0
+            regressions += worse
+            printf "%s%-40s %-22s %12g -> %-12g (%+.1f%%)%s\n", worse ? red : green, key, m, o, n, change, normal
+        }
+        compared++
+    }
+
+    END {
+        printf "%d run(s) compared (%s -> %s), %d regression(s) over %s%%\n",
+               compared, old_version, new_version, regressions, threshold
+        exit regressions > 0
+    }' "$1" "$2"
@@ -0,0 +1,113 @@
+#!/bin/bash
+# BENCH - restart the server under load and count the refused connections
+#
+# A client opens a new connection for every request (--reconnect) while
+# the server is restarted RESTART_COUNT times. Each new server takes the
+# listeners over from the running one (--handover), which then exits once
+# its clients are served. A restart that lets the port close shows up as
+# failed connects; one that drops clients, as connections closed by the
+# peer.
+#
+# Environment (all optional):
+#   RESTART_COUNT    restarts during the run (default: 5)
+#   RESTART_THREADS  server workers and client threads (default: 2)
+#   BENCH_PORT       TCP port of the server (default: 5555)
+#
+# Exit status: 0 if every connection was served.
+
+set -u
+
+TOP=$(cd "$(dirname "$0")/.." && pwd)
+SERVER=$TOP/server/server
+CLIENT=$TOP/client/client
+HOST=127.0.0.1
+
+COUNT=${RESTART_COUNT:-5}
+THREADS=${RESTART_THREADS:-2}
+PORT=${BENCH_PORT:-5555}
+DURATION=$((COUNT + 2))
+
+RED=$'\033[1;31m'
+GREEN=$'\033[1;32m'
+CYAN=$'\033[1;36m'
+NORMAL=$'\033[0m'
+
+WORK=$(mktemp -d)
+HANDOVER=@restart-$$
+SERVER_PID=
+
+cleanup()
+{
+    [ -n "$SERVER_PID" ] && kill -INT "$SERVER_PID" 2>/dev/null && wait "$SERVER_PID" 2>/dev/null
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+# prom FILE SERIES - value of SERIES in a stats file, summed over its
+# per-thread series (0 if absent)
+prom()
+{
+    awk -v name="$2" '
+        $1 == name || index($1, name "{") == 1 { sum += $2 }
+        END                                    { printf "%.9g\n", sum + 0 }' "$1" 2>/dev/null || echo 0
+}
+
+# server_start N - start server number N, taking over from the running one
+server_start()
+{
+    "$SERVER" -q -w "$THREADS" --echo --handover="$HANDOVER" -s "$WORK/server$1.prom" "$PORT" \
+        > "$WORK/server$1.log" 2>&1 &
+    SERVER_PID=$!
+
+    # The first snapshot is written once the workers serve the listeners.
+    for ((i = 0; i < 100; i++)); do
+        [ -s "$WORK/server$1.prom" ] && return 0
+        kill -0 "$SERVER_PID" 2>/dev/null || break
+        sleep 0.05
+    done
+
+    echo "${RED}Server $1 did not start:${NORMAL}" >&2
+    cat "$WORK/server$1.log" >&2
+    exit 1
+}
+
+for prog in "$SERVER" "$CLIENT"; do
+    if [ ! -x "$prog" ]; then
+        echo "${RED}$prog is missing: run make first${NORMAL}" >&2
+        exit 1
+    fi
+done
+
+echo "${CYAN}Restarting the server $COUNT time(s) on $HOST:$PORT under $DURATION s of connect-per-request load${NORMAL}"
+
+server_start 0
+"$CLIENT" -q -j "$THREADS" -c $((THREADS * 4)) -m 64 -d "$DURATION" -P --reconnect \
+    --stats-file="$WORK/client.prom" "$HOST" "$PORT" > "$WORK/client.log" 2>&1 &
+CLIENT_PID=$!
+
+for ((n = 1; n <= COUNT; n++)); do
+    sleep 1
+    old=$SERVER_PID
+    server_start "$n"
+    if ! wait "$old"; then
+        echo "${RED}Server $((n - 1)) failed:${NORMAL}" >&2
+        tail -n 5 "$WORK/server$((n - 1)).log" >&2
+    fi
+    printf "%srestart %d%s: %s\n" "$CYAN" "$n" "$NORMAL" "$(grep "^Handover:" "$WORK/server$((n - 1)).log")"
+done
+
+wait "$CLIENT_PID"
+status=$?
+
+c=$WORK/client.prom
+connected=$(prom "$c" client_connected_total)
+failed=$(prom "$c" client_connect_failed_total)
+closed=$(prom "$c" client_closed_total)
+
+if [ $status -ne 0 ] || [ "$failed" != 0 ] || [ "$closed" != 0 ]; then
+    echo "${RED}$connected connection(s) served, $failed failed to connect, $closed closed by the server${NORMAL}"
+    tail -n 5 "$WORK/client.log"
+    exit 1
+fi
+
+echo "${GREEN}$connected connection(s) served across $COUNT restart(s), none refused or dropped${NORMAL}"
@@ -0,0 +1,198 @@
+// CLIENT - lists and ranges of source addresses and interfaces
+//
+// A single source IP can only have ~28k connections to one server
+// address and port (the ephemeral port range). The load generator
+// spreads its connections over lists of source addresses and interfaces
+// to go past that limit:
+//
+//   --source-address=10.0.0.1-10.0.0.200,10.0.1.1
+//   --source-address=fd00::10-fd00::1f
+//   --interface=eth0,eth1      --interface=veth[0-15]
+#define _GNU_SOURCE
+#include <stdio.h>      /* fprintf() */
+#include <stdlib.h>     /* malloc(), realloc(), strtoul() */
+#include <string.h>     /* strdup(), strchr() */
+#include <arpa/inet.h>  /* htonl(), ntohl() */
+#include <netdb.h>      /* SCOPE_DELIMITER */
+
+#include "client.h"
+
+#define LIST_MAX    65536   /* entries after expansion */
+
+static int addr_cmp(const struct sockaddr_storage *a_p, const struct sockaddr_storage *b_p)
+{
+    if (a_p->ss_family == AF_INET)
+        return memcmp(&((const struct sockaddr_in *)a_p)->sin_addr, &((const struct sockaddr_in *)b_p)->sin_addr, 4);
+
+    return memcmp(&((const struct sockaddr_in6 *)a_p)->sin6_addr, &((const struct sockaddr_in6 *)b_p)->sin6_addr, 16);
+}
+
+static void addr_inc(struct sockaddr_storage *addr_p)
+{
+    if (addr_p->ss_family == AF_INET)
+    {
+        struct in_addr *in_p = &((struct sockaddr_in *)addr_p)->sin_addr;
+        in_p->s_addr = htonl(ntohl(in_p->s_addr) + 1);
+        return;
+    }
+
+    uint8_t *b = ((struct sockaddr_in6 *)addr_p)->sin6_addr.s6_addr;
+    for (int i = 15; i >= 0 && ++b[i] == 0; i--)
+        ;
+}
+
+static int list_append(void **list_pp, int *count_p, size_t elem_size, const void *elem_p)
+{
+    if (*count_p >= LIST_MAX)
+        return -1;
+
+    // Grow by powers of 2
+    if ((*count_p & (*count_p - 1)) == 0)
+    {
+        void *list_p = realloc(*list_pp, (*count_p ? *count_p * 2 : 1) * elem_size);
+        if (!list_p)
+            return -1;
+        *list_pp = list_p;
+    }
+
+    memcpy((char *)*list_pp + *count_p * elem_size, elem_p, elem_size);
+    (*count_p)++;
+    return 0;
+}
+
+/* One FIRST or FIRST-LAST item. The range dash comes before any %scope. */
+static int parse_addr_item(char *item_p, struct sockaddr_storage **addrs_pp, int *count_p)
+{
+    struct sockaddr_storage first, last;
+    char *scope_p = strchr(item_p, SCOPE_DELIMITER);
+    char *dash_p  = strchr(item_p, '-');
+
+    if (dash_p && scope_p && dash_p > scope_p)
+        dash_p = NULL;
+
+    if (!dash_p)
+    {
+        if (inet_pton_with_scope(AF_UNSPEC, item_p, 0, &first) != 0)
+            return -1;
+        return list_append((void **)addrs_pp, count_p, sizeof(first), &first);
+    }
+
+    *dash_p = '\0';
+    if (inet_pton_with_scope(AF_UNSPEC, dash_p + 1, 0, &last) != 0)
+        return -1;
+
+    // The scope of the last address applies to the whole range.
+    if (scope_p)
+        *scope_p = '\0';
+    if (inet_pton_with_scope(last.ss_family, item_p, 0, &first) != 0 || addr_cmp(&first, &last) > 0)
+        return -1;
+    if (last.ss_family == AF_INET6)
+        ((struct sockaddr_in6 *)&first)->sin6_scope_id = ((struct sockaddr_in6 *)&last)->sin6_scope_id;
+
+    for (;;)
+    {
+        if (list_append((void **)addrs_pp, count_p, sizeof(first), &first) != 0)
+            return -1;
+        if (addr_cmp(&first, &last) == 0)
+            return 0;
+        addr_inc(&first);
+    }
+}
+
+/**
+ * parse_addr_list - expand a list of source addresses
+ * @spec_p: comma-separated addresses or FIRST-LAST ranges
+ * @addrs_pp: set to a malloc'ed array of addresses (port 0)
+ *
+ * Return the number of addresses, or -1 if @spec_p is invalid or
+ * expands to more than LIST_MAX addresses.
+ */
+int parse_addr_list(const char *spec_p, struct sockaddr_storage **addrs_pp)
+{
+    char *copy_p = strdup(spec_p);
+    char *save_p = NULL;
+    int   count  = 0;
+
+    *addrs_pp = NULL;
+    for (char *item_p = strtok_r(copy_p, ",", &save_p); item_p; item_p = strtok_r(NULL, ",", &save_p))
+    {
+        if (parse_addr_item(item_p, addrs_pp, &count) != 0)
+        {
+            fprintf(stderr, RED "Invalid source address or range: %s" NORMAL "\n", item_p);
+            count = -1;
+            break;
+        }
+    }
+
+    free(copy_p);
+    if (count <= 0)
+    {
+        free(*addrs_pp);
+        *addrs_pp = NULL;
+        return -1;
+    }
+
+    return count;
+}
+
+/**
+ * parse_iface_list - expand a list of interface names
+ * @spec_p: comma-separated names, each of which may end with a numeric
+ *      range in brackets: "veth[0-15]" is veth0 to veth15
+ * @names_pp: set to a malloc'ed array of malloc'ed names
+ *
+ * Return the number of names, or -1 if @spec_p is invalid.
+ */
+int parse_iface_list(const char *spec_p, char ***names_pp)
+{
+    char *copy_p = strdup(spec_p);
+    char *save_p = NULL;
+    int   count  = 0;
+
+    *names_pp = NULL;
+    for (char *item_p = strtok_r(copy_p, ",", &save_p); item_p && count >= 0; item_p = strtok_r(NULL, ",", &save_p))
+    {
+        char          *open_p = strchr(item_p, '[');
+        unsigned long  lo = 0, hi = 0;
+        char          *end_p;
+
+        if (open_p)
+        {
+            *open_p = '\0';
+            lo = strtoul(open_p + 1, &end_p, 10);
+            if (*end_p == '-')
+                hi = strtoul(end_p + 1, &end_p, 10);
+            else
+                hi = lo;
+            if (strcmp(end_p, "]") != 0 || lo > hi || hi - lo >= LIST_MAX)
+            {
+                count = -1;
+                break;
+            }
+        }
+
+        for (unsigned long i = lo; i <= hi && count >= 0; i++)
+        {
+            char *name_p = NULL;
+            if (open_p)
+            {
+                if (asprintf(&name_p, "%s%lu", item_p, i) < 0)
+                    name_p = NULL;
+            }
+            else
+                name_p = strdup(item_p);
+
+            if (!name_p || list_append((void **)names_pp, &count, sizeof(name_p), &name_p) != 0)
+            {
+                free(name_p);
+                count = -1;
+            }
+        }
+    }
+
+    if (count <= 0)
+        fprintf(stderr, RED "Invalid interface list: %s" NORMAL "\n", spec_p);
+
+    free(copy_p);
+    return count <= 0 ? -1 : count;
+}
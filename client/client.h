@@ -0,0 +1,73 @@
+// CLIENT - declarations shared by the client modes
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <stdint.h>     /* uint16_t */
+#include <sys/socket.h> /* struct sockaddr_storage */
+
+#include "tlsconn.h"
+
+#define RED     "\x1b[1;31m"
+#define GREEN   "\x1b[1;32m"
+#define CYAN    "\x1b[1;36m"
+#define NORMAL  "\x1b[0m"
+
+enum bulk_mode
+{
+    BULK_OFF,
+    BULK_COPY,      /* send() from a user buffer */
+    BULK_ZEROCOPY,  /* send(MSG_ZEROCOPY), completions read from the error queue */
+    BULK_SENDFILE,  /* sendfile() from a file (or a memfd holding one message) */
+};
+
+struct arguments
+{
+    uint16_t     port;
+    const char *addr_p;         /* host, address, or "unix:PATH" */
+    char       *interface_p;
+    char       *srce_addr_p;
+    int         trace_level;
+    const char *trace_file_p;
+    int         framed;         /* length-prefixed frames, see frame.h */
+    int         connect_timeout_msec;   /* also bounds each load connection's connect() */
+    int         fastopen;       /* TCP_FASTOPEN_CONNECT: first data in the SYN */
+    enum tls_mode tls;
+    const char *tls_ca_p;       /* --tls: certificate to trust, NULL: no verification */
+
+    /* Load-generator mode */
+    int         load;           /* set by any of the options below */
+    int         connections;
+    int         threads;
+    size_t      msg_size;
+    double      rate;           /* messages/s over all connections, 0: as fast as possible */
+    double      duration;       /* seconds, 0: no limit */
+    int         ping_pong;      /* wait for each message to be echoed, measure RTT */
+    enum bulk_mode bulk;        /* stream without message boundaries */
+    const char *file_p;         /* --bulk=sendfile: file to send */
+    int         cork;           /* closed loop: MSG_MORE on all but the last send of a burst */
+    const char *stats_file_p;   /* live metrics, NULL: none */
+    int         stats_interval_msec;
+    size_t      shm_size;       /* shared-memory ring bytes per direction, 0: data over the socket */
+    int         reconnect;      /* ping-pong: a new connection for every request */
+    const char *replay_p;       /* server --capture file to send, NULL: generated messages */
+    double      replay_speed;   /* --replay: times the original pace, 0: as fast as possible */
+    int         udp;            /* UDP datagrams of --msg-size bytes, see dgram.h */
+    int         gso_segs;       /* --udp: datagrams per sendmmsg() buffer (UDP_SEGMENT), 0: no GSO */
+    int         crc;            /* end every message with its CRC32C, see crc32c.h */
+};
+
+extern volatile int stop;
+
+int inet_pton_with_scope(int af, const char *src, uint16_t port, struct sockaddr_storage *addr);
+int unix_pton(const char *src, struct sockaddr_storage *addr);
+int connect_start(const struct sockaddr_storage *serv_addr_p, int type, const char *interface_p,
+                  const struct sockaddr_storage *srce_addr_p, int fastopen, int verbose);
+int parse_addr_list(const char *spec_p, struct sockaddr_storage **addrs_pp);
+int parse_iface_list(const char *spec_p, char ***names_pp);
+int happy_connect(const char *host_p, uint16_t port, const char *interface_p,
+                  const struct sockaddr_storage *srce_addr_p, int timeout_msec, int fastopen,
+                  struct sockaddr_storage *peer_p, int verbose);
+
+int loadgen(const struct arguments *args_p);
+
+#endif /* CLIENT_H */
@@ -0,0 +1,416 @@
+// CLIENT - happy eyeballs (RFC 8305)
+//
+// The server name is resolved with getaddrinfo_a(), one request per
+// address family, so that neither family waits for the other. Connection
+// attempts start as soon as there is something to try: right away when
+// the IPv6 answer arrives first, or after a short Resolution Delay when
+// IPv4 answers first. Attempts alternate between the families and start
+// one Connection Attempt Delay apart (or immediately when the previous
+// one fails). All of them run non-blocking in one epoll set: the first
+// to complete wins and the others are cancelled by closing them.
+//
+// A broken family therefore costs at most one attempt delay instead of
+// a full connect timeout.
+#define _GNU_SOURCE
+#include <stdio.h>      /* printf() */
+#include <stdlib.h>     /* exit() */
+#include <string.h>     /* memset(), memcpy() */
+#include <unistd.h>     /* close() */
+#include <errno.h>      /* errno */
+#include <time.h>       /* clock_gettime() */
+#include <signal.h>     /* struct sigevent */
+#include <netdb.h>      /* getaddrinfo_a() */
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>  /* inet_ntop() */
+
+#include "client.h"
+
+#define HE_RESOLUTION_DELAY_MSEC    50
+#define HE_ATTEMPT_DELAY_MSEC       250
+#define HE_MAX_WAIT_MSEC            100     /* upper bound so that stop is noticed quickly */
+#define HE_MAX_ADDRS                16      /* per family */
+
+enum { HE_V6, HE_V4, HE_FAMILIES };
+
+/**
+ * struct he_family - resolution state and candidates of one family
+ * @req: getaddrinfo_a() request
+ * @hints: @req's hints
+ * @done_ms: time the answer arrived, 0 while pending
+ * @addrs: addresses returned, in resolver order
+ * @naddrs: number of @addrs
+ * @next: next address of @addrs to try
+ */
+struct he_family
+{
+    struct gaicb            req;
+    struct addrinfo         hints;
+    uint64_t                done_ms;
+    struct sockaddr_storage addrs[HE_MAX_ADDRS];
+    int                     naddrs;
+    int                     next;
+};
+
+/**
+ * struct he_attempt - one connection attempt in flight
+ * @fd: non-blocking socket, -1 once the attempt is over
+ * @addr_p: the address being connected to
+ */
+struct he_attempt
+{
+    int                             fd;
+    const struct sockaddr_storage  *addr_p;
+};
+
+/*
+ * Lives as long as the process: a getaddrinfo_a() request that could
+ * not be cancelled still completes in the background, and writes to the
+ * eventfd from its notification thread when it does.
+ */
+static struct he_family families[HE_FAMILIES];
+static int              notify_fd = -1;
+
+static uint64_t now_msec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ull + (uint64_t)ts.tv_nsec / 1000000ull;
+}
+
+static void resolved(union sigval sv)
+{
+    uint64_t one = 1;
+    if (write(sv.sival_int, &one, sizeof(one)) < 0) { /* the event loop also polls */ }
+}
+
+static const char *addr_str(const struct sockaddr_storage *addr_p, char *buf, size_t len)
+{
+    const void *src_p = addr_p->ss_family == AF_INET ? (const void *)&((const struct sockaddr_in *)addr_p)->sin_addr
+                                                      : (const void *)&((const struct sockaddr_in6 *)addr_p)->sin6_addr;
+    return inet_ntop(addr_p->ss_family, src_p, buf, len);
+}
+
+/* Collect the answers of the families whose request just completed */
+static void harvest(int verbose)
+{
+    for (int f = 0; f < HE_FAMILIES; f++)
+    {
+        struct he_family *fam_p = &families[f];
+        if (fam_p->done_ms || gai_error(&fam_p->req) == EAI_INPROGRESS)
+            continue;
+
+        fam_p->done_ms = now_msec();
+
+        int rc = gai_error(&fam_p->req);
+        for (struct addrinfo *ai_p = rc == 0 ? fam_p->req.ar_result : NULL; ai_p && fam_p->naddrs < HE_MAX_ADDRS; ai_p = ai_p->ai_next)
+        {
+            struct sockaddr_storage addr;
+            memset(&addr, 0, sizeof(addr));
+            memcpy(&addr, ai_p->ai_addr, ai_p->ai_addrlen);
+
+            int dup = 0;
+            for (int i = 0; i < fam_p->naddrs && !dup; i++)
+                dup = memcmp(&fam_p->addrs[i], &addr, sizeof(addr)) == 0;
+            if (!dup)
+                fam_p->addrs[fam_p->naddrs++] = addr;
+        }
+
+        if (verbose)
+            printf("getaddrinfo_a(%s, %s) -> %s%s" NORMAL " (%d address(es))\n",
+                   fam_p->req.ar_name, f == HE_V6 ? "AF_INET6" : "AF_INET",
+                   rc ? RED : GREEN, rc ? gai_strerror(rc) : "Success", fam_p->naddrs);
+
+        if (rc == 0)
+            freeaddrinfo(fam_p->req.ar_result);
+    }
+}
+
+/*
+ * Pick the next address to try: alternate families, IPv6 first. IPv4
+ * addresses are held back for the Resolution Delay while the IPv6
+ * answer is still pending.
+ */
+static const struct sockaddr_storage *next_addr(int *last_family_p, uint64_t now)
+{
+    struct he_family *v6_p = &families[HE_V6];
+    struct he_family *v4_p = &families[HE_V4];
+    int v6_ok = v6_p->next < v6_p->naddrs;
+    int v4_ok = v4_p->next < v4_p->naddrs &&
+                (v6_p->done_ms || now >= v4_p->done_ms + HE_RESOLUTION_DELAY_MSEC);
+
+    int f;
+    if (v6_ok && v4_ok)
+        f = *last_family_p == HE_V6 ? HE_V4 : HE_V6;
+    else if (v6_ok)
+        f = HE_V6;
+    else if (v4_ok)
+        f = HE_V4;
+    else
+        return NULL;
+
+    *last_family_p = f;
+    return &families[f].addrs[families[f].next++];
+}
+
+static void start_resolution(const char *host_p, uint16_t port)
+{
+    static char       service[8];
+    struct gaicb     *list[HE_FAMILIES];
+    struct sigevent   sev;
+
+    snprintf(service, sizeof(service), "%u", port);
+
+    notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    memset(families, 0, sizeof(families));
+    for (int f = 0; f < HE_FAMILIES; f++)
+    {
+        families[f].hints.ai_family   = f == HE_V6 ? AF_INET6 : AF_INET;
+        families[f].hints.ai_socktype = SOCK_STREAM;
+        families[f].hints.ai_flags    = AI_NUMERICSERV;
+        families[f].req.ar_name       = host_p;
+        families[f].req.ar_service    = service;
+        families[f].req.ar_request    = &families[f].hints;
+        list[f] = &families[f].req;
+    }
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify          = SIGEV_THREAD;
+    sev.sigev_notify_function = resolved;
+    sev.sigev_value.sival_int = notify_fd;
+
+    int rc = getaddrinfo_a(GAI_NOWAIT, list, HE_FAMILIES, &sev);
+    if (rc != 0)
+    {
+        fprintf(stderr, RED "getaddrinfo_a(%s) failed: %s" NORMAL "\n", host_p, gai_strerror(rc));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void cancel_resolution(void)
+{
+    int pending = 0;
+
+    for (int f = 0; f < HE_FAMILIES; f++)
+    {
+        if (families[f].done_ms)
+            continue;
+
+        int rc = gai_cancel(&families[f].req);
+        if (rc == EAI_NOTCANCELED)
+            pending = 1;
+        else if (rc == EAI_ALLDONE && gai_error(&families[f].req) == 0)
+            freeaddrinfo(families[f].req.ar_result);
+    }
+
+    // A request still running will write to the eventfd when it is done.
+    if (!pending)
+    {
+        close(notify_fd);
+        notify_fd = -1;
+    }
+}
+
+/**
+ * happy_connect - resolve @host_p and race connections to its addresses
+ * @host_p: host name, or a literal IPv4/IPv6 address (with %scope)
+ * @port: server port
+ * @interface_p: interface passed to SO_BINDTODEVICE, or NULL
+ * @srce_addr_p: source address passed to bind(), or NULL. Only the
+ *      addresses of the same family are tried.
+ * @timeout_msec: give up after this long
+ * @fastopen: TCP_FASTOPEN_CONNECT. With a cookie cached for an address
+ *      its attempt wins at once, the handshake waiting for the first send.
+ * @peer_p: set to the address that won the race
+ * @verbose: print the resolution and every attempt
+ *
+ * Return the connected socket, or -1 with errno set: ETIMEDOUT,
+ * EHOSTUNREACH when the name resolved to nothing usable, EINTR when
+ * stop was raised, or the error of the last failed attempt.
+ *
+ * Meant to be called once per run: a resolution that cannot be
+ * cancelled keeps using the module's static state in the background.
+ */
+int happy_connect(const char *host_p, uint16_t port, const char *interface_p,
+                  const struct sockaddr_storage *srce_addr_p, int timeout_msec, int fastopen,
+                  struct sockaddr_storage *peer_p, int verbose)
+{
+    struct he_attempt   attempts[HE_FAMILIES * HE_MAX_ADDRS];
+    int                 nattempts   = 0;
+    int                 in_flight   = 0;
+    int                 last_family = HE_V4;    /* so that IPv6 goes first */
+    int                 winner      = -1;
+    int                 last_err    = EHOSTUNREACH;
+    char                buf[INET6_ADDRSTRLEN];
+
+    // Literal addresses need no resolution: race a single candidate.
+    struct sockaddr_storage literal;
+    int is_literal = inet_pton_with_scope(AF_UNSPEC, host_p, port, &literal) == 0;
+    if (is_literal)
+    {
+        memset(families, 0, sizeof(families));
+        int f = literal.ss_family == AF_INET6 ? HE_V6 : HE_V4;
+        families[f].addrs[0] = literal;
+        families[f].naddrs   = 1;
+        families[HE_V6].done_ms = families[HE_V4].done_ms = now_msec();
+    }
+    else
+    {
+        start_resolution(host_p, port);
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+    {
+        fprintf(stderr, RED "Could not create the epoll FD list. Aborting!" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    if (!is_literal)
+    {
+        event.events   = EPOLLIN;
+        event.data.ptr = NULL;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, notify_fd, &event);
+    }
+
+    uint64_t deadline     = now_msec() + timeout_msec;
+    uint64_t next_attempt = 0;
+
+    while (winner < 0 && !stop)
+    {
+        uint64_t now = now_msec();
+        if (now >= deadline)
+        {
+            last_err = ETIMEDOUT;
+            break;
+        }
+
+        if (!is_literal)
+            harvest(verbose);
+
+        // Start the next attempt when it is due.
+        const struct sockaddr_storage *addr_p;
+        while (now >= next_attempt && (addr_p = next_addr(&last_family, now)) != NULL)
+        {
+            if (srce_addr_p && srce_addr_p->ss_family != addr_p->ss_family)
+                continue;
+
+            if (verbose)
+                printf("Attempt %d: connect to %s port %u\n", nattempts + 1, addr_str(addr_p, buf, sizeof(buf)), port);
+
+            int fd = connect_start(addr_p, SOCK_STREAM, interface_p, srce_addr_p, fastopen, verbose);
+            if (fd < 0)
+            {
+                // Immediate failure (e.g. ENETUNREACH): try the next one now.
+                last_err = errno;
+                continue;
+            }
+
+            attempts[nattempts].fd     = fd;
+            attempts[nattempts].addr_p = addr_p;
+            if (errno == 0)
+            {
+                winner = nattempts++;
+                break;
+            }
+
+            event.events   = EPOLLOUT;
+            event.data.ptr = &attempts[nattempts];
+            epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
+            nattempts++;
+            in_flight++;
+            next_attempt = now + HE_ATTEMPT_DELAY_MSEC;
+        }
+
+        if (winner >= 0)
+            break;
+
+        int resolving = !families[HE_V6].done_ms || !families[HE_V4].done_ms;
+        int remaining = families[HE_V6].next < families[HE_V6].naddrs || families[HE_V4].next < families[HE_V4].naddrs;
+        if (!resolving && !remaining && in_flight == 0)
+            break;
+
+        // Sleep until something happens or the next attempt is due.
+        uint64_t wake = deadline;
+        if (remaining && next_attempt < wake)
+            wake = next_attempt;
+        if (families[HE_V4].done_ms && !families[HE_V6].done_ms && wake > families[HE_V4].done_ms + HE_RESOLUTION_DELAY_MSEC)
+            wake = families[HE_V4].done_ms + HE_RESOLUTION_DELAY_MSEC;
+
+        int timeout = wake > now ? (int)(wake - now) : 0;
+        if (timeout > HE_MAX_WAIT_MSEC) timeout = HE_MAX_WAIT_MSEC;
+
+        struct epoll_event events[8];
+        int numfds = epoll_wait(epfd, events, 8, timeout);
+        for (int i = 0; i < numfds && winner < 0; i++)
+        {
+            struct he_attempt *attempt_p = events[i].data.ptr;
+            if (!attempt_p)
+            {
+                uint64_t count;
+                if (read(notify_fd, &count, sizeof(count)) < 0) { /* spurious */ }
+                continue;
+            }
+
+            int       err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(attempt_p->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+                err = errno;
+
+            if (err == 0)
+            {
+                winner = attempt_p - attempts;
+                break;
+            }
+
+            if (verbose)
+                printf("Attempt %d: %s port %u -> " RED "%s" NORMAL "\n", (int)(attempt_p - attempts) + 1,
+                       addr_str(attempt_p->addr_p, buf, sizeof(buf)), port, strerror(err));
+
+            // A failed attempt lets the next one start right away.
+            epoll_ctl(epfd, EPOLL_CTL_DEL, attempt_p->fd, NULL);
+            close(attempt_p->fd);
+            attempt_p->fd = -1;
+            in_flight--;
+            last_err      = err;
+            next_attempt  = 0;
+        }
+    }
+
+    if (stop && winner < 0)
+        last_err = EINTR;
+
+    // Cancel the losers.
+    for (int i = 0; i < nattempts; i++)
+    {
+        if (i == winner || attempts[i].fd < 0)
+            continue;
+        if (verbose)
+            printf("Attempt %d: %s port %u -> cancelled\n", i + 1, addr_str(attempts[i].addr_p, buf, sizeof(buf)), port);
+        close(attempts[i].fd);
+    }
+
+    if (!is_literal)
+    {
+        if (families[HE_V6].naddrs + families[HE_V4].naddrs == 0 && families[HE_V6].done_ms && families[HE_V4].done_ms)
+            fprintf(stderr, RED "Cannot resolve %s" NORMAL "\n", host_p);
+        cancel_resolution();
+    }
+    close(epfd);
+
+    if (winner < 0)
+    {
+        errno = last_err;
+        return -1;
+    }
+
+    if (verbose)
+        printf("Attempt %d: %s port %u -> " GREEN "connected" NORMAL "\n", winner + 1,
+               addr_str(attempts[winner].addr_p, buf, sizeof(buf)), port);
+
+    *peer_p = *attempts[winner].addr_p;
+    return attempts[winner].fd;
+}
@@ -0,0 +1,1805 @@
+// CLIENT - load-generator mode
+//
+// The connections are split over --threads threads. Each thread opens
+// its share with connect_start() and drives them from its own epoll set.
+// Connection i binds to source address i % N and interface i % M of the
+// --source-address and --interface lists, if any:
+//
+//   - Closed loop (--rate 0): every writable connection sends messages
+//     until the socket is full (EAGAIN), so the offered load is whatever
+//     the server and the network absorb.
+//   - Open loop (--rate R): each of the T threads started (at most one
+//     per connection) sends R/T messages per second, round-robin over
+//     its connections, independently of how fast the server reads. A
+//     connection whose socket is full is parked on EPOLLOUT until it
+//     drains.
+//
+// With --ping-pong the server is expected to echo every message. Each
+// connection then has at most one message in flight: the send time is
+// stamped in the first 8 bytes of the message, and when the whole echo
+// is back the round-trip time goes into the connection's histogram.
+// In closed loop the next message leaves as soon as the echo is back;
+// in open loop the pacer only picks connections that are not waiting.
+//
+// With --bulk the connections stream --msg-size chunks in closed loop to
+// measure raw throughput and what each byte costs in CPU. The chunks go
+// out with send() (copy), with send(MSG_ZEROCOPY), where the kernel pins
+// the user pages instead of copying them and reports completion on the
+// socket error queue, or with sendfile() from the page cache. Zero-copy
+// only pays off for chunks of roughly 10 KiB and more, and on loopback
+// the kernel falls back to copying on the receive side (reported as
+// "copied" completions).
+//
+// Connections still connecting after --connect-timeout are given up on
+// (and counted as failed). Their deadlines sit on the thread's timer
+// wheel, which also bounds each epoll_wait().
+//
+// With --framed every message is one frame (see frame.h) whose header
+// is rewritten before each send with the connection's next sequence
+// number. Ping-pong echoes are then parsed as frames, and a sequence
+// number out of order counts as a protocol error.
+//
+// With --reconnect every connection carries a single request: once its
+// echo is back it is closed and a new one takes its place, so what is
+// measured is connection setup plus one round trip. That is where
+// --fastopen pays: the request rides in the SYN and the echo comes back
+// one round trip earlier (see connect_start()).
+//
+// With --tls every connection runs a TLS 1.3 handshake once connected,
+// which the connect latency and --connect-timeout include. The records
+// are then built by the kernel (--tls=ktls: the send()/recv()/sendfile()
+// calls stay the same) or by OpenSSL (--tls=user: SSL_write()/SSL_read()
+// on the socket), so that the two, and plaintext, can be compared on the
+// same load. With --reconnect each request pays a full handshake.
+//
+// With --replay the messages come from a server's --capture file
+// instead: record i goes to connection (client number of record i)
+// modulo --connections, at its original time relative to the first one
+// (scaled by --replay-speed), or as fast as the sockets take them. Each
+// thread walks the whole capture for the records of its connections. A
+// record whose connection cannot take it yet holds back the records
+// after it, so that no message overtakes another: a slow connection
+// delays the replay rather than reordering it. The thread is done once
+// its last record is out.
+//
+// With --udp every connection is a connected UDP socket and a message
+// is a datagram numbered in its flow (see dgram.h), for the server to
+// count the ones lost or reordered. A connection sends its datagrams in
+// batches, LOAD_DGRAM_BATCH buffers per sendmmsg(): in closed loop one
+// full batch per wake-up, in open loop whatever is due. With --gso each
+// buffer holds several datagrams back to back, and the kernel cuts it
+// at every --msg-size bytes (UDP_SEGMENT) only after the whole stack
+// was walked once for it. UDP has no flow control: past what the server
+// reads, datagrams are dropped, and the server says how many.
+//
+// With --crc every message ends with the CRC32C of the rest of it (of
+// its payload with --framed, the frame flagged FRAME_F_CRC32C), for the
+// server to check. A message that never changes is stamped once, when
+// the thread's buffer is made; a --ping-pong one is stamped again along
+// with its send time.
+//
+// With --shm (unix:PATH servers only) every connection offers the server
+// a pair of shared-memory rings as soon as it is connected, and from then
+// on sends into one and reads the echoes from the other. The socket is
+// only watched for the server closing it. The ring's doorbell eventfd
+// stands for both EPOLLIN and EPOLLOUT: it rings when the server has
+// echoed something or made room while we were waiting for either.
+#define _GNU_SOURCE
+#include <stdio.h>      /* printf() */
+#include <stdlib.h>     /* calloc(), free(), exit() */
+#include <unistd.h>     /* close() */
+#include <errno.h>      /* errno */
+#include <string.h>     /* memset(), strerror() */
+#include <signal.h>     /* sigfillset() */
+#include <pthread.h>    /* pthread_create(), pthread_join() */
+#include <time.h>       /* clock_gettime() */
+#include <math.h>       /* ceil() */
+#include <fcntl.h>      /* open() */
+#include <endian.h>     /* htole32() */
+#include <netinet/in.h> /* IP_RECVERR, IPV6_RECVERR */
+#include <netinet/tcp.h> /* TCP_INFO */
+#include <netinet/udp.h> /* UDP_SEGMENT */
+#include <netdb.h>      /* getaddrinfo() */
+#include <arpa/inet.h>  /* inet_ntop() */
+#include <sys/epoll.h>
+#include <sys/resource.h> /* setrlimit() */
+#include <sys/mman.h>   /* memfd_create() */
+#include <sys/stat.h>   /* fstat() */
+#include <sys/sendfile.h>
+#include <sys/random.h> /* getrandom() */
+#include <linux/errqueue.h>
+
+#include "client.h"
+#include "trace.h"
+#include "histogram.h"
+#include "cpustat.h"
+#include "frame.h"
+#include "timer.h"
+#include "metrics.h"
+#include "shmring.h"
+#include "capture.h"
+#include "dgram.h"
+#include "crc32c.h"
+
+#define LOAD_MAX_EVENTS     256
+#define LOAD_MAX_BURST      64      /* messages per connection per wake-up (closed loop) */
+#define LOAD_MAX_WAIT_MSEC  100     /* upper bound so that stop is noticed quickly */
+#define LOAD_RECV_SIZE      65536
+#define LOAD_MAX_CONN_LINES 32      /* per-connection latency lines printed at most */
+#define LOAD_SHM_TAG        1       /* epoll_event.data.ptr bit: a connection's doorbell */
+#define LOAD_DGRAM_BATCH    64      /* --udp: buffers per sendmmsg() */
+#define LOAD_DGRAM_BYTES    (1u << 20) /* --udp: payload per sendmmsg(), at most */
+
+#ifndef TCPI_OPT_SYN_DATA
+#define TCPI_OPT_SYN_DATA   32      /* linux/tcp.h, missing from older glibc */
+#endif
+
+static int      threads_done;      /* load threads that left their loop */
+static SSL_CTX *tls_ctx_p;          /* --tls: shared by the load threads */
+
+enum conn_state
+{
+    CONN_CONNECTING,
+    CONN_HANDSHAKE, /* --tls: connected, handshake in progress */
+    CONN_READY,
+    CONN_BLOCKED,   /* socket full, waiting for EPOLLOUT */
+    CONN_WAITING,   /* ping-pong: message sent, waiting for the echo */
+    CONN_CLOSED,
+};
+
+struct load_conn
+{
+    int                 fd;
+    enum conn_state     state;
+    size_t              off;        /* bytes of the current message already sent */
+    uint64_t            t_sent;     /* ping-pong: send time of the message in flight */
+    uint64_t            t_connect;  /* when connect() was called */
+    size_t              rcvd;       /* ping-pong: bytes of the echo received so far */
+    uint64_t            stamp;      /* ping-pong: timestamp read back from the echo */
+    struct histogram   *rtt_p;      /* ping-pong: round-trip times in ns */
+    int                 zc_parked;  /* zerocopy: ENOBUFS, waiting for completions */
+    uint32_t            seq_tx;     /* framed: sequence number of the next frame */
+    uint32_t            seq_rx;     /* framed: sequence number of the next echo */
+    struct frame_buf    rx;         /* framed ping-pong: partial echoed frame */
+    struct timer        timer;      /* connect deadline */
+    struct shm_chan    *shm_p;      /* --shm: the rings that replace the socket */
+    SSL                *tls_p;      /* --tls: the connection's TLS state */
+    const struct capture_rec *rec_p; /* --replay: the record being sent */
+    uint32_t            flow;       /* --udp: the connection's flow, see dgram.h */
+    uint64_t            dgram_seq;  /* --udp: sequence number of the next datagram */
+};
+
+/**
+ * struct dgram_batch - --udp: the message headers of one sendmmsg()
+ * @msgs: one per buffer
+ * @iovs: the buffers, in the thread's message area
+ * @ctrl: room for each buffer's UDP_SEGMENT cmsg (--gso)
+ */
+struct dgram_batch
+{
+    struct mmsghdr  msgs[LOAD_DGRAM_BATCH];
+    struct iovec    iovs[LOAD_DGRAM_BATCH];
+    union
+    {
+        char            buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr  align;
+    } ctrl[LOAD_DGRAM_BATCH];
+};
+
+/*
+ * Only the owning thread writes these. The main thread reads them while
+ * the test runs for --stats-file (see metrics.h), so each thread's copy
+ * sits on cache lines of its own.
+ */
+struct load_stats
+{
+    uint64_t    connected;
+    uint64_t    connect_failed;
+    uint64_t    connect_timeouts;   /* ... of which were still connecting at the deadline */
+    uint64_t    fastopen;           /* --fastopen: connections whose SYN data the server took */
+    uint64_t    handshakes;         /* --tls: handshakes completed */
+    uint64_t    closed;
+    uint64_t    msgs;
+    uint64_t    bytes;
+    uint64_t    send_calls;
+    uint64_t    eagain;
+    uint64_t    msgs_in;
+    uint64_t    bytes_in;
+    uint64_t    recv_calls;
+    uint64_t    zc_sends;       /* send(MSG_ZEROCOPY) calls that queued data */
+    uint64_t    zc_done;        /* ... whose completion was reaped */
+    uint64_t    zc_copied;      /* ... for which the kernel copied after all */
+    uint64_t    enobufs;
+    uint64_t    bad_frames;
+    uint64_t    shm_bells;      /* doorbells rung on the server, over closed channels */
+    uint64_t    replay_skipped; /* --replay: records whose connection was down */
+} __attribute__((aligned(CACHE_LINE)));
+
+struct load_thread
+{
+    int                             id;
+    pthread_t                       tid;
+    const struct arguments         *args_p;
+    const struct sockaddr_storage  *serv_addr_p;
+    const struct sockaddr_storage  *srce_addrs;
+    int                             nsrce;
+    char                          **ifaces;
+    int                             nifaces;
+    int                             first;      /* index of conns[0] over all threads */
+    int                             nconns;
+    struct load_conn               *conns;
+    double                          rate;       /* --rate: this thread's share */
+    char                           *msg;
+    char                           *rcv_buf;
+    int                             file_fd;    /* --bulk=sendfile */
+    uint32_t                        base_events;
+    int                             epfd;
+    struct timer_wheel              wheel;      /* connect deadlines */
+    const struct capture           *capture_p;  /* --replay */
+    const struct capture_rec       *rec_p;      /* --replay: next record to look at, NULL: none left */
+    uint64_t                        rec_t0_ns;  /* --replay: time stamp of the capture's first record */
+    int                             replay_done;
+    struct dgram_batch             *dgram_p;    /* --udp */
+    int                             dgram_bufs; /* --udp: buffers per sendmmsg() */
+    uint32_t                        flow_base;  /* --udp: flow of connection 0 of the run */
+    double                          t_start;
+    double                          t_end;
+    struct load_stats               stats;
+    struct histogram                rtt;        /* ping-pong: all the thread's round-trip times */
+    struct histogram                connect_ns; /* connect() to established, in ns */
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t now_nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void conn_events(struct load_thread *thread_p, struct load_conn *conn_p, uint32_t events)
+{
+    struct epoll_event  event;
+
+    // --shm: the doorbell tells when the ring has room, the socket would
+    // always be writable.
+    if (conn_p->shm_p)
+        events &= ~EPOLLOUT;
+
+    memset(&event, 0, sizeof event);
+    event.data.ptr = conn_p;
+    event.events   = events | thread_p->base_events | EPOLLRDHUP;
+    epoll_ctl(thread_p->epfd, EPOLL_CTL_MOD, conn_p->fd, &event);
+}
+
+/* --fastopen: did the server take the data sent in the SYN? */
+static void conn_check_fastopen(struct load_thread *thread_p, struct load_conn *conn_p)
+{
+    struct tcp_info info;
+    socklen_t       len = sizeof(info);
+
+    if (getsockopt(conn_p->fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 && (info.tcpi_options & TCPI_OPT_SYN_DATA))
+        thread_p->stats.fastopen++;
+}
+
+static void conn_close(struct load_thread *thread_p, struct load_conn *conn_p)
+{
+    TRACE(TRACE_EVENTS, TC_CLOSE, conn_p->fd, 0, 0, NULL, 0);
+    if (thread_p->args_p->fastopen && conn_p->state != CONN_CONNECTING)
+        conn_check_fastopen(thread_p, conn_p);
+    timer_del(&thread_p->wheel, &conn_p->timer);
+    epoll_ctl(thread_p->epfd, EPOLL_CTL_DEL, conn_p->fd, NULL);
+    close(conn_p->fd);
+    if (conn_p->shm_p)
+    {
+        // The server holds the same eventfd: closing ours would not remove it.
+        epoll_ctl(thread_p->epfd, EPOLL_CTL_DEL, conn_p->shm_p->wait_fd, NULL);
+        thread_p->stats.shm_bells += conn_p->shm_p->bells;
+        shm_free(conn_p->shm_p);
+        conn_p->shm_p = NULL;
+    }
+    tls_free(conn_p->tls_p);
+    conn_p->tls_p = NULL;
+    conn_p->fd    = -1;
+    conn_p->state = CONN_CLOSED;
+    thread_p->stats.closed++;
+}
+
+/**
+ * conn_open - start connecting a connection slot
+ *
+ * Slot i of the whole run binds to source address i % N and interface
+ * i % M. The connection is watched for EPOLLOUT, see connect_done().
+ */
+static void conn_open(struct load_thread *thread_p, struct load_conn *conn_p)
+{
+    const struct arguments        *args_p  = thread_p->args_p;
+    int                            n       = thread_p->first + (int)(conn_p - thread_p->conns);
+    const struct sockaddr_storage *srce_p  = thread_p->nsrce   ? &thread_p->srce_addrs[n % thread_p->nsrce] : NULL;
+    const char                    *iface_p = thread_p->nifaces ? thread_p->ifaces[n % thread_p->nifaces]    : NULL;
+
+    conn_p->t_connect = now_nsec();
+    conn_p->flow      = thread_p->flow_base + n;
+    conn_p->dgram_seq = 0;
+    conn_p->fd        = connect_start(thread_p->serv_addr_p, args_p->udp ? SOCK_DGRAM : SOCK_STREAM,
+                                      iface_p, srce_p, args_p->fastopen, 0);
+    if (conn_p->fd < 0)
+    {
+        TRACE(TRACE_EVENTS, TC_CONNECT, -1, -1, errno, NULL, 0);
+        conn_p->state = CONN_CLOSED;
+        thread_p->stats.connect_failed++;
+        return;
+    }
+
+    conn_p->state = CONN_CONNECTING;
+    timer_add(&thread_p->wheel, &conn_p->timer, timer_now_ms() + args_p->connect_timeout_msec);
+
+    int one = 1;
+    if (args_p->bulk == BULK_ZEROCOPY && setsockopt(conn_p->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0)
+    {
+        fprintf(stderr, RED "setsockopt(SO_ZEROCOPY) failed: %m. Aborting!" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event  event;
+    memset(&event, 0, sizeof event);
+    event.data.ptr = conn_p;
+    event.events   = EPOLLOUT | thread_p->base_events | EPOLLRDHUP;
+    if (epoll_ctl(thread_p->epfd, EPOLL_CTL_ADD, conn_p->fd, &event) == -1)
+    {
+        fprintf(stderr, RED "Could not add the socket FD to the epoll FD list. Aborting!" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * send_msg - send (the rest of) the current message on a connection
+ * @more: another message follows right away (--cork): send with MSG_MORE
+ *
+ * With --replay the message is the connection's current record: sent
+ * straight from the mapped capture, or copied behind a frame header.
+ *
+ * Return 1 when the message is complete, 0 when the socket is full
+ * (the connection is then left in CONN_BLOCKED), -1 when the connection
+ * was closed because of an error.
+ */
+static int send_msg(struct load_thread *thread_p, struct load_conn *conn_p, int more)
+{
+    const struct capture_rec *rec_p = conn_p->rec_p;
+    size_t                    hdr   = thread_p->args_p->framed ? FRAME_HDR_SIZE : 0;
+    size_t                    size  = rec_p ? hdr + rec_p->len : thread_p->args_p->msg_size;
+
+    // The message buffer is shared by the thread's connections: (re)write
+    // this connection's header, payload and stamp before every send.
+    if (hdr)
+    {
+        if (conn_p->off == 0)
+            conn_p->seq_tx++;
+        frame_hdr_write(thread_p->msg, FRAME_DATA, thread_p->args_p->crc ? FRAME_F_CRC32C : 0, conn_p->seq_tx - 1, size - hdr);
+        if (rec_p)
+            memcpy(thread_p->msg + hdr, rec_p->data, rec_p->len);
+    }
+
+    if (thread_p->args_p->ping_pong)
+    {
+        if (conn_p->off == 0)
+            conn_p->t_sent = now_nsec();
+        memcpy(thread_p->msg + hdr, &conn_p->t_sent, sizeof(conn_p->t_sent));
+        if (thread_p->args_p->crc)
+            crc32c_stamp(thread_p->msg + hdr, size - hdr);
+    }
+
+    const char *data_p = thread_p->msg ? thread_p->msg + conn_p->off : NULL;
+    ssize_t     n;
+
+    if (rec_p && !hdr)
+        data_p = rec_p->data + conn_p->off;
+
+    switch (thread_p->args_p->bulk)
+    {
+    case BULK_ZEROCOPY:
+        n = send(conn_p->fd, data_p, size - conn_p->off, MSG_NOSIGNAL | MSG_ZEROCOPY | (more ? MSG_MORE : 0));
+        if (n > 0) thread_p->stats.zc_sends++;
+        break;
+    case BULK_SENDFILE:
+    {
+        off_t offset = conn_p->off;
+        n = sendfile(conn_p->fd, thread_p->file_fd, &offset, size - conn_p->off);
+        break;
+    }
+    default:
+        if (conn_p->shm_p)
+            n = shm_send(conn_p->shm_p, data_p, size - conn_p->off);
+        else if (thread_p->args_p->tls == TLS_USER)
+            n = tls_write(conn_p->tls_p, data_p, size - conn_p->off);
+        else
+            n = send(conn_p->fd, data_p, size - conn_p->off, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+        break;
+    }
+
+    thread_p->stats.send_calls++;
+    TRACE(TRACE_SYSCALLS, TC_SEND, conn_p->fd, n, errno, data_p, data_p ? n : 0);
+    if (n < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            thread_p->stats.eagain++;
+            conn_p->state = CONN_BLOCKED;
+            return 0;
+        }
+
+        if (errno == ENOBUFS && thread_p->args_p->bulk == BULK_ZEROCOPY)
+        {
+            // Too many zero-copy sends await completion (net.core.optmem_max).
+            // Polling EPOLLOUT would spin: park until the completions
+            // arrive with EPOLLERR, see reap_zerocopy().
+            thread_p->stats.enobufs++;
+            conn_p->state     = CONN_BLOCKED;
+            conn_p->zc_parked = 1;
+            conn_events(thread_p, conn_p, 0);
+            return 0;
+        }
+
+        conn_close(thread_p, conn_p);
+        return -1;
+    }
+
+    thread_p->stats.bytes += n;
+    conn_p->off += n;
+    if (conn_p->off < size)
+    {
+        // Short write: the socket buffer is full.
+        conn_p->state = CONN_BLOCKED;
+        return 0;
+    }
+
+    conn_p->off   = 0;
+    conn_p->rec_p = NULL;
+    conn_p->state = thread_p->args_p->ping_pong ? CONN_WAITING : CONN_READY;
+    thread_p->stats.msgs++;
+    return 1;
+}
+
+/**
+ * send_dgrams - --udp: send up to @count datagrams with one sendmmsg()
+ *
+ * The datagrams are numbered from the connection's @dgram_seq: those
+ * the socket did not take are numbered again by the next call.
+ *
+ * Return the number of datagrams sent, 0 when the socket is full (the
+ * connection is then left in CONN_BLOCKED, as it is after a short
+ * batch), -1 when the connection was closed because of an error.
+ */
+static int send_dgrams(struct load_thread *thread_p, struct load_conn *conn_p, uint64_t count)
+{
+    struct dgram_batch *batch_p = thread_p->dgram_p;
+    size_t              size    = thread_p->args_p->msg_size;
+    int                 segs    = thread_p->args_p->gso_segs;
+    uint64_t            seq     = conn_p->dgram_seq;
+    char               *p       = thread_p->msg;
+    int                 nbufs   = 0;
+
+    // The message area is shared by the thread's connections: stamp this
+    // connection's flow and numbers before every send.
+    while (count > 0 && nbufs < thread_p->dgram_bufs)
+    {
+        size_t         k     = segs && count > (uint64_t)segs ? (size_t)segs : segs ? (size_t)count : 1;
+        struct msghdr *hdr_p = &batch_p->msgs[nbufs].msg_hdr;
+
+        for (size_t j = 0; j < k; j++)
+            dgram_hdr_write(p + j * size, conn_p->flow, seq++);
+
+        batch_p->iovs[nbufs].iov_base = p;
+        batch_p->iovs[nbufs].iov_len  = k * size;
+        memset(hdr_p, 0, sizeof(*hdr_p));
+        hdr_p->msg_iov    = &batch_p->iovs[nbufs];
+        hdr_p->msg_iovlen = 1;
+        if (segs)
+        {
+            uint16_t gso_size = (uint16_t)size;
+            hdr_p->msg_control    = batch_p->ctrl[nbufs].buf;
+            hdr_p->msg_controllen = sizeof(batch_p->ctrl[nbufs].buf);
+
+            struct cmsghdr *cmsg_p = CMSG_FIRSTHDR(hdr_p);
+            cmsg_p->cmsg_level = SOL_UDP;
+            cmsg_p->cmsg_type  = UDP_SEGMENT;
+            cmsg_p->cmsg_len   = CMSG_LEN(sizeof(gso_size));
+            memcpy(CMSG_DATA(cmsg_p), &gso_size, sizeof(gso_size));
+        }
+
+        p     += k * size;
+        count -= k;
+        nbufs++;
+    }
+
+    int n = sendmmsg(conn_p->fd, batch_p->msgs, nbufs, 0);
+    thread_p->stats.send_calls++;
+    TRACE(TRACE_SYSCALLS, TC_SENDMMSG, conn_p->fd, n, errno, NULL, 0);
+    if (n < 0)
+    {
+        // ENOBUFS: the device queue is full, which is what EAGAIN means
+        // to a stream.
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+        {
+            thread_p->stats.eagain++;
+            conn_p->state = CONN_BLOCKED;
+            return 0;
+        }
+
+        conn_close(thread_p, conn_p);
+        return -1;
+    }
+
+    size_t bytes = 0;
+    for (int i = 0; i < n; i++)
+        bytes += batch_p->iovs[i].iov_len;
+
+    thread_p->stats.bytes += bytes;
+    thread_p->stats.msgs  += bytes / size;
+    conn_p->dgram_seq     += bytes / size;
+    conn_p->state          = n < nbufs ? CONN_BLOCKED : CONN_READY;
+
+    return (int)(bytes / size);
+}
+
+static void echo_done(struct load_thread *thread_p, struct load_conn *conn_p, uint64_t stamp)
+{
+    uint64_t rtt = now_nsec() - (thread_p->args_p->reconnect ? conn_p->t_connect : stamp);
+
+    hist_record(conn_p->rtt_p, rtt);
+    hist_record(&thread_p->rtt, rtt);
+    thread_p->stats.msgs_in++;
+    if (conn_p->state == CONN_WAITING)
+        conn_p->state = CONN_READY;
+}
+
+/* Raw messages: count bytes, the stamp is in the first 8 of each message */
+static void echo_bytes(struct load_thread *thread_p, struct load_conn *conn_p, const char *p, size_t n)
+{
+    size_t size = thread_p->args_p->msg_size;
+
+    while (n > 0)
+    {
+        size_t take = size - conn_p->rcvd;
+        if (take > n) take = n;
+
+        if (conn_p->rcvd < sizeof(conn_p->stamp))
+        {
+            size_t stamp_bytes = sizeof(conn_p->stamp) - conn_p->rcvd;
+            if (stamp_bytes > take) stamp_bytes = take;
+            memcpy((char *)&conn_p->stamp + conn_p->rcvd, p, stamp_bytes);
+        }
+
+        conn_p->rcvd += take;
+        p            += take;
+        n            -= take;
+
+        if (conn_p->rcvd == size)
+        {
+            conn_p->rcvd = 0;
+            echo_done(thread_p, conn_p, conn_p->stamp);
+        }
+    }
+}
+
+/* Frames: parse what accumulated in the connection's frame buffer */
+static int echo_frames(struct load_thread *thread_p, struct load_conn *conn_p)
+{
+    struct frame frame;
+    int          rc;
+
+    while ((rc = frame_next(&conn_p->rx, &frame)) > 0)
+    {
+        uint64_t stamp;
+
+        if (frame.seq != conn_p->seq_rx++ || frame.len < sizeof(stamp))
+            return -1;
+
+        memcpy(&stamp, frame.payload_p, sizeof(stamp));
+        echo_done(thread_p, conn_p, stamp);
+    }
+
+    return rc;
+}
+
+/**
+ * recv_echo - ping-pong: consume echoed data and record round trips
+ *
+ * Return 0, or -1 when the connection was closed (with --reconnect,
+ * also when it was replaced by a new one).
+ */
+static int recv_echo(struct load_thread *thread_p, struct load_conn *conn_p)
+{
+    int framed = thread_p->args_p->framed;
+
+    for (;;)
+    {
+        char   *buf_p = thread_p->rcv_buf;
+        size_t  room  = LOAD_RECV_SIZE;
+
+        if (framed)
+        {
+            if (frame_buf_reserve(&conn_p->rx, thread_p->args_p->msg_size) != 0)
+            {
+                conn_close(thread_p, conn_p);
+                return -1;
+            }
+            buf_p = conn_p->rx.data + conn_p->rx.tail;
+            room  = conn_p->rx.size - conn_p->rx.tail;
+        }
+
+        ssize_t n;
+        if (conn_p->shm_p)
+            n = shm_recv(conn_p->shm_p, buf_p, room);
+        else if (thread_p->args_p->tls == TLS_USER)
+            n = tls_read(conn_p->tls_p, buf_p, room);
+        else
+            n = recv(conn_p->fd, buf_p, room, 0);
+        TRACE(TRACE_SYSCALLS, TC_RECV, conn_p->fd, n, errno, buf_p, n);
+        thread_p->stats.recv_calls++;
+        if (n <= 0)
+        {
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 0;
+
+            conn_close(thread_p, conn_p);
+            return -1;
+        }
+
+        thread_p->stats.bytes_in += n;
+
+        if (!framed)
+            echo_bytes(thread_p, conn_p, buf_p, n);
+        else
+        {
+            conn_p->rx.tail += n;
+            if (echo_frames(thread_p, conn_p) != 0)
+            {
+                TRACE(TRACE_EVENTS, TC_FRAME, conn_p->fd, -1, EPROTO, NULL, 0);
+                thread_p->stats.bad_frames++;
+                conn_close(thread_p, conn_p);
+                return -1;
+            }
+        }
+
+        // --reconnect: the next request goes on a new connection.
+        if (conn_p->state == CONN_READY && thread_p->args_p->reconnect)
+        {
+            conn_close(thread_p, conn_p);
+            thread_p->stats.closed--;
+            conn_open(thread_p, conn_p);
+            return -1;
+        }
+
+        // Closed loop: the next request leaves as soon as the echo is back.
+        // Return right after so that a fast connection cannot starve the
+        // others: EPOLLIN is level-triggered and brings us back here.
+        if (conn_p->state == CONN_READY && thread_p->args_p->rate <= 0)
+        {
+            int rc = send_msg(thread_p, conn_p, 0);
+            if (rc < 0)
+                return -1;
+            if (rc == 0)
+                conn_events(thread_p, conn_p, EPOLLOUT);
+
+            // A ring is not level-triggered: it must be found empty for
+            // the doorbell to ring again, or else be looked at again.
+            const char *data_p;
+            if (conn_p->shm_p && shm_peek(conn_p->shm_p, &data_p) > 0)
+                shm_kick(conn_p->shm_p);
+
+            // Neither are records OpenSSL already read off the socket.
+            if (!conn_p->tls_p || !tls_buffered(conn_p->tls_p))
+                return 0;
+        }
+    }
+}
+
+/**
+ * reap_zerocopy - read the MSG_ZEROCOPY completions from the error queue
+ *
+ * Each notification covers a range of send() calls, numbered from 0 in
+ * submission order. The bulk buffer is never modified, so completions
+ * are only counted, but they must still be read: every pending one
+ * holds pinned pages and socket option memory.
+ *
+ * Return 0, or -1 when the connection was closed because of a genuine
+ * socket error.
+ */
+static int reap_zerocopy(struct load_thread *thread_p, struct load_conn *conn_p)
+{
+    char control[128];
+
+    for (;;)
+    {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(conn_p->fd, &msg, MSG_ERRQUEUE) < 0)
+            break;
+
+        for (struct cmsghdr *cmsg_p = CMSG_FIRSTHDR(&msg); cmsg_p; cmsg_p = CMSG_NXTHDR(&msg, cmsg_p))
+        {
+            if (!(cmsg_p->cmsg_level == SOL_IP   && cmsg_p->cmsg_type == IP_RECVERR) &&
+                !(cmsg_p->cmsg_level == SOL_IPV6 && cmsg_p->cmsg_type == IPV6_RECVERR))
+                continue;
+
+            const struct sock_extended_err *serr_p = (const void *)CMSG_DATA(cmsg_p);
+            if (serr_p->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr_p->ee_errno != 0)
+                continue;
+
+            uint64_t n = (uint32_t)(serr_p->ee_data - serr_p->ee_info) + 1ull;
+            thread_p->stats.zc_done += n;
+            if (serr_p->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                thread_p->stats.zc_copied += n;
+        }
+    }
+
+    int       err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(conn_p->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        err = errno;
+    if (err != 0)
+    {
+        conn_close(thread_p, conn_p);
+        return -1;
+    }
+
+    if (conn_p->zc_parked)
+    {
+        conn_p->zc_parked = 0;
+        conn_events(thread_p, conn_p, EPOLLOUT);
+    }
+
+    return 0;
+}
+
+/**
+ * shm_connect - --shm: switch a connection that just got established to
+ *      shared-memory rings
+ *
+ * The offer waits for the server's answer, for --connect-timeout at
+ * most: with many connections, this slows the ramp-up down a little.
+ *
+ * Return 0, or -1 if the server did not take the offer.
+ */
+static int shm_connect(struct load_thread *thread_p, struct load_conn *conn_p)
+{
+    conn_p->shm_p = shm_offer(conn_p->fd, thread_p->args_p->shm_size, thread_p->args_p->connect_timeout_msec);
+    if (!conn_p->shm_p)
+    {
+        TRACE(TRACE_EVENTS, TC_CONNECT, conn_p->fd, -1, errno, NULL, 0);
+        if (thread_p->stats.connect_failed == 0)
+            fprintf(stderr, RED "Shared-memory offer not taken: %m (the server needs --unix and --io=epoll)" NORMAL "\n");
+        return -1;
+    }
+
+    struct epoll_event  event;
+    memset(&event, 0, sizeof event);
+    event.data.ptr = (char *)conn_p + LOAD_SHM_TAG;
+    event.events   = EPOLLIN;
+    if (epoll_ctl(thread_p->epfd, EPOLL_CTL_ADD, conn_p->shm_p->wait_fd, &event) == -1)
+    {
+        fprintf(stderr, RED "Could not add the doorbell FD to the epoll FD list. Aborting!" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return 0;
+}
+
+/* A connection that never became usable: closed, and counted as failed */
+static void connect_failed(struct load_thread *thread_p, struct load_conn *conn_p)
+{
+    conn_close(thread_p, conn_p);
+    thread_p->stats.closed--;
+    thread_p->stats.connect_failed++;
+}
+
+/**
+ * conn_ready - a connection is usable: count it and start its traffic
+ */
+static void conn_ready(struct load_thread *thread_p, struct load_conn *conn_p)
+{
+    timer_del(&thread_p->wheel, &conn_p->timer);
+    thread_p->stats.connected++;
+    hist_record(&thread_p->connect_ns, now_nsec() - conn_p->t_connect);
+    conn_p->state = CONN_READY;
+
+    if (thread_p->args_p->rate > 0 || thread_p->capture_p)
+    {
+        // Open loop: sends are driven by the pacer, not by EPOLLOUT
+        conn_events(thread_p, conn_p, 0);
+    }
+    else if (thread_p->args_p->ping_pong)
+    {
+        // Closed-loop ping-pong: send the first request, then wait for
+        // EPOLLIN only.
+        if (send_msg(thread_p, conn_p, 0) == 0)
+            conn_events(thread_p, conn_p, EPOLLOUT);
+    }
+    else if (conn_p->shm_p)
+    {
+        // Closed loop: no EPOLLOUT to start the first burst.
+        shm_kick(conn_p->shm_p);
+    }
+    else if (conn_p->tls_p)
+    {
+        // Closed loop: the handshake only watched what it needed.
+        conn_events(thread_p, conn_p, EPOLLOUT);
+    }
+}
+
+/**
+ * handshake_step - --tls: move a connection's handshake forward
+ *
+ * The connect deadline keeps running until the handshake is over. With
+ * --tls=ktls the keys then go to the kernel, and the connection is used
+ * like a plaintext one.
+ */
+static void handshake_step(struct load_thread *thread_p, struct load_conn *conn_p)
+{
+    int rc = tls_handshake(conn_p->tls_p);
+    if (rc == 0)
+    {
+        conn_events(thread_p, conn_p, SSL_want_write(conn_p->tls_p) ? EPOLLOUT : EPOLLIN);
+        return;
+    }
+
+    if (rc > 0 && thread_p->args_p->tls == TLS_KTLS && tls_ktls_install(conn_p->tls_p, conn_p->fd) != 0)
+        rc = -1;
+
+    if (rc < 0)
+    {
+        const char *reason_p = tls_strerror();
+        TRACE(TRACE_EVENTS, TC_HANDSHAKE, conn_p->fd, -1, errno, reason_p, strlen(reason_p));
+        if (thread_p->stats.connect_failed == 0)
+            fprintf(stderr, RED "TLS handshake failed: %s (does the server run with --tls?)" NORMAL "\n", reason_p);
+        connect_failed(thread_p, conn_p);
+        return;
+    }
+
+    const char *cipher_p = SSL_get_cipher_name(conn_p->tls_p);
+    TRACE(TRACE_EVENTS, TC_HANDSHAKE, conn_p->fd, 1, 0, cipher_p, strlen(cipher_p));
+    thread_p->stats.handshakes++;
+    conn_ready(thread_p, conn_p);
+}
+
+static void connect_done(struct load_thread *thread_p, struct load_conn *conn_p)
+{
+    int       err = 0;
+    socklen_t len = sizeof(err);
+
+    if (getsockopt(conn_p->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        err = errno;
+
+    TRACE(TRACE_EVENTS, TC_CONNECT, conn_p->fd, err ? -1 : 0, err, NULL, 0);
+    if (err != 0 || (thread_p->args_p->shm_size && shm_connect(thread_p, conn_p) != 0))
+    {
+        connect_failed(thread_p, conn_p);
+        return;
+    }
+
+    if (thread_p->args_p->tls != TLS_OFF)
+    {
+        conn_p->tls_p = tls_new(tls_ctx_p, conn_p->fd, thread_p->args_p->addr_p);
+        if (!conn_p->tls_p)
+        {
+            connect_failed(thread_p, conn_p);
+            return;
+        }
+
+        conn_p->state = CONN_HANDSHAKE;
+        handshake_step(thread_p, conn_p);
+        return;
+    }
+
+    conn_ready(thread_p, conn_p);
+}
+
+/**
+ * connect_expire - give up on the connections whose connect deadline passed
+ *
+ * The wheel hands back every expired timer at once, so a SYN flood
+ * into a black hole is reaped in one pass per millisecond tick.
+ */
+static void connect_expire(struct load_thread *thread_p)
+{
+    struct timer *timer_p = timer_wheel_expire(&thread_p->wheel, timer_now_ms());
+
+    while (timer_p)
+    {
+        struct timer     *next_p = timer_p->next;
+        struct load_conn *conn_p = timer_entry(timer_p, struct load_conn, timer);
+
+        TRACE(TRACE_EVENTS, TC_TIMEOUT, conn_p->fd, -1, ETIMEDOUT, NULL, 0);
+        connect_failed(thread_p, conn_p);
+        thread_p->stats.connect_timeouts++;
+
+        timer_p = next_p;
+    }
+}
+
+/**
+ * pace - open loop: send every message that is due by now
+ * @next_p: round-robin cursor over the thread's connections
+ *
+ * Return the number of milliseconds until the next message is due.
+ */
+static int pace(struct load_thread *thread_p, double rate, int *next_p)
+{
+    double   elapsed = now_sec() - thread_p->t_start;
+    uint64_t due     = (uint64_t)(elapsed * rate);
+
+    while (thread_p->stats.msgs < due)
+    {
+        int tried;
+        for (tried = 0; tried < thread_p->nconns; tried++)
+        {
+            struct load_conn *conn_p = &thread_p->conns[*next_p];
+            *next_p = (*next_p + 1) % thread_p->nconns;
+
+            if (conn_p->state != CONN_READY)
+                continue;
+
+            // --udp: the whole backlog, in as few sendmmsg() as it takes.
+            if (thread_p->args_p->udp)
+                send_dgrams(thread_p, conn_p, due - thread_p->stats.msgs);
+            else
+                send_msg(thread_p, conn_p, 0);
+            if (conn_p->state == CONN_BLOCKED && !conn_p->zc_parked)
+                conn_events(thread_p, conn_p, EPOLLOUT);
+            if (conn_p->shm_p)
+                shm_flush(conn_p->shm_p);
+            break;
+        }
+
+        // Every connection is blocked or down: wait for EPOLLOUT.
+        if (tried == thread_p->nconns)
+            return LOAD_MAX_WAIT_MSEC;
+    }
+
+    double next = (double)(thread_p->stats.msgs + 1) / rate - elapsed;
+    int    msec = (int)ceil(next * 1000.0);
+
+    return msec < 0 ? 0 : msec > LOAD_MAX_WAIT_MSEC ? LOAD_MAX_WAIT_MSEC : msec;
+}
+
+/**
+ * replay - --replay: send every record of the thread's connections that
+ *      is due by now
+ * @speed: --replay-speed, 0: every record is due at once
+ *
+ * At most LOAD_MAX_BURST records go out per call, so that the events of
+ * the other connections are not kept waiting.
+ *
+ * Return the number of milliseconds until the next record is due.
+ */
+static int replay(struct load_thread *thread_p, double speed)
+{
+    int    connections = thread_p->args_p->connections;
+    double elapsed     = now_sec() - thread_p->t_start;
+    int    sent        = 0;
+
+    while (thread_p->rec_p)
+    {
+        const struct capture_rec *rec_p = thread_p->rec_p;
+        int                       i     = (int)(rec_p->conn % connections) - thread_p->first;
+
+        if (i < 0 || i >= thread_p->nconns)
+        {
+            thread_p->rec_p = capture_next(thread_p->capture_p, rec_p);
+            continue;
+        }
+
+        if (sent == LOAD_MAX_BURST)
+            return 0;
+
+        // Records are stamped as they are appended: a later one may be a
+        // little older, and is then due at once.
+        if (speed > 0)
+        {
+            double due = ((double)rec_p->ts_ns - (double)thread_p->rec_t0_ns) / 1e9 / speed;
+            if (due > elapsed)
+            {
+                int msec = (int)ceil((due - elapsed) * 1000.0);
+                return msec > LOAD_MAX_WAIT_MSEC ? LOAD_MAX_WAIT_MSEC : msec;
+            }
+        }
+
+        struct load_conn *conn_p = &thread_p->conns[i];
+        if (conn_p->state == CONN_CLOSED)
+            thread_p->stats.replay_skipped++;
+        else if (conn_p->state != CONN_READY)
+            return LOAD_MAX_WAIT_MSEC;      /* connecting or blocked: EPOLLOUT brings us back */
+        else
+        {
+            conn_p->rec_p = rec_p;
+            if (send_msg(thread_p, conn_p, 0) == 0 && !conn_p->zc_parked)
+                conn_events(thread_p, conn_p, EPOLLOUT);
+            if (conn_p->shm_p)
+                shm_flush(conn_p->shm_p);
+            sent++;
+        }
+
+        thread_p->rec_p = capture_next(thread_p->capture_p, rec_p);
+    }
+
+    // Done once the last partial message is out too.
+    for (int i = 0; i < thread_p->nconns; i++)
+    {
+        if (thread_p->conns[i].rec_p && thread_p->conns[i].state != CONN_CLOSED)
+            return LOAD_MAX_WAIT_MSEC;
+    }
+
+    thread_p->replay_done = 1;
+    return 0;
+}
+
+static void *load_thread_main(void *arg)
+{
+    struct load_thread     *thread_p = arg;
+    const struct arguments *args_p   = thread_p->args_p;
+    double                  rate     = thread_p->rate;
+
+    thread_p->base_events = args_p->ping_pong ? EPOLLIN : 0;
+    thread_p->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (thread_p->epfd == -1)
+    {
+        fprintf(stderr, RED "Could not create the epoll FD list. Aborting!" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    timer_wheel_init(&thread_p->wheel, timer_now_ms());
+
+    for (int i = 0; i < thread_p->nconns; i++)
+        conn_open(thread_p, &thread_p->conns[i]);
+
+    struct epoll_event events[LOAD_MAX_EVENTS];
+    int                next = 0;
+
+    thread_p->t_start = now_sec();
+    double t_stop = args_p->duration > 0 ? thread_p->t_start + args_p->duration : INFINITY;
+
+    while (!stop && now_sec() < t_stop && !thread_p->replay_done)
+    {
+        int timeout  = thread_p->capture_p ? replay(thread_p, args_p->replay_speed)
+                     : rate > 0            ? pace(thread_p, rate, &next) : LOAD_MAX_WAIT_MSEC;
+        int deadline = timer_wheel_timeout(&thread_p->wheel, timer_now_ms());
+        if (deadline >= 0 && deadline < timeout)
+            timeout = deadline;
+
+        int numfds = epoll_wait(thread_p->epfd, events, LOAD_MAX_EVENTS, timeout);
+        if (numfds < 0)
+        {
+            if (errno == EINTR) continue;
+
+            fprintf(stderr, RED "Serious error in epoll setup: epoll_wait() returned < 0 status! %m" NORMAL "\n");
+            break;
+        }
+
+        // --shm: the server's doorbell is rung once per connection served,
+        // when the loop moves on to the next one.
+        struct load_conn *served_p = NULL;
+        for (int i = 0; i < numfds; i++)
+        {
+            struct load_conn *conn_p = events[i].data.ptr;
+            uint32_t          ev     = events[i].events;
+
+            if (served_p && served_p->shm_p)
+                shm_flush(served_p->shm_p);
+
+            if ((uintptr_t)conn_p & LOAD_SHM_TAG)
+            {
+                // Closed earlier in this batch if the channel is gone.
+                conn_p = (struct load_conn *)((uintptr_t)conn_p & ~(uintptr_t)LOAD_SHM_TAG);
+                if (!conn_p->shm_p)
+                    continue;
+                shm_drain(conn_p->shm_p);
+                ev = EPOLLIN | EPOLLOUT;
+            }
+            served_p = conn_p;
+
+            if (conn_p->state == CONN_CONNECTING)
+            {
+                connect_done(thread_p, conn_p);
+                continue;
+            }
+
+            if (conn_p->state == CONN_HANDSHAKE)
+            {
+                handshake_step(thread_p, conn_p);
+                continue;
+            }
+
+            if (conn_p->state == CONN_CLOSED)
+                continue;
+
+            if ((ev & EPOLLIN) && args_p->ping_pong && recv_echo(thread_p, conn_p) != 0)
+                continue;
+
+            // With MSG_ZEROCOPY, EPOLLERR mostly means "completions queued".
+            if ((ev & EPOLLERR) && args_p->bulk == BULK_ZEROCOPY)
+            {
+                if (reap_zerocopy(thread_p, conn_p) != 0)
+                    continue;
+                ev &= ~EPOLLERR;
+            }
+
+            if (ev & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+            {
+                conn_close(thread_p, conn_p);
+                continue;
+            }
+
+            if (!(ev & EPOLLOUT))
+                continue;
+
+            if (rate > 0 || args_p->ping_pong || thread_p->capture_p)
+            {
+                // The socket drained: finish the partial message (or send
+                // the --replay record that found it full), then stop
+                // listening for EPOLLOUT.
+                if (conn_p->state == CONN_BLOCKED)
+                {
+                    conn_p->state = CONN_READY;
+                    if ((conn_p->off == 0 && !conn_p->rec_p) || send_msg(thread_p, conn_p, 0) == 1)
+                        conn_events(thread_p, conn_p, 0);
+                }
+                continue;
+            }
+
+            // Closed loop: fill the socket. With --cork only the last
+            // message of the burst pushes the segments out. With --udp
+            // a burst is one full sendmmsg().
+            conn_p->state = CONN_READY;
+            if (args_p->udp)
+            {
+                send_dgrams(thread_p, conn_p, UINT64_MAX);
+                continue;
+            }
+
+            int burst;
+            for (burst = 0; burst < LOAD_MAX_BURST && !stop; burst++)
+            {
+                if (send_msg(thread_p, conn_p, args_p->cork && burst < LOAD_MAX_BURST - 1) != 1)
+                    break;
+            }
+
+            // A ring is not level-triggered: come back while it has room.
+            if (conn_p->shm_p && burst == LOAD_MAX_BURST)
+                shm_kick(conn_p->shm_p);
+        }
+        if (served_p && served_p->shm_p)
+            shm_flush(served_p->shm_p);
+
+        connect_expire(thread_p);
+    }
+
+    thread_p->t_end = now_sec();
+    __atomic_add_fetch(&threads_done, 1, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < thread_p->nconns; i++)
+    {
+        if (args_p->fastopen && thread_p->conns[i].fd >= 0 && thread_p->conns[i].state != CONN_CONNECTING)
+            conn_check_fastopen(thread_p, &thread_p->conns[i]);
+        if (thread_p->conns[i].fd >= 0)
+            close(thread_p->conns[i].fd);
+        tls_free(thread_p->conns[i].tls_p);
+        if (thread_p->conns[i].shm_p)
+        {
+            thread_p->stats.shm_bells += thread_p->conns[i].shm_p->bells;
+            shm_free(thread_p->conns[i].shm_p);
+        }
+        frame_buf_free(&thread_p->conns[i].rx);
+    }
+    close(thread_p->epfd);
+
+    return NULL;
+}
+
+// =============================================================================
+static const struct metric_desc thread_metrics[] =
+{
+    { "client_connected_total",        "counter", "Connections established",                          offsetof(struct load_thread, stats.connected) },
+    { "client_connect_failed_total",   "counter", "Connections that failed or timed out",             offsetof(struct load_thread, stats.connect_failed) },
+    { "client_connect_timeouts_total", "counter", "Connections still connecting at --connect-timeout", offsetof(struct load_thread, stats.connect_timeouts) },
+    { "client_fastopen_total",         "counter", "Connections whose data in the SYN was accepted (--fastopen)", offsetof(struct load_thread, stats.fastopen) },
+    { "client_tls_handshakes_total",   "counter", "TLS handshakes completed (--tls)",                 offsetof(struct load_thread, stats.handshakes) },
+    { "client_closed_total",           "counter", "Established connections closed by the peer",       offsetof(struct load_thread, stats.closed) },
+    { "client_msgs_out_total",         "counter", "Messages (or bulk chunks, or datagrams) sent",     offsetof(struct load_thread, stats.msgs) },
+    { "client_bytes_out_total",        "counter", "Bytes sent",                                       offsetof(struct load_thread, stats.bytes) },
+    { "client_send_calls_total",       "counter", "send(), sendfile() or sendmmsg() calls",           offsetof(struct load_thread, stats.send_calls) },
+    { "client_send_eagain_total",      "counter", "Sends that found the socket full",                 offsetof(struct load_thread, stats.eagain) },
+    { "client_msgs_in_total",          "counter", "Echoes received (--ping-pong)",                    offsetof(struct load_thread, stats.msgs_in) },
+    { "client_bytes_in_total",         "counter", "Bytes received",                                   offsetof(struct load_thread, stats.bytes_in) },
+    { "client_recv_calls_total",       "counter", "recv() calls",                                     offsetof(struct load_thread, stats.recv_calls) },
+    { "client_bad_frames_total",       "counter", "Echoed frames that failed to parse or were out of sequence", offsetof(struct load_thread, stats.bad_frames) },
+    { "client_replay_skipped_total",   "counter", "Records not replayed because their connection was down (--replay)", offsetof(struct load_thread, stats.replay_skipped) },
+};
+
+/**
+ * write_stats - publish a snapshot of every load thread's counters
+ *
+ * Return 0, or -1 if --stats-file could not be written (errno is set).
+ */
+static int write_stats(const struct arguments *args_p, const struct load_thread *threads_p, int nthreads)
+{
+    FILE *fp = metrics_open(args_p->stats_file_p);
+    if (!fp)
+        return -1;
+
+    metrics_write(fp, thread_metrics, sizeof(thread_metrics) / sizeof(thread_metrics[0]), "thread",
+                  threads_p, sizeof(*threads_p), nthreads);
+    if (args_p->ping_pong)
+        metrics_write_summary(fp, "client_rtt_seconds", "Round-trip time of the echoed messages",
+                              &threads_p[0].rtt, sizeof(*threads_p), nthreads, 1e-9);
+    metrics_write_summary(fp, "client_connect_seconds", "Time from connect() to the connection being usable",
+                          &threads_p[0].connect_ns, sizeof(*threads_p), nthreads, 1e-9);
+    metrics_write_process(fp);
+
+    return metrics_close(fp, args_p->stats_file_p);
+}
+
+/**
+ * print_latency - ping-pong: print the round-trip time percentiles
+ *
+ * One line per connection (up to LOAD_MAX_CONN_LINES connections), then
+ * the aggregate over all connections.
+ */
+static void print_latency(const struct arguments *args_p, const struct load_conn *conns_p)
+{
+    struct histogram *all_p = malloc(sizeof(*all_p));
+    if (!all_p)
+        return;
+
+    hist_init(all_p);
+
+    printf("\nRound-trip time (usec):\n");
+    hist_print_header("");
+    for (int i = 0; i < args_p->connections; i++)
+    {
+        hist_merge(all_p, conns_p[i].rtt_p);
+        if (args_p->connections <= LOAD_MAX_CONN_LINES)
+        {
+            char label[32];
+            snprintf(label, sizeof(label), "connection %d", i);
+            hist_print(conns_p[i].rtt_p, label);
+        }
+    }
+
+    if (args_p->connections > LOAD_MAX_CONN_LINES)
+        printf("(per-connection lines omitted for more than %d connections)\n", LOAD_MAX_CONN_LINES);
+
+    hist_print(all_p, "all");
+    free(all_p);
+}
+
+/**
+ * struct replay_info - --replay: what a capture holds
+ * @msgs: complete records
+ * @bytes: their payload
+ * @max_len: the largest payload
+ * @clients: client numbers seen
+ * @t_first_ns: time stamp of the first record
+ * @t_last_ns: the latest time stamp
+ */
+struct replay_info
+{
+    uint64_t    msgs;
+    uint64_t    bytes;
+    uint32_t    max_len;
+    uint32_t    clients;
+    uint64_t    t_first_ns;
+    uint64_t    t_last_ns;
+};
+
+static void replay_scan(const struct capture *capture_p, struct replay_info *info_p)
+{
+    uint32_t max_conn = 0;
+
+    memset(info_p, 0, sizeof(*info_p));
+    for (const struct capture_rec *rec_p = capture_next(capture_p, NULL); rec_p; rec_p = capture_next(capture_p, rec_p))
+    {
+        if (info_p->msgs++ == 0)
+            info_p->t_first_ns = rec_p->ts_ns;
+        info_p->bytes += rec_p->len;
+        if (rec_p->len   > info_p->max_len)   info_p->max_len   = rec_p->len;
+        if (rec_p->ts_ns > info_p->t_last_ns) info_p->t_last_ns = rec_p->ts_ns;
+        if (rec_p->conn  > max_conn)          max_conn          = rec_p->conn;
+    }
+
+    // The server numbers its clients densely: a bitmap counts them.
+    uint8_t *seen_p = info_p->msgs ? calloc(max_conn / 8 + 1, 1) : NULL;
+    for (const struct capture_rec *rec_p = seen_p ? capture_next(capture_p, NULL) : NULL; rec_p;
+         rec_p = capture_next(capture_p, rec_p))
+    {
+        if (!(seen_p[rec_p->conn / 8] & (1u << rec_p->conn % 8)))
+            info_p->clients++;
+        seen_p[rec_p->conn / 8] |= 1u << rec_p->conn % 8;
+    }
+    free(seen_p);
+}
+
+/**
+ * resolve_dgram - --udp: resolve the server name
+ *
+ * There is no handshake to race: the first address getaddrinfo() gives
+ * is taken.
+ *
+ * Return 0, or -1 (reported).
+ */
+static int resolve_dgram(const char *host_p, uint16_t port, struct sockaddr_storage *addr_p)
+{
+    struct addrinfo  hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_DGRAM, .ai_flags = AI_ADDRCONFIG };
+    struct addrinfo *res_p = NULL;
+    char             service[8];
+
+    snprintf(service, sizeof(service), "%u", port);
+    int rc = getaddrinfo(host_p, service, &hints, &res_p);
+    if (rc != 0)
+    {
+        fprintf(stderr, RED "Cannot resolve %s: %s" NORMAL "\n", host_p, gai_strerror(rc));
+        return -1;
+    }
+
+    memset(addr_p, 0, sizeof(*addr_p));
+    memcpy(addr_p, res_p->ai_addr, res_p->ai_addrlen);
+    freeaddrinfo(res_p);
+    return 0;
+}
+
+/**
+ * loadgen - run the load-generator mode
+ * @args_p: command-line configuration
+ *
+ * Return EXIT_SUCCESS if at least one connection could be established.
+ */
+int loadgen(const struct arguments *args_p)
+{
+    struct sockaddr_storage *srce_addrs = NULL;
+    int                      nsrce      = 0;
+    if (args_p->srce_addr_p && (nsrce = parse_addr_list(args_p->srce_addr_p, &srce_addrs)) < 0)
+        exit(EXIT_FAILURE);
+
+    char **ifaces  = NULL;
+    int    nifaces = 0;
+    if (args_p->interface_p && (nifaces = parse_iface_list(args_p->interface_p, &ifaces)) < 0)
+        exit(EXIT_FAILURE);
+
+    // Names are resolved once: a happy-eyeballs race picks the address
+    // that every connection then uses.
+    struct sockaddr_storage serv_addr;
+    if (unix_pton(args_p->addr_p, &serv_addr) != 0 &&
+        inet_pton_with_scope(AF_UNSPEC, args_p->addr_p, args_p->port, &serv_addr) != 0)
+    {
+        if (args_p->udp)
+        {
+            if (resolve_dgram(args_p->addr_p, args_p->port, &serv_addr) != 0)
+                exit(EXIT_FAILURE);
+        }
+        else
+        {
+            int fd = happy_connect(args_p->addr_p, args_p->port, nifaces ? ifaces[0] : NULL,
+                                   nsrce ? &srce_addrs[0] : NULL, args_p->connect_timeout_msec, 0, &serv_addr, 0);
+            if (fd < 0)
+            {
+                fprintf(stderr, RED "Cannot connect to %s: %m" NORMAL "\n", args_p->addr_p);
+                exit(EXIT_FAILURE);
+            }
+            close(fd);
+        }
+
+        char buf[INET6_ADDRSTRLEN];
+        const void *src_p = serv_addr.ss_family == AF_INET ? (const void *)&((struct sockaddr_in *)&serv_addr)->sin_addr
+                                                            : (const void *)&((struct sockaddr_in6 *)&serv_addr)->sin6_addr;
+        printf("Resolved %s to %s\n", args_p->addr_p, inet_ntop(serv_addr.ss_family, src_p, buf, sizeof(buf)));
+    }
+
+    // A source address of the other family cannot reach the server.
+    int kept = 0;
+    for (int i = 0; i < nsrce; i++)
+    {
+        if (srce_addrs[i].ss_family == serv_addr.ss_family)
+            srce_addrs[kept++] = srce_addrs[i];
+    }
+    if (nsrce && !kept)
+    {
+        fprintf(stderr, RED "No source address of the server's address family" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+    nsrce = kept;
+
+    // Every connection is a descriptor: raise the soft limit as far as
+    // the hard limit allows.
+    struct rlimit rl;
+    rlim_t        want = (rlim_t)args_p->connections * (args_p->shm_size ? 3 : 1) + 64;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < want)
+    {
+        rl.rlim_cur = rl.rlim_max < want ? rl.rlim_max : want;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if (rl.rlim_cur < want)
+            fprintf(stderr, RED "Only %llu descriptors available for %d connections (see ulimit -Hn)" NORMAL "\n",
+                    (unsigned long long)rl.rlim_cur, args_p->connections);
+    }
+
+    int nthreads = args_p->threads > args_p->connections ? args_p->connections : args_p->threads;
+
+    // --replay: the messages are the capture's records
+    struct capture    *capture_p = NULL;
+    struct replay_info replay;
+    size_t             msg_size  = args_p->msg_size;
+    if (args_p->replay_p)
+    {
+        capture_p = capture_open(args_p->replay_p);
+        if (!capture_p)
+        {
+            fprintf(stderr, RED "Cannot open %s: %s" NORMAL "\n", args_p->replay_p,
+                    errno == EINVAL ? "not a capture file" : strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        replay_scan(capture_p, &replay);
+        if (replay.msgs == 0)
+        {
+            fprintf(stderr, RED "%s holds no messages" NORMAL "\n", args_p->replay_p);
+            exit(EXIT_FAILURE);
+        }
+        if (args_p->framed && replay.max_len > FRAME_MAX_LEN)
+        {
+            fprintf(stderr, RED "%s holds messages of more than %u bytes: they cannot be --framed" NORMAL "\n",
+                    args_p->replay_p, FRAME_MAX_LEN);
+            exit(EXIT_FAILURE);
+        }
+
+        // Only --framed copies the records, behind a header.
+        msg_size = args_p->framed ? FRAME_HDR_SIZE + replay.max_len : 0;
+    }
+
+    // --udp: the message area holds one sendmmsg() worth of datagrams,
+    // and the flows of the run are numbered from a random base.
+    int      dgram_bufs = 0;
+    uint32_t flow_base  = 0;
+    if (args_p->udp)
+    {
+        size_t buf_size = (args_p->gso_segs ? args_p->gso_segs : 1) * args_p->msg_size;
+
+        dgram_bufs = LOAD_DGRAM_BYTES / buf_size < LOAD_DGRAM_BATCH ? LOAD_DGRAM_BYTES / buf_size : LOAD_DGRAM_BATCH;
+        if (dgram_bufs < 1)
+            dgram_bufs = 1;
+        msg_size = dgram_bufs * buf_size;
+
+        if (getrandom(&flow_base, sizeof(flow_base), 0) != sizeof(flow_base))
+            flow_base = (uint32_t)now_nsec();
+        flow_base = (flow_base & 0x7fffffff) | 1;   /* never 0, and room for 2^31 connections */
+    }
+
+    // Threads cache-line aligned, so that no two share a line of counters.
+    struct load_conn    *conns_p   = calloc(args_p->connections, sizeof(*conns_p));
+    struct load_thread  *threads_p = NULL;
+    struct histogram    *rtts_p    = NULL;
+    if (args_p->ping_pong)
+        rtts_p = malloc(args_p->connections * sizeof(*rtts_p));
+    if (!conns_p || posix_memalign((void **)&threads_p, CACHE_LINE, nthreads * sizeof(*threads_p)) != 0 ||
+        (args_p->ping_pong && !rtts_p))
+    {
+        fprintf(stderr, RED "Out of memory. Aborting!" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(threads_p, 0, nthreads * sizeof(*threads_p));
+
+    for (int i = 0; args_p->ping_pong && i < args_p->connections; i++)
+    {
+        hist_init(&rtts_p[i]);
+        conns_p[i].rtt_p = &rtts_p[i];
+    }
+
+    static const char *bulk_names[] =
+    {
+        [BULK_COPY]     = "bulk send() chunks",
+        [BULK_ZEROCOPY] = "bulk send(MSG_ZEROCOPY) chunks",
+        [BULK_SENDFILE] = "bulk sendfile() chunks",
+    };
+
+    const char *kind_p = args_p->ping_pong ? "ping-pong messages" : "messages";
+    if (args_p->bulk)
+        kind_p = bulk_names[args_p->bulk];
+    else if (args_p->framed)
+        kind_p = args_p->ping_pong ? "framed ping-pong messages" : "framed messages";
+    else if (args_p->udp)
+        kind_p = args_p->gso_segs ? "UDP datagrams (GSO)" : "UDP datagrams";
+
+    printf("Load: %d connection(s) over %d thread(s) to ", args_p->connections, nthreads);
+    if (serv_addr.ss_family == AF_UNIX)
+        printf("%s%s", args_p->addr_p, args_p->shm_size ? " (shared memory)" : "");
+    else
+        printf("%s:%u", args_p->addr_p, args_p->port);
+    if (capture_p)
+        printf(", %s", args_p->framed ? "replayed frames" : "replayed messages");
+    else
+    {
+        printf(", %zu-byte %s, rate: ", args_p->msg_size, kind_p);
+        if (args_p->rate > 0)
+            printf("%.0f msgs/s", args_p->rate);
+        else
+            printf("unlimited");
+    }
+    if (args_p->duration > 0)
+        printf(", duration: %.1f s\n", args_p->duration);
+    else
+        printf(", duration: %s\n", capture_p ? "until replayed" : "until Ctrl-C");
+    if (capture_p)
+    {
+        printf("Replay:      %s: %llu message(s), %llu bytes from %u client(s) over %.3f s, ",
+               args_p->replay_p, (unsigned long long)replay.msgs, (unsigned long long)replay.bytes,
+               replay.clients, (replay.t_last_ns - replay.t_first_ns) / 1e9);
+        if (args_p->replay_speed > 0)
+            printf("at %gx the original pace\n", args_p->replay_speed);
+        else
+            printf("as fast as possible\n");
+        if ((int)replay.clients > args_p->connections)
+            printf("             (%u clients share %d connection(s): see --connections)\n",
+                   replay.clients, args_p->connections);
+    }
+    if (nsrce > 1 || nifaces > 1)
+        printf("Fan-out: %d source address(es), %d interface(s)\n", nsrce, nifaces);
+    if (args_p->crc)
+        printf("Integrity:   CRC32C (%s) at the end of every %s\n", crc32c_init(), args_p->framed ? "frame's payload" : "message");
+
+    // sendfile() source: the user's file, or a memfd holding one chunk
+    int file_fd = -1;
+    if (args_p->bulk == BULK_SENDFILE)
+    {
+        file_fd = args_p->file_p ? open(args_p->file_p, O_RDONLY | O_CLOEXEC) : memfd_create("loadgen", MFD_CLOEXEC);
+        if (file_fd < 0)
+        {
+            fprintf(stderr, RED "Cannot open %s: %m" NORMAL "\n", args_p->file_p ? args_p->file_p : "memfd");
+            exit(EXIT_FAILURE);
+        }
+
+        if (!args_p->file_p)
+        {
+            char     chunk[4096];
+            size_t   body = args_p->msg_size - (args_p->crc ? CRC32C_SIZE : 0);
+            uint32_t crc  = 0;
+            for (size_t j = 0; j < sizeof(chunk); j++)
+                chunk[j] = 'a' + j % 26;
+
+            for (size_t done = 0; done < body; )
+            {
+                size_t  len = body - done < sizeof(chunk) ? body - done : sizeof(chunk);
+                ssize_t n   = write(file_fd, chunk, len);
+                if (n <= 0)
+                {
+                    fprintf(stderr, RED "Cannot fill the memfd: %m" NORMAL "\n");
+                    exit(EXIT_FAILURE);
+                }
+                crc   = crc32c(crc, chunk, n);
+                done += n;
+            }
+
+            crc = htole32(crc);
+            if (args_p->crc && write(file_fd, &crc, sizeof(crc)) != sizeof(crc))
+            {
+                fprintf(stderr, RED "Cannot fill the memfd: %m" NORMAL "\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    if (args_p->tls != TLS_OFF && !(tls_ctx_p = tls_client_ctx(args_p->tls_ca_p)))
+    {
+        fprintf(stderr, RED "Cannot set up TLS" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct cpustat cpu_begin, cpu_end;
+    cpustat_open();
+    cpustat_sample(&cpu_begin);
+
+    if (args_p->stats_file_p && write_stats(args_p, threads_p, nthreads) != 0)
+    {
+        fprintf(stderr, RED "Cannot write %s: %m" NORMAL "\n", args_p->stats_file_p);
+        exit(EXIT_FAILURE);
+    }
+
+    // Only the main thread takes SIGINT.
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+
+    int first = 0;
+    for (int i = 0; i < nthreads; i++)
+    {
+        struct load_thread *thread_p = &threads_p[i];
+        int                 nconns   = args_p->connections / nthreads + (i < args_p->connections % nthreads);
+
+        thread_p->id          = i;
+        thread_p->args_p      = args_p;
+        thread_p->serv_addr_p = &serv_addr;
+        thread_p->srce_addrs  = srce_addrs;
+        thread_p->nsrce       = nsrce;
+        thread_p->ifaces      = ifaces;
+        thread_p->nifaces     = nifaces;
+        thread_p->first       = first;
+        thread_p->nconns      = nconns;
+        thread_p->conns       = &conns_p[first];
+        thread_p->rate        = args_p->rate / nthreads;
+        thread_p->msg         = file_fd < 0 && msg_size ? malloc(msg_size) : NULL;
+        thread_p->rcv_buf     = args_p->ping_pong && !args_p->framed ? malloc(LOAD_RECV_SIZE) : NULL;
+        thread_p->file_fd     = file_fd;
+        thread_p->capture_p   = capture_p;
+        thread_p->rec_p       = capture_p ? capture_next(capture_p, NULL) : NULL;
+        thread_p->rec_t0_ns   = capture_p ? replay.t_first_ns : 0;
+        thread_p->dgram_p     = args_p->udp ? malloc(sizeof(*thread_p->dgram_p)) : NULL;
+        thread_p->dgram_bufs  = dgram_bufs;
+        thread_p->flow_base   = flow_base;
+        hist_init(&thread_p->rtt);
+        hist_init(&thread_p->connect_ns);
+        first += nconns;
+
+        if ((file_fd < 0 && msg_size && !thread_p->msg) || (args_p->ping_pong && !args_p->framed && !thread_p->rcv_buf) ||
+            (args_p->udp && !thread_p->dgram_p))
+        {
+            fprintf(stderr, RED "Out of memory. Aborting!" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for (size_t j = 0; thread_p->msg && j < msg_size; j++)
+            thread_p->msg[j] = 'a' + j % 26;
+        if (thread_p->msg && args_p->crc)
+        {
+            size_t hdr = args_p->framed ? FRAME_HDR_SIZE : 0;
+            crc32c_stamp(thread_p->msg + hdr, msg_size - hdr);
+        }
+
+        int rc = pthread_create(&thread_p->tid, NULL, load_thread_main, thread_p);
+        if (rc != 0)
+        {
+            fprintf(stderr, RED "pthread_create() failed: %s" NORMAL "\n", strerror(rc));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    // Live metrics: short naps so that the end of the run is noticed fast.
+    double t_stats = now_sec();
+    while (args_p->stats_file_p && __atomic_load_n(&threads_done, __ATOMIC_ACQUIRE) < nthreads)
+    {
+        struct timespec nap = { .tv_sec = 0, .tv_nsec = LOAD_MAX_WAIT_MSEC * 1000000L };
+        nanosleep(&nap, NULL);
+        if (now_sec() - t_stats >= args_p->stats_interval_msec / 1000.0)
+        {
+            write_stats(args_p, threads_p, nthreads);
+            t_stats = now_sec();
+        }
+    }
+
+    struct load_stats total;
+    struct histogram  connect_ns;
+    double            t_start = 0, t_end = 0;
+
+    memset(&total, 0, sizeof(total));
+    hist_init(&connect_ns);
+    for (int i = 0; i < nthreads; i++)
+    {
+        struct load_thread *thread_p = &threads_p[i];
+
+        pthread_join(thread_p->tid, NULL);
+
+        total.connected        += thread_p->stats.connected;
+        total.connect_failed   += thread_p->stats.connect_failed;
+        total.connect_timeouts += thread_p->stats.connect_timeouts;
+        total.fastopen         += thread_p->stats.fastopen;
+        total.handshakes       += thread_p->stats.handshakes;
+        total.closed           += thread_p->stats.closed;
+        total.msgs             += thread_p->stats.msgs;
+        total.bytes            += thread_p->stats.bytes;
+        total.send_calls       += thread_p->stats.send_calls;
+        total.eagain           += thread_p->stats.eagain;
+        total.msgs_in          += thread_p->stats.msgs_in;
+        total.bytes_in         += thread_p->stats.bytes_in;
+        total.zc_sends         += thread_p->stats.zc_sends;
+        total.zc_done          += thread_p->stats.zc_done;
+        total.zc_copied        += thread_p->stats.zc_copied;
+        total.enobufs          += thread_p->stats.enobufs;
+        total.bad_frames       += thread_p->stats.bad_frames;
+        total.shm_bells        += thread_p->stats.shm_bells;
+        total.replay_skipped   += thread_p->stats.replay_skipped;
+        hist_merge(&connect_ns, &thread_p->connect_ns);
+
+        free(thread_p->msg);
+        free(thread_p->rcv_buf);
+        free(thread_p->dgram_p);
+
+        if (i == 0 || thread_p->t_start < t_start) t_start = thread_p->t_start;
+        if (i == 0 || thread_p->t_end   > t_end)   t_end   = thread_p->t_end;
+    }
+
+    cpustat_sample(&cpu_end);
+    if (file_fd >= 0)
+        close(file_fd);
+    capture_close(capture_p);
+
+    double elapsed = t_end - t_start;
+    if (elapsed <= 0) elapsed = 1e-9;
+
+    printf("Connections: %llu established, %llu failed (%llu timed out), %llu closed by peer\n",
+           (unsigned long long)total.connected, (unsigned long long)total.connect_failed,
+           (unsigned long long)total.connect_timeouts, (unsigned long long)total.closed);
+    if (args_p->tls != TLS_OFF)
+        printf("TLS:         %llu handshake(s), records by %s\n", (unsigned long long)total.handshakes,
+               args_p->tls == TLS_KTLS ? "the kernel" : "OpenSSL");
+    if (args_p->fastopen)
+        printf("Fast Open:   %llu connection(s) sent their first request in the SYN\n",
+               (unsigned long long)total.fastopen);
+    if (connect_ns.count)
+        printf("Connect:     p50 %.1f us, p99 %.1f us, max %.1f us\n",
+               hist_percentile(&connect_ns, 50.0) / 1e3, hist_percentile(&connect_ns, 99.0) / 1e3,
+               connect_ns.max / 1e3);
+    printf("Sent:        %llu %s, %llu bytes in %.3f s (%llu %s calls, %llu EAGAIN)\n",
+           (unsigned long long)total.msgs, args_p->udp ? "datagrams" : "messages", (unsigned long long)total.bytes,
+           elapsed, (unsigned long long)total.send_calls, args_p->udp ? "sendmmsg()" : "send()",
+           (unsigned long long)total.eagain);
+    printf("Throughput:  " GREEN "%.0f msgs/s" NORMAL ", " GREEN "%.0f bytes/s" NORMAL " (%.3f Gbit/s)\n",
+           total.msgs / elapsed, total.bytes / elapsed, total.bytes * 8.0 / elapsed / 1e9);
+
+    if (args_p->bulk)
+        cpustat_print(&cpu_begin, &cpu_end, elapsed, total.bytes);
+
+    if (args_p->udp)
+    {
+        printf("Datagrams:   %.1f per sendmmsg() call", total.send_calls ? (double)total.msgs / total.send_calls : 0.0);
+        if (args_p->gso_segs)
+            printf(", up to %d per buffer (UDP_SEGMENT)", args_p->gso_segs);
+        printf("; the server counts the lost and reordered ones\n");
+    }
+
+    if (capture_p)
+        printf("Replayed:    %llu of %llu message(s)%s, %llu skipped (connection down)\n",
+               (unsigned long long)total.msgs, (unsigned long long)replay.msgs,
+               total.msgs + total.replay_skipped < replay.msgs ? " (cut short)" : "",
+               (unsigned long long)total.replay_skipped);
+
+    if (args_p->shm_size)
+        printf("Doorbells:   %llu rung on the server (%.3f per message)\n",
+               (unsigned long long)total.shm_bells, total.msgs ? (double)total.shm_bells / total.msgs : 0.0);
+
+    if (args_p->bulk == BULK_ZEROCOPY)
+        printf("Zerocopy:    %llu sends, %llu completed, %llu of which copied by the kernel, %llu ENOBUFS\n",
+               (unsigned long long)total.zc_sends, (unsigned long long)total.zc_done,
+               (unsigned long long)total.zc_copied, (unsigned long long)total.enobufs);
+
+    if (args_p->ping_pong)
+    {
+        printf("Received:    %llu echoes, %llu bytes",
+               (unsigned long long)total.msgs_in, (unsigned long long)total.bytes_in);
+        if (args_p->framed)
+            printf(", %llu protocol errors", (unsigned long long)total.bad_frames);
+        printf("\n");
+        print_latency(args_p, conns_p);
+    }
+
+    // Final totals, for whoever scrapes the file after the run.
+    if (args_p->stats_file_p)
+        write_stats(args_p, threads_p, nthreads);
+
+    free(threads_p);
+    free(conns_p);
+    free(rtts_p);
+    SSL_CTX_free(tls_ctx_p);
+    free(srce_addrs);
+    for (int i = 0; i < nifaces; i++)
+        free(ifaces[i]);
+    free(ifaces);
+
+    return total.connected > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
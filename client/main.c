@@ -7,37 +7,84 @@
 #include <string.h>     /* strerror() */
 #include <sys/socket.h> /* socket(), setsockopt(), connect() */
 #include <arpa/inet.h>  /* htons(), inet_pton() */
+#include <netinet/tcp.h> /* TCP_FASTOPEN_CONNECT */
 #include <signal.h>     /* signal(), SIGINT */
 #include <sys/epoll.h>
+#include <poll.h>       /* poll() */
+#include <sys/stat.h>   /* stat() */
 #include <argp.h>
 #include <netdb.h>
 #include <net/if.h>
 
-#define RED     "\x1b[1;31m"
-#define GREEN   "\x1b[1;32m"
-#define CYAN    "\x1b[1;36m"
-#define NORMAL  "\x1b[0m"
+#include "client.h"
+#include "trace.h"
+#include "frame.h"
+#include "wqueue.h"
+#include "unixsock.h"
+#include "shmring.h"
+#include "dgram.h"
+#include "crc32c.h"
 
 
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#define IP_BIND_ADDRESS_NO_PORT 24      /* linux/in.h, not exported by glibc */
+#endif
+
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT    30      /* linux/tcp.h, missing from older glibc */
+#endif
+
 const char *argp_program_version = "1.0";
 const char *argp_program_bug_address = "";
 static char doc[] = "Test bind() before connect() and SO_BINDTODEVICE.";
-static char args_doc[] = "DEST-ADDR PORT";
+static char args_doc[] = "DEST-HOST PORT\nunix:PATH";
+#define OPT_STATS_FILE      0x100   /* long options only */
+#define OPT_STATS_INTERVAL  0x101
+#define OPT_SHM             0x102
+#define OPT_FASTOPEN        0x103
+#define OPT_RECONNECT       0x104
+#define OPT_TLS             0x105
+#define OPT_TLS_CA          0x106
+#define OPT_REPLAY          0x107
+#define OPT_REPLAY_SPEED    0x108
+#define OPT_UDP             0x109
+#define OPT_GSO             0x10a
+#define OPT_CRC             0x10b
+
 static struct argp_option options[] =
 {
-    { "interface",      'i', "IFACE", OPTION_ARG_OPTIONAL, "Interface passed to SO_BINDTODEVICE" },
-    { "source-address", 's', "ADDR",  OPTION_ARG_OPTIONAL, "IP Address passed to bind()" },
+    { "interface",      'i', "IFACE", OPTION_ARG_OPTIONAL, "Interface passed to SO_BINDTODEVICE. Load mode: comma-separated list, NAME[A-B] ranges allowed" },
+    { "source-address", 's', "ADDR",  OPTION_ARG_OPTIONAL, "IP Address passed to bind(). Load mode: comma-separated list, FIRST-LAST ranges allowed" },
+    { "quiet",          'q', 0,       0,                   "Do not trace anything (same as --trace=off)" },
+    { "trace",          't', "LEVEL", 0,                   "Trace level: off, events, syscalls or data (default: data, events in load mode)" },
+    { "trace-file",     'T', "FILE",  0,                   "Dump binary trace records to FILE instead of formatting them on stdout" },
+    { "framed",         'f', 0,       0,                   "Send length-prefixed frames (header included in --msg-size); the server must run with --framed" },
+    { "connect-timeout", 'C', "SECS", 0,                   "Give up on a connection that is not established after SECS seconds (default: 7)" },
+    { "fastopen",       OPT_FASTOPEN, 0, 0,                "Send the first data in the SYN (TCP Fast Open) once the server handed out a cookie. Needs net.ipv4.tcp_fastopen & 1 and a server with --fastopen" },
+    { "tls",            OPT_TLS, "MODE", OPTION_ARG_OPTIONAL, "Talk TLS 1.3 to a server running with --tls, with the records built by the kernel (ktls, the default) or by OpenSSL in user space (user, load mode only)" },
+    { "tls-ca",         OPT_TLS_CA, "FILE", 0,             "--tls: only trust the server if its certificate is in the PEM FILE (e.g. the server's --tls-cert) and names DEST-HOST (default: trust any certificate)" },
+    { 0, 0, 0, 0, "Load-generator mode (enabled by any of these options):" },
+    { "connections",    'c', "N",     0,                   "Number of concurrent connections (default: 1)" },
+    { "threads",        'j', "N",     0,                   "Number of threads sharing the connections (default: 1)" },
+    { "msg-size",       'm', "BYTES", 0,                   "Message size (default: 64, 64 KiB with --bulk)" },
+    { "rate",           'r', "MSGS",  0,                   "Open loop: total messages per second over all connections. 0 (default): closed loop, as fast as the sockets accept" },
+    { "duration",       'd', "SECS",  0,                   "Test duration, 0: until Ctrl-C (default: 10, with --replay: until the capture is replayed)" },
+    { "ping-pong",      'P', 0,       0,                   "Request/response: wait for the server to echo each message and report round-trip time percentiles (server must run with --echo)" },
+    { "bulk",           'B', "METHOD", OPTION_ARG_OPTIONAL, "Bulk throughput: stream --msg-size chunks with copy (default), zerocopy (send with MSG_ZEROCOPY) or sendfile, and report the CPU cost per byte" },
+    { "file",           'F', "FILE",  0,                   "Send FILE over and over with sendfile() (implies --bulk=sendfile, the chunk size is the file size)" },
+    { "cork",           'k', 0,       0,                   "Closed loop: send each burst of messages with MSG_MORE so that they leave in as few segments as possible" },
+    { "stats-file",     OPT_STATS_FILE, "FILE", 0,         "Rewrite FILE with Prometheus-style counters every --stats-interval during the run (default: none)" },
+    { "stats-interval", OPT_STATS_INTERVAL, "SECS", 0,     "Seconds between two --stats-file snapshots (default: 1)" },
+    { "reconnect",      OPT_RECONNECT, 0, 0,               "Ping-pong: open a new connection for every request and close it once echoed (connect-per-request). The round trip then runs from connect()" },
+    { "replay",         OPT_REPLAY, "FILE", 0,             "Send the messages recorded by a server's --capture FILE instead of --msg-size ones, each on connection (its client's number modulo --connections), at the pace they arrived. With --framed, each goes in a frame (the server captured with --framed)" },
+    { "replay-speed",   OPT_REPLAY_SPEED, "X", 0,          "--replay at X times the original pace, 0: as fast as the sockets accept (default: 1)" },
+    { "udp",            OPT_UDP, 0,   0,                   "Send UDP datagrams of --msg-size bytes (sequence-numbered, see the server's --udp) with sendmmsg() instead of TCP messages" },
+    { "gso",            OPT_GSO, "SEGS", OPTION_ARG_OPTIONAL, "--udp: send SEGS datagrams per sendmmsg() buffer, cut by the kernel (UDP_SEGMENT) (default SEGS: as many as fit in 64 KiB, 64 at most)" },
+    { "crc",            OPT_CRC, 0,   0,                   "End every message with the CRC32C of the rest of it (of its payload with --framed), for a server running with --crc to check. Hardware CRC instructions when the CPU has them" },
+    { "shm",            OPT_SHM, "BYTES", OPTION_ARG_OPTIONAL, "With unix:PATH, move the data through shared-memory rings of BYTES each way (a power of two, default: 1 MiB) instead of the socket. The server must run with --io=epoll" },
     { 0 }
 };
 
-struct arguments
-{
-    uint16_t     port;
-    const char *addr_p;
-    char       *interface_p;
-    char       *srce_addr_p;
-};
-
 static error_t parse_opt(int key, char *arg, struct argp_state *state)
 {
     struct arguments *arguments = state->input;
@@ -47,6 +94,153 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
         arguments->interface_p = arg; break;
     case 's':
         arguments->srce_addr_p = arg; break;
+    case 'q':
+        arguments->trace_level = TRACE_OFF; break;
+    case 't':
+        arguments->trace_level = trace_parse_level(arg);
+        if (arguments->trace_level < 0)
+        {
+            fprintf(stderr, RED "Unknown trace level: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'T':
+        arguments->trace_file_p = arg; break;
+    case 'f':
+        arguments->framed = 1; break;
+    case 'C':
+    {
+        double secs = strtod(arg, NULL);
+        if (secs <= 0 || secs > 3600)
+        {
+            fprintf(stderr, RED "Invalid connect timeout: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        arguments->connect_timeout_msec = (int)(secs * 1000 + 0.5);
+        break;
+    }
+    case 'c':
+        arguments->load = 1;
+        arguments->connections = atoi(arg);
+        if (arguments->connections < 1)
+        {
+            fprintf(stderr, RED "Invalid number of connections: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'j':
+        arguments->load = 1;
+        arguments->threads = atoi(arg);
+        if (arguments->threads < 1)
+        {
+            fprintf(stderr, RED "Invalid number of threads: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'm':
+        arguments->load = 1;
+        arguments->msg_size = strtoul(arg, NULL, 0);
+        if (arguments->msg_size < 1)
+        {
+            fprintf(stderr, RED "Invalid message size: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'r':
+        arguments->load = 1;
+        arguments->rate = atof(arg); break;
+    case 'd':
+        arguments->load = 1;
+        arguments->duration = atof(arg); break;
+    case 'P':
+        arguments->load = 1;
+        arguments->ping_pong = 1; break;
+    case 'B':
+        arguments->load = 1;
+        if (!arg || strcmp(arg, "copy") == 0)
+            arguments->bulk = BULK_COPY;
+        else if (strcmp(arg, "zerocopy") == 0)
+            arguments->bulk = BULK_ZEROCOPY;
+        else if (strcmp(arg, "sendfile") == 0)
+            arguments->bulk = BULK_SENDFILE;
+        else
+        {
+            fprintf(stderr, RED "Unknown bulk method: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'F':
+        arguments->load   = 1;
+        arguments->bulk   = BULK_SENDFILE;
+        arguments->file_p = arg; break;
+    case 'k':
+        arguments->load = 1;
+        arguments->cork = 1; break;
+    case OPT_FASTOPEN:
+        arguments->fastopen = 1; break;
+    case OPT_TLS:
+        arguments->tls = tls_parse_mode(arg);
+        if ((int)arguments->tls < 0)
+        {
+            fprintf(stderr, RED "Unknown TLS mode: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case OPT_TLS_CA:
+        arguments->tls_ca_p = arg; break;
+    case OPT_RECONNECT:
+        arguments->load      = 1;
+        arguments->ping_pong = 1;
+        arguments->reconnect = 1; break;
+    case OPT_REPLAY:
+        arguments->load     = 1;
+        arguments->replay_p = arg; break;
+    case OPT_REPLAY_SPEED:
+        arguments->load         = 1;
+        arguments->replay_speed = strtod(arg, NULL);
+        if (arguments->replay_speed < 0 || arguments->replay_speed > 1e6)
+        {
+            fprintf(stderr, RED "Invalid replay speed: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case OPT_UDP:
+        arguments->load = 1;
+        arguments->udp  = 1; break;
+    case OPT_GSO:
+        arguments->load     = 1;
+        arguments->gso_segs = arg ? atoi(arg) : -1;
+        if (arg && (arguments->gso_segs < 1 || arguments->gso_segs > DGRAM_MAX_SEGS))
+        {
+            fprintf(stderr, RED "Invalid number of segments: %s (1 to %d)" NORMAL "\n", arg, DGRAM_MAX_SEGS);
+            argp_usage(state);
+        }
+        break;
+    case OPT_CRC:
+        arguments->load = 1;
+        arguments->crc  = 1; break;
+    case OPT_STATS_FILE:
+        arguments->load         = 1;
+        arguments->stats_file_p = arg; break;
+    case OPT_SHM:
+        arguments->load     = 1;
+        arguments->shm_size = arg ? strtoul(arg, NULL, 0) : SHM_SIZE_DEFAULT;
+        if (arguments->shm_size < SHM_SIZE_MIN || arguments->shm_size > SHM_SIZE_MAX ||
+            (arguments->shm_size & (arguments->shm_size - 1)) != 0)
+        {
+            fprintf(stderr, RED "Invalid ring size: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case OPT_STATS_INTERVAL:
+        arguments->load = 1;
+        arguments->stats_interval_msec = (int)(atof(arg) * 1000 + 0.5);
+        if (arguments->stats_interval_msec < 1)
+        {
+            fprintf(stderr, RED "Invalid number of seconds: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
 
     case ARGP_KEY_ARG:
         switch (state->arg_num)
@@ -62,7 +256,9 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
         break;
 
     case ARGP_KEY_END:
-        if (state->arg_num < 2)
+        // unix:PATH needs no PORT.
+        if (state->arg_num < 1 ||
+            (state->arg_num < 2 && strncmp(arguments->addr_p, UNIX_PREFIX, strlen(UNIX_PREFIX)) != 0))
         {
             fprintf(stderr, RED "Missing arguments" NORMAL "\n");
             argp_usage(state);
@@ -78,7 +274,7 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
 static struct argp argp = { options, parse_opt, args_doc, doc, 0, 0, 0 };
 
 
-static volatile int stop = 0;
+volatile int stop = 0;
 static void sig_handler(int signo)
 {
     stop = 1;
@@ -116,11 +312,9 @@ static int inet6_pton(const char *src, uint16_t port, struct sockaddr_storage *a
         scope = src + (p - tmp) + 1;
     }
 
+    // Not a literal address (maybe a host name): the caller decides.
     if (inet_pton(AF_INET6, tmp, &addr6->sin6_addr) != 1)
-    {
-        fprintf(stderr, RED "invalid source address: %s" NORMAL "\n", src);
         goto free_tmp;
-    }
 
     if (IN6_IS_ADDR_LINKLOCAL(&addr6->sin6_addr) && scope)
     {
@@ -149,8 +343,8 @@ free_tmp:
  *
  * Return 0 on success, errno otherwise.
  */
-static int inet_pton_with_scope(int af, const char *src,
-                                uint16_t port, struct sockaddr_storage *addr)
+int inet_pton_with_scope(int af, const char *src,
+                         uint16_t port, struct sockaddr_storage *addr)
 {
     int rc = -EINVAL;
 
@@ -175,120 +369,175 @@ static int inet_pton_with_scope(int af, const char *src,
     return rc;
 }
 
-static int connect_to_server(const char *addr_p, uint16_t port, const char *interface_p, const char *srce_addr_p)
+/**
+ * unix_pton - convert a "unix:PATH" (or "unix:@NAME") DEST-HOST to a
+ *      Unix-domain socket address
+ * @src: the DEST-HOST string
+ * @addr: output socket address
+ *
+ * Return 0 on success, -EINVAL if @src is not of that form or the path
+ * is too long.
+ */
+int unix_pton(const char *src, struct sockaddr_storage *addr)
 {
-    int                     rc = 0;
-    struct sockaddr_storage serv_addr;
-    rc = inet_pton_with_scope(AF_UNSPEC, addr_p, port, &serv_addr);
-    if (rc != 0)
-    {
-        fprintf(stderr, RED "Invalid address %s" NORMAL "\n", addr_p);
-        exit(EXIT_FAILURE);
-    }
+    socklen_t len;
+
+    memset(addr, 0, sizeof(*addr));
+    if (strncmp(src, UNIX_PREFIX, strlen(UNIX_PREFIX)) != 0 ||
+        unix_addr(src + strlen(UNIX_PREFIX), (struct sockaddr_un *)addr, &len) != 0)
+        return -EINVAL;
+
+    return 0;
+}
 
-    printf("serverfd = socket(AF_INET%s, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) -> ", serv_addr.ss_family == AF_INET ? "" : "6");
-    int serverfd = socket(serv_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
-    printf("%d\n", serverfd);
+static socklen_t sockaddr_len(const struct sockaddr_storage *addr_p)
+{
+    if (addr_p->ss_family == AF_UNIX)
+        return unix_addr_len((const struct sockaddr_un *)addr_p);
+
+    return addr_p->ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+}
+
+/**
+ * connect_start - create a non-blocking socket and start connecting it
+ * @serv_addr_p: server address
+ * @type: SOCK_STREAM, or SOCK_DGRAM for a connected UDP socket
+ * @interface_p: interface passed to SO_BINDTODEVICE, or NULL
+ * @srce_addr_p: source address passed to bind() before connect(), or NULL
+ * @fastopen: set TCP_FASTOPEN_CONNECT (TCP only)
+ * @verbose: print every syscall and its result
+ *
+ * With @fastopen and a cookie cached for the server, connect() returns
+ * at once without sending anything: the socket reports itself writable
+ * and the SYN leaves with the first send(), carrying its data. Without
+ * a cookie, the SYN asks for one and the handshake is a regular one.
+ *
+ * A UDP socket is "connected" at once: connect() only sets the peer that
+ * send() goes to and the only one recv() hears from.
+ *
+ * Return the socket on success, with errno set to EINPROGRESS if the
+ * connection is not established yet, or -1 on failure.
+ */
+int connect_start(const struct sockaddr_storage *serv_addr_p, int type, const char *interface_p,
+                  const struct sockaddr_storage *srce_addr_p, int fastopen, int verbose)
+{
+    int rc = 0;
+
+    if (verbose) printf("serverfd = socket(%s, %s | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) -> ",
+                        serv_addr_p->ss_family == AF_UNIX ? "AF_UNIX" : serv_addr_p->ss_family == AF_INET ? "AF_INET" : "AF_INET6",
+                        type == SOCK_DGRAM ? "SOCK_DGRAM" : "SOCK_STREAM");
+    int serverfd = socket(serv_addr_p->ss_family, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (verbose) printf("%d\n", serverfd);
+    if (serverfd < 0)
+        return -1;
 
     // =================================================================
     // Force interface: SO_BINDTODEVICE
     if (interface_p)
     {
         size_t len = strlen(interface_p);
-        printf("setsockopt(serverfd, SOL_SOCKET, SO_BINDTODEVICE, %s, %lu) -> ", interface_p, len);
+        if (verbose) printf("setsockopt(serverfd, SOL_SOCKET, SO_BINDTODEVICE, %s, %lu) -> ", interface_p, len);
         rc = setsockopt(serverfd, SOL_SOCKET, SO_BINDTODEVICE, interface_p, len);
-        printf("%s%m" NORMAL "\n", rc ? RED : GREEN);
+        if (verbose) printf("%s%m" NORMAL "\n", rc ? RED : GREEN);
     }
 
     // =================================================================
     // Set source address: bind()-before-connect()
+    //
+    // IP_BIND_ADDRESS_NO_PORT defers the choice of the source port to
+    // connect(), which then only needs the whole 4-tuple to be unique.
+    // Without it bind() reserves a port per source address for good and
+    // every source address tops out at the ephemeral port range.
     if (srce_addr_p)
     {
-        struct sockaddr_storage  addr;
-        rc = inet_pton_with_scope(AF_UNSPEC, srce_addr_p, 0, &addr);
-        if (rc != 0)
-        {
-            fprintf(stderr, RED "Invalid source address %s" NORMAL "\n", srce_addr_p);
-            exit(EXIT_FAILURE);
-        }
+        int one = 1;
+        if (verbose) printf("setsockopt(serverfd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, 1) -> ");
+        rc = setsockopt(serverfd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+        if (verbose) printf("%s%m" NORMAL "\n", rc ? RED : GREEN);
 
-        socklen_t addrlen = addr.ss_family == AF_INET ? sizeof(struct sockaddr_in)
-                                                      : sizeof(struct sockaddr_in6);
+        socklen_t addrlen = sockaddr_len(srce_addr_p);
+        char      buf[INET6_ADDRSTRLEN];
+        const void *src_p = srce_addr_p->ss_family == AF_INET ? (const void *)&((const struct sockaddr_in *)srce_addr_p)->sin_addr
+                                                                : (const void *)&((const struct sockaddr_in6 *)srce_addr_p)->sin6_addr;
 
-        printf("bind(serverfd, %s, %d) -> ", srce_addr_p, addrlen);
+        if (verbose) printf("bind(serverfd, %s, %d) -> ", inet_ntop(srce_addr_p->ss_family, src_p, buf, sizeof(buf)), addrlen);
         errno = 0;
-        rc = bind(serverfd, (struct sockaddr *)&addr, addrlen);
-        printf("%s%m" NORMAL "\n", rc ? RED : GREEN);
+        rc = bind(serverfd, (const struct sockaddr *)srce_addr_p, addrlen);
+        if (verbose) printf("%s%m" NORMAL "\n", rc ? RED : GREEN);
     }
 
-    printf("connect(serverfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr) -> ");
-    rc = connect(serverfd, (struct sockaddr *)&serv_addr, serv_addr.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
-    printf("%s%m" NORMAL "\n", rc ? errno == EINPROGRESS ? "\x1b[1;93m" : RED : GREEN);
-
-    if (rc != 0)
+    // =================================================================
+    // TCP Fast Open: the first send() completes the connect()
+    if (fastopen && serv_addr_p->ss_family != AF_UNIX && type == SOCK_STREAM)
     {
-        if (errno != EINPROGRESS)
-        {
-            fprintf(stderr, RED "Failed to connect" NORMAL "\n");
-            exit(EXIT_FAILURE);
-        }
-        else
-        {
-            int epollfd = epoll_create1(EPOLL_CLOEXEC);
-            if (epollfd == -1)
-            {
-                fprintf(stderr, RED "Could not create the epoll FD list. Aborting!" NORMAL "\n");
-                exit(EXIT_FAILURE);
-            }
+        int one = 1;
+        if (verbose) printf("setsockopt(serverfd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1) -> ");
+        rc = setsockopt(serverfd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof(one));
+        if (verbose) printf("%s%m" NORMAL "\n", rc ? RED : GREEN);
+    }
 
-            struct epoll_event  newPeerConnectionEvent;
-            newPeerConnectionEvent.data.fd = serverfd;
-            newPeerConnectionEvent.events  = EPOLLOUT | EPOLLIN | EPOLLERR | EPOLLRDHUP | EPOLLHUP;
+    if (verbose) printf("connect(serverfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr) -> ");
+    rc = connect(serverfd, (const struct sockaddr *)serv_addr_p, sockaddr_len(serv_addr_p));
+    if (verbose) printf("%s%m" NORMAL "\n", rc ? errno == EINPROGRESS ? "\x1b[1;93m" : RED : GREEN);
 
-            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, serverfd, &newPeerConnectionEvent) == -1)
-            {
-                fprintf(stderr, RED "Could not add the socket FD to the epoll FD list. Aborting!" NORMAL "\n");
-                exit(EXIT_FAILURE);
-            }
+    if (rc != 0 && errno != EINPROGRESS)
+    {
+        int err = errno;
+        close(serverfd);
+        errno = err;
+        return -1;
+    }
 
-            sigset_t    sigmsk;
-            sigfillset(&sigmsk);
-            sigdelset(&sigmsk, SIGINT); // SIGINT -> CTRL-c
-            sigprocmask(SIG_SETMASK, &sigmsk, NULL);
-            static const int timeout_msec = 7000; // 7 seconds
+    if (rc == 0)
+        errno = 0;
 
-            struct epoll_event  processableEvents;
-            int numfds = epoll_pwait(epollfd, &processableEvents, 1, timeout_msec, &sigmsk);
+    return serverfd;
+}
 
-            if (numfds < 0)
-            {
-                if (errno == EINTR)
-                {
-                    return -1;
-                }
-                fprintf(stderr, RED "Serious error in epoll setup: epoll_wait() returned < 0 status! %m" NORMAL "\n");
-                exit(EXIT_FAILURE);
-            }
+static int connect_to_server(const char *addr_p, uint16_t port, const char *interface_p, const char *srce_addr_p,
+                             int timeout_msec, int fastopen)
+{
+    int                     rc = 0;
+    struct sockaddr_storage srce_addr;
+    if (srce_addr_p)
+    {
+        rc = inet_pton_with_scope(AF_UNSPEC, srce_addr_p, 0, &srce_addr);
+        if (rc != 0)
+        {
+            fprintf(stderr, RED "Invalid source address %s" NORMAL "\n", srce_addr_p);
+            exit(EXIT_FAILURE);
+        }
+    }
 
-            if (numfds == 0)
-            {
-                fprintf(stderr, RED "Connection timed out!" NORMAL "\n");
-                exit(EXIT_FAILURE);
-            }
+    // Unix-domain: nothing to resolve and no race. A full backlog fails
+    // right away (EAGAIN) instead of waiting.
+    struct sockaddr_storage serv_addr;
+    if (unix_pton(addr_p, &serv_addr) == 0)
+    {
+        int serverfd = connect_start(&serv_addr, SOCK_STREAM, NULL, NULL, 0, 1);
+        if (serverfd < 0)
+        {
+            fprintf(stderr, RED "Failed to connect: %m" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
 
-            socklen_t rc_len = sizeof rc;
-            if (getsockopt(serverfd, SOL_SOCKET, SO_ERROR, (void *)&rc, &rc_len) < 0)
-            {
-                fprintf(stderr, RED "getsockopt() failed" NORMAL "\n");
-                exit(EXIT_FAILURE);
-            }
+        printf("Connected to server\n");
+        return serverfd;
+    }
 
-            if (rc != 0)
-            {
-                fprintf(stderr, RED "Failed to connect. rc=%d" NORMAL "\n", rc);
-                exit(EXIT_FAILURE);
-            }
-        }
+    // SIGINT -> CTRL-c aborts the connection race.
+    int serverfd = happy_connect(addr_p, port, interface_p, srce_addr_p ? &srce_addr : NULL,
+                                 timeout_msec, fastopen, &serv_addr, 1);
+    if (serverfd < 0)
+    {
+        if (errno == EINTR)
+            return -1;
+
+        if (errno == ETIMEDOUT)
+            fprintf(stderr, RED "Connection timed out!" NORMAL "\n");
+        else
+            fprintf(stderr, RED "Failed to connect: %m" NORMAL "\n");
+        exit(EXIT_FAILURE);
     }
 
     printf("Connected to server\n");
@@ -316,41 +565,287 @@ static int connect_to_server(const char *addr_p, uint16_t port, const char *inte
     return serverfd;
 }
 
+/**
+ * start_tls - --tls=ktls: greet the server over TLS built by the kernel
+ * @serverfd: the connected, non-blocking socket
+ * @args_p: command-line configuration
+ *
+ * The handshake runs in user space and is given --connect-timeout; once
+ * the kernel has the keys, the greeting loop goes on with the same plain
+ * send()s as without TLS.
+ *
+ * Return 0, or -1 (reported).
+ */
+static int start_tls(int serverfd, const struct arguments *args_p)
+{
+    SSL_CTX *ctx_p = tls_client_ctx(args_p->tls_ca_p);
+    SSL     *ssl_p = ctx_p ? tls_new(ctx_p, serverfd, args_p->addr_p) : NULL;
+    int      rc    = ssl_p ? 0 : -1;
+
+    while (rc == 0 && !stop)
+    {
+        rc = tls_handshake(ssl_p);
+
+        struct pollfd pfd = { .fd = serverfd, .events = rc == 0 && SSL_want_write(ssl_p) ? POLLOUT : POLLIN };
+        if (rc == 0 && poll(&pfd, 1, args_p->connect_timeout_msec) == 0)
+        {
+            errno = ETIMEDOUT;
+            rc    = -1;
+        }
+    }
+
+    printf("TLS handshake -> ");
+    if (rc > 0 && tls_ktls_install(ssl_p, serverfd) == 0)
+        printf(GREEN "%s, records handed to the kernel" NORMAL "\n", SSL_get_cipher_name(ssl_p));
+    else
+    {
+        printf(RED "%s" NORMAL "\n", tls_strerror());
+        rc = -1;
+    }
+
+    tls_free(ssl_p);
+    SSL_CTX_free(ctx_p);
+    return rc < 0 ? -1 : 0;
+}
+
 int main(int argc, char *argv[])
 {
     signal(SIGINT, sig_handler); // CTRL-c
 
     struct arguments arguments;
 
-    arguments.port        = 0;
-    arguments.addr_p      = NULL;
-    arguments.interface_p = NULL;
-    arguments.srce_addr_p = NULL;
+    arguments.port                 = 0;
+    arguments.addr_p               = NULL;
+    arguments.interface_p          = NULL;
+    arguments.srce_addr_p          = NULL;
+    arguments.trace_level          = -1;
+    arguments.trace_file_p         = NULL;
+    arguments.framed               = 0;
+    arguments.connect_timeout_msec = 7000;
+    arguments.fastopen             = 0;
+    arguments.tls                  = TLS_OFF;
+    arguments.tls_ca_p             = NULL;
+    arguments.load                 = 0;
+    arguments.connections          = 1;
+    arguments.threads              = 1;
+    arguments.msg_size             = 0;     /* default depends on --bulk */
+    arguments.rate                 = 0;
+    arguments.duration             = -1;    /* default depends on --replay */
+    arguments.ping_pong            = 0;
+    arguments.bulk                 = BULK_OFF;
+    arguments.file_p               = NULL;
+    arguments.cork                 = 0;
+    arguments.stats_file_p         = NULL;
+    arguments.stats_interval_msec  = 1000;
+    arguments.shm_size             = 0;
+    arguments.reconnect            = 0;
+    arguments.replay_p             = NULL;
+    arguments.replay_speed         = 1;
+    arguments.udp                  = 0;
+    arguments.gso_segs             = 0;
+    arguments.crc                  = 0;
 
     argp_parse(&argp, argc, argv, 0, 0, &arguments);
 
-    int serverfd = connect_to_server(arguments.addr_p, arguments.port,
-                                     arguments.interface_p, arguments.srce_addr_p);
+    if (arguments.duration < 0)
+        arguments.duration = arguments.replay_p ? 0 : 10;
+
+    if (arguments.file_p)
+    {
+        struct stat st;
+        if (stat(arguments.file_p, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        {
+            fprintf(stderr, RED "%s is not a non-empty regular file" NORMAL "\n", arguments.file_p);
+            exit(EXIT_FAILURE);
+        }
+        arguments.msg_size = st.st_size;
+    }
+
+    if (arguments.msg_size == 0)
+        arguments.msg_size = arguments.bulk ? 65536 : 64;
+
+    if (arguments.bulk && arguments.ping_pong)
+    {
+        fprintf(stderr, RED "--bulk and --ping-pong are mutually exclusive" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.cork && (arguments.rate > 0 || arguments.ping_pong || arguments.bulk == BULK_SENDFILE || arguments.replay_p))
+    {
+        fprintf(stderr, RED "--cork only applies to the closed loop, without --rate, --ping-pong, --replay or sendfile" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.replay_p && (arguments.rate > 0 || arguments.ping_pong || arguments.bulk))
+    {
+        fprintf(stderr, RED "--replay sets its own pace and messages: no --rate, --ping-pong or --bulk" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.shm_size)
+    {
+        struct sockaddr_storage addr;
+        if (unix_pton(arguments.addr_p, &addr) != 0)
+        {
+            fprintf(stderr, RED "--shm requires a unix:PATH server" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+        if (arguments.bulk == BULK_ZEROCOPY || arguments.bulk == BULK_SENDFILE)
+        {
+            fprintf(stderr, RED "--shm copies into the rings: --bulk=zerocopy and sendfile do not apply" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (arguments.reconnect && (arguments.bulk || arguments.rate > 0 || arguments.shm_size))
+    {
+        fprintf(stderr, RED "--reconnect is a closed-loop --ping-pong mode: no --bulk, --rate or --shm" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.tls != TLS_OFF)
+    {
+        struct sockaddr_storage addr;
+        if (unix_pton(arguments.addr_p, &addr) == 0)
+        {
+            fprintf(stderr, RED "--tls only applies to TCP servers" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+        if (arguments.bulk == BULK_ZEROCOPY || (arguments.bulk == BULK_SENDFILE && arguments.tls == TLS_USER))
+        {
+            fprintf(stderr, RED "--tls: --bulk=zerocopy does not apply, and sendfile requires --tls=ktls" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+        if (arguments.tls == TLS_USER && !arguments.load)
+        {
+            fprintf(stderr, RED "--tls=user only applies to load mode" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+        if (arguments.tls == TLS_KTLS && !tls_ktls_available())
+        {
+            fprintf(stderr, RED "--tls=ktls: this kernel has no TLS support (modprobe tls), try --tls=user" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (arguments.tls_ca_p)
+    {
+        fprintf(stderr, RED "--tls-ca requires --tls" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.framed && arguments.bulk)
+    {
+        fprintf(stderr, RED "--framed does not apply to --bulk streams" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.crc && (arguments.udp || arguments.replay_p || arguments.file_p))
+    {
+        fprintf(stderr, RED "--crc stamps the messages it makes: no --udp, --replay or --file" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t min_size = (arguments.framed ? FRAME_HDR_SIZE : 0) + (arguments.ping_pong ? sizeof(uint64_t) : 0) +
+                      (arguments.crc ? CRC32C_SIZE : 0);
+    if (arguments.msg_size < min_size || (arguments.framed && arguments.msg_size - FRAME_HDR_SIZE > FRAME_MAX_LEN))
+    {
+        fprintf(stderr, RED "--msg-size must be between %zu and %u bytes with these options" NORMAL "\n",
+                min_size, FRAME_MAX_LEN + FRAME_HDR_SIZE);
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.udp)
+    {
+        struct sockaddr_storage addr;
+        if (unix_pton(arguments.addr_p, &addr) == 0 || arguments.ping_pong || arguments.bulk || arguments.framed ||
+            arguments.tls != TLS_OFF || arguments.fastopen || arguments.cork || arguments.replay_p)
+        {
+            fprintf(stderr, RED "--udp sends numbered datagrams to an IP server: no unix:PATH, --ping-pong, --bulk, "
+                    "--framed, --tls, --fastopen, --cork or --replay" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+        if (arguments.msg_size < DGRAM_HDR_SIZE || arguments.msg_size > DGRAM_MAX_SIZE)
+        {
+            fprintf(stderr, RED "--udp: --msg-size must be between %d and %d bytes" NORMAL "\n",
+                    DGRAM_HDR_SIZE, DGRAM_MAX_SIZE);
+            exit(EXIT_FAILURE);
+        }
+
+        // One UDP_SEGMENT buffer is one IP packet before it is cut.
+        if (arguments.gso_segs < 0)
+            arguments.gso_segs = DGRAM_MAX_SIZE / arguments.msg_size < DGRAM_MAX_SEGS ? DGRAM_MAX_SIZE / arguments.msg_size
+                                                                                      : DGRAM_MAX_SEGS;
+        if (arguments.gso_segs * arguments.msg_size > DGRAM_MAX_SIZE)
+        {
+            fprintf(stderr, RED "--gso: %d datagrams of %zu bytes do not fit in %d" NORMAL "\n",
+                    arguments.gso_segs, arguments.msg_size, DGRAM_MAX_SIZE);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (arguments.gso_segs)
+    {
+        fprintf(stderr, RED "--gso requires --udp" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Per-message records would swamp the drainer in load mode
+    if (arguments.trace_level < 0)
+        arguments.trace_level = arguments.load ? TRACE_EVENTS : TRACE_DATA;
+
+    trace_init(arguments.trace_level, arguments.trace_file_p);
+
+    if (arguments.load)
+    {
+        int status = loadgen(&arguments);
+        trace_exit();
+        exit(status);
+    }
+
+    int serverfd = connect_to_server(arguments.addr_p, arguments.port, arguments.interface_p,
+                                     arguments.srce_addr_p, arguments.connect_timeout_msec, arguments.fastopen);
+    if (serverfd > 0 && arguments.tls != TLS_OFF && start_tls(serverfd, &arguments) != 0)
+    {
+        close(serverfd);
+        exit(EXIT_FAILURE);
+    }
+
     if (serverfd > 0)
     {
+        char          msg[FRAME_HDR_SIZE + 5];
+        size_t        hdr = arguments.framed ? FRAME_HDR_SIZE : 0;
+        uint32_t      seq = 0;
+        struct wqueue wq;
+
+        memset(&wq, 0, sizeof(wq));
+        memcpy(msg + hdr, "hello", 5);
         while (!stop)
         {
-            printf("send(serverfd, \"hello\", 5, 0) -> ");
-            ssize_t l = send(serverfd, "hello", 5, 0);
-            printf("%ld", l);
-            if (l < 0)
-            {
-                printf(" - " RED "%m" NORMAL "\n");
+            if (arguments.framed)
+                frame_hdr_write(msg, FRAME_DATA, 0, seq++, 5);
+
+            // A server that does not read only makes the queue grow: the
+            // greeting keeps its 2 s period either way.
+            int rc = wq_send(&wq, serverfd, msg, hdr + 5, 0);
+            TRACE(TRACE_SYSCALLS, TC_SEND, serverfd, rc < 0 ? -1 : (ssize_t)(hdr + 5), errno, msg + hdr, 5);
+            if (rc < 0)
                 break;
-            }
 
-            printf("\n");
-            sleep(2);
+            // Wake up every 100 ms to check for Ctrl-C.
+            for (int i = 0; i < 20 && !stop && rc >= 0; i++)
+            {
+                struct pollfd pfd = { .fd = serverfd, .events = wq_pending(&wq) ? POLLOUT : 0 };
+                if (poll(&pfd, 1, 100) > 0 && (pfd.revents & POLLOUT))
+                    rc = wq_flush(&wq, serverfd, 0);
+            }
+            if (rc < 0)
+                break;
         }
 
+        wq_free(&wq);
         close(serverfd);
     }
 
+    trace_exit();
     printf("\n\n");
 
     exit(EXIT_SUCCESS);
@@ -0,0 +1,200 @@
+// COMMON - append-only, memory-mapped capture of received messages
+#define _GNU_SOURCE
+#include <stdlib.h>     /* calloc(), free() */
+#include <string.h>     /* memcpy() */
+#include <unistd.h>     /* close(), ftruncate() */
+#include <errno.h>      /* errno, EINVAL */
+#include <fcntl.h>      /* open(), posix_fallocate() */
+#include <time.h>       /* clock_gettime() */
+#include <sys/mman.h>   /* mmap(), munmap(), madvise() */
+#include <sys/stat.h>   /* fstat() */
+
+#include "capture.h"
+
+static uint64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static struct capture *capture_map(int fd, size_t size, int prot)
+{
+    struct capture *cap_p = calloc(1, sizeof(*cap_p));
+    if (!cap_p)
+        return NULL;
+
+    cap_p->hdr_p = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+    if (cap_p->hdr_p == MAP_FAILED)
+    {
+        free(cap_p);
+        return NULL;
+    }
+
+    cap_p->size = size;
+    cap_p->end  = size;
+    cap_p->fd   = fd;
+    return cap_p;
+}
+
+/**
+ * capture_create - create (or truncate) a capture file and map it
+ * @path_p: the file
+ * @size: most bytes the file may grow to, header included
+ *
+ * The whole size is allocated up front, so that running out of disk
+ * space shows here rather than as a SIGBUS in a worker. The file is
+ * trimmed to what was used by capture_close().
+ *
+ * Return the capture, or NULL with errno set.
+ */
+struct capture *capture_create(const char *path_p, size_t size)
+{
+    if (size < CAPTURE_SIZE_MIN)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    int fd = open(path_p, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return NULL;
+
+    int             rc    = posix_fallocate(fd, 0, size);
+    struct capture *cap_p = rc == 0 ? capture_map(fd, size, PROT_READ | PROT_WRITE) : NULL;
+    if (!cap_p)
+    {
+        int err = rc ? rc : errno;
+        close(fd);
+        unlink(path_p);
+        errno = err;
+        return NULL;
+    }
+
+    cap_p->writer            = 1;
+    cap_p->t0_ns             = clock_ns(CLOCK_MONOTONIC);
+    cap_p->hdr_p->magic      = CAPTURE_MAGIC;
+    cap_p->hdr_p->rec_offset = sizeof(struct capture_hdr);
+    cap_p->hdr_p->t0_ns      = clock_ns(CLOCK_REALTIME);
+    cap_p->hdr_p->tail       = 0;
+
+    return cap_p;
+}
+
+/**
+ * capture_write - append a message to a capture
+ * @cap_p: the capture, from capture_create()
+ * @conn: the connection it came on
+ * @now_ns: CLOCK_MONOTONIC time it arrived
+ * @data_p: the message
+ * @len: its size
+ *
+ * May be called from any thread. The payload is copied straight into the
+ * mapping: no system call, and no lock beyond the one atomic add.
+ *
+ * Return 0, or -1 if the capture is full (the message is dropped).
+ */
+int capture_write(struct capture *cap_p, uint32_t conn, uint64_t now_ns, const void *data_p, size_t len)
+{
+    struct capture_hdr *hdr_p = cap_p->hdr_p;
+    size_t              size  = CAPTURE_REC_SIZE(len);
+    size_t              room  = cap_p->end - hdr_p->rec_offset;
+
+    // Once full, stay off the shared line: only read it.
+    if (len == 0 || len > UINT32_MAX || __atomic_load_n(&hdr_p->tail, __ATOMIC_RELAXED) + size > room)
+        return -1;
+
+    uint64_t off = __atomic_fetch_add(&hdr_p->tail, size, __ATOMIC_RELAXED);
+    if (off + size > room)
+        return -1;
+
+    struct capture_rec *rec_p = (struct capture_rec *)((char *)hdr_p + hdr_p->rec_offset + off);
+    rec_p->conn  = conn;
+    rec_p->ts_ns = now_ns - cap_p->t0_ns;
+    memcpy(rec_p->data, data_p, len);
+    __atomic_store_n(&rec_p->len, (uint32_t)len, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* Bytes of the file in use: the header and the records that fitted */
+size_t capture_used(const struct capture *cap_p)
+{
+    const struct capture_hdr *hdr_p = cap_p->hdr_p;
+    uint64_t                  tail  = __atomic_load_n(&hdr_p->tail, __ATOMIC_ACQUIRE);
+
+    return hdr_p->rec_offset + tail > cap_p->end ? cap_p->end : hdr_p->rec_offset + tail;
+}
+
+/**
+ * capture_open - map an existing capture file to read it
+ * @path_p: the file
+ *
+ * A capture still being written can be opened too: only the records
+ * complete at that time are seen.
+ *
+ * Return the capture, or NULL with errno set (EINVAL: not a capture).
+ */
+struct capture *capture_open(const char *path_p)
+{
+    int fd = open(path_p, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    struct stat     st;
+    struct capture *cap_p = NULL;
+    if (fstat(fd, &st) == 0)
+    {
+        if ((size_t)st.st_size < sizeof(struct capture_hdr))
+            errno = EINVAL;
+        else
+            cap_p = capture_map(fd, st.st_size, PROT_READ);
+    }
+
+    if (cap_p && (cap_p->hdr_p->magic != CAPTURE_MAGIC || cap_p->hdr_p->rec_offset != sizeof(struct capture_hdr)))
+    {
+        munmap(cap_p->hdr_p, cap_p->size);
+        free(cap_p);
+        cap_p = NULL;
+        errno = EINVAL;
+    }
+
+    if (!cap_p)
+    {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+
+    cap_p->end = capture_used(cap_p);
+    madvise(cap_p->hdr_p, cap_p->size, MADV_SEQUENTIAL);
+
+    return cap_p;
+}
+
+/**
+ * capture_close - unmap a capture, trimming a written one to its records
+ * @cap_p: the capture, or NULL
+ *
+ * Return 0, or -1 if a written capture could not be trimmed (errno is
+ * set). It is still readable: the records end at the first one without
+ * a length.
+ */
+int capture_close(struct capture *cap_p)
+{
+    if (!cap_p)
+        return 0;
+
+    size_t used = capture_used(cap_p);
+    int    err  = 0;
+
+    munmap(cap_p->hdr_p, cap_p->size);
+    if (cap_p->writer && ftruncate(cap_p->fd, used) != 0)
+        err = errno;
+    close(cap_p->fd);
+    free(cap_p);
+
+    errno = err;
+    return err ? -1 : 0;
+}
@@ -0,0 +1,104 @@
+// COMMON - append-only, memory-mapped capture of received messages
+//
+// The server (--capture) maps a file of a fixed size and appends one
+// record per message received; the client (--replay) maps the same file
+// read-only and sends the records again, with their original timing.
+//
+// Layout: a struct capture_hdr, then the records back to back, each an
+// 8-byte aligned struct capture_rec followed by its payload. Writers
+// from any number of threads reserve space with one atomic add on the
+// header's @tail and fill their record in place; @len is written last,
+// so a reader stops at the first record that has none. When the file is
+// full, messages are dropped (and counted by the caller), the writers
+// never wait. Fields are in the host's byte order.
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>     /* size_t */
+#include <stdint.h>     /* uint32_t, uint64_t */
+
+#define CAPTURE_MAGIC           0x31504143  /* "CAP1" on little-endian */
+#define CAPTURE_SIZE_DEFAULT    (256ul << 20)
+#define CAPTURE_SIZE_MIN        (1ul << 20)
+
+/**
+ * struct capture_hdr - the start of a capture file
+ * @magic: CAPTURE_MAGIC
+ * @rec_offset: offset of the first record, sizeof(struct capture_hdr)
+ * @t0_ns: CLOCK_REALTIME time at which the records' @ts_ns is 0
+ * @tail: bytes of records reserved so far, on a cache line of its own
+ */
+struct capture_hdr
+{
+    uint32_t    magic;
+    uint32_t    rec_offset;
+    uint64_t    t0_ns;
+    uint64_t    tail __attribute__((aligned(64)));
+} __attribute__((aligned(64)));
+
+/**
+ * struct capture_rec - one message
+ * @len: payload bytes, 0 if the record is not complete (yet)
+ * @conn: connection the message came on, unique within the capture
+ * @ts_ns: arrival time, in ns since the capture was created
+ * @data: the payload, padded to a multiple of 8 bytes
+ */
+struct capture_rec
+{
+    uint32_t    len;
+    uint32_t    conn;
+    uint64_t    ts_ns;
+    char        data[];
+};
+
+#define CAPTURE_REC_SIZE(len)   ((sizeof(struct capture_rec) + (len) + 7) & ~(size_t)7)
+
+/**
+ * struct capture - a mapped capture file
+ * @hdr_p: the mapping, which starts with the header
+ * @size: bytes mapped
+ * @end: offset of the end of the records: @size when writing, the end of
+ *      the complete ones when reading
+ * @t0_ns: writer: CLOCK_MONOTONIC time at which @ts_ns is 0
+ * @fd: the file
+ * @writer: made by capture_create(), trimmed to what was used on close
+ */
+struct capture
+{
+    struct capture_hdr *hdr_p;
+    size_t              size;
+    size_t              end;
+    uint64_t            t0_ns;
+    int                 fd;
+    int                 writer;
+};
+
+struct capture *capture_create(const char *path_p, size_t size);
+int             capture_write(struct capture *cap_p, uint32_t conn, uint64_t now_ns, const void *data_p, size_t len);
+size_t          capture_used(const struct capture *cap_p);
+struct capture *capture_open(const char *path_p);
+int             capture_close(struct capture *cap_p);
+
+/**
+ * capture_next - walk the records of a capture opened with capture_open()
+ * @cap_p: the capture
+ * @rec_p: the current record, or NULL for the first one
+ *
+ * Return the next record, or NULL after the last one.
+ */
+static inline const struct capture_rec *capture_next(const struct capture *cap_p, const struct capture_rec *rec_p)
+{
+    size_t off = rec_p ? (size_t)((const char *)rec_p - (const char *)cap_p->hdr_p) + CAPTURE_REC_SIZE(rec_p->len)
+                       : cap_p->hdr_p->rec_offset;
+
+    if (off + sizeof(struct capture_rec) > cap_p->end)
+        return NULL;
+
+    rec_p = (const struct capture_rec *)((const char *)cap_p->hdr_p + off);
+    if (rec_p->len == 0 || off + CAPTURE_REC_SIZE(rec_p->len) > cap_p->end)
+        return NULL;
+
+    return rec_p;
+}
+
+#endif /* CAPTURE_H */
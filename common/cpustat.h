@@ -0,0 +1,25 @@
+// COMMON - process CPU cost: CPU time and, when available, CPU cycles
+//
+// CPU time comes from getrusage(RUSAGE_SELF), which covers every thread
+// of the process. Cycles come from a perf_event_open() hardware counter
+// opened with inherit=1, so threads created afterwards are counted too;
+// their counts are folded into the counter when they exit, which is why
+// the final sample must be taken after the threads were joined.
+#ifndef CPUSTAT_H
+#define CPUSTAT_H
+
+#include <stdint.h>     /* uint64_t */
+
+struct cpustat
+{
+    double      user_sec;
+    double      sys_sec;
+    uint64_t    cycles;     /* 0 when no cycle counter could be opened */
+};
+
+void cpustat_open(void);
+void cpustat_sample(struct cpustat *sample_p);
+void cpustat_print(const struct cpustat *begin_p, const struct cpustat *end_p,
+                   double elapsed, uint64_t bytes);
+
+#endif /* CPUSTAT_H */
@@ -0,0 +1,276 @@
+// COMMON - CRC32C (Castagnoli) of message payloads
+#define _GNU_SOURCE
+#include <string.h>     /* memcpy() */
+#include <endian.h>     /* htole32(), le64toh() */
+#if defined(__x86_64__)
+#include <nmmintrin.h>  /* _mm_crc32_u8(), _mm_crc32_u64() */
+#elif defined(__aarch64__)
+#include <arm_acle.h>   /* __crc32cb(), __crc32cd() */
+#include <sys/auxv.h>   /* getauxval() */
+#include <asm/hwcap.h>  /* HWCAP_CRC32 */
+#endif
+
+#include "crc32c.h"
+
+#define CRC32C_POLY     0x82f63b78u     /* bit-reversed 0x1edc6f41 */
+#define CRC32C_LONG     8192            /* hardware: bytes per stream of a long block */
+#define CRC32C_SHORT    256             /* ... of a short block */
+
+#if defined(__x86_64__)
+#define CRC32C_HW_NAME  "sse4.2"
+#define CRC32C_HW       __attribute__((target("sse4.2")))
+#define hw_u8(crc, b)   _mm_crc32_u8((crc), (b))
+#define hw_u64(crc, w)  _mm_crc32_u64((crc), (w))
+#elif defined(__aarch64__)
+#define CRC32C_HW_NAME  "armv8 crc32"
+#define CRC32C_HW       __attribute__((target("+crc")))
+#define hw_u8(crc, b)   __crc32cb((crc), (b))
+#define hw_u64(crc, w)  __crc32cd((crc), (w))
+#endif
+
+static uint32_t sw_table[8][256];       /* slicing-by-8 */
+static uint32_t long_zeros[4][256];     /* hardware: appends CRC32C_LONG zeros to a CRC */
+static uint32_t short_zeros[4][256];    /* ... CRC32C_SHORT zeros */
+
+static uint32_t crc32c_sw(uint32_t crc, const void *data_p, size_t len);
+
+static uint32_t  (*crc32c_fn)(uint32_t, const void *, size_t) = crc32c_sw;
+static const char *crc32c_name = NULL;
+
+static uint64_t load64(const unsigned char *p)
+{
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return le64toh(word);
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const void *data_p, size_t len)
+{
+    const unsigned char *p = data_p;
+
+    crc = ~crc;
+    while (len > 0 && ((uintptr_t)p & 7))
+    {
+        crc = (crc >> 8) ^ sw_table[0][(crc ^ *p++) & 0xff];
+        len--;
+    }
+
+    // Eight table lookups per 8 bytes, all independent of each other.
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint64_t word = load64(p) ^ crc;
+
+        crc = sw_table[7][word & 0xff]         ^ sw_table[6][(word >> 8) & 0xff]  ^
+              sw_table[5][(word >> 16) & 0xff] ^ sw_table[4][(word >> 24) & 0xff] ^
+              sw_table[3][(word >> 32) & 0xff] ^ sw_table[2][(word >> 40) & 0xff] ^
+              sw_table[1][(word >> 48) & 0xff] ^ sw_table[0][word >> 56];
+    }
+
+    while (len-- > 0)
+        crc = (crc >> 8) ^ sw_table[0][(crc ^ *p++) & 0xff];
+
+    return ~crc;
+}
+
+static void sw_init(void)
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        sw_table[0][n] = crc;
+    }
+
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        for (int k = 1; k < 8; k++)
+            sw_table[k][n] = (sw_table[k - 1][n] >> 8) ^ sw_table[0][sw_table[k - 1][n] & 0xff];
+    }
+}
+
+#ifdef CRC32C_HW
+
+/* GF(2) 32x32 matrix times vector, the matrix as 32 columns */
+static uint32_t gf2_times(const uint32_t *mat_p, uint32_t vec)
+{
+    uint32_t sum = 0;
+
+    for (; vec; vec >>= 1, mat_p++)
+    {
+        if (vec & 1)
+            sum ^= *mat_p;
+    }
+
+    return sum;
+}
+
+static void gf2_square(uint32_t *square_p, const uint32_t *mat_p)
+{
+    for (int n = 0; n < 32; n++)
+        square_p[n] = gf2_times(mat_p, mat_p[n]);
+}
+
+/**
+ * zeros_init - tables that append @len zero bytes to a CRC register
+ * @zeros: filled in, one table per byte of the register
+ * @len: a power of two
+ *
+ * The operator for one zero bit is squared until it covers @len bytes,
+ * then applied to every value of each byte of the register.
+ */
+static void zeros_init(uint32_t zeros[4][256], size_t len)
+{
+    uint32_t even[32], odd[32];
+
+    odd[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n++)
+        odd[n] = 1u << (n - 1);
+    gf2_square(even, odd);          /* 2 zero bits */
+    gf2_square(odd, even);          /* 4 zero bits */
+
+    const uint32_t *op_p = odd;
+    for (len *= 2; len > 1; len >>= 1)
+    {
+        // Each round doubles: 1 byte, 2 bytes... until @len.
+        gf2_square(op_p == odd ? even : odd, op_p);
+        op_p = op_p == odd ? even : odd;
+    }
+
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        zeros[0][n] = gf2_times(op_p, n);
+        zeros[1][n] = gf2_times(op_p, n << 8);
+        zeros[2][n] = gf2_times(op_p, n << 16);
+        zeros[3][n] = gf2_times(op_p, n << 24);
+    }
+}
+
+static uint32_t zeros_apply(uint32_t zeros[4][256], uint32_t crc)
+{
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+           zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+/* Run @crc over the 3 * @block byte blocks at *@p_p, three streams at a time */
+CRC32C_HW
+static inline uint32_t hw_blocks(uint32_t crc, const unsigned char **p_p, size_t *len_p,
+                                 size_t block, uint32_t zeros[4][256])
+{
+    const unsigned char *p = *p_p;
+
+    for (; *len_p >= 3 * block; p += 2 * block, *len_p -= 3 * block)
+    {
+        uint32_t crc1 = 0, crc2 = 0;
+        for (const unsigned char *end_p = p + block; p < end_p; p += 8)
+        {
+            crc  = hw_u64(crc, load64(p));
+            crc1 = hw_u64(crc1, load64(p + block));
+            crc2 = hw_u64(crc2, load64(p + 2 * block));
+        }
+        crc = zeros_apply(zeros, crc) ^ crc1;
+        crc = zeros_apply(zeros, crc) ^ crc2;
+    }
+
+    *p_p = p;
+    return crc;
+}
+
+/**
+ * crc32c_hw - the CRC instruction, 8 bytes at a time
+ *
+ * The instruction has a latency of about 3 cycles but can start one per
+ * cycle: a block is cut into three streams computed side by side, and
+ * their CRCs merged by appending to each the length of the streams that
+ * follow it (zeros_apply()), which is linear.
+ */
+CRC32C_HW
+static uint32_t crc32c_hw(uint32_t crc, const void *data_p, size_t len)
+{
+    const unsigned char *p    = data_p;
+    uint32_t             crc0 = ~crc;
+
+    while (len > 0 && ((uintptr_t)p & 7))
+    {
+        crc0 = hw_u8(crc0, *p++);
+        len--;
+    }
+
+    crc0 = hw_blocks(crc0, &p, &len, CRC32C_LONG, long_zeros);
+    crc0 = hw_blocks(crc0, &p, &len, CRC32C_SHORT, short_zeros);
+
+    for (; len >= 8; p += 8, len -= 8)
+        crc0 = hw_u64(crc0, load64(p));
+
+    while (len-- > 0)
+        crc0 = hw_u8(crc0, *p++);
+
+    return ~crc0;
+}
+
+static int hw_available(void)
+{
+#if defined(__x86_64__)
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+}
+
+#endif /* CRC32C_HW */
+
+/**
+ * crc32c_init - pick the implementation crc32c() uses
+ *
+ * Call once, before any thread uses crc32c().
+ *
+ * Return its name: "sse4.2", "armv8 crc32" or "slicing-by-8".
+ */
+const char *crc32c_init(void)
+{
+    if (crc32c_name)
+        return crc32c_name;
+
+    sw_init();
+    crc32c_fn   = crc32c_sw;
+    crc32c_name = "slicing-by-8";
+
+#ifdef CRC32C_HW
+    if (hw_available())
+    {
+        zeros_init(long_zeros, CRC32C_LONG);
+        zeros_init(short_zeros, CRC32C_SHORT);
+        crc32c_fn   = crc32c_hw;
+        crc32c_name = CRC32C_HW_NAME;
+    }
+#endif
+
+    return crc32c_name;
+}
+
+/**
+ * crc32c - update a CRC32C with more data
+ * @crc: the CRC of the data so far, 0 to start
+ * @data_p: the data, no alignment required
+ * @len: its size
+ *
+ * crc32c(crc32c(0, a, n), b, m) is the CRC of a followed by b.
+ *
+ * Return the CRC of all the data.
+ */
+uint32_t crc32c(uint32_t crc, const void *data_p, size_t len)
+{
+    return crc32c_fn(crc, data_p, len);
+}
+
+/**
+ * crc32c_stamp - end a message with the CRC32C of the rest of it
+ * @msg_p: the message
+ * @len: its size, the stamp's CRC32C_SIZE bytes included
+ */
+void crc32c_stamp(void *msg_p, size_t len)
+{
+    uint32_t crc = htole32(crc32c(0, msg_p, len - CRC32C_SIZE));
+
+    memcpy((char *)msg_p + len - CRC32C_SIZE, &crc, sizeof(crc));
+}
@@ -0,0 +1,26 @@
+// COMMON - CRC32C (Castagnoli) of message payloads
+//
+// The client's --crc ends every message with the CRC32C of the bytes
+// before it, little-endian, so that the server can check it in one pass:
+// the CRC32C of any data followed by its own CRC is CRC32C_RESIDUE, and a
+// receiver that runs crc32c() over whole buffers as they come only has to
+// compare at each message boundary.
+//
+// crc32c_init() picks, once, the fastest implementation the CPU has: the
+// SSE4.2 crc32 instruction (x86-64) or the ARMv8 CRC32 extension, three
+// streams interleaved to hide the instruction's latency, or else a
+// table-driven slicing-by-8 in plain C.
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>     /* uint32_t */
+#include <stddef.h>     /* size_t */
+
+#define CRC32C_SIZE     4               /* bytes of the stamp at the end of a message */
+#define CRC32C_RESIDUE  0x48674bc7u     /* crc32c() of any data followed by its stamp */
+
+const char *crc32c_init(void);
+uint32_t    crc32c(uint32_t crc, const void *data_p, size_t len);
+void        crc32c_stamp(void *msg_p, size_t len);
+
+#endif /* CRC32C_H */
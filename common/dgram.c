@@ -0,0 +1,128 @@
+// COMMON - datagrams of the --udp mode
+#define _DEFAULT_SOURCE
+#include <stdlib.h>     /* calloc(), free() */
+#include <string.h>     /* memcpy() */
+#include <endian.h>     /* htobe32(), htobe64() */
+
+#include "dgram.h"
+
+#define DGRAM_FLOWS_MIN 64      /* slots of a new table */
+
+/**
+ * dgram_hdr_write - stamp the header of a datagram to send
+ * @dst_p: the datagram, at least DGRAM_HDR_SIZE bytes, no alignment required
+ * @flow: the sending socket's flow, not 0
+ * @seq: the datagram's number in the flow
+ */
+void dgram_hdr_write(void *dst_p, uint32_t flow, uint64_t seq)
+{
+    char     *p       = dst_p;
+    uint32_t  magic_n = htobe32(DGRAM_MAGIC);
+    uint32_t  flow_n  = htobe32(flow);
+    uint64_t  seq_n   = htobe64(seq);
+
+    memcpy(p + 0, &magic_n, sizeof(magic_n));
+    memcpy(p + 4, &flow_n,  sizeof(flow_n));
+    memcpy(p + 8, &seq_n,   sizeof(seq_n));
+}
+
+/**
+ * dgram_hdr_read - parse the header of a received datagram
+ * @src_p: the datagram, no alignment required
+ * @len: its size
+ * @flow_p: its flow
+ * @seq_p: its sequence number
+ *
+ * Return 0, or -1 if the datagram is too short or not one of ours.
+ */
+int dgram_hdr_read(const void *src_p, size_t len, uint32_t *flow_p, uint64_t *seq_p)
+{
+    const char *p = src_p;
+    uint32_t    magic_n, flow_n;
+    uint64_t    seq_n;
+
+    if (len < DGRAM_HDR_SIZE)
+        return -1;
+
+    memcpy(&magic_n, p + 0, sizeof(magic_n));
+    memcpy(&flow_n,  p + 4, sizeof(flow_n));
+    memcpy(&seq_n,   p + 8, sizeof(seq_n));
+
+    if (be32toh(magic_n) != DGRAM_MAGIC || flow_n == 0)
+        return -1;
+
+    *flow_p = be32toh(flow_n);
+    *seq_p  = be64toh(seq_n);
+    return 0;
+}
+
+static struct dgram_flow *flow_slot(struct dgram_flow *slots_p, size_t mask, uint32_t flow)
+{
+    // Fibonacci hashing: the flows of a run are consecutive numbers.
+    size_t i = (size_t)((flow * 2654435761u) & mask);
+
+    while (slots_p[i].id != 0 && slots_p[i].id != flow)
+        i = (i + 1) & mask;
+
+    return &slots_p[i];
+}
+
+static int flows_grow(struct dgram_flows *flows_p)
+{
+    size_t             size    = flows_p->slots_p ? (flows_p->mask + 1) * 2 : DGRAM_FLOWS_MIN;
+    struct dgram_flow *slots_p = calloc(size, sizeof(*slots_p));
+    if (!slots_p)
+        return -1;
+
+    for (size_t i = 0; flows_p->slots_p && i <= flows_p->mask; i++)
+    {
+        if (flows_p->slots_p[i].id != 0)
+            *flow_slot(slots_p, size - 1, flows_p->slots_p[i].id) = flows_p->slots_p[i];
+    }
+
+    free(flows_p->slots_p);
+    flows_p->slots_p = slots_p;
+    flows_p->mask    = size - 1;
+    return 0;
+}
+
+/**
+ * dgram_track - account for a received datagram
+ * @flows_p: the receiver's flows
+ * @flow: the datagram's flow, not 0
+ * @seq: its sequence number
+ *
+ * The first datagram of a flow is expected to be number 0.
+ *
+ * Return 0 if it is the one expected, the number of datagrams it skipped
+ * if it is ahead (missing so far), or -1 if it is behind: one that was
+ * skipped before turned up late (or a duplicate). Out of memory, the
+ * datagram is taken as expected.
+ */
+int64_t dgram_track(struct dgram_flows *flows_p, uint32_t flow, uint64_t seq)
+{
+    if ((flows_p->used + 1) * 2 > (flows_p->slots_p ? flows_p->mask + 1 : 0) && flows_grow(flows_p) != 0)
+        return 0;
+
+    struct dgram_flow *flow_p = flow_slot(flows_p->slots_p, flows_p->mask, flow);
+    if (flow_p->id == 0)
+    {
+        flow_p->id = flow;
+        flows_p->used++;
+    }
+
+    if (seq < flow_p->next)
+        return -1;
+
+    int64_t skipped = (int64_t)(seq - flow_p->next);
+    flow_p->next = seq + 1;
+    return skipped;
+}
+
+void dgram_flows_free(struct dgram_flows *flows_p)
+{
+    free(flows_p->slots_p);
+    flows_p->slots_p = NULL;
+    flows_p->mask    = 0;
+    flows_p->used    = 0;
+}
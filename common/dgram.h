@@ -0,0 +1,65 @@
+// COMMON - datagrams of the --udp mode
+//
+// Every datagram starts with a fixed 16-byte header, the rest is
+// padding up to the client's --msg-size:
+//
+//   +--------+--------+--------+--------+
+//   |              magic                |
+//   +--------+--------+--------+--------+
+//   |               flow                |
+//   +--------+--------+--------+--------+
+//   |          sequence number          |
+//   |             (64 bits)             |
+//   +--------+--------+--------+--------+
+//
+// All fields are in network byte order. The flow identifies the sending
+// socket (the client picks a random, non-zero base for each run) and its
+// datagrams are numbered from 0. UDP keeps no order and no count, so the
+// receiver keeps them: a struct dgram_flows follows, per flow, the next
+// number expected, which is enough to tell a datagram that skipped some
+// (lost, or only late) from one that comes after a later one (late).
+// Datagrams lost after the last one received are not seen.
+#ifndef DGRAM_H
+#define DGRAM_H
+
+#include <stdint.h>     /* uint32_t, uint64_t */
+#include <stddef.h>     /* size_t */
+
+#define DGRAM_MAGIC     0x44474d31      /* "DGM1" */
+#define DGRAM_HDR_SIZE  16
+#define DGRAM_MAX_SIZE  65507           /* UDP payload over IPv4 */
+#define DGRAM_MAX_SEGS  64              /* datagrams per UDP_SEGMENT send (UDP_MAX_SEGMENTS) */
+
+void dgram_hdr_write(void *dst_p, uint32_t flow, uint64_t seq);
+int  dgram_hdr_read(const void *src_p, size_t len, uint32_t *flow_p, uint64_t *seq_p);
+
+/**
+ * struct dgram_flow - what the receiver knows of one flow
+ * @id: the flow, 0 for a free slot
+ * @next: sequence number expected next
+ */
+struct dgram_flow
+{
+    uint32_t    id;
+    uint64_t    next;
+};
+
+/**
+ * struct dgram_flows - open-addressing table of the flows seen so far
+ * @slots_p: NULL until the first datagram
+ * @mask: number of slots - 1 (a power of two)
+ * @used: slots taken, kept under half of them
+ *
+ * Not thread-safe: each receiver owns its table.
+ */
+struct dgram_flows
+{
+    struct dgram_flow  *slots_p;
+    size_t              mask;
+    size_t              used;
+};
+
+int64_t dgram_track(struct dgram_flows *flows_p, uint32_t flow, uint64_t seq);
+void    dgram_flows_free(struct dgram_flows *flows_p);
+
+#endif /* DGRAM_H */
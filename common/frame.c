@@ -0,0 +1,191 @@
+// COMMON - length-prefixed message framing
+#include <stdlib.h>     /* malloc(), realloc(), free() */
+#include <string.h>     /* memcpy(), memmove() */
+#include <arpa/inet.h>  /* htonl(), ntohl() */
+
+#include "frame.h"
+#include "crc32c.h"
+
+#define FRAME_BUF_MIN   4096
+
+void frame_hdr_write(void *dst_p, uint16_t type, uint16_t flags, uint32_t seq, uint32_t len)
+{
+    char     *p       = dst_p;
+    uint32_t  len_n   = htonl(len);
+    uint16_t  type_n  = htons(type);
+    uint16_t  flags_n = htons(flags);
+    uint32_t  seq_n   = htonl(seq);
+
+    memcpy(p + 0,  &len_n,   sizeof(len_n));
+    memcpy(p + 4,  &type_n,  sizeof(type_n));
+    memcpy(p + 6,  &flags_n, sizeof(flags_n));
+    memcpy(p + 8,  &seq_n,   sizeof(seq_n));
+}
+
+/**
+ * frame_parse - parse the frame at the start of @data_p, in place
+ * @data_p: received bytes, no alignment required
+ * @len: number of bytes at @data_p
+ * @frame_p: filled in when a complete frame is found
+ *
+ * Return the size of the complete frame (header included), 0 if @len
+ * bytes are not enough, or -1 if the header is invalid. When 0 is
+ * returned and at least a header was available, @frame_p->len is set
+ * so that the caller knows how much is missing.
+ */
+ssize_t frame_parse(const char *data_p, size_t len, struct frame *frame_p)
+{
+    uint32_t len_n, seq_n;
+    uint16_t type_n, flags_n;
+
+    if (len < FRAME_HDR_SIZE)
+        return 0;
+
+    memcpy(&len_n,   data_p + 0, sizeof(len_n));
+    memcpy(&type_n,  data_p + 4, sizeof(type_n));
+    memcpy(&flags_n, data_p + 6, sizeof(flags_n));
+    memcpy(&seq_n,   data_p + 8, sizeof(seq_n));
+
+    frame_p->len   = ntohl(len_n);
+    frame_p->type  = ntohs(type_n);
+    frame_p->flags = ntohs(flags_n);
+    frame_p->seq   = ntohl(seq_n);
+
+    if (frame_p->len > FRAME_MAX_LEN || frame_p->type != FRAME_DATA ||
+        ((frame_p->flags & FRAME_F_CRC32C) && frame_p->len < CRC32C_SIZE))
+        return -1;
+
+    if (len - FRAME_HDR_SIZE < frame_p->len)
+        return 0;
+
+    frame_p->payload_p = data_p + FRAME_HDR_SIZE;
+
+    return FRAME_HDR_SIZE + frame_p->len;
+}
+
+/**
+ * frame_next - take the next complete frame out of a receive buffer
+ * @buf_p: the receive buffer
+ * @frame_p: view of the frame, valid until @buf_p is written to again
+ *
+ * Call in a loop after each read until it stops returning 1.
+ *
+ * Return 1 when a frame was found, 0 when more data is needed (see
+ * @buf_p->need), -1 on a protocol error.
+ */
+int frame_next(struct frame_buf *buf_p, struct frame *frame_p)
+{
+    ssize_t size = frame_parse(buf_p->data + buf_p->head, buf_p->tail - buf_p->head, frame_p);
+
+    if (size < 0)
+        return -1;
+
+    if (size == 0)
+    {
+        buf_p->need = buf_p->tail - buf_p->head < FRAME_HDR_SIZE ? FRAME_HDR_SIZE : FRAME_HDR_SIZE + frame_p->len;
+        return 0;
+    }
+
+    buf_p->head += size;
+    buf_p->need  = 0;
+    return 1;
+}
+
+/**
+ * frame_buf_reserve - make room for the next read
+ * @buf_p: the receive buffer
+ * @room: bytes wanted after @buf_p->tail
+ *
+ * The room is also made large enough for the frame being received to
+ * fit entirely. The unparsed bytes are moved to the start of the buffer
+ * only when that avoids growing it; an empty buffer is rewound for free.
+ *
+ * Return 0, or -1 if memory could not be allocated.
+ */
+int frame_buf_reserve(struct frame_buf *buf_p, size_t room)
+{
+    size_t pending = buf_p->tail - buf_p->head;
+
+    if (pending == 0)
+        buf_p->head = buf_p->tail = 0;
+
+    if (buf_p->need > pending && buf_p->need - pending > room)
+        room = buf_p->need - pending;
+
+    if (buf_p->size - buf_p->tail >= room)
+        return 0;
+
+    if (buf_p->head > 0)
+    {
+        memmove(buf_p->data, buf_p->data + buf_p->head, pending);
+        buf_p->head = 0;
+        buf_p->tail = pending;
+        if (buf_p->size - buf_p->tail >= room)
+            return 0;
+    }
+
+    if (!buf_p->data && buf_p->pool_p && buf_p->pool_p->obj_size >= room)
+    {
+        buf_p->data = pool_get(buf_p->pool_p);
+        if (buf_p->data)
+        {
+            buf_p->size   = buf_p->pool_p->obj_size;
+            buf_p->pooled = 1;
+            return 0;
+        }
+    }
+
+    size_t size = buf_p->size ? buf_p->size : FRAME_BUF_MIN;
+    while (size - pending < room)
+        size *= 2;
+
+    // Pool buffers cannot be resized: move to the heap.
+    char *data = buf_p->pooled ? malloc(size) : realloc(buf_p->data, size);
+    if (!data)
+        return -1;
+
+    if (buf_p->pooled)
+    {
+        memcpy(data, buf_p->data, buf_p->tail);
+        pool_put(buf_p->pool_p, buf_p->data);
+        buf_p->pooled = 0;
+    }
+
+    buf_p->data = data;
+    buf_p->size = size;
+    return 0;
+}
+
+/**
+ * frame_buf_release - give the storage back once everything was parsed
+ * @buf_p: the receive buffer
+ *
+ * A connection between frames then holds no buffer at all; the next
+ * frame_buf_reserve() borrows one again.
+ */
+void frame_buf_release(struct frame_buf *buf_p)
+{
+    if (!buf_p->data || buf_p->tail != buf_p->head)
+        return;
+
+    if (buf_p->pooled)
+        pool_put(buf_p->pool_p, buf_p->data);
+    else
+        free(buf_p->data);
+
+    buf_p->data   = NULL;
+    buf_p->size   = 0;
+    buf_p->head   = 0;
+    buf_p->tail   = 0;
+    buf_p->need   = 0;
+    buf_p->pooled = 0;
+}
+
+void frame_buf_free(struct frame_buf *buf_p)
+{
+    if (buf_p->pooled)
+        pool_put(buf_p->pool_p, buf_p->data);
+    else
+        free(buf_p->data);
+    memset(buf_p, 0, sizeof(*buf_p));
+}
@@ -0,0 +1,92 @@
+// COMMON - length-prefixed message framing
+//
+// Every message is a fixed 12-byte header followed by the payload:
+//
+//   +--------+--------+--------+--------+
+//   |          payload length           |
+//   +--------+--------+--------+--------+
+//   |      type       |      flags      |
+//   +--------+--------+--------+--------+
+//   |          sequence number          |
+//   +--------+--------+--------+--------+
+//   |  payload ...
+//
+// All fields are in network byte order. With FRAME_F_CRC32C the last
+// CRC32C_SIZE bytes of the payload are the CRC32C of the rest of it
+// (see crc32c.h), and belong to the payload as far as the length goes.
+// The receive side accumulates
+// bytes in a struct frame_buf and frame_next() hands out views into it
+// (struct frame): no payload is ever copied by the parser. A header or a
+// payload split across reads simply stays in the buffer until the rest
+// arrives, and one read holding many small frames is parsed in one go.
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>     /* uint32_t */
+#include <stddef.h>     /* size_t */
+#include <sys/types.h>  /* ssize_t */
+
+#include "pool.h"
+
+#define FRAME_HDR_SIZE  12
+#define FRAME_MAX_LEN   (16u << 20)     /* larger payloads are a protocol error */
+
+enum frame_type
+{
+    FRAME_DATA = 1,     /* opaque payload */
+};
+
+enum frame_flags
+{
+    FRAME_F_CRC32C = 0x0001,    /* the payload ends with its CRC32C (client --crc) */
+};
+
+/**
+ * struct frame - a parsed frame
+ * @len: payload length
+ * @type: enum frame_type
+ * @flags: enum frame_flags
+ * @seq: sender's sequence number
+ * @payload_p: points into the buffer that was parsed. Valid until that
+ *      buffer is written to again.
+ */
+struct frame
+{
+    uint32_t    len;
+    uint16_t    type;
+    uint16_t    flags;
+    uint32_t    seq;
+    const char *payload_p;
+};
+
+/**
+ * struct frame_buf - per-connection receive buffer
+ * @data: storage, NULL until the first frame_buf_reserve()
+ * @size: bytes allocated
+ * @head: first byte not parsed yet
+ * @tail: end of the received data; new data is read at @data + @tail
+ * @need: bytes the frame at @head needs to be complete (0 if unknown)
+ * @pool_p: optional pool of fixed-size buffers. The storage is borrowed
+ *      from it whenever it is large enough, and only falls back to
+ *      malloc() for frames that do not fit.
+ * @pooled: @data belongs to @pool_p
+ */
+struct frame_buf
+{
+    char        *data;
+    size_t       size;
+    size_t       head;
+    size_t       tail;
+    size_t       need;
+    struct pool *pool_p;
+    int          pooled;
+};
+
+void    frame_hdr_write(void *dst_p, uint16_t type, uint16_t flags, uint32_t seq, uint32_t len);
+ssize_t frame_parse(const char *data_p, size_t len, struct frame *frame_p);
+int     frame_next(struct frame_buf *buf_p, struct frame *frame_p);
+int     frame_buf_reserve(struct frame_buf *buf_p, size_t room);
+void    frame_buf_release(struct frame_buf *buf_p);
+void    frame_buf_free(struct frame_buf *buf_p);
+
+#endif /* FRAME_H */
@@ -0,0 +1,95 @@
+// COMMON - HDR-style log-bucketed latency histogram
+#include <stdio.h>      /* printf() */
+#include <string.h>     /* memset() */
+
+#include "histogram.h"
+
+void hist_init(struct histogram *hist_p)
+{
+    memset(hist_p, 0, sizeof(*hist_p));
+    hist_p->min = UINT64_MAX;
+}
+
+void hist_merge(struct histogram *dst_p, const struct histogram *src_p)
+{
+    for (unsigned i = 0; i < HIST_BUCKETS; i++)
+        dst_p->counts[i] += src_p->counts[i];
+
+    dst_p->count += src_p->count;
+    dst_p->sum   += src_p->sum;
+    if (src_p->min < dst_p->min) dst_p->min = src_p->min;
+    if (src_p->max > dst_p->max) dst_p->max = src_p->max;
+}
+
+/* Highest value that falls in the same bucket as index @idx */
+static uint64_t hist_value(unsigned idx)
+{
+    unsigned bucket = idx >> HIST_SUB_BITS;
+    uint64_t sub    = idx & (HIST_SUB_BUCKETS - 1);
+
+    if (bucket == 0)
+        return sub;
+
+    unsigned shift = bucket - 1;
+    return ((HIST_SUB_BUCKETS + sub) << shift) + ((1ull << shift) - 1);
+}
+
+/**
+ * hist_percentile - value below which @percentile % of the samples fall
+ * @hist_p: the histogram
+ * @percentile: 0.0 to 100.0
+ *
+ * Return 0 for an empty histogram. The result never exceeds the
+ * largest recorded value.
+ */
+uint64_t hist_percentile(const struct histogram *hist_p, double percentile)
+{
+    if (hist_p->count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)hist_p->count + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > hist_p->count) rank = hist_p->count;
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += hist_p->counts[i];
+        if (seen >= rank)
+        {
+            uint64_t value = hist_value(i);
+            return value > hist_p->max ? hist_p->max : value;
+        }
+    }
+
+    return hist_p->max;
+}
+
+void hist_print_header(const char *label_p)
+{
+    printf("%-24s %10s %10s %10s %10s %10s %10s %10s\n",
+           label_p, "count", "min", "p50", "p90", "p99", "p99.9", "max");
+}
+
+/**
+ * hist_print - print one line of latency percentiles in microseconds
+ * @hist_p: histogram of nanosecond samples
+ * @label_p: row label
+ */
+void hist_print(const struct histogram *hist_p, const char *label_p)
+{
+    if (hist_p->count == 0)
+    {
+        printf("%-24s %10d %10s %10s %10s %10s %10s %10s\n", label_p, 0, "-", "-", "-", "-", "-", "-");
+        return;
+    }
+
+    printf("%-24s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+           label_p, (unsigned long long)hist_p->count,
+           hist_p->min / 1e3,
+           hist_percentile(hist_p, 50.0) / 1e3,
+           hist_percentile(hist_p, 90.0) / 1e3,
+           hist_percentile(hist_p, 99.0) / 1e3,
+           hist_percentile(hist_p, 99.9) / 1e3,
+           hist_p->max / 1e3);
+}
@@ -0,0 +1,52 @@
+// COMMON - HDR-style log-bucketed latency histogram
+//
+// Values are grouped by power of two, and every power of two is split
+// into HIST_SUB_BUCKETS linear sub-buckets. Recording is O(1) (one
+// count-leading-zeros and one increment) and the relative error of any
+// reported percentile is below 1 / HIST_SUB_BUCKETS (~3%), from 1 ns up
+// to the full 64-bit range.
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>     /* uint64_t */
+
+#define HIST_SUB_BITS       5
+#define HIST_SUB_BUCKETS    (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS        ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+struct histogram
+{
+    uint64_t    count;
+    uint64_t    min;
+    uint64_t    max;
+    uint64_t    sum;
+    uint64_t    counts[HIST_BUCKETS];
+};
+
+void     hist_init(struct histogram *hist_p);
+void     hist_merge(struct histogram *dst_p, const struct histogram *src_p);
+uint64_t hist_percentile(const struct histogram *hist_p, double percentile);
+void     hist_print_header(const char *label_p);
+void     hist_print(const struct histogram *hist_p, const char *label_p);
+
+static inline unsigned hist_index(uint64_t value)
+{
+    if (value < HIST_SUB_BUCKETS)
+        return (unsigned)value;
+
+    unsigned msb   = 63 - __builtin_clzll(value);
+    unsigned shift = msb - HIST_SUB_BITS;
+
+    return ((shift + 1) << HIST_SUB_BITS) + (unsigned)((value >> shift) & (HIST_SUB_BUCKETS - 1));
+}
+
+static inline void hist_record(struct histogram *hist_p, uint64_t value)
+{
+    hist_p->counts[hist_index(value)]++;
+    hist_p->count++;
+    hist_p->sum += value;
+    if (value < hist_p->min) hist_p->min = value;
+    if (value > hist_p->max) hist_p->max = value;
+}
+
+#endif /* HISTOGRAM_H */
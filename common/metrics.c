@@ -0,0 +1,181 @@
+// COMMON - Prometheus-style text export of per-thread counters
+#include <stdio.h>      /* fopen(), fprintf(), rename() */
+#include <stdlib.h>     /* malloc(), free() */
+#include <string.h>     /* strlen() */
+#include <unistd.h>     /* unlink(), sysconf() */
+#include <sys/resource.h> /* getrusage() */
+
+#include "metrics.h"
+
+static char *tmp_path(const char *path_p)
+{
+    size_t len   = strlen(path_p);
+    char  *tmp_p = malloc(len + sizeof(".tmp"));
+    if (tmp_p)
+    {
+        memcpy(tmp_p, path_p, len);
+        memcpy(tmp_p + len, ".tmp", sizeof(".tmp"));
+    }
+    return tmp_p;
+}
+
+/**
+ * metrics_open - start a new snapshot of the stats file @path_p
+ *
+ * Return the stream to write the snapshot to, or NULL (errno is set).
+ */
+FILE *metrics_open(const char *path_p)
+{
+    char *tmp_p = tmp_path(path_p);
+    if (!tmp_p)
+        return NULL;
+
+    FILE *fp = fopen(tmp_p, "w");
+    free(tmp_p);
+    return fp;
+}
+
+/**
+ * metrics_close - publish the snapshot started by metrics_open()
+ *
+ * Return 0, or -1 if the snapshot could not be written (errno is set).
+ * The previous snapshot is left in place then.
+ */
+int metrics_close(FILE *fp, const char *path_p)
+{
+    char *tmp_p = tmp_path(path_p);
+    int   rc    = ferror(fp) ? -1 : 0;
+
+    if (fclose(fp) != 0)
+        rc = -1;
+
+    if (!tmp_p)
+        return -1;
+
+    if (rc == 0)
+        rc = rename(tmp_p, path_p);
+    else
+        unlink(tmp_p);
+
+    free(tmp_p);
+    return rc;
+}
+
+/**
+ * metrics_write - write one series per thread for every counter of @descs_p
+ * @fp: stream returned by metrics_open()
+ * @descs_p: the counters to export
+ * @ndescs: number of entries in @descs_p
+ * @label_p: name of the label that tells the threads apart, e.g. "worker"
+ * @first_p: per-thread structure of thread 0
+ * @stride: bytes from one thread's structure to the next
+ * @nthreads: number of threads
+ */
+void metrics_write(FILE *fp, const struct metric_desc *descs_p, size_t ndescs, const char *label_p,
+                   const void *first_p, size_t stride, int nthreads)
+{
+    for (size_t d = 0; d < ndescs; d++)
+    {
+        fprintf(fp, "# HELP %s %s\n", descs_p[d].name_p, descs_p[d].help_p);
+        fprintf(fp, "# TYPE %s %s\n", descs_p[d].name_p, descs_p[d].type_p);
+
+        for (int i = 0; i < nthreads; i++)
+        {
+            const char *base_p = (const char *)first_p + (size_t)i * stride;
+            fprintf(fp, "%s{%s=\"%d\"} %llu\n", descs_p[d].name_p, label_p, i,
+                    (unsigned long long)metrics_load((const uint64_t *)(base_p + descs_p[d].offset)));
+        }
+    }
+}
+
+/**
+ * metrics_write_summary - write the per-thread histograms as one summary
+ * @fp: stream returned by metrics_open()
+ * @name_p: metric name, e.g. "client_rtt_seconds"
+ * @help_p: one-line description
+ * @first_p: histogram of thread 0, possibly still being recorded into
+ * @stride: bytes from one thread's histogram to the next
+ * @nthreads: number of threads
+ * @scale: multiplier from recorded values to exported ones, e.g. 1e-9
+ *      for nanoseconds exported as seconds
+ *
+ * The total count is recomputed from the buckets so that the quantiles
+ * stay consistent with them even if the histograms change while they
+ * are read.
+ */
+void metrics_write_summary(FILE *fp, const char *name_p, const char *help_p,
+                           const struct histogram *first_p, size_t stride, int nthreads, double scale)
+{
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    struct histogram    snap;
+
+    hist_init(&snap);
+    for (int t = 0; t < nthreads; t++)
+    {
+        const struct histogram *hist_p = (const void *)((const char *)first_p + (size_t)t * stride);
+        uint64_t                max    = metrics_load(&hist_p->max);
+
+        for (unsigned i = 0; i < HIST_BUCKETS; i++)
+        {
+            uint64_t n = metrics_load(&hist_p->counts[i]);
+            snap.counts[i] += n;
+            snap.count     += n;
+        }
+        snap.sum += metrics_load(&hist_p->sum);
+        if (max > snap.max) snap.max = max;
+    }
+
+    fprintf(fp, "# HELP %s %s\n", name_p, help_p);
+    fprintf(fp, "# TYPE %s summary\n", name_p);
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+        fprintf(fp, "%s{quantile=\"%g\"} %.9g\n", name_p, quantiles[q],
+                hist_percentile(&snap, quantiles[q] * 100.0) * scale);
+    fprintf(fp, "%s_sum %.9g\n", name_p, snap.sum * scale);
+    fprintf(fp, "%s_count %llu\n", name_p, (unsigned long long)snap.count);
+}
+
+/**
+ * metrics_rss_bytes - resident set size of the process, in bytes (0 if unknown)
+ */
+size_t metrics_rss_bytes(void)
+{
+    unsigned long size, resident = 0;
+    FILE         *fp = fopen("/proc/self/statm", "r");
+
+    if (fp)
+    {
+        if (fscanf(fp, "%lu %lu", &size, &resident) != 2)
+            resident = 0;
+        fclose(fp);
+    }
+
+    return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * metrics_write_process - write the CPU time and memory of the whole process
+ * @fp: stream returned by metrics_open()
+ *
+ * These are the names the Prometheus client libraries use, so the usual
+ * dashboards work, and a benchmark can tell the cost of a run from the
+ * last snapshot alone.
+ */
+void metrics_write_process(FILE *fp)
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return;
+
+    fprintf(fp, "# HELP process_cpu_seconds_total User and system CPU time spent\n");
+    fprintf(fp, "# TYPE process_cpu_seconds_total counter\n");
+    fprintf(fp, "process_cpu_seconds_total %.6f\n",
+            usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+            usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6);
+    fprintf(fp, "# HELP process_resident_memory_bytes Resident memory size\n");
+    fprintf(fp, "# TYPE process_resident_memory_bytes gauge\n");
+    fprintf(fp, "process_resident_memory_bytes %zu\n", metrics_rss_bytes());
+    fprintf(fp, "# HELP process_resident_memory_max_bytes Peak resident memory size\n");
+    fprintf(fp, "# TYPE process_resident_memory_max_bytes gauge\n");
+    fprintf(fp, "process_resident_memory_max_bytes %llu\n", (unsigned long long)usage.ru_maxrss * 1024);
+}
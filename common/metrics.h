@@ -0,0 +1,53 @@
+// COMMON - Prometheus-style text export of per-thread counters
+//
+// Every event loop thread keeps its counters in a private structure,
+// aligned on a cache line so that two threads never write to the same
+// line. Only the owning thread writes them. Another thread (the one
+// that writes the stats file) reads each counter with a relaxed atomic
+// load: every value is whole, but a snapshot is not consistent across
+// counters, which is fine for monitoring.
+//
+// The file is written next to its final name and renamed over it, so a
+// reader (cat, watch, or the node_exporter textfile collector) always
+// sees a complete snapshot.
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>      /* FILE */
+#include <stddef.h>     /* size_t, offsetof() */
+#include <stdint.h>     /* uint64_t */
+
+#include "histogram.h"
+
+#define CACHE_LINE  64
+
+/**
+ * struct metric_desc - one uint64_t counter of a per-thread structure
+ * @name_p: metric name, e.g. "server_bytes_in_total"
+ * @type_p: "counter" or "gauge"
+ * @help_p: one-line description
+ * @offset: offsetof() the counter in the per-thread structure
+ */
+struct metric_desc
+{
+    const char *name_p;
+    const char *type_p;
+    const char *help_p;
+    size_t      offset;
+};
+
+FILE  *metrics_open(const char *path_p);
+int    metrics_close(FILE *fp, const char *path_p);
+void   metrics_write(FILE *fp, const struct metric_desc *descs_p, size_t ndescs, const char *label_p,
+                     const void *first_p, size_t stride, int nthreads);
+void   metrics_write_summary(FILE *fp, const char *name_p, const char *help_p,
+                             const struct histogram *first_p, size_t stride, int nthreads, double scale);
+void   metrics_write_process(FILE *fp);
+size_t metrics_rss_bytes(void);
+
+static inline uint64_t metrics_load(const uint64_t *counter_p)
+{
+    return __atomic_load_n(counter_p, __ATOMIC_RELAXED);
+}
+
+#endif /* METRICS_H */
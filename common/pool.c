@@ -0,0 +1,93 @@
+// COMMON - fixed-size object pool (slab allocator)
+#include <stdlib.h>     /* realloc(), free() */
+#include <string.h>     /* memset() */
+#include <sys/mman.h>   /* mmap(), munmap() */
+
+#include "pool.h"
+
+/**
+ * pool_init - set up an empty pool
+ * @pool_p: the pool
+ * @obj_size: size of each object
+ * @slab_size: bytes mapped at a time, 0 for POOL_SLAB_SIZE. Rounded up
+ *      so that a slab holds at least one object.
+ * @max: most objects handed out at once, 0 for no limit
+ */
+void pool_init(struct pool *pool_p, size_t obj_size, size_t slab_size, size_t max)
+{
+    memset(pool_p, 0, sizeof(*pool_p));
+
+    pool_p->obj_size = (obj_size + 15) & ~(size_t)15;
+    if (slab_size == 0)
+        slab_size = POOL_SLAB_SIZE;
+    if (slab_size < pool_p->obj_size)
+        slab_size = pool_p->obj_size;
+    pool_p->slab_size = slab_size - slab_size % pool_p->obj_size;
+    pool_p->max       = max;
+}
+
+static int pool_grow(struct pool *pool_p)
+{
+    void **slabs = realloc(pool_p->slabs, (pool_p->nslabs + 1) * sizeof(*slabs));
+    if (!slabs)
+        return -1;
+    pool_p->slabs = slabs;
+
+    char *slab_p = mmap(NULL, pool_p->slab_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slab_p == MAP_FAILED)
+        return -1;
+
+    pool_p->slabs[pool_p->nslabs++] = slab_p;
+    pool_p->bump_p   = slab_p;
+    pool_p->bump_end = slab_p + pool_p->slab_size;
+
+    return 0;
+}
+
+/**
+ * pool_get - take an object out of the pool
+ *
+ * Recently returned objects are handed out first, while they are still
+ * warm in the cache. The object is not cleared.
+ *
+ * Return the object, or NULL if the pool is at its limit or out of memory.
+ */
+void *pool_get(struct pool *pool_p)
+{
+    void *obj_p;
+
+    if (pool_p->max && pool_p->in_use >= pool_p->max)
+        return NULL;
+
+    if (pool_p->free_p)
+    {
+        obj_p = pool_p->free_p;
+        pool_p->free_p = *(void **)obj_p;
+    }
+    else
+    {
+        if (pool_p->bump_p == pool_p->bump_end && pool_grow(pool_p) != 0)
+            return NULL;
+        obj_p = pool_p->bump_p;
+        pool_p->bump_p += pool_p->obj_size;
+    }
+
+    pool_p->in_use++;
+    return obj_p;
+}
+
+void pool_put(struct pool *pool_p, void *obj_p)
+{
+    *(void **)obj_p = pool_p->free_p;
+    pool_p->free_p  = obj_p;
+    pool_p->in_use--;
+}
+
+/* Every object is released at once, whether it was returned or not. */
+void pool_destroy(struct pool *pool_p)
+{
+    for (size_t i = 0; i < pool_p->nslabs; i++)
+        munmap(pool_p->slabs[i], pool_p->slab_size);
+    free(pool_p->slabs);
+    memset(pool_p, 0, sizeof(*pool_p));
+}
@@ -0,0 +1,47 @@
+// COMMON - fixed-size object pool (slab allocator)
+//
+// Objects are carved out of large anonymous mappings ("slabs") and
+// recycled through an intrusive free list, so once a pool has grown to
+// its working size getting and putting an object never calls malloc().
+// Slabs are carved lazily, so untouched objects cost no resident memory,
+// and they are only unmapped by pool_destroy().
+//
+// A pool is not thread-safe: each event loop owns its pools.
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>     /* size_t */
+
+#define POOL_SLAB_SIZE  (1u << 20)      /* default slab size */
+
+/**
+ * struct pool - a pool of objects of one size
+ * @obj_size: object size, rounded up to a multiple of 16 bytes
+ * @slab_size: bytes per slab, a multiple of @obj_size
+ * @max: most objects handed out at once, 0 for no limit
+ * @free_p: free list, linked through the first word of each object
+ * @bump_p: next object never handed out in the current slab
+ * @bump_end: end of the current slab
+ * @slabs: every slab mapped so far
+ * @nslabs: number of entries in @slabs
+ * @in_use: objects currently handed out
+ */
+struct pool
+{
+    size_t      obj_size;
+    size_t      slab_size;
+    size_t      max;
+    void       *free_p;
+    char       *bump_p;
+    char       *bump_end;
+    void      **slabs;
+    size_t      nslabs;
+    size_t      in_use;
+};
+
+void  pool_init(struct pool *pool_p, size_t obj_size, size_t slab_size, size_t max);
+void *pool_get(struct pool *pool_p);
+void  pool_put(struct pool *pool_p, void *obj_p);
+void  pool_destroy(struct pool *pool_p);
+
+#endif /* POOL_H */
@@ -0,0 +1,443 @@
+// COMMON - shared-memory SPSC byte rings with eventfd doorbells
+#define _GNU_SOURCE
+#include <stdlib.h>     /* calloc(), free() */
+#include <string.h>     /* memcpy() */
+#include <unistd.h>     /* close(), ftruncate() */
+#include <errno.h>      /* errno, EAGAIN, EPROTO */
+#include <poll.h>       /* poll() */
+#include <sys/mman.h>   /* memfd_create(), mmap(), munmap() */
+#include <sys/stat.h>   /* fstat() */
+#include <sys/socket.h> /* send(), recv() */
+#include <sys/eventfd.h>/* eventfd() */
+
+#include "shmring.h"
+#include "unixsock.h"
+
+#define SHM_LINE        64      /* cache line */
+#define SHM_CTL_SIZE    4096    /* the page that holds both control blocks */
+
+/**
+ * struct shm_ring_ctl - shared indexes of one ring
+ * @head: bytes consumed so far, written by the consumer only
+ * @tail: bytes produced so far, written by the producer only
+ * @consumer_waiting: set by a consumer about to sleep on an empty ring
+ * @producer_waiting: set by a producer about to sleep on a full ring
+ *
+ * Each index has a cache line of its own so that the two sides do not
+ * keep stealing the same line from each other.
+ */
+struct shm_ring_ctl
+{
+    uint64_t head __attribute__((aligned(SHM_LINE)));
+    uint64_t tail __attribute__((aligned(SHM_LINE)));
+    uint32_t consumer_waiting __attribute__((aligned(SHM_LINE)));
+    uint32_t producer_waiting;
+};
+
+/* Layout: [c2s ctl, s2c ctl][c2s data][s2c data] */
+static void shm_layout(struct shm_chan *chan_p, int server)
+{
+    char                *base_p = chan_p->map_p;
+    struct shm_ring_ctl *c2s_p  = (struct shm_ring_ctl *)base_p;
+    struct shm_ring_ctl *s2c_p  = c2s_p + 1;
+    char                *c2s_data_p = base_p + SHM_CTL_SIZE;
+    char                *s2c_data_p = c2s_data_p + chan_p->size;
+
+    chan_p->tx_p      = server ? s2c_p : c2s_p;
+    chan_p->rx_p      = server ? c2s_p : s2c_p;
+    chan_p->tx_data_p = server ? s2c_data_p : c2s_data_p;
+    chan_p->rx_data_p = server ? c2s_data_p : s2c_data_p;
+}
+
+static int shm_size_ok(size_t size)
+{
+    return size >= SHM_SIZE_MIN && size <= SHM_SIZE_MAX && (size & (size - 1)) == 0;
+}
+
+/**
+ * shm_offer - set up a channel and offer it to the server (client side)
+ * @sock: connected AF_UNIX stream socket, with nothing sent on it yet
+ * @size: bytes in each ring, a power of two
+ * @timeout_msec: how long to wait for the server's answer
+ *
+ * Return the channel, or NULL with errno set. A server that does not
+ * take the offer (an older one, or one that does not use epoll) either
+ * never answers (ETIMEDOUT) or echoes the offer back (EPROTO).
+ */
+struct shm_chan *shm_offer(int sock, size_t size, int timeout_msec)
+{
+    struct shm_chan *chan_p = calloc(1, sizeof(*chan_p));
+    int              fds[3] = { -1, -1, -1 };
+    int              err;
+
+    if (!chan_p)
+        return NULL;
+    chan_p->wait_fd = chan_p->bell_fd = -1;
+
+    if (!shm_size_ok(size))
+    {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    chan_p->size     = size;
+    chan_p->map_size = SHM_CTL_SIZE + 2 * size;
+
+    fds[0] = memfd_create("echo-shm", MFD_CLOEXEC);
+    if (fds[0] < 0 || ftruncate(fds[0], chan_p->map_size) < 0)
+        goto fail;
+
+    chan_p->map_p = mmap(NULL, chan_p->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    if (chan_p->map_p == MAP_FAILED)
+    {
+        chan_p->map_p = NULL;
+        goto fail;
+    }
+    shm_layout(chan_p, 0);
+
+    // Neither side has looked at its ring yet: the first bytes must wake it.
+    chan_p->tx_p->consumer_waiting = 1;
+    chan_p->rx_p->consumer_waiting = 1;
+
+    fds[1] = chan_p->wait_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fds[2] = chan_p->bell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds[1] < 0 || fds[2] < 0)
+        goto fail;
+
+    struct shm_hello hello = { .magic = SHM_MAGIC, .size = size };
+    if (unix_send_fds(sock, &hello, sizeof(hello), fds, 3) != sizeof(hello))
+        goto fail;
+    close(fds[0]);
+    fds[0] = -1;
+
+    struct pollfd pfd = { .fd = sock, .events = POLLIN };
+    int           rc  = poll(&pfd, 1, timeout_msec);
+    if (rc <= 0)
+    {
+        if (rc == 0)
+            errno = ETIMEDOUT;
+        goto fail;
+    }
+
+    uint32_t ack;
+    ssize_t  n = recv(sock, &ack, sizeof(ack), MSG_WAITALL);
+    if (n != sizeof(ack) || ack != SHM_ACK)
+    {
+        if (n >= 0)
+            errno = EPROTO;
+        goto fail;
+    }
+
+    return chan_p;
+
+fail:
+    err = errno;
+    if (fds[0] >= 0)
+        close(fds[0]);
+    shm_free(chan_p);
+    errno = err;
+    return NULL;
+}
+
+/**
+ * shm_accept - map a channel offered by a client and answer (server side)
+ * @sock: the client's socket
+ * @hello_p: the offer
+ * @fds: the descriptors that came with it, all consumed by this call
+ *
+ * Return the channel, or NULL with errno set.
+ */
+struct shm_chan *shm_accept(int sock, const struct shm_hello *hello_p, const int fds[3])
+{
+    struct shm_chan *chan_p = calloc(1, sizeof(*chan_p));
+    struct stat      st;
+    int              err;
+
+    if (!chan_p)
+    {
+        err = errno;
+        for (int i = 0; i < 3; i++)
+            close(fds[i]);
+        errno = err;
+        return NULL;
+    }
+
+    chan_p->size     = hello_p->size;
+    chan_p->map_size = SHM_CTL_SIZE + 2 * (size_t)hello_p->size;
+    chan_p->wait_fd  = fds[2];
+    chan_p->bell_fd  = fds[1];
+
+    if (hello_p->magic != SHM_MAGIC || !shm_size_ok(hello_p->size))
+    {
+        errno = EPROTO;
+        goto fail;
+    }
+
+    if (fstat(fds[0], &st) < 0)
+        goto fail;
+    if ((size_t)st.st_size < chan_p->map_size)
+    {
+        errno = EPROTO;
+        goto fail;
+    }
+
+    chan_p->map_p = mmap(NULL, chan_p->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    if (chan_p->map_p == MAP_FAILED)
+    {
+        chan_p->map_p = NULL;
+        goto fail;
+    }
+    shm_layout(chan_p, 1);
+    close(fds[0]);
+
+    uint32_t ack = SHM_ACK;
+    if (send(sock, &ack, sizeof(ack), MSG_NOSIGNAL) != sizeof(ack))
+    {
+        err = errno;
+        shm_free(chan_p);
+        errno = err;
+        return NULL;
+    }
+
+    return chan_p;
+
+fail:
+    err = errno;
+    close(fds[0]);
+    shm_free(chan_p);
+    errno = err;
+    return NULL;
+}
+
+/**
+ * shm_free - unmap a channel and close its doorbells
+ */
+void shm_free(struct shm_chan *chan_p)
+{
+    if (!chan_p)
+        return;
+
+    if (chan_p->map_p)
+        munmap(chan_p->map_p, chan_p->map_size);
+    if (chan_p->wait_fd >= 0)
+        close(chan_p->wait_fd);
+    if (chan_p->bell_fd >= 0)
+        close(chan_p->bell_fd);
+    free(chan_p);
+}
+
+// =============================================================================
+// Doorbells
+
+/* Raise *flag_p, and keep it raised only if *index_p is still @seen. */
+static int shm_park(uint32_t *flag_p, const uint64_t *index_p, uint64_t seen)
+{
+    __atomic_store_n(flag_p, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(index_p, __ATOMIC_ACQUIRE) == seen)
+        return 1;
+
+    __atomic_store_n(flag_p, 0, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Note that the peer parked on *flag_p must be woken. Call after moving an index. */
+static void shm_notify(struct shm_chan *chan_p, uint32_t *flag_p)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(flag_p, __ATOMIC_RELAXED) && __atomic_exchange_n(flag_p, 0, __ATOMIC_RELAXED))
+        chan_p->bell_pending = 1;
+}
+
+/**
+ * shm_flush - ring the peer's doorbell if a shm_send() or shm_consume()
+ *      found it asleep
+ *
+ * Call once after a batch: ringing on every message would hand the CPU
+ * to the peer after each one when both sides share a core.
+ */
+void shm_flush(struct shm_chan *chan_p)
+{
+    if (!chan_p->bell_pending)
+        return;
+
+    chan_p->bell_pending = 0;
+    eventfd_write(chan_p->bell_fd, 1);
+    chan_p->bells++;
+}
+
+/**
+ * shm_drain - reset this side's doorbell after epoll reported it
+ */
+void shm_drain(struct shm_chan *chan_p)
+{
+    eventfd_t value;
+    eventfd_read(chan_p->wait_fd, &value);
+}
+
+/**
+ * shm_kick - ring this side's own doorbell, to come back to the channel
+ *      on the next pass of the event loop
+ */
+void shm_kick(struct shm_chan *chan_p)
+{
+    eventfd_write(chan_p->wait_fd, 1);
+}
+
+/* Bytes between @head and @tail, or -1 (EPROTO) if the peer set them apart by more than a ring. */
+static ssize_t shm_used(const struct shm_chan *chan_p, uint64_t head, uint64_t tail)
+{
+    if (tail - head > chan_p->size)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+    return (ssize_t)(tail - head);
+}
+
+// =============================================================================
+// Producer
+
+/**
+ * shm_room - free bytes in the ring this side produces into
+ * @want: bytes the caller needs to make progress
+ *
+ * If fewer than @want bytes are free, the peer is asked to ring our
+ * doorbell once it has consumed some.
+ *
+ * Return the number of free bytes, or -1 with errno set to EPROTO if the
+ * indexes are corrupt.
+ */
+ssize_t shm_room(struct shm_chan *chan_p, size_t want)
+{
+    struct shm_ring_ctl *ctl_p = chan_p->tx_p;
+    uint64_t             tail  = __atomic_load_n(&ctl_p->tail, __ATOMIC_RELAXED);
+
+    for (;;)
+    {
+        uint64_t head = __atomic_load_n(&ctl_p->head, __ATOMIC_ACQUIRE);
+        ssize_t  used = shm_used(chan_p, head, tail);
+        if (used < 0)
+            return -1;
+
+        size_t room = chan_p->size - (size_t)used;
+        if (room >= want || shm_park(&ctl_p->producer_waiting, &ctl_p->head, head))
+            return room;
+    }
+}
+
+/**
+ * shm_send - copy as much of @data_p as fits into the ring
+ *
+ * Return the number of bytes copied, or -1 with errno set to EAGAIN if
+ * the ring is full (the doorbell rings when it is not anymore), or to
+ * EPROTO if its indexes are corrupt.
+ */
+ssize_t shm_send(struct shm_chan *chan_p, const void *data_p, size_t len)
+{
+    struct shm_ring_ctl *ctl_p = chan_p->tx_p;
+    uint64_t             tail  = __atomic_load_n(&ctl_p->tail, __ATOMIC_RELAXED);
+    ssize_t              room  = shm_room(chan_p, 1);
+
+    if (room <= 0)
+    {
+        if (room == 0)
+            errno = EAGAIN;
+        return -1;
+    }
+
+    size_t n     = len < (size_t)room ? len : (size_t)room;
+    size_t off   = tail & (chan_p->size - 1);
+    size_t first = n < chan_p->size - off ? n : chan_p->size - off;
+
+    memcpy(chan_p->tx_data_p + off, data_p, first);
+    memcpy(chan_p->tx_data_p, (const char *)data_p + first, n - first);
+    __atomic_store_n(&ctl_p->tail, tail + n, __ATOMIC_RELEASE);
+
+    shm_notify(chan_p, &ctl_p->consumer_waiting);
+    return n;
+}
+
+// =============================================================================
+// Consumer
+
+/**
+ * shm_peek - look at the bytes waiting in the ring this side consumes
+ * @data_pp: where to store the address of the first one
+ *
+ * Return how many contiguous bytes are at *@data_pp, 0 if the ring is
+ * empty (the doorbell rings when it is not anymore), or -1 with errno
+ * set to EPROTO if its indexes are corrupt. Nothing is consumed until
+ * shm_consume().
+ */
+ssize_t shm_peek(struct shm_chan *chan_p, const char **data_pp)
+{
+    struct shm_ring_ctl *ctl_p = chan_p->rx_p;
+    uint64_t             head  = __atomic_load_n(&ctl_p->head, __ATOMIC_RELAXED);
+    uint64_t             tail  = __atomic_load_n(&ctl_p->tail, __ATOMIC_ACQUIRE);
+
+    if (tail == head)
+    {
+        if (shm_park(&ctl_p->consumer_waiting, &ctl_p->tail, tail))
+            return 0;
+        tail = __atomic_load_n(&ctl_p->tail, __ATOMIC_ACQUIRE);
+    }
+
+    ssize_t used = shm_used(chan_p, head, tail);
+    if (used < 0)
+        return -1;
+
+    size_t off = head & (chan_p->size - 1);
+    size_t n   = (size_t)used;
+
+    *data_pp = chan_p->rx_data_p + off;
+    return n < chan_p->size - off ? n : chan_p->size - off;
+}
+
+/**
+ * shm_consume - release @n bytes returned by shm_peek()
+ */
+void shm_consume(struct shm_chan *chan_p, size_t n)
+{
+    struct shm_ring_ctl *ctl_p = chan_p->rx_p;
+
+    __atomic_store_n(&ctl_p->head, ctl_p->head + n, __ATOMIC_RELEASE);
+    shm_notify(chan_p, &ctl_p->producer_waiting);
+}
+
+/**
+ * shm_recv - copy up to @len bytes out of the ring
+ *
+ * Return the number of bytes copied, or -1 with errno set to EAGAIN if
+ * the ring is empty, or to EPROTO if its indexes are corrupt. Unless
+ * @len bytes were copied, the ring was found empty and the doorbell
+ * rings when it is not anymore.
+ */
+ssize_t shm_recv(struct shm_chan *chan_p, void *buf_p, size_t len)
+{
+    size_t done = 0;
+
+    // Until the ring is found empty, so that the doorbell is armed.
+    while (done < len)
+    {
+        const char *data_p;
+        ssize_t     n = shm_peek(chan_p, &data_p);
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        if ((size_t)n > len - done)
+            n = len - done;
+
+        memcpy((char *)buf_p + done, data_p, n);
+        shm_consume(chan_p, n);
+        done += n;
+    }
+
+    if (done == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    return done;
+}
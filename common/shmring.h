@@ -0,0 +1,89 @@
+// COMMON - shared-memory SPSC byte rings with eventfd doorbells
+//
+// A channel is two single-producer single-consumer byte rings in one
+// memfd, one per direction. The client creates them and offers them
+// over an established Unix-domain connection, together with two
+// eventfds: one each side waits on. From then on the echo traffic
+// goes through the rings and never enters the kernel, except to ring a
+// doorbell.
+//
+// A doorbell is only rung when the peer said it is about to sleep:
+// a consumer that finds its ring empty (or a producer that finds it
+// full) raises its "waiting" flag, fences, and checks again before it
+// goes back to epoll_wait(). The other side fences after moving its
+// index and rings if it sees the flag. One of them always sees the
+// other, so no wake-up is lost and a busy channel makes no syscall.
+// The bell itself is rung by shm_flush(), once per batch of messages.
+//
+// The indexes live in memory the peer can write: neither side trusts
+// them. Rings whose indexes are more than a ring apart are reported as
+// EPROTO, and the channel must then be closed.
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stddef.h>     /* size_t */
+#include <stdint.h>     /* uint32_t, uint64_t */
+#include <sys/types.h>  /* ssize_t */
+
+#define SHM_MAGIC           0x314d4853  /* "SHM1" on little-endian */
+#define SHM_ACK             0x414d4853  /* "SHMA": not an echo of the offer */
+#define SHM_SIZE_DEFAULT    (1 << 20)   /* bytes per direction */
+#define SHM_SIZE_MIN        (1 << 12)
+#define SHM_SIZE_MAX        (1 << 30)
+
+/**
+ * struct shm_hello - offer sent by the client, with SCM_RIGHTS carrying
+ *      [memfd, client doorbell, server doorbell]. The server answers
+ *      with SHM_ACK alone once it has mapped the rings.
+ */
+struct shm_hello
+{
+    uint32_t magic;
+    uint32_t size;
+};
+
+struct shm_ring_ctl;
+
+/**
+ * struct shm_chan - one side's view of a channel
+ * @map_p: the whole shared mapping
+ * @map_size: its size
+ * @size: bytes in each ring, a power of two
+ * @tx_p: control block of the ring this side produces into
+ * @rx_p: control block of the ring this side consumes from
+ * @tx_data_p: data area of @tx_p
+ * @rx_data_p: data area of @rx_p
+ * @wait_fd: eventfd this side waits on
+ * @bell_fd: eventfd the peer waits on
+ * @bell_pending: the peer must be woken at the next shm_flush()
+ * @bells: doorbells rung by this side
+ */
+struct shm_chan
+{
+    void                *map_p;
+    size_t               map_size;
+    size_t               size;
+    struct shm_ring_ctl *tx_p;
+    struct shm_ring_ctl *rx_p;
+    char                *tx_data_p;
+    char                *rx_data_p;
+    int                  wait_fd;
+    int                  bell_fd;
+    int                  bell_pending;
+    uint64_t             bells;
+};
+
+struct shm_chan *shm_offer(int sock, size_t size, int timeout_msec);
+struct shm_chan *shm_accept(int sock, const struct shm_hello *hello_p, const int fds[3]);
+void             shm_free(struct shm_chan *chan_p);
+
+ssize_t shm_send(struct shm_chan *chan_p, const void *data_p, size_t len);
+ssize_t shm_recv(struct shm_chan *chan_p, void *buf_p, size_t len);
+ssize_t shm_peek(struct shm_chan *chan_p, const char **data_pp);
+void    shm_consume(struct shm_chan *chan_p, size_t n);
+ssize_t shm_room(struct shm_chan *chan_p, size_t want);
+void    shm_drain(struct shm_chan *chan_p);
+void    shm_flush(struct shm_chan *chan_p);
+void    shm_kick(struct shm_chan *chan_p);
+
+#endif /* SHMRING_H */
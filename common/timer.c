@@ -0,0 +1,216 @@
+// COMMON - hierarchical timer wheel
+#include <string.h>     /* memset() */
+#include <time.h>       /* clock_gettime() */
+
+#include "timer.h"
+
+#define WHEEL_MASK      (WHEEL_SLOTS - 1)
+#define WHEEL_SPAN      (1ull << (WHEEL_BITS * WHEEL_LEVELS))
+
+uint64_t timer_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ull + (uint64_t)ts.tv_nsec / 1000000ull;
+}
+
+void timer_wheel_init(struct timer_wheel *wheel_p, uint64_t now_ms)
+{
+    memset(wheel_p, 0, sizeof(*wheel_p));
+    wheel_p->now = now_ms;
+}
+
+/*
+ * A timer on level L goes to the slot of its deadline's level-L period.
+ * Since it is at most WHEEL_SLOTS periods away, that slot is cascaded
+ * exactly when the period begins, never one lap too late.
+ */
+static void wheel_insert(struct timer_wheel *wheel_p, struct timer *timer_p)
+{
+    uint64_t expires = timer_p->expires < wheel_p->now ? wheel_p->now : timer_p->expires;
+    uint64_t delta   = expires - wheel_p->now;
+    unsigned level   = 0;
+
+    if (delta >= WHEEL_SPAN)
+    {
+        delta   = WHEEL_SPAN - 1;
+        expires = wheel_p->now + delta;
+    }
+
+    while (delta >= (1ull << (WHEEL_BITS * (level + 1))))
+        level++;
+
+    struct timer **head_pp = &wheel_p->slots[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+
+    timer_p->next  = *head_pp;
+    timer_p->pprev = head_pp;
+    timer_p->level = level;
+    if (*head_pp)
+        (*head_pp)->pprev = &timer_p->next;
+    *head_pp = timer_p;
+
+    wheel_p->count[level]++;
+}
+
+static void wheel_unlink(struct timer_wheel *wheel_p, struct timer *timer_p)
+{
+    *timer_p->pprev = timer_p->next;
+    if (timer_p->next)
+        timer_p->next->pprev = timer_p->pprev;
+    timer_p->next  = NULL;
+    timer_p->pprev = NULL;
+
+    wheel_p->count[timer_p->level]--;
+}
+
+/**
+ * timer_add - (re)arm a timer
+ * @wheel_p: the wheel
+ * @timer_p: the timer, pending or not
+ * @expires_ms: CLOCK_MONOTONIC deadline in milliseconds. A deadline in
+ *      the past expires on the next timer_wheel_expire().
+ */
+void timer_add(struct timer_wheel *wheel_p, struct timer *timer_p, uint64_t expires_ms)
+{
+    if (timer_pending(timer_p))
+        wheel_unlink(wheel_p, timer_p);
+
+    timer_p->expires = expires_ms;
+    wheel_insert(wheel_p, timer_p);
+}
+
+void timer_del(struct timer_wheel *wheel_p, struct timer *timer_p)
+{
+    if (timer_pending(timer_p))
+        wheel_unlink(wheel_p, timer_p);
+}
+
+/**
+ * timer_wheel_timeout - how long an event loop may sleep
+ * @wheel_p: the wheel
+ * @now_ms: current CLOCK_MONOTONIC time in milliseconds
+ *
+ * Level 0 slots give exact deadlines. A slot on a higher level is only
+ * known to expire no earlier than the start of its period, which is when
+ * it gets cascaded, so that is when the loop has to wake up.
+ *
+ * Return the timeout in milliseconds, suitable for epoll_wait(), or -1
+ * when no timer is pending.
+ */
+int timer_wheel_timeout(const struct timer_wheel *wheel_p, uint64_t now_ms)
+{
+    uint64_t wake = UINT64_MAX;
+
+    for (unsigned level = 0; level < WHEEL_LEVELS; level++)
+    {
+        if (wheel_p->count[level] == 0)
+            continue;
+
+        unsigned shift  = WHEEL_BITS * level;
+        uint64_t period = wheel_p->now >> shift;
+
+        // Unless the wheel sits right at its start, the current period
+        // of a higher level has already been cascaded.
+        uint64_t first  = period + ((wheel_p->now & ((1ull << shift) - 1)) ? 1 : 0);
+
+        for (uint64_t n = first; n <= period + WHEEL_SLOTS; n++)
+        {
+            if (wheel_p->slots[level][n & WHEEL_MASK])
+            {
+                if ((n << shift) < wake)
+                    wake = n << shift;
+                break;
+            }
+        }
+    }
+
+    if (wake == UINT64_MAX)
+        return -1;
+
+    if (wake <= now_ms)
+        return 0;
+
+    return wake - now_ms > INT32_MAX ? INT32_MAX : (int)(wake - now_ms);
+}
+
+static void wheel_cascade(struct timer_wheel *wheel_p, unsigned level, unsigned slot)
+{
+    struct timer *timer_p = wheel_p->slots[level][slot];
+
+    wheel_p->slots[level][slot] = NULL;
+    while (timer_p)
+    {
+        struct timer *next_p = timer_p->next;
+
+        wheel_p->count[level]--;
+        wheel_insert(wheel_p, timer_p);
+        timer_p = next_p;
+    }
+}
+
+/**
+ * timer_wheel_expire - advance the wheel up to @now_ms
+ * @wheel_p: the wheel
+ * @now_ms: current CLOCK_MONOTONIC time in milliseconds
+ *
+ * Expired timers are unlinked from the wheel and handed back as a single
+ * list, linked by @next, so that the caller can reap them in one batch.
+ * A timer in the list may be re-armed with timer_add() once its @next has
+ * been read.
+ *
+ * Return the first expired timer, or NULL.
+ */
+struct timer *timer_wheel_expire(struct timer_wheel *wheel_p, uint64_t now_ms)
+{
+    struct timer *expired_p = NULL;
+    unsigned      pending   = 0;
+
+    for (unsigned level = 0; level < WHEEL_LEVELS; level++)
+        pending += wheel_p->count[level];
+
+    if (pending == 0)
+    {
+        if (wheel_p->now <= now_ms)
+            wheel_p->now = now_ms + 1;
+        return NULL;
+    }
+
+    while (wheel_p->now <= now_ms)
+    {
+        unsigned slot = wheel_p->now & WHEEL_MASK;
+
+        if (slot == 0)
+        {
+            for (unsigned level = 1; level < WHEEL_LEVELS; level++)
+            {
+                unsigned up = (wheel_p->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+                wheel_cascade(wheel_p, level, up);
+                if (up != 0)
+                    break;
+            }
+        }
+
+        // Nothing due on level 0: jump to the next cascade point
+        if (wheel_p->count[0] == 0)
+        {
+            uint64_t next = (wheel_p->now | WHEEL_MASK) + 1;
+            wheel_p->now = next <= now_ms ? next : now_ms + 1;
+            continue;
+        }
+
+        struct timer *timer_p = wheel_p->slots[0][slot];
+        while (timer_p)
+        {
+            struct timer *next_p = timer_p->next;
+
+            wheel_unlink(wheel_p, timer_p);
+            timer_p->next = expired_p;
+            expired_p     = timer_p;
+            timer_p       = next_p;
+        }
+
+        wheel_p->now++;
+    }
+
+    return expired_p;
+}
@@ -0,0 +1,57 @@
+// COMMON - hierarchical timer wheel
+//
+// Deadlines are kept in WHEEL_LEVELS wheels of WHEEL_SLOTS slots. Level
+// 0 has one slot per millisecond, each level above is WHEEL_SLOTS times
+// coarser. A timer goes to the finest level that covers its deadline;
+// whenever a level wraps around, the next slot of the level above is
+// cascaded down. Adding, deleting and expiring a timer are all O(1), and
+// nothing ever walks the list of connections.
+//
+// The wheel is not thread-safe: each event loop owns one.
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>     /* uint64_t */
+#include <stddef.h>     /* offsetof() */
+
+#define WHEEL_BITS      6
+#define WHEEL_SLOTS     (1 << WHEEL_BITS)
+#define WHEEL_LEVELS    4       /* 2^24 ms (4.6 hours), later deadlines are clamped */
+
+/**
+ * struct timer - a deadline, embedded in the object it belongs to
+ * @next: next timer in the same slot (or in the expired list)
+ * @pprev: the pointer that points to this timer, NULL when not pending
+ * @expires: CLOCK_MONOTONIC deadline in milliseconds
+ * @level: wheel level the timer is on, while pending
+ */
+struct timer
+{
+    struct timer   *next;
+    struct timer  **pprev;
+    uint64_t        expires;
+    unsigned        level;
+};
+
+struct timer_wheel
+{
+    uint64_t        now;                        /* next tick to process */
+    unsigned        count[WHEEL_LEVELS];        /* timers per level */
+    struct timer   *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+#define timer_entry(ptr, type, member)  ((type *)((char *)(ptr) - offsetof(type, member)))
+
+static inline int timer_pending(const struct timer *timer_p)
+{
+    return timer_p->pprev != NULL;
+}
+
+uint64_t      timer_now_ms(void);
+void          timer_wheel_init(struct timer_wheel *wheel_p, uint64_t now_ms);
+void          timer_add(struct timer_wheel *wheel_p, struct timer *timer_p, uint64_t expires_ms);
+void          timer_del(struct timer_wheel *wheel_p, struct timer *timer_p);
+int           timer_wheel_timeout(const struct timer_wheel *wheel_p, uint64_t now_ms);
+struct timer *timer_wheel_expire(struct timer_wheel *wheel_p, uint64_t now_ms);
+
+#endif /* TIMER_H */
@@ -0,0 +1,650 @@
+// COMMON - TLS 1.3 connections: kernel records (kTLS) or OpenSSL records
+#include <stdio.h>          /* fopen(), fclose() */
+#include <string.h>         /* memset(), memcpy(), strcmp(), strncmp() */
+#include <stdlib.h>         /* calloc(), free(), strtoul() */
+#include <stdint.h>         /* uint8_t */
+#include <unistd.h>         /* close() */
+#include <errno.h>          /* errno, EAGAIN, EPROTO */
+#include <fcntl.h>          /* open() */
+#include <time.h>           /* time() */
+#include <sys/stat.h>       /* S_IRUSR */
+#include <sys/socket.h>     /* socket(), setsockopt() */
+#include <netinet/in.h>     /* IPPROTO_TCP */
+#include <netinet/tcp.h>    /* TCP_ULP */
+#include <arpa/inet.h>      /* inet_pton() */
+#include <linux/tls.h>      /* TLS_TX, TLS_RX, tls12_crypto_info_aes_gcm_128 */
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+#include <openssl/core_names.h>
+
+#include "tlsconn.h"
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+#define TLS_CIPHER          "TLS_AES_128_GCM_SHA256"
+#define TLS_SECRET_MAX      48          /* SHA-384 sized, SHA-256 uses 32 */
+#define TLS_CERT_DAYS       30
+
+/**
+ * struct tls_secrets - traffic secrets of one connection
+ * @client: CLIENT_TRAFFIC_SECRET_0
+ * @server: SERVER_TRAFFIC_SECRET_0
+ * @client_len: length of @client, 0 until seen
+ * @server_len: length of @server, 0 until seen
+ *
+ * OpenSSL only hands the application traffic secrets out through its
+ * key log callback; that is where kTLS gets them from.
+ */
+struct tls_secrets
+{
+    uint8_t client[TLS_SECRET_MAX];
+    uint8_t server[TLS_SECRET_MAX];
+    size_t  client_len;
+    size_t  server_len;
+};
+
+static int secrets_index = -1;
+
+// ==========================================================================
+
+/**
+ * tls_parse_mode - parse the argument of --tls
+ *
+ * Return TLS_KTLS for "ktls" (or no argument), TLS_USER for "user",
+ * -1 otherwise.
+ */
+int tls_parse_mode(const char *arg_p)
+{
+    if (arg_p == NULL || strcmp(arg_p, "ktls") == 0)
+        return TLS_KTLS;
+
+    if (strcmp(arg_p, "user") == 0)
+        return TLS_USER;
+
+    return -1;
+}
+
+/**
+ * tls_ktls_available - whether the kernel has the "tls" upper layer
+ *
+ * Setting TCP_ULP on an unconnected socket fails with ENOTCONN when the
+ * module is there, and with ENOENT when it is not (modprobe tls).
+ */
+int tls_ktls_available(void)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return 0;
+
+    int rc = setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls"));
+    int available = rc == 0 || errno != ENOENT;
+    close(fd);
+
+    return available;
+}
+
+// ==========================================================================
+
+/**
+ * unhex - decode @len bytes of hexadecimal from @hex_p
+ *
+ * Return the number of bytes decoded.
+ */
+static size_t unhex(const char *hex_p, uint8_t *out_p, size_t len)
+{
+    size_t n;
+    for (n = 0; n < len && hex_p[0] != '\0' && hex_p[1] != '\0'; n++, hex_p += 2)
+    {
+        char byte[3] = { hex_p[0], hex_p[1], '\0' };
+        out_p[n] = (uint8_t)strtoul(byte, NULL, 16);
+    }
+
+    return n;
+}
+
+/**
+ * keylog - OpenSSL key log callback, keep the application traffic secrets
+ *
+ * Lines look like "CLIENT_TRAFFIC_SECRET_0 <client random> <secret>".
+ */
+static void keylog(const SSL *ssl_p, const char *line_p)
+{
+    struct tls_secrets *secrets_p = SSL_get_ex_data(ssl_p, secrets_index);
+    if (secrets_p == NULL)
+        return;
+
+    const char *secret_p = strrchr(line_p, ' ');
+    if (secret_p == NULL)
+        return;
+    secret_p++;
+
+    if (strncmp(line_p, "CLIENT_TRAFFIC_SECRET_0 ", 24) == 0)
+        secrets_p->client_len = unhex(secret_p, secrets_p->client, TLS_SECRET_MAX);
+    else if (strncmp(line_p, "SERVER_TRAFFIC_SECRET_0 ", 24) == 0)
+        secrets_p->server_len = unhex(secret_p, secrets_p->server, TLS_SECRET_MAX);
+}
+
+/**
+ * ctx_new - context common to both sides: TLS 1.3, AES-128-GCM only
+ */
+static SSL_CTX *ctx_new(const SSL_METHOD *method_p)
+{
+    if (secrets_index < 0)
+        secrets_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+
+    SSL_CTX *ctx_p = SSL_CTX_new(method_p);
+    if (ctx_p == NULL)
+        return NULL;
+
+    SSL_CTX_set_min_proto_version(ctx_p, TLS1_3_VERSION);
+    SSL_CTX_set_max_proto_version(ctx_p, TLS1_3_VERSION);
+    SSL_CTX_set_ciphersuites(ctx_p, TLS_CIPHER);
+    SSL_CTX_set_keylog_callback(ctx_p, keylog);
+    SSL_CTX_set_mode(ctx_p, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    SSL_CTX_set_read_ahead(ctx_p, 0);
+
+    return ctx_p;
+}
+
+/**
+ * write_pem - save a freshly made certificate and its key
+ *
+ * The key file is created readable by its owner only.
+ */
+static int write_pem(X509 *cert_p, EVP_PKEY *pkey_p, const char *cert_path_p, const char *key_path_p)
+{
+    FILE *fp = fopen(cert_path_p, "w");
+    if (fp == NULL)
+        return -1;
+    int ok = PEM_write_X509(fp, cert_p);
+    fclose(fp);
+    if (!ok)
+        return -1;
+
+    int fd = open(key_path_p, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0 || (fp = fdopen(fd, "w")) == NULL)
+    {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    ok = PEM_write_PrivateKey(fp, pkey_p, NULL, NULL, 0, NULL, NULL);
+    fclose(fp);
+
+    return ok ? 0 : -1;
+}
+
+/**
+ * self_signed - make a P-256 key and a self-signed certificate for it
+ *
+ * The certificate names localhost, 127.0.0.1 and ::1, so that a client
+ * trusting it (--tls-ca) can also check the host it connects to.
+ */
+static int self_signed(SSL_CTX *ctx_p, const char *cert_path_p, const char *key_path_p)
+{
+    int       rc     = -1;
+    EVP_PKEY *pkey_p = EVP_EC_gen("P-256");
+    X509     *cert_p = X509_new();
+
+    if (pkey_p == NULL || cert_p == NULL)
+        goto out;
+
+    X509_set_version(cert_p, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert_p), (long)time(NULL));
+    X509_gmtime_adj(X509_getm_notBefore(cert_p), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert_p), 60L * 60 * 24 * TLS_CERT_DAYS);
+    X509_set_pubkey(cert_p, pkey_p);
+
+    X509_NAME *name_p = X509_get_subject_name(cert_p);
+    X509_NAME_add_entry_by_txt(name_p, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+    X509_set_issuer_name(cert_p, name_p);
+
+    X509V3_CTX v3;
+    X509V3_set_ctx_nodb(&v3);
+    X509V3_set_ctx(&v3, cert_p, cert_p, NULL, NULL, 0);
+    X509_EXTENSION *ext_p = X509V3_EXT_conf_nid(NULL, &v3, NID_subject_alt_name,
+                                                "DNS:localhost,IP:127.0.0.1,IP:::1");
+    if (ext_p == NULL)
+        goto out;
+    X509_add_ext(cert_p, ext_p, -1);
+    X509_EXTENSION_free(ext_p);
+
+    if (!X509_sign(cert_p, pkey_p, EVP_sha256()))
+        goto out;
+
+    if (!SSL_CTX_use_certificate(ctx_p, cert_p) || !SSL_CTX_use_PrivateKey(ctx_p, pkey_p))
+        goto out;
+
+    if (cert_path_p != NULL && write_pem(cert_p, pkey_p, cert_path_p, key_path_p) < 0)
+    {
+        fprintf(stderr, "Cannot write %s and %s: %m\n", cert_path_p, key_path_p);
+        goto out;
+    }
+
+    rc = 0;
+
+out:
+    X509_free(cert_p);
+    EVP_PKEY_free(pkey_p);
+    return rc;
+}
+
+/**
+ * tls_server_ctx - context for accepted connections
+ * @cert_p: PEM certificate file, or NULL
+ * @key_p: PEM private key file, or NULL
+ *
+ * Without files, a self-signed certificate is made in memory. With files
+ * that do not exist yet, it is made and saved there, for clients to trust
+ * with --tls-ca. No session tickets are sent: they would be records the
+ * kernel does not know about once it takes over.
+ *
+ * Return the context, or NULL with the OpenSSL errors printed.
+ */
+SSL_CTX *tls_server_ctx(const char *cert_p, const char *key_p)
+{
+    SSL_CTX *ctx_p = ctx_new(TLS_server_method());
+    if (ctx_p == NULL)
+        goto fail;
+
+    SSL_CTX_set_num_tickets(ctx_p, 0);
+
+    if (cert_p != NULL && access(cert_p, F_OK) == 0)
+    {
+        if (SSL_CTX_use_certificate_chain_file(ctx_p, cert_p) != 1 ||
+            SSL_CTX_use_PrivateKey_file(ctx_p, key_p, SSL_FILETYPE_PEM) != 1 ||
+            SSL_CTX_check_private_key(ctx_p) != 1)
+            goto fail;
+    }
+    else if (self_signed(ctx_p, cert_p, key_p) < 0)
+        goto fail;
+
+    return ctx_p;
+
+fail:
+    ERR_print_errors_fp(stderr);
+    SSL_CTX_free(ctx_p);
+    return NULL;
+}
+
+/**
+ * tls_client_ctx - context for outgoing connections
+ * @ca_p: PEM file of the certificate(s) to trust, or NULL to trust anyone
+ *
+ * Return the context, or NULL with the OpenSSL errors printed.
+ */
+SSL_CTX *tls_client_ctx(const char *ca_p)
+{
+    SSL_CTX *ctx_p = ctx_new(TLS_client_method());
+    if (ctx_p == NULL)
+        goto fail;
+
+    if (ca_p != NULL)
+    {
+        if (SSL_CTX_load_verify_locations(ctx_p, ca_p, NULL) != 1)
+            goto fail;
+        SSL_CTX_set_verify(ctx_p, SSL_VERIFY_PEER, NULL);
+    }
+
+    return ctx_p;
+
+fail:
+    ERR_print_errors_fp(stderr);
+    SSL_CTX_free(ctx_p);
+    return NULL;
+}
+
+/**
+ * tls_new - start TLS on a connected, non-blocking socket
+ * @host_p: name or address the client connected to (checked against the
+ *          certificate when the context verifies it), NULL on the server
+ *
+ * The socket gets TCP_NODELAY: the client's Finished and its first
+ * request are two small writes in a row, and Nagle would hold the request
+ * until the Finished is acknowledged, which the server, having nothing
+ * to answer, delays by up to 40 ms.
+ *
+ * Return the connection, to drive with tls_handshake(), or NULL.
+ */
+SSL *tls_new(SSL_CTX *ctx_p, int fd, const char *host_p)
+{
+    SSL                *ssl_p     = SSL_new(ctx_p);
+    struct tls_secrets *secrets_p = calloc(1, sizeof(*secrets_p));
+    int                 one       = 1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (ssl_p == NULL || secrets_p == NULL || !SSL_set_fd(ssl_p, fd))
+        goto fail;
+
+    SSL_set_ex_data(ssl_p, secrets_index, secrets_p);
+
+    if (host_p == NULL)
+    {
+        SSL_set_accept_state(ssl_p);
+        return ssl_p;
+    }
+
+    // Server names go in the SNI extension; addresses may not (RFC 6066).
+    struct in6_addr addr;
+    int             is_ip = inet_pton(AF_INET, host_p, &addr) == 1 || inet_pton(AF_INET6, host_p, &addr) == 1;
+
+    SSL_set_connect_state(ssl_p);
+    if (!is_ip)
+        SSL_set_tlsext_host_name(ssl_p, host_p);
+
+    if ((SSL_get_verify_mode(ssl_p) & SSL_VERIFY_PEER) &&
+        (is_ip ? !X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl_p), host_p) : !SSL_set1_host(ssl_p, host_p)))
+        goto fail;
+
+    return ssl_p;
+
+fail:
+    free(secrets_p);
+    SSL_free(ssl_p);
+    return NULL;
+}
+
+/**
+ * tls_free - release a connection (the socket is left open)
+ */
+void tls_free(SSL *ssl_p)
+{
+    if (ssl_p == NULL)
+        return;
+
+    free(SSL_get_ex_data(ssl_p, secrets_index));
+    SSL_free(ssl_p);
+}
+
+/**
+ * tls_handshake - move the handshake forward
+ *
+ * Call again when the socket becomes readable, or writable if
+ * SSL_want_write() says so.
+ *
+ * Return 1 once done, 0 while in progress, -1 on failure (see
+ * tls_strerror()).
+ */
+int tls_handshake(SSL *ssl_p)
+{
+    errno  = 0;
+    int rc = SSL_do_handshake(ssl_p);
+    if (rc == 1)
+        return 1;
+
+    switch (SSL_get_error(ssl_p, rc))
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * tls_strerror - why the last handshake or TLS call failed
+ *
+ * The reason comes from the OpenSSL error queue, which is then cleared,
+ * or else from errno. A peer that closed the connection leaves neither.
+ */
+const char *tls_strerror(void)
+{
+    unsigned long err = ERR_peek_last_error();
+
+    ERR_clear_error();
+    if (err != 0 && ERR_reason_error_string(err) != NULL)
+        return ERR_reason_error_string(err);
+
+    return errno != 0 ? strerror(errno) : "connection closed by peer";
+}
+
+// ==========================================================================
+
+/**
+ * expand_label - HKDF-Expand-Label(@secret, @label, "", @len), RFC 8446 7.1
+ */
+static int expand_label(const uint8_t *secret_p, size_t secret_len, const char *label_p,
+                        uint8_t *out_p, size_t len)
+{
+    uint8_t info[2 + 1 + 255 + 1];
+    size_t  label_len = 6 + strlen(label_p);
+    size_t  n         = 0;
+
+    info[n++] = (uint8_t)(len >> 8);
+    info[n++] = (uint8_t)len;
+    info[n++] = (uint8_t)label_len;
+    memcpy(info + n, "tls13 ", 6);
+    memcpy(info + n + 6, label_p, label_len - 6);
+    n += label_len;
+    info[n++] = 0;      /* empty context */
+
+    EVP_KDF     *kdf_p = EVP_KDF_fetch(NULL, OSSL_KDF_NAME_HKDF, NULL);
+    EVP_KDF_CTX *kctx_p = EVP_KDF_CTX_new(kdf_p);
+    int          mode   = EVP_KDF_HKDF_MODE_EXPAND_ONLY;
+    OSSL_PARAM   params[] =
+    {
+        OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST, "SHA256", 0),
+        OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_KEY, (void *)secret_p, secret_len),
+        OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_INFO, info, n),
+        OSSL_PARAM_construct_int(OSSL_KDF_PARAM_MODE, &mode),
+        OSSL_PARAM_construct_end(),
+    };
+
+    int rc = kctx_p != NULL && EVP_KDF_derive(kctx_p, out_p, len, params) == 1 ? 0 : -1;
+
+    EVP_KDF_CTX_free(kctx_p);
+    EVP_KDF_free(kdf_p);
+    return rc;
+}
+
+/**
+ * crypto_info - kernel key material for one direction
+ *
+ * TLS 1.3 nonces are the 12-byte write IV XORed with the record sequence
+ * number; the kernel takes the IV as a 4-byte salt and an 8-byte iv.
+ */
+static int crypto_info(const uint8_t *secret_p, size_t secret_len,
+                       struct tls12_crypto_info_aes_gcm_128 *info_p)
+{
+    uint8_t key[TLS_CIPHER_AES_GCM_128_KEY_SIZE];
+    uint8_t iv[TLS_CIPHER_AES_GCM_128_SALT_SIZE + TLS_CIPHER_AES_GCM_128_IV_SIZE];
+
+    if (secret_len == 0 ||
+        expand_label(secret_p, secret_len, "key", key, sizeof(key)) < 0 ||
+        expand_label(secret_p, secret_len, "iv", iv, sizeof(iv)) < 0)
+        return -1;
+
+    memset(info_p, 0, sizeof(*info_p));
+    info_p->info.version     = TLS_1_3_VERSION;
+    info_p->info.cipher_type = TLS_CIPHER_AES_GCM_128;
+    memcpy(info_p->key, key, sizeof(info_p->key));
+    memcpy(info_p->salt, iv, sizeof(info_p->salt));
+    memcpy(info_p->iv, iv + sizeof(info_p->salt), sizeof(info_p->iv));
+    /* rec_seq stays 0: no application record went out or came in yet */
+
+    return 0;
+}
+
+/**
+ * tls_ktls_install - hand the records of a finished handshake to the kernel
+ *
+ * Must be called right after tls_handshake() returned 1, before any
+ * application data is read or written. The SSL object is not used for
+ * the data afterwards, only kept until the connection is closed.
+ *
+ * Return 0, or -1 with errno set (ENOENT: no "tls" module in the kernel,
+ * EPROTO: the secrets could not be derived).
+ */
+int tls_ktls_install(SSL *ssl_p, int fd)
+{
+    struct tls_secrets                  *secrets_p = SSL_get_ex_data(ssl_p, secrets_index);
+    struct tls12_crypto_info_aes_gcm_128 client, server;
+
+    if (secrets_p == NULL ||
+        SSL_CIPHER_get_id(SSL_get_current_cipher(ssl_p)) != TLS1_3_CK_AES_128_GCM_SHA256 ||
+        crypto_info(secrets_p->client, secrets_p->client_len, &client) < 0 ||
+        crypto_info(secrets_p->server, secrets_p->server_len, &server) < 0)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    int is_server = SSL_is_server(ssl_p);
+    int rc        = -1;
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == 0 &&
+        setsockopt(fd, SOL_TLS, TLS_TX, is_server ? &server : &client, sizeof(server)) == 0 &&
+        setsockopt(fd, SOL_TLS, TLS_RX, is_server ? &client : &server, sizeof(client)) == 0)
+        rc = 0;
+
+    OPENSSL_cleanse(&client, sizeof(client));
+    OPENSSL_cleanse(&server, sizeof(server));
+    return rc;
+}
+
+/**
+ * tls_use_memory - move the records of a finished handshake to memory BIOs
+ *
+ * From then on the caller reads ciphertext from the socket itself and
+ * passes it to tls_feed(), and sends what tls_seal() returns. OpenSSL
+ * does not read ahead, so nothing received is left in the socket BIO.
+ *
+ * Return 0, or -1.
+ */
+int tls_use_memory(SSL *ssl_p)
+{
+    BIO *rbio_p = BIO_new(BIO_s_mem());
+    BIO *wbio_p = BIO_new(BIO_s_mem());
+
+    if (rbio_p == NULL || wbio_p == NULL)
+    {
+        BIO_free(rbio_p);
+        BIO_free(wbio_p);
+        return -1;
+    }
+
+    SSL_set_bio(ssl_p, rbio_p, wbio_p);
+    return 0;
+}
+
+// ==========================================================================
+
+/**
+ * ssl_errno - turn an SSL_read()/SSL_write() failure into recv()/send() terms
+ *
+ * Return 0 for a clean end of stream, -1 with errno set otherwise.
+ */
+static ssize_t ssl_errno(SSL *ssl_p, int rc)
+{
+    switch (SSL_get_error(ssl_p, rc))
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    case SSL_ERROR_SYSCALL:
+        if (errno == 0)
+            return 0;           /* peer closed without close_notify */
+        return -1;
+    default:
+        ERR_clear_error();
+        errno = EPROTO;
+        return -1;
+    }
+}
+
+/**
+ * tls_read - recv() through OpenSSL
+ *
+ * Return the number of plaintext bytes, 0 at the end of the stream, or
+ * -1 with errno set (EAGAIN when more ciphertext is needed).
+ */
+ssize_t tls_read(SSL *ssl_p, void *buf_p, size_t len)
+{
+    errno = 0;
+    int n = SSL_read(ssl_p, buf_p, (int)len);
+    return n > 0 ? n : ssl_errno(ssl_p, n);
+}
+
+/**
+ * tls_write - send() through OpenSSL (socket BIO only)
+ *
+ * Partial writes are on: a record that could only be partly sent is
+ * finished by the next call, which must pass the same data again.
+ *
+ * Return the number of plaintext bytes taken, or -1 with errno set.
+ */
+ssize_t tls_write(SSL *ssl_p, const void *data_p, size_t len)
+{
+    errno = 0;
+    int n = SSL_write(ssl_p, data_p, (int)len);
+    return n > 0 ? n : ssl_errno(ssl_p, n);
+}
+
+/**
+ * tls_feed - pass ciphertext read from the socket (memory BIOs only)
+ *
+ * Return 0, or -1.
+ */
+int tls_feed(SSL *ssl_p, const void *data_p, size_t len)
+{
+    return BIO_write(SSL_get_rbio(ssl_p), data_p, (int)len) == (int)len ? 0 : -1;
+}
+
+/**
+ * tls_seal - turn plaintext into records (memory BIOs only)
+ * @out_pp: where to store a pointer to the records
+ *
+ * The records stay valid until tls_sealed() is called; they accumulate
+ * over several calls until then.
+ *
+ * Return the number of bytes of records waiting at *@out_pp.
+ */
+size_t tls_seal(SSL *ssl_p, const void *data_p, size_t len, const char **out_pp)
+{
+    char *out_p;
+
+    if (len > 0)
+        SSL_write(ssl_p, data_p, (int)len);
+
+    long n = BIO_get_mem_data(SSL_get_wbio(ssl_p), &out_p);
+    *out_pp = out_p;
+    return n > 0 ? (size_t)n : 0;
+}
+
+/**
+ * tls_sealed - the records returned by tls_seal() were consumed
+ */
+void tls_sealed(SSL *ssl_p)
+{
+    (void)BIO_reset(SSL_get_wbio(ssl_p));
+}
+
+/**
+ * tls_buffered - whether reading could return data without the socket
+ *
+ * True when OpenSSL holds decrypted bytes not returned yet, or (memory
+ * BIOs) ciphertext not decrypted yet: an event loop waiting for the
+ * socket to become readable would wait for nothing.
+ */
+int tls_buffered(SSL *ssl_p)
+{
+    if (SSL_pending(ssl_p) > 0)
+        return 1;
+
+    BIO *rbio_p = SSL_get_rbio(ssl_p);
+    return BIO_method_type(rbio_p) == BIO_TYPE_MEM && BIO_ctrl_pending(rbio_p) > 0;
+}
@@ -0,0 +1,54 @@
+// COMMON - TLS 1.3 connections: kernel records (kTLS) or OpenSSL records
+//
+// The handshake always runs in user space, through OpenSSL, on the
+// non-blocking socket. What happens next depends on the mode:
+//
+//   - TLS_KTLS: the traffic secrets are turned into AES-128-GCM keys and
+//     handed to the kernel with setsockopt(SOL_TLS, TLS_TX/TLS_RX). From
+//     then on send(), recv(), sendmsg(), splice() and sendfile() work on
+//     plaintext as if there were no TLS: the kernel builds and checks the
+//     records, and nothing is copied through user space to do it.
+//   - TLS_USER: OpenSSL keeps the records. The caller either reads and
+//     writes through tls_read()/tls_write() (socket BIO), or switches the
+//     connection to memory BIOs with tls_use_memory() and moves the
+//     ciphertext itself, with tls_feed() and tls_seal().
+//
+// To keep the record sequence numbers at 0 when the kernel takes over,
+// both sides stick to TLS 1.3 with TLS_AES_128_GCM_SHA256, the server
+// sends no session tickets, and OpenSSL never reads ahead of the last
+// handshake record.
+#ifndef TLSCONN_H
+#define TLSCONN_H
+
+#include <stddef.h>     /* size_t */
+#include <sys/types.h>  /* ssize_t */
+#include <openssl/ssl.h>
+
+enum tls_mode
+{
+    TLS_OFF,
+    TLS_KTLS,       /* handshake in user space, records in the kernel */
+    TLS_USER,       /* handshake and records in user space (OpenSSL) */
+};
+
+int         tls_parse_mode(const char *arg_p);
+int         tls_ktls_available(void);
+
+SSL_CTX    *tls_server_ctx(const char *cert_p, const char *key_p);
+SSL_CTX    *tls_client_ctx(const char *ca_p);
+SSL        *tls_new(SSL_CTX *ctx_p, int fd, const char *host_p);
+void        tls_free(SSL *ssl_p);
+
+int         tls_handshake(SSL *ssl_p);
+const char *tls_strerror(void);
+int         tls_ktls_install(SSL *ssl_p, int fd);
+int         tls_use_memory(SSL *ssl_p);
+
+ssize_t     tls_read(SSL *ssl_p, void *buf_p, size_t len);
+ssize_t     tls_write(SSL *ssl_p, const void *data_p, size_t len);
+int         tls_feed(SSL *ssl_p, const void *data_p, size_t len);
+size_t      tls_seal(SSL *ssl_p, const void *data_p, size_t len, const char **out_pp);
+void        tls_sealed(SSL *ssl_p);
+int         tls_buffered(SSL *ssl_p);
+
+#endif /* TLSCONN_H */
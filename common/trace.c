@@ -0,0 +1,279 @@
+// COMMON - asynchronous binary syscall trace
+#define _GNU_SOURCE
+#include <stdio.h>      /* printf(), fwrite() */
+#include <stdlib.h>     /* calloc(), exit() */
+#include <string.h>     /* memcpy(), strerror() */
+#include <errno.h>      /* EAGAIN */
+#include <strings.h>    /* strcasecmp() */
+#include <signal.h>     /* sigfillset() */
+#include <pthread.h>    /* pthread_create(), pthread_mutex_lock() */
+#include <time.h>       /* clock_gettime(), nanosleep() */
+
+#include "trace.h"
+
+#define TRACE_RING_SIZE     4096        /* records per thread, power of 2 */
+#define TRACE_DRAIN_NSEC    10000000    /* drainer period: 10 ms */
+#define TRACE_MAX_THREADS   256
+
+/**
+ * struct trace_ring - single-producer/single-consumer record ring
+ * @head: next record to consume, written by the drainer only
+ * @tail: next record to produce, written by the owning thread only
+ * @dropped: records lost because the ring was full
+ * @recs: the records
+ *
+ * @head and @tail sit on separate cache lines so the producer and the
+ * consumer do not bounce a line between cores on every record.
+ */
+struct trace_ring
+{
+    uint64_t            head __attribute__((aligned(64)));
+    uint64_t            tail __attribute__((aligned(64)));
+    uint64_t            dropped;
+    struct trace_rec    recs[TRACE_RING_SIZE] __attribute__((aligned(64)));
+};
+
+int trace_level = TRACE_DATA;
+
+static __thread struct trace_ring *my_ring_p = NULL;
+static __thread uint16_t           my_tid    = 0;
+
+static struct trace_ring *rings[TRACE_MAX_THREADS];
+static int                nrings = 0;   /* published with release semantics */
+static pthread_mutex_t    rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t          drainer_tid;
+static int                drainer_running = 0;
+static volatile int       drainer_stop    = 0;
+static FILE              *dump_fp         = NULL;
+static uint64_t           t0_ns           = 0;
+
+static const char *call_names[TC_MAX] =
+{
+    [TC_ACCEPT]    = "accept4",
+    [TC_CONNECT]   = "connect",
+    [TC_RECV]      = "recv",
+    [TC_SEND]      = "send",
+    [TC_CLOSE]     = "close",
+    [TC_FRAME]     = "frame",
+    [TC_TIMEOUT]   = "timeout",
+    [TC_HANDSHAKE] = "handshake",
+    [TC_RECVMMSG]  = "recvmmsg",
+    [TC_SENDMMSG]  = "sendmmsg",
+    [TC_CRC]       = "crc32c",
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * trace_parse_level - convert a --trace argument to enum trace_level
+ * @arg: a number (0..3) or one of off, events, syscalls, data
+ *
+ * Return the level, or -1 if @arg is not recognized.
+ */
+int trace_parse_level(const char *arg)
+{
+    static const char *names[] = { "off", "events", "syscalls", "data" };
+
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+    {
+        if (strcasecmp(arg, names[i]) == 0)
+            return i;
+    }
+
+    if (arg[0] >= '0' && arg[0] <= '3' && arg[1] == '\0')
+        return arg[0] - '0';
+
+    return -1;
+}
+
+static struct trace_ring *register_ring(void)
+{
+    struct trace_ring *ring_p = NULL;
+
+    pthread_mutex_lock(&rings_lock);
+    if (nrings < TRACE_MAX_THREADS)
+    {
+        ring_p = aligned_alloc(64, sizeof(*ring_p));
+        if (ring_p)
+        {
+            memset(ring_p, 0, sizeof(*ring_p));
+            my_tid = (uint16_t)nrings;
+            rings[nrings] = ring_p;
+            __atomic_store_n(&nrings, nrings + 1, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    return ring_p;
+}
+
+void trace_record(int call, int fd, int64_t ret, int err, const void *data_p, size_t len)
+{
+    struct trace_ring *ring_p = my_ring_p;
+    if (!ring_p)
+    {
+        ring_p = my_ring_p = register_ring();
+        if (!ring_p) return;
+    }
+
+    uint64_t tail = ring_p->tail;
+    if (tail - __atomic_load_n(&ring_p->head, __ATOMIC_ACQUIRE) >= TRACE_RING_SIZE)
+    {
+        // Never block the hot path: count the loss and move on.
+        ring_p->dropped++;
+        return;
+    }
+
+    struct trace_rec *rec_p = &ring_p->recs[tail & (TRACE_RING_SIZE - 1)];
+    rec_p->ts_ns = now_ns();
+    rec_p->ret   = ret;
+    rec_p->fd    = fd;
+    rec_p->err   = ret < 0 ? err : 0;
+    rec_p->call  = (uint16_t)call;
+    rec_p->tid   = my_tid;
+    rec_p->len   = 0;
+    // A failed call may carry a reason; recv() and send() pass their -1
+    // as the length, which must not be taken for one.
+    if (data_p && len > 0 && (ret >= 0 || (int64_t)len > 0))
+    {
+        rec_p->len = len > TRACE_DATA_SIZE ? TRACE_DATA_SIZE : (uint16_t)len;
+        memcpy(rec_p->data, data_p, rec_p->len);
+    }
+
+    __atomic_store_n(&ring_p->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void format_rec(const struct trace_rec *rec_p)
+{
+    uint64_t    ns   = rec_p->ts_ns - t0_ns;
+    const char *name = rec_p->call < TC_MAX ? call_names[rec_p->call] : "?";
+
+    printf("[%5llu.%06llu] T%-2u %s(%d) -> %lld",
+           (unsigned long long)(ns / 1000000000ull), (unsigned long long)(ns % 1000000000ull) / 1000,
+           rec_p->tid, name, rec_p->fd, (long long)rec_p->ret);
+
+    if (rec_p->ret < 0 && (rec_p->err == EAGAIN || rec_p->err == EWOULDBLOCK))
+        printf(" - %s", strerror(rec_p->err));
+    else if (rec_p->ret < 0 && rec_p->len)
+        printf(" - \x1b[1;31m%.*s\x1b[0m", rec_p->len, rec_p->data);     /* a reason, e.g. TC_HANDSHAKE */
+    else if (rec_p->ret < 0)
+        printf(" - \x1b[1;31m%s\x1b[0m", strerror(rec_p->err));
+    else if (rec_p->len)
+        printf(" - %.*s%s", rec_p->len, rec_p->data,
+               (rec_p->call == TC_RECV || rec_p->call == TC_SEND || rec_p->call == TC_FRAME) && rec_p->ret > rec_p->len ? "..." : "");
+    else if (rec_p->call == TC_RECV && rec_p->ret == 0)
+        printf(" - Connection closed by peer");
+
+    printf("\n");
+}
+
+static void drain(void)
+{
+    int n = __atomic_load_n(&nrings, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < n; i++)
+    {
+        struct trace_ring *ring_p = rings[i];
+        uint64_t head = ring_p->head;
+        uint64_t tail = __atomic_load_n(&ring_p->tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++)
+        {
+            const struct trace_rec *rec_p = &ring_p->recs[head & (TRACE_RING_SIZE - 1)];
+            if (dump_fp)
+                fwrite(rec_p, sizeof(*rec_p), 1, dump_fp);
+            else
+                format_rec(rec_p);
+        }
+
+        __atomic_store_n(&ring_p->head, head, __ATOMIC_RELEASE);
+    }
+
+    fflush(dump_fp ? dump_fp : stdout);
+}
+
+static void *drainer_main(void *arg)
+{
+    struct timespec period = { 0, TRACE_DRAIN_NSEC };
+
+    while (!drainer_stop)
+    {
+        nanosleep(&period, NULL);
+        drain();
+    }
+
+    return NULL;
+}
+
+/**
+ * trace_init - set the trace level and start the drainer
+ * @level: enum trace_level
+ * @dump_file_p: write raw struct trace_rec records to this file instead
+ *      of formatting them on stdout. May be NULL.
+ */
+void trace_init(int level, const char *dump_file_p)
+{
+    trace_level = level;
+    t0_ns       = now_ns();
+
+    if (level == TRACE_OFF)
+        return;
+
+    if (dump_file_p)
+    {
+        dump_fp = fopen(dump_file_p, "we");
+        if (!dump_fp)
+        {
+            fprintf(stderr, "\x1b[1;31mCannot open %s: %m\x1b[0m\n", dump_file_p);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // The drainer must never be picked to run a signal handler.
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    int rc = pthread_create(&drainer_tid, NULL, drainer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (rc != 0)
+    {
+        fprintf(stderr, "\x1b[1;31mpthread_create() failed: %s\x1b[0m\n", strerror(rc));
+        exit(EXIT_FAILURE);
+    }
+    drainer_running = 1;
+}
+
+/**
+ * trace_exit - stop the drainer after a final drain
+ *
+ * Reports the number of records lost to full rings, if any.
+ */
+void trace_exit(void)
+{
+    if (!drainer_running)
+        return;
+
+    drainer_stop = 1;
+    pthread_join(drainer_tid, NULL);
+    drainer_running = 0;
+    drain();
+
+    uint64_t dropped = 0;
+    int n = __atomic_load_n(&nrings, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < n; i++)
+        dropped += rings[i]->dropped;
+    if (dropped)
+        fprintf(stderr, "trace: %llu records dropped (rings full)\n", (unsigned long long)dropped);
+
+    if (dump_fp)
+    {
+        fclose(dump_fp);
+        dump_fp = NULL;
+    }
+}
@@ -0,0 +1,88 @@
+// COMMON - asynchronous binary syscall trace
+//
+// Each thread appends fixed-size binary records to its own lock-free
+// single-producer/single-consumer ring. A background drainer thread
+// empties the rings periodically and either formats the records on
+// stdout or dumps them verbatim to a file. The hot path therefore never
+// does formatted I/O: it only reads the clock and copies 64 bytes.
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>     /* uint64_t */
+#include <stddef.h>     /* size_t */
+
+enum trace_level
+{
+    TRACE_OFF      = 0, /* --quiet: nothing is recorded */
+    TRACE_EVENTS   = 1, /* connection set-up and tear-down */
+    TRACE_SYSCALLS = 2, /* every send()/recv() */
+    TRACE_DATA     = 3, /* same, plus the first bytes of each payload */
+};
+
+enum trace_call
+{
+    TC_ACCEPT,      /* ret: new fd,   data: peer "ADDR:PORT" */
+    TC_CONNECT,     /* ret: 0/-1,     data: local "ADDR:PORT" */
+    TC_RECV,        /* ret: bytes,    data: payload */
+    TC_SEND,        /* ret: bytes,    data: payload */
+    TC_CLOSE,       /* ret: 0,        data: reason */
+    TC_FRAME,       /* ret: length,   data: payload (one parsed frame) */
+    TC_TIMEOUT,     /* ret: -1,       err: ETIMEDOUT (a deadline expired) */
+    TC_HANDSHAKE,   /* ret: 1/-1,     data: TLS cipher, or error reason */
+    TC_RECVMMSG,    /* ret: messages, data: none */
+    TC_SENDMMSG,    /* ret: messages, data: none */
+    TC_CRC,         /* ret: -1,       err: EBADMSG (a message failed its CRC32C) */
+    TC_MAX
+};
+
+#define TRACE_DATA_SIZE 32
+
+/**
+ * struct trace_rec - one binary trace record (one cache line)
+ * @ts_ns: CLOCK_MONOTONIC timestamp in nanoseconds
+ * @ret: return value of the call
+ * @fd: descriptor the call was made on
+ * @err: errno when @ret < 0, 0 otherwise
+ * @call: enum trace_call
+ * @tid: index of the recording thread's ring
+ * @len: number of valid bytes in @data
+ * @data: payload snippet or peer name, not NUL-terminated
+ *
+ * This is also the on-disk format written by --trace-file.
+ */
+struct trace_rec
+{
+    uint64_t    ts_ns;
+    int64_t     ret;
+    int32_t     fd;
+    int32_t     err;
+    uint16_t    call;
+    uint16_t    tid;
+    uint16_t    len;
+    uint16_t    pad;
+    char        data[TRACE_DATA_SIZE];
+};
+
+extern int trace_level;
+
+int  trace_parse_level(const char *arg);
+void trace_init(int level, const char *dump_file_p);
+void trace_exit(void);
+void trace_record(int call, int fd, int64_t ret, int err, const void *data_p, size_t len);
+
+/**
+ * TRACE - record a call if the current level is at least @level
+ *
+ * The level test is inlined so that a disabled trace costs one load and
+ * one branch.
+ */
+#define TRACE(level, call, fd, ret, err, data_p, len)                     \
+    do                                                                    \
+    {                                                                     \
+        if (__builtin_expect(trace_level >= (level), 0))                  \
+            trace_record((call), (fd), (ret), (err),                      \
+                         trace_level >= TRACE_DATA || (level) < TRACE_SYSCALLS ? (data_p) : NULL, \
+                         (len));                                          \
+    } while (0)
+
+#endif /* TRACE_H */
@@ -0,0 +1,137 @@
+// COMMON - AF_UNIX addressing and descriptor passing
+#include <string.h>     /* memset(), memcpy(), strlen() */
+#include <stddef.h>     /* offsetof() */
+#include <unistd.h>     /* close() */
+#include <errno.h>      /* ENAMETOOLONG */
+
+#include "unixsock.h"
+
+/**
+ * unix_addr - build the address of a Unix-domain socket
+ * @path_p: filesystem path, or "@NAME" for NAME in the abstract namespace
+ * @addr_p: where to store the address
+ * @len_p: where to store the address length to pass to bind()/connect()
+ *
+ * Abstract names need no file and vanish with the last socket using
+ * them; their length, not a NUL, tells where they end.
+ *
+ * Return 0, or -1 with errno set to ENAMETOOLONG.
+ */
+int unix_addr(const char *path_p, struct sockaddr_un *addr_p, socklen_t *len_p)
+{
+    size_t len = strlen(path_p);
+
+    memset(addr_p, 0, sizeof(*addr_p));
+    addr_p->sun_family = AF_UNIX;
+
+    if (len == 0 || len >= sizeof(addr_p->sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memcpy(addr_p->sun_path, path_p, len);
+    if (path_p[0] == '@')
+    {
+        addr_p->sun_path[0] = '\0';
+        *len_p = offsetof(struct sockaddr_un, sun_path) + len;
+    }
+    else
+        *len_p = offsetof(struct sockaddr_un, sun_path) + len + 1;
+
+    return 0;
+}
+
+/**
+ * unix_addr_len - length of an address built by unix_addr()
+ */
+socklen_t unix_addr_len(const struct sockaddr_un *addr_p)
+{
+    if (addr_p->sun_path[0] == '\0')
+        return offsetof(struct sockaddr_un, sun_path) + 1 + strlen(addr_p->sun_path + 1);
+
+    return offsetof(struct sockaddr_un, sun_path) + strlen(addr_p->sun_path) + 1;
+}
+
+/**
+ * unix_send_fds - send data along with open descriptors (SCM_RIGHTS)
+ *
+ * The receiver gets its own copies of @fds_p; the caller keeps its own.
+ *
+ * Return what sendmsg() returns.
+ */
+ssize_t unix_send_fds(int sock, const void *data_p, size_t len, const int *fds_p, int nfds)
+{
+    union
+    {
+        struct cmsghdr hdr;
+        char           buf[CMSG_SPACE(sizeof(int) * UNIX_MAX_FDS)];
+    } ctl;
+    struct iovec  iov = { .iov_base = (void *)data_p, .iov_len = len };
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctl, 0, sizeof(ctl));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctl.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+    struct cmsghdr *cmsg_p = CMSG_FIRSTHDR(&msg);
+    cmsg_p->cmsg_level = SOL_SOCKET;
+    cmsg_p->cmsg_type  = SCM_RIGHTS;
+    cmsg_p->cmsg_len   = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cmsg_p), fds_p, sizeof(int) * nfds);
+
+    return sendmsg(sock, &msg, MSG_NOSIGNAL);
+}
+
+/**
+ * unix_recv_fds - receive data and the descriptors that came with it
+ * @fds_p: where to store the descriptors (close-on-exec)
+ * @nfds_p: in: room in @fds_p, out: descriptors received. Any beyond
+ *      the room are closed.
+ *
+ * Return what recvmsg() returns.
+ */
+ssize_t unix_recv_fds(int sock, void *data_p, size_t len, int *fds_p, int *nfds_p)
+{
+    union
+    {
+        struct cmsghdr hdr;
+        char           buf[CMSG_SPACE(sizeof(int) * UNIX_MAX_FDS)];
+    } ctl;
+    struct iovec  iov = { .iov_base = data_p, .iov_len = len };
+    struct msghdr msg;
+    int           room = *nfds_p;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    *nfds_p = 0;
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0)
+        return n;
+
+    for (struct cmsghdr *cmsg_p = CMSG_FIRSTHDR(&msg); cmsg_p; cmsg_p = CMSG_NXTHDR(&msg, cmsg_p))
+    {
+        if (cmsg_p->cmsg_level != SOL_SOCKET || cmsg_p->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        int count = (cmsg_p->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count; i++)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg_p) + i * sizeof(int), sizeof(int));
+            if (*nfds_p < room)
+                fds_p[(*nfds_p)++] = fd;
+            else
+                close(fd);
+        }
+    }
+
+    return n;
+}
@@ -0,0 +1,17 @@
+// COMMON - AF_UNIX addressing and descriptor passing
+#ifndef UNIXSOCK_H
+#define UNIXSOCK_H
+
+#include <sys/types.h>  /* ssize_t */
+#include <sys/socket.h> /* socklen_t */
+#include <sys/un.h>     /* struct sockaddr_un */
+
+#define UNIX_PREFIX         "unix:"     /* client DEST-HOST prefix */
+#define UNIX_MAX_FDS        8           /* descriptors per message at most */
+
+int       unix_addr(const char *path_p, struct sockaddr_un *addr_p, socklen_t *len_p);
+socklen_t unix_addr_len(const struct sockaddr_un *addr_p);
+ssize_t   unix_send_fds(int sock, const void *data_p, size_t len, const int *fds_p, int nfds);
+ssize_t   unix_recv_fds(int sock, void *data_p, size_t len, int *fds_p, int *nfds_p);
+
+#endif /* UNIXSOCK_H */
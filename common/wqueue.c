@@ -0,0 +1,192 @@
+// COMMON - per-connection outbound write queue
+#include <stdlib.h>     /* malloc(), realloc(), free() */
+#include <string.h>     /* memcpy(), memset() */
+#include <errno.h>      /* EAGAIN */
+#include <sys/socket.h> /* sendmsg() */
+
+#include "wqueue.h"
+
+/**
+ * wq_append - queue a copy of @data_p without sending anything
+ *
+ * Return 0, or -1 if memory could not be allocated.
+ */
+int wq_append(struct wqueue *wq_p, const void *data_p, size_t len)
+{
+    if (len == 0)
+        return 0;
+
+    if (wq_p->count == wq_p->cap)
+    {
+        unsigned      cap   = wq_p->cap ? wq_p->cap * 2 : 8;
+        struct iovec *iov_p = malloc(cap * sizeof(*iov_p));
+        if (!iov_p)
+            return -1;
+
+        // Unwrap the ring while growing it.
+        for (unsigned i = 0; i < wq_p->count; i++)
+            iov_p[i] = wq_p->iov[(wq_p->head + i) & (wq_p->cap - 1)];
+        free(wq_p->iov);
+        wq_p->iov  = iov_p;
+        wq_p->cap  = cap;
+        wq_p->head = 0;
+    }
+
+    void *copy_p = malloc(len);
+    if (!copy_p)
+        return -1;
+    memcpy(copy_p, data_p, len);
+
+    struct iovec *iov_p = &wq_p->iov[(wq_p->head + wq_p->count) & (wq_p->cap - 1)];
+    iov_p->iov_base = copy_p;
+    iov_p->iov_len  = len;
+    wq_p->count++;
+    wq_p->bytes += len;
+
+    return 0;
+}
+
+/* Drop @n sent bytes from the front of the queue. */
+static void wq_consume(struct wqueue *wq_p, size_t n)
+{
+    wq_p->bytes -= n;
+    n += wq_p->off;
+
+    while (wq_p->count > 0 && n >= wq_p->iov[wq_p->head].iov_len)
+    {
+        n -= wq_p->iov[wq_p->head].iov_len;
+        free(wq_p->iov[wq_p->head].iov_base);
+        wq_p->head = (wq_p->head + 1) & (wq_p->cap - 1);
+        wq_p->count--;
+    }
+
+    wq_p->off = n;
+}
+
+/**
+ * wq_flush - send as much of the queue as the socket takes
+ * @wq_p: the queue
+ * @fd: non-blocking socket
+ * @flags: extra sendmsg() flags, e.g. MSG_MORE when more data follows
+ *
+ * Return 0 when the queue is empty, 1 when the socket is full and data
+ * remains queued, -1 on a socket error (errno is set).
+ */
+int wq_flush(struct wqueue *wq_p, int fd, int flags)
+{
+    while (wq_p->count > 0)
+    {
+        struct iovec iov[WQ_IOV_MAX];
+        unsigned     n = wq_p->count < WQ_IOV_MAX ? wq_p->count : WQ_IOV_MAX;
+
+        for (unsigned i = 0; i < n; i++)
+            iov[i] = wq_p->iov[(wq_p->head + i) & (wq_p->cap - 1)];
+        iov[0].iov_base  = (char *)iov[0].iov_base + wq_p->off;
+        iov[0].iov_len  -= wq_p->off;
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = n;
+
+        // More segments than fit in one call: they are not the last.
+        ssize_t sent = sendmsg(fd, &msg, flags | MSG_NOSIGNAL | MSG_DONTWAIT |
+                                         (wq_p->count > n ? MSG_MORE : 0));
+        if (sent < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 1 : -1;
+
+        wq_consume(wq_p, sent);
+    }
+
+    // The ring stays, for the next time the socket falls behind: it goes
+    // with the connection, in wq_free().
+    return 0;
+}
+
+/**
+ * wq_sendv - send the segments of @iov_p after whatever is already queued
+ * @iov_p: the segments, @iovcnt of them
+ * @flags: extra sendmsg() flags
+ *
+ * When the queue is empty the segments go straight to the socket in one
+ * sendmsg(), and only the part the socket did not take is copied.
+ *
+ * Return 0 when everything was sent, 1 when data remains queued, -1 on
+ * error.
+ */
+int wq_sendv(struct wqueue *wq_p, int fd, const struct iovec *iov_p, int iovcnt, int flags)
+{
+    if (wq_p->count > 0)
+    {
+        for (int i = 0; i < iovcnt; i++)
+        {
+            if (wq_append(wq_p, iov_p[i].iov_base, iov_p[i].iov_len) != 0)
+                return -1;
+        }
+        return wq_flush(wq_p, fd, flags);
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = (struct iovec *)iov_p;
+    msg.msg_iovlen = iovcnt;
+
+    ssize_t sent = sendmsg(fd, &msg, flags | MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+        sent = 0;
+    }
+
+    for (int i = 0; i < iovcnt; i++)
+    {
+        size_t skip = (size_t)sent < iov_p[i].iov_len ? (size_t)sent : iov_p[i].iov_len;
+        sent -= skip;
+        if (wq_append(wq_p, (const char *)iov_p[i].iov_base + skip, iov_p[i].iov_len - skip) != 0)
+            return -1;
+    }
+
+    return wq_p->count > 0;
+}
+
+/**
+ * wq_send - send @data_p after whatever is already queued
+ *
+ * When the queue is empty the data goes straight from @data_p to the
+ * socket, and only the part the socket did not take is copied.
+ *
+ * Return 0 when everything was sent, 1 when data remains queued, -1 on
+ * error.
+ */
+int wq_send(struct wqueue *wq_p, int fd, const void *data_p, size_t len, int flags)
+{
+    if (wq_p->count == 0)
+    {
+        ssize_t sent = send(fd, data_p, len, flags | MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+            sent = 0;
+        }
+
+        if ((size_t)sent == len)
+            return 0;
+
+        return wq_append(wq_p, (const char *)data_p + sent, len - sent) == 0 ? 1 : -1;
+    }
+
+    if (wq_append(wq_p, data_p, len) != 0)
+        return -1;
+
+    return wq_flush(wq_p, fd, flags);
+}
+
+void wq_free(struct wqueue *wq_p)
+{
+    for (unsigned i = 0; i < wq_p->count; i++)
+        free(wq_p->iov[(wq_p->head + i) & (wq_p->cap - 1)].iov_base);
+    free(wq_p->iov);
+    memset(wq_p, 0, sizeof(*wq_p));
+}
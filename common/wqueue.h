@@ -0,0 +1,50 @@
+// COMMON - per-connection outbound write queue
+//
+// Whatever the socket does not take right away is copied into the
+// queue, in order, and sent later with one sendmsg() per flush covering
+// up to WQ_IOV_MAX queued segments. The owner of the socket polls for
+// writability only while wq_pending() is not zero.
+//
+// The queue can also be filled without any syscall (wq_append()) and
+// flushed once, so that many small messages leave in one sendmsg() and,
+// with MSG_MORE, in as few segments as possible.
+#ifndef WQUEUE_H
+#define WQUEUE_H
+
+#include <stddef.h>     /* size_t */
+#include <sys/uio.h>    /* struct iovec */
+
+#define WQ_IOV_MAX  64  /* segments per sendmsg() */
+
+/**
+ * struct wqueue - bytes accepted by the caller but not by the socket yet
+ * @iov: ring of queued segments, each one a malloc'ed copy
+ * @cap: size of @iov, a power of 2 (0 until the first append). The ring
+ *      is kept once allocated, until wq_free().
+ * @head: index of the oldest segment
+ * @count: number of queued segments
+ * @off: bytes of the oldest segment already sent
+ * @bytes: bytes queued and not sent yet
+ */
+struct wqueue
+{
+    struct iovec   *iov;
+    unsigned        cap;
+    unsigned        head;
+    unsigned        count;
+    size_t          off;
+    size_t          bytes;
+};
+
+static inline size_t wq_pending(const struct wqueue *wq_p)
+{
+    return wq_p->bytes;
+}
+
+int  wq_append(struct wqueue *wq_p, const void *data_p, size_t len);
+int  wq_flush(struct wqueue *wq_p, int fd, int flags);
+int  wq_send(struct wqueue *wq_p, int fd, const void *data_p, size_t len, int flags);
+int  wq_sendv(struct wqueue *wq_p, int fd, const struct iovec *iov_p, int iovcnt, int flags);
+void wq_free(struct wqueue *wq_p);
+
+#endif /* WQUEUE_H */
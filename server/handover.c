@@ -0,0 +1,206 @@
+// SERVER - zero-downtime restart: handing the listeners to a new process
+//
+// With --handover=PATH the server listens on the Unix socket PATH for a
+// successor. A new server started with the same --handover connects to
+// it before it creates any listener of its own:
+//
+//   1. The old process sends its listening descriptors (SCM_RIGHTS,
+//      UNIX_MAX_FDS per message, each behind the same struct
+//      handover_hello): the PATH listener itself, the --unix listener if
+//      any, then the IPv4 and IPv6 listeners of each worker, in worker
+//      order.
+//   2. The new process checks that it listens the same way (port,
+//      workers, --unix), starts its workers on the descriptors it got,
+//      and answers with one byte once they all wait for clients.
+//   3. Only then does the old process stop accepting: its workers drop
+//      the listeners from their epoll sets, serve the clients they have
+//      until those leave (or --drain-timeout), and exit.
+//
+// The sockets themselves never close, so neither the listen queues nor
+// the reuseport groups (nor a --steer=cpu program attached to them) are
+// disturbed: a connection that arrives during the handover waits in its
+// queue for whichever process accepts first, and none is refused. If the
+// new process gives up before answering, the old one keeps serving.
+// Established clients stay with the old process: their state (partial
+// frames, TLS, shared-memory rings) does not travel with a descriptor.
+#define _GNU_SOURCE
+#include <stdio.h>      /* printf() */
+#include <unistd.h>     /* close(), unlink() */
+#include <errno.h>      /* errno, ENOENT, ECONNREFUSED, EPROTO */
+#include <sys/socket.h> /* socket(), connect(), accept4() */
+#include <sys/time.h>   /* struct timeval */
+
+#include "server.h"
+#include "unixsock.h"
+
+static void handover_timeout(int sock)
+{
+    struct timeval tv = { .tv_sec = HANDOVER_TIMEOUT_S, .tv_usec = 0 };
+
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/**
+ * handover_listen - listen on PATH for a successor
+ * @path_p: filesystem path, or "@NAME" in the abstract namespace
+ *
+ * A SOCK_SEQPACKET socket, so that each message keeps its descriptors.
+ * A stale socket file left by a previous run is removed first.
+ *
+ * Return the listener (non-blocking), or -1 with errno set.
+ */
+int handover_listen(const char *path_p)
+{
+    struct sockaddr_un addr;
+    socklen_t          addrlen;
+
+    if (unix_addr(path_p, &addr, &addrlen) != 0)
+        return -1;
+
+    printf("handoversock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) -> ");
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    printf("%d\n", sock);
+    if (sock < 0)
+        return -1;
+
+    if (path_p[0] != '@')
+        unlink(path_p);
+
+    printf("bind(handoversock, \"%s\") -> ", path_p);
+    int rc = bind(sock, (struct sockaddr *)&addr, addrlen);
+    printf("%d\n", rc);
+    if (rc == 0)
+    {
+        printf("listen(handoversock, 1) -> ");
+        rc = listen(sock, 1);
+        printf("%d\n", rc);
+    }
+
+    if (rc != 0)
+    {
+        int err = errno;
+        close(sock);
+        errno = err;
+        return -1;
+    }
+
+    return sock;
+}
+
+/**
+ * handover_take - get the listeners of the server running on PATH, if any
+ * @path_p: the --handover path
+ * @hello_p: filled in with what the old process says it sends
+ * @fds_p: where to store the descriptors, in the order of the file header
+ * @room: size of @fds_p; descriptors beyond it are closed
+ * @peer_p: the connection to answer on with handover_ack()
+ *
+ * Return the number of descriptors received, 0 if no server listens on
+ * PATH, or -1 with errno set (EPROTO: not a server that hands over).
+ */
+int handover_take(const char *path_p, struct handover_hello *hello_p, int *fds_p, int room, int *peer_p)
+{
+    struct sockaddr_un addr;
+    socklen_t          addrlen;
+
+    if (unix_addr(path_p, &addr, &addrlen) != 0)
+        return -1;
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+
+    printf("handover: connect(\"%s\") -> ", path_p);
+    int rc = connect(sock, (struct sockaddr *)&addr, addrlen);
+    printf("%d%s\n", rc, rc == 0 ? "" : errno == ENOENT || errno == ECONNREFUSED ? " (nobody to take over from)" : "");
+    if (rc != 0)
+    {
+        int err = errno;
+        close(sock);
+        errno = err;
+        return err == ENOENT || err == ECONNREFUSED ? 0 : -1;
+    }
+
+    // A predecessor that does not answer is none.
+    handover_timeout(sock);
+
+    int got = 0, msgs = 0;
+    do
+    {
+        struct handover_hello hello;
+        int                   n   = room - got;
+        ssize_t               len = unix_recv_fds(sock, &hello, sizeof(hello), fds_p + got, &n);
+
+        got += n;
+        if (len != sizeof(hello) || hello.magic != HANDOVER_MAGIC || (msgs++ > 0 && hello.nfds != hello_p->nfds))
+        {
+            int err = len < 0 ? errno : EPROTO;
+            while (got > 0)
+                close(fds_p[--got]);
+            close(sock);
+            errno = err;
+            return -1;
+        }
+        *hello_p = hello;
+    } while (got < hello_p->nfds && got < room);
+
+    printf("handover: %d descriptor(s) from a server on port %u with %u worker(s)%s\n",
+           got, hello_p->port, hello_p->workers, hello_p->unix_listener ? " and a --unix listener" : "");
+
+    *peer_p = sock;
+    return got;
+}
+
+/**
+ * handover_ack - tell the old process its listeners are served
+ * @peer: from handover_take(), closed here
+ *
+ * Return 0, or -1 if the old process did not get it (it then keeps
+ * accepting too, which is harmless).
+ */
+int handover_ack(int peer)
+{
+    char    ack = 1;
+    ssize_t n   = send(peer, &ack, sizeof(ack), MSG_NOSIGNAL);
+
+    close(peer);
+    return n == sizeof(ack) ? 0 : -1;
+}
+
+/**
+ * handover_give - hand the listeners to a successor that connected
+ * @listen_fd: from handover_listen(), readable
+ * @hello_p: what is sent, @hello_p->nfds descriptors
+ * @fds_p: the descriptors
+ *
+ * Waits for the successor's answer, HANDOVER_TIMEOUT_S at most.
+ *
+ * Return 0 once the successor serves the listeners: the caller must stop
+ * accepting. -1 if it did not answer: nothing changed.
+ */
+int handover_give(int listen_fd, const struct handover_hello *hello_p, const int *fds_p)
+{
+    int peer = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    printf("handover: accept4(handoversock) -> %d\n", peer);
+    if (peer < 0)
+        return -1;
+
+    handover_timeout(peer);
+
+    int rc = 0;
+    for (int i = 0; i < hello_p->nfds && rc == 0; i += UNIX_MAX_FDS)
+    {
+        int n = hello_p->nfds - i < UNIX_MAX_FDS ? hello_p->nfds - i : UNIX_MAX_FDS;
+        if (unix_send_fds(peer, hello_p, sizeof(*hello_p), fds_p + i, n) != sizeof(*hello_p))
+            rc = -1;
+    }
+
+    char ack = 0;
+    if (rc == 0 && recv(peer, &ack, sizeof(ack), 0) != sizeof(ack))
+        rc = -1;
+    printf("handover: %d descriptor(s) sent -> %s\n", hello_p->nfds, rc == 0 ? "taken" : "not taken, still serving");
+
+    close(peer);
+    return rc;
+}
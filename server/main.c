@@ -6,32 +6,406 @@
 #include <errno.h>      /* errno, program_invocation_short_name */
 #include <string.h>     /* strerror() */
 #include <sys/socket.h> /* socket(), setsockopt(), connect() */
+#include <netinet/tcp.h> /* TCP_NODELAY, TCP_QUICKACK */
+#include <netinet/udp.h> /* UDP_GRO */
+#include <linux/filter.h> /* struct sock_fprog, SKF_AD_CPU */
 #include <arpa/inet.h>  /* htons(), inet_pton() */
 #include <signal.h>     /* signal(), SIGINT */
 #include <sys/epoll.h>
+#include <poll.h>       /* ppoll() */
+#include <argp.h>
+#include <pthread.h>    /* pthread_create(), pthread_setaffinity_np() */
+#include <sched.h>      /* cpu_set_t, CPU_SET() */
+#include <fcntl.h>      /* splice(), open() */
+#include <sys/resource.h> /* setrlimit() */
 
-#define RED     "\x1b[1;31m"
-#define GREEN   "\x1b[1;32m"
-#define CYAN    "\x1b[1;36m"
-#define NORMAL  "\x1b[0m"
+#include "server.h"
+#include "trace.h"
+#include "cpustat.h"
+#include "unixsock.h"
 
-static void syntax()
+#define RX_POOL_BUF_MIN 4096    /* smallest receive buffer lent to a client */
+#define EPOLL_SHM_TAG   1       /* epoll_event.data.ptr bit: a client's doorbell, not its socket */
+#define UDP_BATCH       32      /* --udp: buffers per recvmmsg() */
+#define UDP_MAX_ROUNDS  8       /* --udp: recvmmsg() calls per wake-up, at most */
+#define UDP_RCVBUF      (8 << 20) /* --udp: SO_RCVBUF asked for, capped by net.core.rmem_max */
+#define DRAIN_POLL_MS   100     /* --handover: how often main() checks the draining workers */
+
+const char *argp_program_version = "1.0";
+const char *argp_program_bug_address = "";
+static char doc[] = "Accept TCP clients on IPv4 and IPv6 (and Unix-domain clients with --unix, or UDP datagrams with --udp) and print (or --capture) what they send.";
+static char args_doc[] = "PORT";
+#define OPT_STATS_INTERVAL  0x100   /* long options only */
+#define OPT_STEER           0x101
+#define OPT_TLS             0x102
+#define OPT_TLS_CERT        0x103
+#define OPT_TLS_KEY         0x104
+#define OPT_CAPTURE         0x105
+#define OPT_CAPTURE_SIZE    0x106
+#define OPT_UDP             0x107
+#define OPT_CRC             0x108
+#define OPT_HANDOVER        0x109
+#define OPT_DRAIN_TIMEOUT   0x10a
+
+#ifndef TCPI_OPT_SYN_DATA
+#define TCPI_OPT_SYN_DATA   32      /* linux/tcp.h, missing from older glibc */
+#endif
+
+static struct argp_option options[] =
+{
+    { "workers",        'w', "N",     0,                   "Number of worker threads, each with its own SO_REUSEPORT listeners and epoll loop (default: 1)" },
+    { "pin",            'p', "CPU",   OPTION_ARG_OPTIONAL, "Pin worker i to CPU (CPU + i) modulo the number of online CPUs (default CPU: 0)" },
+    { "backlog",        'b', "N",     0,                   "listen() backlog (default: SOMAXCONN)" },
+    { "fastopen",       'F', "QLEN",  OPTION_ARG_OPTIONAL, "Accept data in the SYN (TCP Fast Open) with up to QLEN cookie-validated connections pending (default QLEN: 1024). Needs net.ipv4.tcp_fastopen & 2" },
+    { "steer",          OPT_STEER, "MODE", 0,                                "Spread TCP clients over the workers by kernel hash (hash) or to the worker pinned to the CPU that received the connection (cpu, a SO_ATTACH_REUSEPORT_CBPF program). Both imply --pin and count the clients whose SO_INCOMING_CPU is the worker's" },
+    { "defer-accept",   'D', "SECS",  OPTION_ARG_OPTIONAL, "Only wake up for a connection once its first data arrived, waiting SECS seconds for it at most (TCP_DEFER_ACCEPT, default SECS: 5)" },
+    { "unix",           'u', "PATH",  0,                   "Also accept clients on the Unix-domain stream socket PATH (@NAME: abstract namespace). Its clients may switch to shared-memory rings (epoll only)" },
+    { "max-events",     'm', "N",     0,                   "Size of the epoll_event array passed to each epoll_pwait() (default: 64)" },
+    { "edge-triggered", 'e', 0,       0,                   "Register clients with EPOLLET and drain each socket until EAGAIN" },
+    { "busy-poll",      'B', "USECS", OPTION_ARG_OPTIONAL, "Keep polling with epoll_wait(timeout=0) for USECS microseconds after each event before blocking again (default USECS: 50), and set SO_BUSY_POLL, SO_PREFER_BUSY_POLL, TCP_NODELAY and TCP_QUICKACK on clients. Burns a core: use with --pin (epoll only)" },
+    { "io",             'I', "BACKEND", 0,                 "I/O back-end: epoll (default) or uring" },
+    { "echo",           'E', 0,       0,                   "Send everything received back to the client" },
+    { "framed",         'f', 0,       0,                   "Clients send length-prefixed frames: parse them (and echo whole frames with --echo)" },
+    { "udp",            OPT_UDP, 0,   0,                   "Receive the datagrams of clients running with --udp instead of TCP clients: recvmmsg() batches of --recv-size buffers with UDP_GRO, and per-flow loss and reordering counts. epoll only" },
+    { "crc",            OPT_CRC, "BYTES", OPTION_ARG_OPTIONAL, "Check the CRC32C that clients running with --crc end their messages with: every frame with --framed, else every BYTES bytes of the stream (the clients' --msg-size). Mismatches are counted and traced, the clients kept" },
+    { "cork",           'k', 0,       0,                   "With --echo, queue the echoes of one read pass and send them with a single sendmsg(MSG_MORE) (epoll only)" },
+    { "sink",           'S', "METHOD", 0,                  "What to do with received data: buffer (default, recv() into a reusable buffer) or splice (splice() to /dev/null without copying to user space, epoll only)" },
+    { "recv-size",      'R', "BYTES", 0,                   "Bytes per recv() or splice(), or per --udp or --io=uring buffer (default: 1024, 64 KiB with --sink=splice or --udp)" },
+    { "tls",            OPT_TLS, "MODE", OPTION_ARG_OPTIONAL,   "Serve TCP clients over TLS 1.3, with the records built by the kernel (ktls, the default: send()/recv()/splice() stay as they are) or by OpenSSL in user space (user). epoll only" },
+    { "tls-cert",       OPT_TLS_CERT, "FILE", 0,                "--tls: PEM certificate. Made self-signed for localhost, and saved with --tls-key, if FILE does not exist (default: self-signed, in memory)" },
+    { "tls-key",        OPT_TLS_KEY, "FILE", 0,                 "--tls: PEM private key of --tls-cert" },
+    { "capture",        OPT_CAPTURE, "FILE", 0,             "Record what each recv() returns (each frame with --framed) with its client and arrival time in FILE, a memory-mapped capture the client can --replay. Implies --trace=events" },
+    { "capture-size",   OPT_CAPTURE_SIZE, "BYTES", 0,       "--capture: size FILE is allocated with; messages that do not fit are dropped and counted (default: 256 MiB)" },
+    { "idle-timeout",   'i', "SECS",  0,                   "Close clients that send nothing for SECS seconds (default: never)" },
+    { "max-conns",      'c', "N",     0,                   "Most clients held at once over all workers; more are closed as soon as accepted (default: no limit)" },
+    { "read-timeout",   'r', "SECS",  0,                   "With --framed, close clients that take more than SECS seconds to complete a frame (default: never)" },
+    { "handover",       OPT_HANDOVER, "PATH", 0,           "Zero-downtime restart: take the listeners over from the server listening on the Unix socket PATH (@NAME: abstract namespace), if any, and listen there for a successor. The one that hands them over stops accepting and exits once its clients are gone. Same PORT, --workers and --unix on both sides; epoll only" },
+    { "drain-timeout",  OPT_DRAIN_TIMEOUT, "SECS", 0,      "--handover: close the clients still open this long after the handover (default: 10)" },
+    { "stats-file",     's', "FILE",  0,                   "Rewrite FILE with Prometheus-style counters every --stats-interval (default: none)" },
+    { "stats-interval", OPT_STATS_INTERVAL, "SECS", 0,     "Seconds between two --stats-file snapshots (default: 1)" },
+    { "quiet",          'q', 0,       0,                   "Do not trace anything (same as --trace=off)" },
+    { "trace",          't', "LEVEL", 0,                   "Trace level: off, events, syscalls or data (default: data, events with --capture or --udp)" },
+    { "trace-file",     'T', "FILE",  0,                   "Dump binary trace records to FILE instead of formatting them on stdout" },
+    { 0 }
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state)
 {
-    fprintf(stderr, "Syntax:  %s PORT\n", program_invocation_short_name);
+    struct arguments *arguments = state->input;
+    switch (key)
+    {
+    case 'w':
+        arguments->workers = atoi(arg);
+        if (arguments->workers < 1)
+        {
+            fprintf(stderr, RED "Invalid number of workers: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'p':
+        arguments->pin_cpu = arg ? atoi(arg) : 0; break;
+    case 'b':
+        arguments->backlog = atoi(arg); break;
+    case 'F':
+        arguments->fastopen_qlen = arg ? atoi(arg) : 1024;
+        if (arguments->fastopen_qlen < 1)
+        {
+            fprintf(stderr, RED "Invalid Fast Open queue length: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case OPT_STEER:
+        if (strcmp(arg, "hash") == 0)
+            arguments->steer = STEER_HASH;
+        else if (strcmp(arg, "cpu") == 0)
+            arguments->steer = STEER_CPU;
+        else
+        {
+            fprintf(stderr, RED "Unknown steering mode: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'D':
+        arguments->defer_accept_s = arg ? atoi(arg) : 5;
+        if (arguments->defer_accept_s < 1)
+        {
+            fprintf(stderr, RED "Invalid number of seconds: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'u':
+    {
+        struct sockaddr_un addr;
+        socklen_t          len;
+        if (unix_addr(arg, &addr, &len) != 0)
+        {
+            fprintf(stderr, RED "Invalid Unix socket path: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        arguments->unix_path_p = arg;
+        break;
+    }
+    case 'm':
+        arguments->max_events = atoi(arg);
+        if (arguments->max_events < 1)
+        {
+            fprintf(stderr, RED "Invalid number of events: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'e':
+        arguments->edge_triggered = 1; break;
+    case 'B':
+        arguments->busy_poll_us = arg ? strtoul(arg, NULL, 0) : 50;
+        if (arguments->busy_poll_us < 1 || arguments->busy_poll_us > 1000000)
+        {
+            fprintf(stderr, RED "Invalid spin budget: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'I':
+        if (strcmp(arg, "epoll") == 0)
+            arguments->io = IO_EPOLL;
+        else if (strcmp(arg, "uring") == 0)
+            arguments->io = IO_URING;
+        else
+        {
+            fprintf(stderr, RED "Unknown I/O back-end: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'E':
+        arguments->echo = 1; break;
+    case 'f':
+        arguments->framed = 1; break;
+    case OPT_UDP:
+        arguments->udp = 1; break;
+    case OPT_CRC:
+        arguments->crc      = 1;
+        arguments->crc_size = arg ? strtoul(arg, NULL, 0) : 0;
+        if (arg && (arguments->crc_size <= CRC32C_SIZE || arguments->crc_size > UINT32_MAX))
+        {
+            fprintf(stderr, RED "Invalid message size: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'k':
+        arguments->cork = 1; break;
+    case 'S':
+        if (strcmp(arg, "buffer") == 0)
+            arguments->sink = SINK_BUFFER;
+        else if (strcmp(arg, "splice") == 0)
+            arguments->sink = SINK_SPLICE;
+        else
+        {
+            fprintf(stderr, RED "Unknown sink: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case OPT_TLS:
+        arguments->tls = tls_parse_mode(arg);
+        if ((int)arguments->tls < 0)
+        {
+            fprintf(stderr, RED "Unknown TLS mode: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case OPT_TLS_CERT:
+        arguments->tls_cert_p = arg; break;
+    case OPT_TLS_KEY:
+        arguments->tls_key_p = arg; break;
+    case OPT_CAPTURE:
+        arguments->capture_p = arg; break;
+    case OPT_CAPTURE_SIZE:
+        arguments->capture_size = strtoul(arg, NULL, 0);
+        if (arguments->capture_size < CAPTURE_SIZE_MIN)
+        {
+            fprintf(stderr, RED "Invalid capture size: %s (1 MiB at least)" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'R':
+        arguments->recv_size = strtoul(arg, NULL, 0);
+        if (arguments->recv_size < 1)
+        {
+            fprintf(stderr, RED "Invalid receive size: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 's':
+        arguments->stats_file_p = arg; break;
+    case OPT_HANDOVER:
+    {
+        struct sockaddr_un addr;
+        socklen_t          len;
+        if (unix_addr(arg, &addr, &len) != 0)
+        {
+            fprintf(stderr, RED "Invalid Unix socket path: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        arguments->handover_p = arg;
+        break;
+    }
+    case 'i':
+    case 'r':
+    case OPT_DRAIN_TIMEOUT:
+    case OPT_STATS_INTERVAL:
+    {
+        double secs = strtod(arg, NULL);
+        if (secs <= 0 || secs > 86400)
+        {
+            fprintf(stderr, RED "Invalid number of seconds: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        if (key == 'i')
+            arguments->idle_timeout_ms = (unsigned)(secs * 1000 + 0.5);
+        else if (key == 'r')
+            arguments->read_timeout_ms = (unsigned)(secs * 1000 + 0.5);
+        else if (key == OPT_DRAIN_TIMEOUT)
+            arguments->drain_timeout_ms = (unsigned)(secs * 1000 + 0.5);
+        else
+            arguments->stats_interval_ms = (unsigned)(secs * 1000 + 0.5);
+        break;
+    }
+    case 'c':
+        arguments->max_conns = strtoul(arg, NULL, 0);
+        if (arguments->max_conns < 1)
+        {
+            fprintf(stderr, RED "Invalid number of connections: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'q':
+        arguments->trace_level = TRACE_OFF; break;
+    case 't':
+        arguments->trace_level = trace_parse_level(arg);
+        if (arguments->trace_level < 0)
+        {
+            fprintf(stderr, RED "Unknown trace level: %s" NORMAL "\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'T':
+        arguments->trace_file_p = arg; break;
+
+    case ARGP_KEY_ARG:
+        switch (state->arg_num)
+        {
+        case 0:
+            arguments->port = (uint16_t)atoi(arg); break;
+        default:
+            fprintf(stderr, RED "Too many arguments" NORMAL "\n");
+            argp_usage(state);  /* Too many arguments. */
+        }
+        break;
+
+    case ARGP_KEY_END:
+        if (state->arg_num < 1)
+        {
+            fprintf(stderr, RED "Missing arguments" NORMAL "\n");
+            argp_usage(state);
+        }
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
 }
 
-static volatile int stop = 0;
+static struct argp argp = { options, parse_opt, args_doc, doc, 0, 0, 0 };
+
+
+volatile int stop = 0;
+int          workers_ready = 0;
+static int   unix_listen_fd = -1;   /* --unix: shared by all the workers */
+static volatile int draining = 0;   /* --handover: a successor took the listeners */
+static int   workers_drained = 0;   /* --handover: workers whose last client is gone */
+static SSL_CTX *tls_ctx_p   = NULL; /* --tls: shared by all the workers */
+static struct capture *capture_p = NULL; /* --capture: shared by all the workers */
 static void sig_handler(int signo)
 {
     stop = 1;
 }
 
-static int get_listen_sock4(uint16_t port)
+/**
+ * listen_tune - set the options of a TCP listener that bind() does not care about
+ * @listensock: the listener, bound but not listening yet
+ * @name_p: its name in the printed syscalls
+ * @args_p: --fastopen and --defer-accept
+ *
+ * With TCP_DEFER_ACCEPT the handshake completes in the kernel, but the
+ * connection only reaches the accept queue (and wakes a worker) once
+ * the client sent something. With TCP_FASTOPEN a client holding a
+ * cookie sends its first request in the SYN. Either way accept_clients()
+ * finds data waiting and reads it on the spot.
+ */
+static void listen_tune(int listensock, const char *name_p, const struct arguments *args_p)
+{
+    int rc;
+
+    if (args_p->fastopen_qlen)
+    {
+        int qlen = args_p->fastopen_qlen;
+        printf("setsockopt(%s, IPPROTO_TCP, TCP_FASTOPEN, %d) -> ", name_p, qlen);
+        rc = setsockopt(listensock, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof qlen);
+        printf("%d\n", rc);
+        if (rc != 0)
+        {
+            fprintf(stderr, RED "setsockopt() failed: %m" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (args_p->defer_accept_s)
+    {
+        int secs = args_p->defer_accept_s;
+        printf("setsockopt(%s, IPPROTO_TCP, TCP_DEFER_ACCEPT, %d) -> ", name_p, secs);
+        rc = setsockopt(listensock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &secs, sizeof secs);
+        printf("%d\n", rc);
+        if (rc != 0)
+        {
+            fprintf(stderr, RED "setsockopt() failed: %m" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * udp_tune - --udp: ask for the datagrams of a flow in as few buffers as possible
+ * @sock: the UDP socket, bound
+ * @name_p: its name in the printed syscalls
+ *
+ * With UDP_GRO the kernel hands up runs of same-sized datagrams of one
+ * flow as a single buffer, and says where to cut it in a cmsg. Kernels
+ * older than 5.0 do not have it: each datagram then takes a buffer.
+ * A larger receive queue absorbs the bursts a batching sender makes.
+ */
+static void udp_tune(int sock, const char *name_p)
+{
+    int one = 1;
+
+    printf("setsockopt(%s, SOL_UDP, UDP_GRO, 1) -> ", name_p);
+    int rc = setsockopt(sock, SOL_UDP, UDP_GRO, &one, sizeof(one));
+    printf("%d\n", rc);
+    if (rc != 0)
+        fprintf(stderr, RED "setsockopt(UDP_GRO) failed: %m (one datagram per buffer)" NORMAL "\n");
+
+    int size = UDP_RCVBUF;
+    printf("setsockopt(%s, SOL_SOCKET, SO_RCVBUF, %d) -> ", name_p, size);
+    rc = setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    printf("%d\n", rc);
+}
+
+static int get_listen_sock4(const struct arguments *args_p)
 {
+    uint16_t port    = args_p->port;
+    int      backlog = args_p->backlog;
+    int      type    = args_p->udp ? SOCK_DGRAM : SOCK_STREAM;
     int rc = 0;
 
-    printf("listensock4 = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0) -> ");
-    int listensock4 = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    printf("listensock4 = socket(AF_INET, %s | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) -> ", args_p->udp ? "SOCK_DGRAM" : "SOCK_STREAM");
+    int listensock4 = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     printf("%d\n", listensock4);
 
     if (listensock4 < 0)
@@ -63,8 +437,16 @@ static int get_listen_sock4(uint16_t port)
         exit(EXIT_FAILURE);
     }
 
-    printf("listen(listensock4, 1) -> ");
-    rc = listen(listensock4, 1);
+    if (args_p->udp)
+    {
+        udp_tune(listensock4, "listensock4");
+        return listensock4;
+    }
+
+    listen_tune(listensock4, "listensock4", args_p);
+
+    printf("listen(listensock4, %d) -> ", backlog);
+    rc = listen(listensock4, backlog);
     printf("%d\n", rc);
     if (rc < 0)
     {
@@ -75,12 +457,16 @@ static int get_listen_sock4(uint16_t port)
     return listensock4;
 }
 
-static int get_listen_sock6(uint16_t port)
+static int get_listen_sock6(const struct arguments *args_p)
 {
+    uint16_t port    = args_p->port;
+    int      backlog = args_p->backlog;
+    int      type    = args_p->udp ? SOCK_DGRAM : SOCK_STREAM;
     int rc = 0;
 
-    printf("listensock6 = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP) -> ");
-    int listensock6 = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    printf("listensock6 = socket(AF_INET6, %s | SOCK_NONBLOCK | SOCK_CLOEXEC, %s) -> ",
+           args_p->udp ? "SOCK_DGRAM" : "SOCK_STREAM", args_p->udp ? "IPPROTO_UDP" : "IPPROTO_TCP");
+    int listensock6 = socket(AF_INET6, type | SOCK_NONBLOCK | SOCK_CLOEXEC, args_p->udp ? IPPROTO_UDP : IPPROTO_TCP);
     printf("%d\n", listensock6);
 
     if (listensock6 < 0)
@@ -112,8 +498,16 @@ static int get_listen_sock6(uint16_t port)
         exit(EXIT_FAILURE);
     }
 
-    printf("listen(listensock6, 1) -> ");
-    rc = listen(listensock6, 1);
+    if (args_p->udp)
+    {
+        udp_tune(listensock6, "listensock6");
+        return listensock6;
+    }
+
+    listen_tune(listensock6, "listensock6", args_p);
+
+    printf("listen(listensock6, %d) -> ", backlog);
+    rc = listen(listensock6, backlog);
     printf("%d\n", rc);
     if (rc < 0)
     {
@@ -124,200 +518,2187 @@ static int get_listen_sock6(uint16_t port)
     return listensock6;
 }
 
-static int get_client_connection(uint16_t port, sigset_t sigmsk, struct sockaddr_storage * client_address)
+/**
+ * steer_to_cpu - --steer=cpu: send each connection to the worker on its CPU
+ * @listensock: any listener of the reuseport group (one per family)
+ * @args_p: --workers and --pin
+ * @ncpus: online CPUs
+ *
+ * The classic BPF program runs for every SYN and returns the index of a
+ * socket in the group: worker w sits on CPU (pin + w) % ncpus, so the
+ * CPU that took the SYN maps back to w = (cpu - pin) % ncpus. CPUs with
+ * no worker of their own wrap around the workers. Softirq, socket and
+ * worker then touch the connection from the same core and its caches.
+ */
+static void steer_to_cpu(int listensock, const struct arguments *args_p, long ncpus)
 {
-    int rc = 0;
-
-    int listensock4 = get_listen_sock4(port);
-    int listensock6 = get_listen_sock6(port);
+    struct sock_filter code[] =
+    {
+        { BPF_LD  | BPF_W   | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_ALU | BPF_ADD | BPF_K,   0, 0, (uint32_t)(ncpus - args_p->pin_cpu % ncpus) },
+        { BPF_ALU | BPF_MOD | BPF_K,   0, 0, (uint32_t)ncpus },
+        { BPF_ALU | BPF_MOD | BPF_K,   0, 0, (uint32_t)args_p->workers },
+        { BPF_RET | BPF_A,             0, 0, 0 },
+    };
+    struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
 
-    int epfd = epoll_create1(EPOLL_CLOEXEC);
-    if (epfd == -1)
+    printf("setsockopt(%d, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, (cpu + %ld) %% %ld %% %d) -> ",
+           listensock, ncpus - args_p->pin_cpu % ncpus, ncpus, args_p->workers);
+    int rc = setsockopt(listensock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+    printf("%d\n", rc);
+    if (rc != 0)
     {
-        fprintf(stderr, "\x1b[1;31Could not create the listen epoll FD list. Aborting!\n");
+        fprintf(stderr, RED "setsockopt() failed: %m" NORMAL "\n");
         exit(EXIT_FAILURE);
     }
+}
 
-    struct epoll_event  newPeerConnectionEvent;
+/**
+ * get_listen_sock_unix - --unix: the Unix-domain listener of all workers
+ * @path_p: filesystem path, or "@NAME" in the abstract namespace
+ * @backlog: listen() backlog
+ *
+ * AF_UNIX has no SO_REUSEPORT group to spread clients over, so a single
+ * listener is shared: the workers wait on it with EPOLLEXCLUSIVE (or a
+ * multishot accept each), and whoever wakes up first accepts.
+ *
+ * A stale socket file left by a previous run is removed first.
+ */
+static int get_listen_sock_unix(const char *path_p, int backlog)
+{
+    struct sockaddr_un address;
+    socklen_t          addrlen;
+    int                rc = 0;
 
-    memset(&newPeerConnectionEvent, 0, sizeof newPeerConnectionEvent);
-    newPeerConnectionEvent.data.fd = listensock4;
-    newPeerConnectionEvent.events  = EPOLLOUT | EPOLLIN | EPOLLERR | EPOLLRDHUP | EPOLLHUP;
-    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listensock4, &newPeerConnectionEvent) == -1)
-    {
-        fprintf(stderr, "\x1b[1;31Could not add listensock4 to the epoll FD list. Aborting!\n");
-        exit(EXIT_FAILURE);
-    }
+    unix_addr(path_p, &address, &addrlen);
 
-    memset(&newPeerConnectionEvent, 0, sizeof newPeerConnectionEvent);
-    newPeerConnectionEvent.data.fd = listensock6;
-    newPeerConnectionEvent.events  = EPOLLOUT | EPOLLIN | EPOLLERR | EPOLLRDHUP | EPOLLHUP;
-    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listensock6, &newPeerConnectionEvent) == -1)
+    printf("listensockun = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) -> ");
+    int listensockun = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    printf("%d\n", listensockun);
+
+    if (listensockun < 0)
     {
-        fprintf(stderr, "\x1b[1;31Could not add listensock6 to the epoll FD list. Aborting!\n");
         exit(EXIT_FAILURE);
     }
 
-    struct epoll_event  processableEvents;
-    memset(&processableEvents, 0, sizeof processableEvents);
-    int numfds = epoll_pwait(epfd, &processableEvents, 1, -1, &sigmsk);
-    if (numfds < 0)
+    if (path_p[0] != '@')
+        unlink(path_p);
+
+    printf("bind(listensockun, \"%s\") -> ", path_p);
+    rc = bind(listensockun, (struct sockaddr *)&address, addrlen);
+    printf("%d\n", rc);
+    if (rc < 0)
     {
-        if (errno == EINTR)
-        {
-            return -1;
-        }
-        fprintf(stderr, "\x1b[1;31Serious error in epoll setup: epoll_wait() returned < 0 status! %m\n");
+        fprintf(stderr, RED "bind() failed: %m" NORMAL "\n");
         exit(EXIT_FAILURE);
     }
 
-    if (numfds == 0)
+    printf("listen(listensockun, %d) -> ", backlog);
+    rc = listen(listensockun, backlog);
+    printf("%d\n", rc);
+    if (rc < 0)
     {
-        fprintf(stderr, "\x1b[1;31Connection timed out!\n");
+        fprintf(stderr, RED "listen() failed: %m" NORMAL "\n");
         exit(EXIT_FAILURE);
     }
 
-    socklen_t rc_len = sizeof rc;
-    if (getsockopt(processableEvents.data.fd, SOL_SOCKET, SO_ERROR, (void *)&rc, &rc_len) < 0)
+    return listensockun;
+}
+
+static void epoll_add(int epfd, struct conn *conn_p, uint32_t events)
+{
+    struct epoll_event  event;
+
+    memset(&event, 0, sizeof event);
+    event.data.ptr = conn_p;
+    event.events   = events;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, conn_p->fd, &event) == -1)
     {
-        fprintf(stderr, "\x1b[1;31getsockopt() failed\n");
+        fprintf(stderr, RED "Could not add %s to the epoll FD list. Aborting!" NORMAL "\n", conn_p->name);
         exit(EXIT_FAILURE);
     }
+}
 
-    if (rc != 0)
+static struct conn *new_listener(int fd, const char *name_p)
+{
+    struct conn *conn_p = calloc(1, sizeof(*conn_p));
+    if (!conn_p)
     {
-        fprintf(stderr, "\x1b[1;31connect did not go through. rc=%d\n", rc);
+        fprintf(stderr, RED "Out of memory. Aborting!" NORMAL "\n");
         exit(EXIT_FAILURE);
     }
 
+    conn_p->fd       = fd;
+    conn_p->listener = 1;
+    snprintf(conn_p->name, sizeof(conn_p->name), "%s", name_p);
+
+    return conn_p;
+}
+
+/**
+ * conn_new - get a client connection from the worker's pool
+ * @worker_p: the worker that accepted the client
+ * @fd: the client socket
+ *
+ * Clients are numbered by the worker in an interleaved sequence (worker
+ * i of N gives out i, i + N, i + 2N...), so that the numbers are unique
+ * in the process without the workers sharing a counter.
+ *
+ * Return the cleared connection, or NULL at the --max-conns limit (or
+ * out of memory).
+ */
+struct conn *conn_new(struct worker *worker_p, int fd)
+{
+    struct conn *conn_p = pool_get(&worker_p->conn_pool);
+    if (!conn_p)
+        return NULL;
+
+    memset(conn_p, 0, sizeof(*conn_p));
+    conn_p->fd        = fd;
+    conn_p->id        = worker_p->next_conn_id++ * worker_p->args_p->workers + worker_p->id;
+    conn_p->rx.pool_p = &worker_p->buf_pool;
+    worker_p->stats.active++;
 
-    socklen_t    addrlen = sizeof(*client_address);
-    const char * sock_name_p = processableEvents.data.fd == listensock4 ? "listensock4" : "listensock6";
+    return conn_p;
+}
 
-    printf("clientfd = accept4(%s, (struct sockaddr *)&client_address, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC) -> ", sock_name_p);
-    int clientfd = accept4(processableEvents.data.fd, (struct sockaddr *)client_address, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
-    printf("%d\n", clientfd);
-    if (clientfd < 0)
+void conn_free(struct worker *worker_p, struct conn *conn_p)
+{
+    frame_buf_free(&conn_p->rx);
+    wq_free(&conn_p->wq);
+    while (conn_p->cork_p)
     {
-        fprintf(stderr, "\x1b[1;31accept() failed: %m\n");
-        exit(EXIT_FAILURE);
+        struct cork_buf *buf_p = conn_p->cork_p;
+        conn_p->cork_p = buf_p->next_p;
+        pool_put(&worker_p->buf_pool, buf_p);
     }
+    shm_free(conn_p->shm_p);
+    conn_p->shm_p = NULL;
+    tls_free(conn_p->tls_p);
+    conn_p->tls_p = NULL;
+    pool_put(&worker_p->conn_pool, conn_p);
+    worker_p->stats.active--;
+    worker_p->stats.closes++;
+}
 
-    epoll_ctl(epfd, EPOLL_CTL_DEL, listensock4, NULL);
-    epoll_ctl(epfd, EPOLL_CTL_DEL, listensock6, NULL);
-    close(listensock4);
-    close(listensock6);
-    close(epfd);
+void conn_set_name(struct conn *conn_p, const struct sockaddr_storage *addr_p)
+{
+    if (addr_p->ss_family == AF_UNIX)
+    {
+        // Unix-domain clients are anonymous: name them after their process.
+        struct ucred cred;
+        socklen_t    len = sizeof(cred);
+        if (getsockopt(conn_p->fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0)
+            snprintf(conn_p->name, sizeof(conn_p->name), "unix:pid=%d", (int)cred.pid);
+        else
+            snprintf(conn_p->name, sizeof(conn_p->name), "unix:fd=%d", conn_p->fd);
+        return;
+    }
+
+    char             buf[INET6_ADDRSTRLEN];
+    const void     * src  = &((const struct sockaddr_in *)addr_p)->sin_addr;
+    uint16_t         port = ((const struct sockaddr_in *)addr_p)->sin_port;
+    if (addr_p->ss_family == AF_INET6)
+    {
+        src  = &((const struct sockaddr_in6 *)addr_p)->sin6_addr;
+        port = ((const struct sockaddr_in6 *)addr_p)->sin6_port;
+    }
 
-    return clientfd;
+    snprintf(conn_p->name, sizeof(conn_p->name), "%s:%hu",
+             inet_ntop(addr_p->ss_family, src, buf, sizeof(buf)), ntohs(port));
 }
 
-int main(int argc, char *argv[])
+/**
+ * cork_flush - --cork: send the staged echoes
+ * @flags: MSG_MORE while the read pass goes on
+ *
+ * One sendmsg() for all the buffers; only what the socket does not take
+ * is copied into the write queue. The buffers go back to the pool.
+ *
+ * Return 0, or -1 if the connection should be closed (see echo()).
+ */
+static int cork_flush(struct worker *worker_p, struct conn *conn_p, int flags)
 {
-    if (argc < 2)
+    struct iovec iov[WQ_IOV_MAX];
+    size_t       total = 0;
+    int          n     = 0;
+
+    if (!conn_p->cork_p)
+        return 0;
+
+    for (struct cork_buf *buf_p = conn_p->cork_p; buf_p; buf_p = buf_p->next_p, n++)
     {
-        syntax();
-        exit(EXIT_FAILURE);
+        iov[n].iov_base = buf_p->data;
+        iov[n].iov_len  = buf_p->len;
+        total += buf_p->len;
     }
 
-    sigset_t    sigmsk;
-    sigfillset(&sigmsk);
-    sigdelset(&sigmsk, SIGINT); // SIGINT -> CTRL-c
-    sigprocmask(SIG_SETMASK, &sigmsk, NULL);
-    signal(SIGINT, sig_handler); // CTRL-c
-    setvbuf(stdout, NULL, _IONBF, 0);
+    int rc = wq_sendv(&conn_p->wq, conn_p->fd, iov, n, flags);
+    TRACE(TRACE_SYSCALLS, TC_SEND, conn_p->fd, rc < 0 ? -1 : (ssize_t)(total - wq_pending(&conn_p->wq)), errno, NULL, 0);
+    if (rc >= 0)
+        worker_count_tx(worker_p, rc, total - wq_pending(&conn_p->wq));
 
-    int status = EXIT_SUCCESS;
-    do
+    while (conn_p->cork_p)
     {
-        printf("\n-------------------------------------------------------------------------------\n");
-        struct sockaddr_storage client_addr;
-        memset(&client_addr, 0, sizeof(client_addr));
-        int clientfd = get_client_connection((uint16_t)atoi(argv[1]), sigmsk, &client_addr);
+        struct cork_buf *buf_p = conn_p->cork_p;
+        conn_p->cork_p = buf_p->next_p;
+        pool_put(&worker_p->buf_pool, buf_p);
+    }
+    conn_p->cork_tail_p = NULL;
+    conn_p->cork_bufs   = 0;
 
-        if (stop) break;
+    return rc < 0 || wq_pending(&conn_p->wq) > ECHO_MAX_QUEUED ? -1 : 0;
+}
 
-        printf(GREEN "%m" NORMAL "\n");
+/**
+ * cork_stage - --cork: add an echo to the ones of the read pass
+ *
+ * Copied into the pass's pool buffers, without any syscall while up to
+ * WQ_IOV_MAX buffers hold the pass. Once the socket falls behind, or the
+ * pool is out of memory, the rest goes into the write queue.
+ *
+ * Return 0, or -1 if the connection should be closed (see echo()).
+ */
+static int cork_stage(struct worker *worker_p, struct conn *conn_p, const char *data_p, size_t len)
+{
+    size_t room = worker_p->buf_pool.obj_size - sizeof(struct cork_buf);
 
-        char buf[INET6_ADDRSTRLEN];
-        void     * src  = &((struct sockaddr_in *)&client_addr)->sin_addr;
-        uint16_t   port = ((struct sockaddr_in *)&client_addr)->sin_port;
-        if (client_addr.ss_family == AF_INET6)
+    while (len > 0)
+    {
+        struct cork_buf *buf_p = conn_p->cork_tail_p;
+        if (!buf_p || buf_p->len == room)
         {
-            src  = &((struct sockaddr_in6 *)&client_addr)->sin6_addr;
-            port = ((struct sockaddr_in6 *)&client_addr)->sin6_port;
-        }
-        printf("New client: " CYAN "%s" NORMAL ":%hu\n",
-               inet_ntop(client_addr.ss_family, src, buf, sizeof(buf)),
-               ntohs(port));
+            // Full: let the kernel hold the segment back for the rest of the pass.
+            if (conn_p->cork_bufs == WQ_IOV_MAX && cork_flush(worker_p, conn_p, MSG_MORE) != 0)
+                return -1;
 
-        struct epoll_event  newPeerConnectionEvent;
-        memset(&newPeerConnectionEvent, 0, sizeof newPeerConnectionEvent);
+            buf_p = wq_pending(&conn_p->wq) == 0 ? pool_get(&worker_p->buf_pool) : NULL;
+            if (!buf_p)
+                break;
 
-        int epfd = epoll_create1(EPOLL_CLOEXEC);
-        if (epfd == -1)
-        {
-            fprintf(stderr, "\x1b[1;31Could not create the read epoll FD list. Aborting!\n");
-            exit(EXIT_FAILURE);
+            buf_p->next_p = NULL;
+            buf_p->len    = 0;
+            if (conn_p->cork_tail_p)
+                conn_p->cork_tail_p->next_p = buf_p;
+            else
+                conn_p->cork_p = buf_p;
+            conn_p->cork_tail_p = buf_p;
+            conn_p->cork_bufs++;
         }
 
-        newPeerConnectionEvent.data.fd = clientfd;
-        newPeerConnectionEvent.events  = EPOLLIN | EPOLLERR | EPOLLRDHUP | EPOLLHUP;
-        if (epoll_ctl(epfd, EPOLL_CTL_ADD, clientfd, &newPeerConnectionEvent) == -1)
+        size_t n = len < room - buf_p->len ? len : room - buf_p->len;
+        memcpy(buf_p->data + buf_p->len, data_p, n);
+        buf_p->len += n;
+        data_p     += n;
+        len        -= n;
+    }
+
+    if (len == 0)
+        return 0;
+
+    if (cork_flush(worker_p, conn_p, MSG_MORE) != 0)
+        return -1;
+    return wq_append(&conn_p->wq, data_p, len) != 0 || wq_pending(&conn_p->wq) > ECHO_MAX_QUEUED ? -1 : 0;
+}
+
+/**
+ * echo_send - send bytes to a client's socket, queueing what it does not take
+ *
+ * Return 0, or -1 if the connection should be closed (see echo()).
+ */
+static int echo_send(struct worker *worker_p, struct conn *conn_p, const char *data_p, size_t len)
+{
+    if (conn_p->corked)
+        return cork_stage(worker_p, conn_p, data_p, len);
+
+    size_t queued = wq_pending(&conn_p->wq);
+    int    rc     = wq_send(&conn_p->wq, conn_p->fd, data_p, len, 0);
+    TRACE(TRACE_SYSCALLS, TC_SEND, conn_p->fd, rc < 0 ? -1 : (ssize_t)len, errno, data_p, rc < 0 ? 0 : len);
+    if (rc >= 0)
+        worker_count_tx(worker_p, rc, queued + len - wq_pending(&conn_p->wq));
+
+    if (rc < 0 || wq_pending(&conn_p->wq) > ECHO_MAX_QUEUED)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * echo - send data back to a client
+ * @conn_p: the client connection
+ * @data_p: what was received
+ * @len: number of bytes
+ *
+ * Whatever the socket does not take is left in the connection's write
+ * queue; the event loop flushes it when the socket becomes writable.
+ * While @conn_p->corked is set nothing is sent at all: the data is only
+ * staged, to be flushed in one go at the end of the read pass. A client
+ * on shared memory gets the data in its ring, which shm_client() made
+ * sure has room for it.
+ *
+ * With --tls=user the data is sealed into records first, and the records
+ * take the same way; with --tls=ktls the kernel does that on send().
+ *
+ * Return 0 on success, -1 if the connection should be closed: on a
+ * socket error, or when the client has let more than ECHO_MAX_QUEUED
+ * bytes pile up without reading them.
+ */
+int echo(struct worker *worker_p, struct conn *conn_p, const char *data_p, size_t len)
+{
+    if (conn_p->shm_p)
+    {
+        if (len > 0 && shm_send(conn_p->shm_p, data_p, len) != (ssize_t)len)
+            return -1;
+        worker_p->stats.bytes_out += len;
+        return 0;
+    }
+
+    if (conn_p->tls_p && worker_p->args_p->tls == TLS_USER)
+    {
+        const char *records_p;
+        size_t      n  = tls_seal(conn_p->tls_p, data_p, len, &records_p);
+        int         rc = echo_send(worker_p, conn_p, records_p, n);
+
+        tls_sealed(conn_p->tls_p);
+        return rc;
+    }
+
+    return echo_send(worker_p, conn_p, data_p, len);
+}
+
+/* --crc: count a message whose CRC32C, stamp included, came to @crc */
+static void crc_check(struct worker *worker_p, const struct conn *conn_p, uint32_t crc)
+{
+    worker_p->stats.crc_checked++;
+    if (crc != CRC32C_RESIDUE)
+    {
+        worker_p->stats.crc_errors++;
+        TRACE(TRACE_EVENTS, TC_CRC, conn_p->fd, -1, EBADMSG, NULL, 0);
+    }
+}
+
+/**
+ * deliver_frames - hand over every complete frame found in a buffer
+ * @buf_p: the buffer, parsing starts at @buf_p->head
+ *
+ * Parsing stops at the first incomplete frame. All the complete frames
+ * are contiguous, so with --echo they go back in a single echo(). With
+ * --crc each payload is checked as it is: a frame without a CRC32C
+ * stamp fails.
+ *
+ * Return 0, or -1 on a protocol error or a failed echo.
+ */
+static int deliver_frames(struct worker *worker_p, struct conn *conn_p, struct frame_buf *buf_p)
+{
+    struct frame frame;
+    size_t       start = buf_p->head;
+    int          rc;
+
+    while ((rc = frame_next(buf_p, &frame)) > 0)
+    {
+        TRACE(TRACE_DATA, TC_FRAME, conn_p->fd, frame.len, 0, frame.payload_p, frame.len);
+        worker_capture(worker_p, conn_p, frame.payload_p, frame.len);
+        worker_p->stats.frames_in++;
+        if (worker_p->args_p->crc)
+            crc_check(worker_p, conn_p, frame.flags & FRAME_F_CRC32C ? crc32c(0, frame.payload_p, frame.len) : 0);
+    }
+
+    if (rc < 0)
+    {
+        TRACE(TRACE_EVENTS, TC_FRAME, conn_p->fd, -1, EPROTO, NULL, 0);
+        return -1;
+    }
+
+    if (buf_p->head > start && worker_p->args_p->echo)
+        return echo(worker_p, conn_p, buf_p->data + start, buf_p->head - start);
+
+    return 0;
+}
+
+/**
+ * conn_frames - --framed: process the frames received on a connection
+ * @worker_p: the worker owning the client
+ * @conn_p: the client connection
+ * @data_p: bytes received outside of @conn_p->rx (io_uring provided
+ *      buffer), or NULL when they were read into @conn_p->rx directly
+ * @len: number of bytes at @data_p
+ *
+ * When nothing is pending in @conn_p->rx, @data_p is parsed in place and
+ * only a trailing partial frame is copied to @conn_p->rx, so whole frames
+ * are never copied. Once every frame is out, the buffer goes back to the
+ * pool: an idle connection holds none.
+ *
+ * Return 0, or -1 if the connection must be closed.
+ */
+int conn_frames(struct worker *worker_p, struct conn *conn_p, const char *data_p, size_t len)
+{
+    struct frame_buf *rx_p = &conn_p->rx;
+
+    if (data_p && rx_p->tail == rx_p->head)
+    {
+        struct frame_buf view = { .data = (char *)data_p, .size = len, .tail = len };
+
+        if (deliver_frames(worker_p, conn_p, &view) != 0)
+            return -1;
+        data_p += view.head;
+        len    -= view.head;
+    }
+
+    if (data_p && len > 0)
+    {
+        if (frame_buf_reserve(rx_p, len) != 0)
+            return -1;
+        memcpy(rx_p->data + rx_p->tail, data_p, len);
+        rx_p->tail += len;
+    }
+
+    int rc = deliver_frames(worker_p, conn_p, rx_p);
+    frame_buf_release(rx_p);
+
+    return rc;
+}
+
+/**
+ * conn_crc - --crc=BYTES: check the messages of a raw stream
+ * @worker_p: the worker owning the client
+ * @conn_p: the client connection
+ * @data_p: the bytes received, in stream order
+ * @len: number of bytes
+ *
+ * The stream is a run of BYTES-byte messages, each ending with its
+ * CRC32C, and one may straddle any number of reads. The CRC runs over
+ * what was read in one pass, stamps included, carried over from one
+ * read to the next in @conn_p: at every message boundary it must be
+ * CRC32C_RESIDUE, so nothing is copied or looked up. A corrupted
+ * message is counted and the next one checked afresh.
+ */
+void conn_crc(struct worker *worker_p, struct conn *conn_p, const char *data_p, size_t len)
+{
+    size_t size = worker_p->args_p->crc_size;
+
+    while (len > 0)
+    {
+        size_t n = size - conn_p->crc_off < len ? size - conn_p->crc_off : len;
+
+        conn_p->crc      = crc32c(conn_p->crc, data_p, n);
+        conn_p->crc_off += n;
+        data_p          += n;
+        len             -= n;
+
+        if (conn_p->crc_off == size)
         {
-            fprintf(stderr, RED "Could not add the socket FD to the epoll FD list. Aborting!" NORMAL "\n");
-            exit(EXIT_FAILURE);
+            crc_check(worker_p, conn_p, conn_p->crc);
+            conn_p->crc     = 0;
+            conn_p->crc_off = 0;
         }
+    }
+}
 
-        char buffer[1024] = {0};
-        while (!stop)
-        {
-            struct epoll_event  processableEvents;
-            memset(&processableEvents, 0, sizeof processableEvents);
-            int numfds = epoll_pwait(epfd, &processableEvents, 1, -1, &sigmsk);
+static uint64_t conn_deadline(const struct arguments *args_p, const struct conn *conn_p)
+{
+    uint64_t deadline = UINT64_MAX;
 
-            if (stop) break;
+    if (args_p->idle_timeout_ms)
+        deadline = conn_p->last_rx_ms + args_p->idle_timeout_ms;
 
-            if (numfds < 0)
-            {
-                fprintf(stderr, RED "Serious error in epoll setup: epoll_wait() returned < 0 status! %m" NORMAL "\n");
-                status = EXIT_FAILURE;
-                stop = 1;
-                break;
-            }
+    if (args_p->read_timeout_ms && conn_p->partial_ms && conn_p->partial_ms + args_p->read_timeout_ms < deadline)
+        deadline = conn_p->partial_ms + args_p->read_timeout_ms;
 
-            if (numfds == 0)
-            {
-                fprintf(stderr, RED "Timeout" NORMAL "\n");
-                status = EXIT_FAILURE;
-                stop = 1;
-                break;
-            }
+    return deadline;
+}
 
-            printf("recv(clientfd, buffer, 1024, 0) -> ");
-            int n = recv(clientfd, buffer, 1024, 0);
-            printf("%d", n);
-            if (n > 0)
-            {
-                printf(" - %.*s\n", n, buffer);
-            }
-            else if (n == 0)
-            {
-                printf(" - Connection closed by client\n");
-                break;
-            }
-            else
-            {
-                printf(" - " RED "%m" NORMAL "\n");
-                break;
-            }
-        }
+/**
+ * conn_touch - note that a client just sent something (or was accepted)
+ * @worker_p: the worker owning the client
+ * @conn_p: the client connection, after its data was processed
+ *
+ * Moving the deadline later does not touch the wheel: the timer keeps
+ * its old expiry and conn_timers_run() pushes it back when it fires.
+ * The timer is only re-armed when the deadline moves earlier, i.e. when
+ * a read timeout shorter than the idle timeout starts with a partial
+ * frame. Most receives therefore cost one clock read.
+ */
+void conn_touch(struct worker *worker_p, struct conn *conn_p)
+{
+    const struct arguments *args_p = worker_p->args_p;
 
-        close(clientfd);
-        close(epfd);
+    if (!args_p->idle_timeout_ms && !args_p->read_timeout_ms)
+        return;
 
-    } while (!stop);
+    uint64_t now = timer_now_ms();
 
-    exit(status);
+    conn_p->last_rx_ms = now;
+    if (conn_p->rx.tail == conn_p->rx.head)
+        conn_p->partial_ms = 0;
+    else if (conn_p->partial_ms == 0)
+        conn_p->partial_ms = now;
+
+    uint64_t deadline = conn_deadline(args_p, conn_p);
+    if (deadline != UINT64_MAX && (!timer_pending(&conn_p->timer) || deadline < conn_p->timer.expires))
+        timer_add(&worker_p->wheel, &conn_p->timer, deadline);
+}
+
+/**
+ * conn_timers_run - reap the clients whose deadline has passed
+ * @worker_p: the worker
+ * @reap_fn: how the event loop gets rid of a client
+ *
+ * All the timers due are taken off the wheel in one go. Those whose
+ * connection saw activity since they were armed are simply pushed back
+ * to the new deadline.
+ */
+void conn_timers_run(struct worker *worker_p, void (*reap_fn)(struct worker *, struct conn *))
+{
+    uint64_t      now     = timer_now_ms();
+    struct timer *timer_p = timer_wheel_expire(&worker_p->wheel, now);
+
+    while (timer_p)
+    {
+        struct timer *next_p   = timer_p->next;
+        struct conn  *conn_p   = timer_entry(timer_p, struct conn, timer);
+        uint64_t      deadline = conn_deadline(worker_p->args_p, conn_p);
+
+        if (deadline > now)
+        {
+            if (deadline != UINT64_MAX)
+                timer_add(&worker_p->wheel, timer_p, deadline);
+        }
+        else
+        {
+            TRACE(TRACE_EVENTS, TC_TIMEOUT, conn_p->fd, -1, ETIMEDOUT, NULL, 0);
+            worker_p->stats.timeouts++;
+            reap_fn(worker_p, conn_p);
+        }
+
+        timer_p = next_p;
+    }
+}
+
+/*
+ * The batch being handled may still hold events for this client: a
+ * shared-memory client has two entries in the epoll set, its socket and
+ * its doorbell. The connection is only freed once the batch is over (see
+ * free_closed()); until then, its remaining events are skipped.
+ */
+static void close_client(struct worker *worker_p, struct conn *conn_p)
+{
+    TRACE(TRACE_EVENTS, TC_CLOSE, conn_p->fd, 0, 0, conn_p->name, strlen(conn_p->name));
+    timer_del(&worker_p->wheel, &conn_p->timer);
+    epoll_ctl(worker_p->epfd, EPOLL_CTL_DEL, conn_p->fd, NULL);
+    // The client holds the same eventfd: closing ours would not remove it.
+    if (conn_p->shm_p)
+        epoll_ctl(worker_p->epfd, EPOLL_CTL_DEL, conn_p->shm_p->wait_fd, NULL);
+    close(conn_p->fd);
+    conn_p->closing       = 1;
+    conn_p->closed_next_p = worker_p->closed_p;
+    worker_p->closed_p    = conn_p;
 }
 
+static void free_closed(struct worker *worker_p)
+{
+    while (worker_p->closed_p)
+    {
+        struct conn *conn_p = worker_p->closed_p;
+        worker_p->closed_p = conn_p->closed_next_p;
+        conn_free(worker_p, conn_p);
+    }
+}
+
+/**
+ * conn_drop - close a client that could not get a connection object
+ *
+ * At the --max-conns limit this is expected: it is only traced and
+ * counted, and the accept queue keeps being drained so that clients
+ * fail fast.
+ */
+void conn_drop(struct worker *worker_p, int fd)
+{
+    const struct pool *pool_p   = &worker_p->conn_pool;
+    const char        *reason_p = pool_p->max && pool_p->in_use >= pool_p->max ? "over --max-conns" : "out of memory";
+
+    TRACE(TRACE_EVENTS, TC_CLOSE, fd, 0, 0, reason_p, strlen(reason_p));
+    worker_p->stats.dropped++;
+    close(fd);
+}
+
+/**
+ * busy_poll_tune - --busy-poll: low-latency options of an accepted client
+ * @args_p: command-line configuration
+ * @fd: the client socket
+ *
+ * All best effort. Raising SO_BUSY_POLL above net.core.busy_read needs
+ * CAP_NET_ADMIN (main() warns about it once), and SO_PREFER_BUSY_POLL
+ * needs Linux 5.11. TCP_QUICKACK is not sticky: the kernel may switch
+ * back to delayed ACKs, but with --echo the ACKs ride on the replies.
+ */
+static void busy_poll_tune(const struct arguments *args_p, int fd)
+{
+    int usecs = (int)args_p->busy_poll_us;
+    int one   = 1;
+
+    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs));
+#ifdef SO_PREFER_BUSY_POLL
+    setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one));
+#endif
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+}
+
+static void read_client(struct worker *worker_p, struct conn *conn_p);
+
+/**
+ * conn_accept_checks - count what a new TCP client tells about its setup
+ * @worker_p: the worker that accepted it
+ * @fd: the client socket
+ *
+ * --fastopen: the kernel only keeps data from the SYN when the client
+ * presented a valid cookie, and TCP_INFO tells whether it did.
+ * --steer: SO_INCOMING_CPU is the CPU that processed the client's
+ * packets last, the one whose caches hold its socket.
+ *
+ * Each costs one getsockopt(), so nothing is checked without the options.
+ */
+void conn_accept_checks(struct worker *worker_p, int fd)
+{
+    if (worker_p->args_p->fastopen_qlen)
+    {
+        struct tcp_info info;
+        socklen_t       len = sizeof(info);
+
+        if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 && (info.tcpi_options & TCPI_OPT_SYN_DATA))
+            worker_p->stats.fastopen++;
+    }
+
+    if (worker_p->args_p->steer != STEER_NONE)
+    {
+        int       cpu = -1;
+        socklen_t len = sizeof(cpu);
+
+        if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 && cpu >= 0)
+        {
+            if (cpu == worker_p->cpu)
+                worker_p->stats.cpu_local++;
+            else
+                worker_p->stats.cpu_remote++;
+        }
+    }
+}
+
+/**
+ * accept_clients - accept every pending connection on a listener
+ * @worker_p: the worker owning the listener
+ * @listener_p: the listen socket that became readable
+ *
+ * Listen sockets are non-blocking, so accept4() is called repeatedly
+ * until the accept queue is empty (EAGAIN). Under a connection storm
+ * this amortizes one epoll wake-up over many connections.
+ *
+ * With --defer-accept or --fastopen the first request is usually there
+ * already: it is read right away instead of one more trip through
+ * epoll_pwait(). With --tls that request is the ClientHello.
+ */
+static void accept_clients(struct worker *worker_p, struct conn *listener_p)
+{
+    uint32_t events = EPOLLIN | EPOLLERR | EPOLLRDHUP | EPOLLHUP;
+    if (worker_p->args_p->edge_triggered)
+        events |= EPOLLET;
+
+    while (!stop)
+    {
+        struct sockaddr_storage client_addr;
+        socklen_t               addrlen = sizeof(client_addr);
+
+        memset(&client_addr, 0, sizeof(client_addr));
+
+        int clientfd = accept4(listener_p->fd, (struct sockaddr *)&client_addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientfd < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                TRACE(TRACE_SYSCALLS, TC_ACCEPT, listener_p->fd, clientfd, errno, NULL, 0);
+                return;
+            }
+
+            // The peer may have reset the connection before we got to it.
+            TRACE(TRACE_EVENTS, TC_ACCEPT, listener_p->fd, clientfd, errno, NULL, 0);
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+                return;
+
+            continue;
+        }
+
+        worker_p->stats.accepts++;
+
+        struct conn *conn_p = conn_new(worker_p, clientfd);
+        if (!conn_p)
+        {
+            conn_drop(worker_p, clientfd);
+            continue;
+        }
+
+        conn_set_name(conn_p, &client_addr);
+
+        TRACE(TRACE_EVENTS, TC_ACCEPT, listener_p->fd, clientfd, 0, conn_p->name, strlen(conn_p->name));
+
+        if (worker_p->args_p->busy_poll_us && client_addr.ss_family != AF_UNIX)
+            busy_poll_tune(worker_p->args_p, clientfd);
+
+        if (client_addr.ss_family != AF_UNIX)
+            conn_accept_checks(worker_p, clientfd);
+
+        conn_p->hello = client_addr.ss_family == AF_UNIX && worker_p->args_p->sink == SINK_BUFFER;
+
+        conn_p->events = events;
+        epoll_add(worker_p->epfd, conn_p, events);
+        conn_touch(worker_p, conn_p);
+
+        if (tls_ctx_p && client_addr.ss_family != AF_UNIX)
+        {
+            conn_p->tls_p     = tls_new(tls_ctx_p, clientfd, NULL);
+            conn_p->handshake = 1;
+            if (!conn_p->tls_p)
+            {
+                close_client(worker_p, conn_p);
+                continue;
+            }
+        }
+
+        if ((worker_p->args_p->defer_accept_s || worker_p->args_p->fastopen_qlen) && client_addr.ss_family != AF_UNIX)
+            read_client(worker_p, conn_p);
+    }
+}
+
+/**
+ * struct udp_batch - --udp: the buffers of one recvmmsg() call
+ * @msgs: one message header per buffer
+ * @iovs: the buffers, --recv-size bytes each, carved out of @data
+ * @ctrl: room for each buffer's UDP_GRO cmsg
+ * @data: the storage behind @iovs
+ */
+struct udp_batch
+{
+    struct mmsghdr  msgs[UDP_BATCH];
+    struct iovec    iovs[UDP_BATCH];
+    union
+    {
+        char            buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr  align;
+    } ctrl[UDP_BATCH];
+    char            data[];
+};
+
+static struct udp_batch *udp_batch_new(size_t buffer_size)
+{
+    struct udp_batch *batch_p = malloc(sizeof(*batch_p) + UDP_BATCH * buffer_size);
+    if (!batch_p)
+        return NULL;
+
+    for (int i = 0; i < UDP_BATCH; i++)
+    {
+        batch_p->iovs[i].iov_base = batch_p->data + i * buffer_size;
+        batch_p->iovs[i].iov_len  = buffer_size;
+        memset(&batch_p->msgs[i], 0, sizeof(batch_p->msgs[i]));
+        batch_p->msgs[i].msg_hdr.msg_iov    = &batch_p->iovs[i];
+        batch_p->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    return batch_p;
+}
+
+/* --udp: count one datagram against its flow */
+static void udp_datagram(struct worker *worker_p, const char *data_p, size_t len)
+{
+    uint32_t flow;
+    uint64_t seq;
+
+    if (dgram_hdr_read(data_p, len, &flow, &seq) != 0)
+    {
+        worker_p->stats.dgrams_bad++;
+        return;
+    }
+
+    worker_p->stats.dgrams_in++;
+
+    int64_t skipped = dgram_track(&worker_p->flows, flow, seq);
+    if (skipped > 0)
+        worker_p->stats.dgrams_lost += skipped;
+    else if (skipped < 0)
+    {
+        // Late rather than lost: it was counted missing when skipped.
+        worker_p->stats.dgrams_late++;
+        if (worker_p->stats.dgrams_lost > 0)
+            worker_p->stats.dgrams_lost--;
+    }
+}
+
+/**
+ * read_datagrams - --udp: drain a readable UDP socket, a batch at a time
+ * @worker_p: the worker owning the socket
+ * @sock_p: the socket
+ *
+ * Each recvmmsg() fills up to UDP_BATCH buffers in one system call, and
+ * with UDP_GRO each buffer may hold a run of datagrams of one flow, cut
+ * every gso_size bytes (the cmsg). The socket is read until a batch
+ * comes back short, or UDP_MAX_ROUNDS times so that a flood on one
+ * socket cannot keep the worker from the others: it is level-triggered
+ * and comes back at the next epoll_pwait().
+ */
+static void read_datagrams(struct worker *worker_p, struct conn *sock_p)
+{
+    struct udp_batch *batch_p = worker_p->udp_p;
+
+    for (int round = 0; round < UDP_MAX_ROUNDS && !stop; round++)
+    {
+        for (int i = 0; i < UDP_BATCH; i++)
+        {
+            batch_p->msgs[i].msg_hdr.msg_control    = batch_p->ctrl[i].buf;
+            batch_p->msgs[i].msg_hdr.msg_controllen = sizeof(batch_p->ctrl[i].buf);
+        }
+
+        int n = recvmmsg(sock_p->fd, batch_p->msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+        TRACE(TRACE_SYSCALLS, TC_RECVMMSG, sock_p->fd, n, errno, NULL, 0);
+        worker_p->stats.recv_calls++;
+        if (n <= 0)
+        {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                TRACE(TRACE_EVENTS, TC_RECVMMSG, sock_p->fd, n, errno, NULL, 0);
+            else
+                worker_p->stats.recv_eagain++;
+            return;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            struct msghdr *hdr_p = &batch_p->msgs[i].msg_hdr;
+            const char    *data_p = hdr_p->msg_iov->iov_base;
+            size_t         len    = batch_p->msgs[i].msg_len;
+            size_t         seg    = len;
+
+            for (struct cmsghdr *cmsg_p = CMSG_FIRSTHDR(hdr_p); cmsg_p; cmsg_p = CMSG_NXTHDR(hdr_p, cmsg_p))
+            {
+                int gso_size;
+                if (cmsg_p->cmsg_level == SOL_UDP && cmsg_p->cmsg_type == UDP_GRO)
+                {
+                    memcpy(&gso_size, CMSG_DATA(cmsg_p), sizeof(gso_size));
+                    if (gso_size > 0)
+                        seg = gso_size;
+                }
+            }
+
+            worker_p->stats.dgram_bufs++;
+            worker_count_rx(worker_p, len);
+
+            // Cut short by a --recv-size too small: the rest is gone.
+            if (hdr_p->msg_flags & MSG_TRUNC)
+            {
+                worker_p->stats.dgrams_bad++;
+                continue;
+            }
+
+            for (size_t off = 0; off < len; off += seg)
+                udp_datagram(worker_p, data_p + off, len - off < seg ? len - off : seg);
+        }
+
+        if (n < UDP_BATCH)
+            return;
+    }
+}
+
+/**
+ * splice_client - move pending data from a client to /dev/null
+ * @worker_p: the worker owning the client
+ * @conn_p: the client connection
+ *
+ * The payload goes socket -> pipe -> /dev/null by page reference and is
+ * never copied to user space. The pipe is always emptied before
+ * returning, so the next call never finds it full.
+ *
+ * Return the number of bytes moved, with recv() semantics for 0 and -1.
+ */
+static ssize_t splice_client(struct worker *worker_p, struct conn *conn_p)
+{
+    ssize_t n = splice(conn_p->fd, NULL, worker_p->pipe_fds[1], NULL, worker_p->buffer_size,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+    for (ssize_t left = n; left > 0; )
+    {
+        ssize_t m = splice(worker_p->pipe_fds[0], NULL, worker_p->null_fd, NULL, left, SPLICE_F_MOVE);
+        if (m <= 0)
+            return -1;
+        left -= m;
+    }
+
+    return n;
+}
+
+/**
+ * conn_watch - register the events a client should wake the worker for
+ * @worker_p: the worker owning the client
+ * @conn_p: the client connection
+ * @force: re-register even if the events did not change
+ *
+ * EPOLLOUT is only wanted while echoed data is queued (or while a TLS
+ * handshake waits for room in the socket), and reading stops while more
+ * than ECHO_HIGH_WATER bytes are queued so that a client that does not
+ * read its echoes cannot make the server buffer without limit.
+ * epoll_ctl() is only called when the events change, or when @force is
+ * set: EPOLL_CTL_MOD re-checks readiness, which re-arms an edge-triggered
+ * client that still has unread data.
+ */
+static void conn_watch(struct worker *worker_p, struct conn *conn_p, int force)
+{
+    uint32_t events = conn_p->events & ~(EPOLLIN | EPOLLOUT);
+    size_t   queued = wq_pending(&conn_p->wq);
+
+    if (queued < ECHO_HIGH_WATER)
+        events |= EPOLLIN;
+    if (queued > 0 || (conn_p->handshake && SSL_want_write(conn_p->tls_p)))
+        events |= EPOLLOUT;
+
+    if (events == conn_p->events && !force)
+        return;
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof event);
+    event.data.ptr = conn_p;
+    event.events   = events;
+    epoll_ctl(worker_p->epfd, EPOLL_CTL_MOD, conn_p->fd, &event);
+    conn_p->events = events;
+}
+
+/**
+ * shm_hello - first read of a Unix-domain client: take a shared-memory offer
+ * @worker_p: the worker owning the client
+ * @conn_p: the client connection
+ * @buffer: where to receive
+ * @size: room at @buffer
+ *
+ * A client that wants the rings sends a struct shm_hello with the
+ * descriptors before anything else, then waits for the answer. Any
+ * other first read is plain data.
+ *
+ * Return what recv() would, except that a taken offer is reported as
+ * EAGAIN: there is no data to process, and from now on the client's
+ * doorbell, not its socket, says when there is.
+ */
+static ssize_t shm_hello(struct worker *worker_p, struct conn *conn_p, char *buffer, size_t size)
+{
+    int fds[3];
+    int nfds = 3;
+
+    conn_p->hello = 0;
+    ssize_t n = unix_recv_fds(conn_p->fd, buffer, size, fds, &nfds);
+    if (nfds == 0)
+        return n;
+
+    if (n == sizeof(struct shm_hello) && nfds == 3)
+    {
+        struct shm_hello hello;
+        memcpy(&hello, buffer, sizeof(hello));
+
+        conn_p->shm_p = shm_accept(conn_p->fd, &hello, fds);
+        if (!conn_p->shm_p)
+            return -1;
+
+        struct epoll_event event;
+        memset(&event, 0, sizeof event);
+        event.data.ptr = (char *)conn_p + EPOLL_SHM_TAG;
+        event.events   = EPOLLIN;
+        if (epoll_ctl(worker_p->epfd, EPOLL_CTL_ADD, conn_p->shm_p->wait_fd, &event) != 0)
+            return -1;
+
+        errno = EAGAIN;
+        return -1;
+    }
+
+    // Descriptors nobody asked for.
+    for (int i = 0; i < nfds; i++)
+        close(fds[i]);
+    errno = EPROTO;
+    return -1;
+}
+
+/**
+ * shm_client - serve a shared-memory client whose doorbell rang
+ * @worker_p: the worker owning the client
+ * @conn_p: the client connection
+ *
+ * The data is processed where it lies in the ring. With --echo, only as
+ * much is taken as the return ring can hold, counting what a partial
+ * frame held in @conn_p->rx will add once complete: the rest waits for
+ * the client to make room, which rings our doorbell. A client that keeps
+ * its ring full gets one ring's worth per pass, so that it cannot starve
+ * the worker's other clients.
+ */
+static void shm_client(struct worker *worker_p, struct conn *conn_p)
+{
+    const struct arguments *args_p = worker_p->args_p;
+    struct shm_chan        *chan_p = conn_p->shm_p;
+    size_t                  budget = chan_p->size;
+
+    shm_drain(chan_p);
+
+    while (budget > 0)
+    {
+        const char *data_p;
+        ssize_t     peeked = shm_peek(chan_p, &data_p);
+        ssize_t     room   = 0;
+        size_t      held   = conn_p->rx.tail - conn_p->rx.head;
+        if (peeked > 0 && args_p->echo)
+            room = shm_room(chan_p, held + 1);
+        if (peeked < 0 || room < 0)
+        {
+            // The client moved the ring indexes out of range.
+            close_client(worker_p, conn_p);
+            return;
+        }
+        if (peeked == 0 || (args_p->echo && (size_t)room <= held))
+            break;
+
+        size_t n = peeked;
+        if (args_p->echo && n > room - held)
+            n = room - held;
+        if (n > budget)
+            n = budget;
+
+        worker_p->stats.recv_calls++;
+        worker_count_rx(worker_p, n);
+
+        int rc = 0;
+        if (args_p->framed)
+            rc = conn_frames(worker_p, conn_p, data_p, n);
+        else
+        {
+            worker_capture(worker_p, conn_p, data_p, n);
+            if (args_p->crc)
+                conn_crc(worker_p, conn_p, data_p, n);
+            if (args_p->echo)
+                rc = echo(worker_p, conn_p, data_p, n);
+        }
+        if (rc != 0)
+        {
+            close_client(worker_p, conn_p);
+            return;
+        }
+
+        shm_consume(chan_p, n);
+        conn_touch(worker_p, conn_p);
+        budget -= n;
+    }
+
+    if (budget == 0)
+        shm_kick(chan_p);
+    shm_flush(chan_p);
+}
+
+/**
+ * handshake_client - move a client's TLS handshake forward
+ * @worker_p: the worker owning the client
+ * @conn_p: the client connection, readable or writable
+ *
+ * Once the handshake is over, --tls=ktls hands the records to the kernel
+ * and the client is served like any other; --tls=user moves the records
+ * to memory, for read_client_once() and echo() to carry.
+ *
+ * Return 1 when the client is ready for data, 0 while the handshake goes
+ * on, or -1 if the client was closed.
+ */
+static int handshake_client(struct worker *worker_p, struct conn *conn_p)
+{
+    int rc = tls_handshake(conn_p->tls_p);
+    if (rc == 0)
+    {
+        conn_watch(worker_p, conn_p, 0);
+        return 0;
+    }
+
+    if (rc > 0)
+    {
+        conn_p->handshake = 0;
+        rc = worker_p->args_p->tls == TLS_KTLS ? tls_ktls_install(conn_p->tls_p, conn_p->fd)
+                                               : tls_use_memory(conn_p->tls_p);
+    }
+
+    if (rc < 0)
+    {
+        const char *reason_p = tls_strerror();
+        TRACE(TRACE_EVENTS, TC_HANDSHAKE, conn_p->fd, -1, errno, reason_p, strlen(reason_p));
+        worker_p->stats.handshake_failures++;
+        close_client(worker_p, conn_p);
+        return -1;
+    }
+
+    const char *cipher_p = SSL_get_cipher_name(conn_p->tls_p);
+    TRACE(TRACE_EVENTS, TC_HANDSHAKE, conn_p->fd, 1, 0, cipher_p, strlen(cipher_p));
+    worker_p->stats.handshakes++;
+    // Forced: an edge-triggered client may have sent its first request
+    // along with the end of the handshake.
+    conn_watch(worker_p, conn_p, 1);
+
+    return 1;
+}
+
+/**
+ * tls_recv - --tls=user: recv() for a client whose records OpenSSL handles
+ * @worker_p: the worker owning the client
+ * @conn_p: the client connection
+ * @buffer: where to store the plaintext
+ * @size: room at @buffer
+ *
+ * OpenSSL may hold a whole record, or the start of one, from the last
+ * call: that is decrypted first, and the socket only read when more
+ * ciphertext is needed. The ciphertext goes through the worker's
+ * @tls_buffer.
+ *
+ * Return what recv() would.
+ */
+static ssize_t tls_recv(struct worker *worker_p, struct conn *conn_p, char *buffer, size_t size)
+{
+    for (;;)
+    {
+        ssize_t n = tls_read(conn_p->tls_p, buffer, size);
+        if (n >= 0 || errno != EAGAIN)
+            return n;
+
+        n = recv(conn_p->fd, worker_p->tls_buffer, worker_p->buffer_size, 0);
+        if (n <= 0)
+            return n;
+
+        if (tls_feed(conn_p->tls_p, worker_p->tls_buffer, n) != 0)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+}
+
+/**
+ * read_client_once - read and process what a readable client sent
+ * @worker_p: the worker owning the client
+ * @conn_p: the client connection
+ *
+ * In level-triggered mode a single recv() is issued; epoll reports the
+ * socket again if more is pending. In edge-triggered mode the socket
+ * must be drained until EAGAIN or no further event will be reported,
+ * unless ECHO_HIGH_WATER bytes of echo are queued first. The same goes
+ * for plaintext OpenSSL still holds with --tls=user: epoll cannot see it.
+ *
+ * With --framed the data is read straight into the connection's frame
+ * buffer, behind any partial frame left by the previous read, and
+ * parsed there.
+ *
+ * Return 0, 1 if edge-triggered reading stopped before EAGAIN, or -1 if
+ * the client must be closed.
+ */
+static int read_client_once(struct worker *worker_p, struct conn *conn_p)
+{
+    char   *buffer = worker_p->buffer;
+    size_t  size   = worker_p->buffer_size;
+    int     spliced = worker_p->args_p->sink == SINK_SPLICE;
+    int     framed  = worker_p->args_p->framed;
+    int     user_tls = conn_p->tls_p && worker_p->args_p->tls == TLS_USER;
+
+    do
+    {
+        if (framed)
+        {
+            if (frame_buf_reserve(&conn_p->rx, worker_p->buffer_size) != 0)
+                return -1;
+            buffer = conn_p->rx.data + conn_p->rx.tail;
+            size   = conn_p->rx.size - conn_p->rx.tail;
+        }
+
+        ssize_t n;
+        if (spliced)
+            n = splice_client(worker_p, conn_p);
+        else if (conn_p->hello)
+            n = shm_hello(worker_p, conn_p, buffer, size);
+        else if (user_tls)
+            n = tls_recv(worker_p, conn_p, buffer, size);
+        else
+            n = recv(conn_p->fd, buffer, size, 0);
+        TRACE(TRACE_SYSCALLS, TC_RECV, conn_p->fd, n, errno, spliced ? NULL : buffer, spliced ? 0 : n);
+        worker_p->stats.recv_calls++;
+        if (n == 0)
+            return -1;
+        else if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+            worker_p->stats.recv_eagain++;
+            return 0;
+        }
+
+        worker_count_rx(worker_p, n);
+
+        if (framed)
+        {
+            conn_p->rx.tail += n;
+            if (conn_frames(worker_p, conn_p, NULL, 0) != 0)
+                return -1;
+        }
+        else
+        {
+            worker_capture(worker_p, conn_p, buffer, n);
+            if (worker_p->args_p->crc)
+                conn_crc(worker_p, conn_p, buffer, n);
+            if (worker_p->args_p->echo && echo(worker_p, conn_p, buffer, n) != 0)
+                return -1;
+        }
+
+        conn_touch(worker_p, conn_p);
+    } while ((worker_p->args_p->edge_triggered || (user_tls && tls_buffered(conn_p->tls_p))) &&
+             wq_pending(&conn_p->wq) < ECHO_HIGH_WATER);
+
+    return worker_p->args_p->edge_triggered;
+}
+
+/**
+ * read_client - consume data from a readable client
+ *
+ * With --cork the echoes produced by the whole read pass are staged in
+ * pooled buffers and only sent at the end, with one sendmsg().
+ * With --tls the data only comes once the handshake is over.
+ */
+static void read_client(struct worker *worker_p, struct conn *conn_p)
+{
+    if (conn_p->handshake && handshake_client(worker_p, conn_p) <= 0)
+        return;
+
+    conn_p->corked = worker_p->args_p->cork;
+    int rc = read_client_once(worker_p, conn_p);
+    conn_p->corked = 0;
+
+    if (rc >= 0 && conn_p->cork_p && cork_flush(worker_p, conn_p, 0) != 0)
+        rc = -1;
+    else if (rc >= 0 && worker_p->args_p->cork && wq_pending(&conn_p->wq))
+    {
+        size_t queued = wq_pending(&conn_p->wq);
+        int    sent   = wq_flush(&conn_p->wq, conn_p->fd, 0);
+        TRACE(TRACE_SYSCALLS, TC_SEND, conn_p->fd, sent < 0 ? -1 : (ssize_t)(queued - wq_pending(&conn_p->wq)), errno, NULL, 0);
+        if (sent < 0)
+            rc = -1;
+        else
+            worker_count_tx(worker_p, sent, queued - wq_pending(&conn_p->wq));
+    }
+
+    if (rc < 0)
+        close_client(worker_p, conn_p);
+    else
+        conn_watch(worker_p, conn_p, rc > 0);
+}
+
+/**
+ * write_client - send the echoes a client's socket did not take earlier
+ * @worker_p: the worker owning the client
+ * @conn_p: the writable client connection
+ *
+ * A --tls=user client that stopped at ECHO_HIGH_WATER with records left
+ * in OpenSSL is read again here: its socket may have nothing more to
+ * report.
+ *
+ * Return 0, or -1 if the client was closed or read already.
+ */
+static int write_client(struct worker *worker_p, struct conn *conn_p)
+{
+    if (conn_p->handshake)
+        return handshake_client(worker_p, conn_p) < 0 ? -1 : 0;
+
+    size_t queued = wq_pending(&conn_p->wq);
+    int    rc     = wq_flush(&conn_p->wq, conn_p->fd, 0);
+    TRACE(TRACE_SYSCALLS, TC_SEND, conn_p->fd, rc < 0 ? -1 : (ssize_t)(queued - wq_pending(&conn_p->wq)), errno, NULL, 0);
+
+    if (rc < 0)
+    {
+        close_client(worker_p, conn_p);
+        return -1;
+    }
+    worker_count_tx(worker_p, rc, queued - wq_pending(&conn_p->wq));
+
+    if (conn_p->tls_p && tls_buffered(conn_p->tls_p) && wq_pending(&conn_p->wq) < ECHO_HIGH_WATER)
+    {
+        read_client(worker_p, conn_p);
+        return -1;
+    }
+
+    conn_watch(worker_p, conn_p, 0);
+    return 0;
+}
+
+/**
+ * epoll_loop - the default epoll_pwait() + recv() event loop
+ *
+ * The epoll set lives for the whole life of the worker. Accepted clients
+ * are added to the same set as the listeners. epoll_pwait() sleeps until
+ * the nearest client deadline at most, then every expired client is
+ * reaped in the same pass.
+ *
+ * With --busy-poll the worker does not go to sleep right after a batch:
+ * it keeps polling for up to the spin budget, trading a busy core for
+ * the wake-up latency of a blocked thread.
+ *
+ * Once main() handed the listeners over (--handover) the worker only
+ * serves the clients it has, and returns when the last one is gone.
+ */
+static int epoll_loop(struct worker *worker_p, struct conn **listeners_pp, int nlisteners,
+                      const sigset_t *sigmsk_p)
+{
+    const struct arguments *args_p = worker_p->args_p;
+    int status = EXIT_SUCCESS;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+    {
+        fprintf(stderr, RED "Could not create the epoll FD list. Aborting!" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+    worker_p->epfd = epfd;
+
+    // EPOLLEXCLUSIVE only matters for the --unix listener, the one that
+    // several workers wait on: a client wakes one of them, not all.
+    for (int i = 0; i < nlisteners; i++)
+        epoll_add(epfd, listeners_pp[i], EPOLLIN | EPOLLEXCLUSIVE);
+
+    worker_p->buffer     = args_p->sink == SINK_BUFFER ? malloc(worker_p->buffer_size) : NULL;
+    worker_p->tls_buffer = args_p->tls == TLS_USER ? malloc(worker_p->buffer_size) : NULL;
+    worker_p->udp_p      = args_p->udp ? udp_batch_new(worker_p->buffer_size) : NULL;
+    if ((args_p->sink == SINK_BUFFER && !worker_p->buffer) || (args_p->tls == TLS_USER && !worker_p->tls_buffer) ||
+        (args_p->udp && !worker_p->udp_p))
+    {
+        fprintf(stderr, RED "Out of memory. Aborting!" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (args_p->sink == SINK_SPLICE)
+    {
+        worker_p->null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (worker_p->null_fd < 0 || pipe2(worker_p->pipe_fds, O_CLOEXEC) != 0)
+        {
+            fprintf(stderr, RED "Cannot set up the splice() sink: %m. Aborting!" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // Best effort: a pipe smaller than --recv-size only means shorter splices.
+        fcntl(worker_p->pipe_fds[1], F_SETPIPE_SZ, (int)worker_p->buffer_size);
+    }
+
+    struct epoll_event *processableEvents = calloc(args_p->max_events, sizeof(*processableEvents));
+    if (!processableEvents)
+    {
+        fprintf(stderr, RED "Out of memory. Aborting!" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    timer_wheel_init(&worker_p->wheel, timer_now_ms());
+    __atomic_add_fetch(&workers_ready, 1, __ATOMIC_RELEASE);
+
+    uint64_t spin_ns    = args_p->busy_poll_us * 1000ull;
+    uint64_t spin_until = 0;    /* --busy-poll: do not sleep before this time */
+
+    int accepting = 1;
+    while (!stop)
+    {
+        // --handover: the successor accepts from now on. The listeners
+        // must leave the epoll set before they are closed: the other
+        // process keeps them open, so close() alone would not remove them.
+        if (draining && accepting)
+        {
+            for (int i = 0; i < nlisteners; i++)
+                epoll_ctl(epfd, EPOLL_CTL_DEL, listeners_pp[i]->fd, NULL);
+            accepting = 0;
+        }
+        if (draining && worker_p->stats.active == 0)
+        {
+            __atomic_add_fetch(&workers_drained, 1, __ATOMIC_RELEASE);
+            break;
+        }
+
+        int timeout = timer_wheel_timeout(&worker_p->wheel, timer_now_ms());
+        int numfds;
+
+        // --busy-poll: while the spin budget lasts, poll without sleeping
+        // and without the two sigprocmask() of epoll_pwait(). stop is
+        // checked on every turn, so SIGUSR1 is not needed to get out.
+        if (timeout != 0 && spin_until && worker_now_ns() < spin_until)
+        {
+            numfds = epoll_wait(epfd, processableEvents, args_p->max_events, 0);
+            if (numfds == 0)
+            {
+                worker_p->stats.idle_polls++;
+                continue;
+            }
+        }
+        else
+            numfds = epoll_pwait(epfd, processableEvents, args_p->max_events, timeout, sigmsk_p);
+
+        if (stop) break;
+
+        if (numfds < 0)
+        {
+            if (errno == EINTR) continue;
+
+            fprintf(stderr, RED "Serious error in epoll setup: epoll_wait() returned < 0 status! %m" NORMAL "\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        uint64_t t0_ns = worker_now_ns();
+        for (int i = 0; i < numfds && !stop; i++)
+        {
+            struct conn *conn_p = processableEvents[i].data.ptr;
+            uint32_t     events = processableEvents[i].events;
+            int          shm    = (uintptr_t)conn_p & EPOLL_SHM_TAG;
+
+            conn_p = (struct conn *)((uintptr_t)conn_p & ~(uintptr_t)EPOLL_SHM_TAG);
+            if (conn_p->closing)
+                continue;   /* closed earlier in this batch */
+            else if (shm)
+                shm_client(worker_p, conn_p);
+            else if (conn_p->listener && args_p->udp)
+                read_datagrams(worker_p, conn_p);
+            else if (conn_p->listener)
+                accept_clients(worker_p, conn_p);
+            else if ((events & EPOLLOUT) && write_client(worker_p, conn_p) != 0)
+                continue;
+            else if (events & ~EPOLLOUT)
+                read_client(worker_p, conn_p);
+        }
+
+        conn_timers_run(worker_p, close_client);
+        free_closed(worker_p);
+        if (numfds > 0)
+        {
+            uint64_t t1_ns = worker_now_ns();
+            hist_record(&worker_p->batch_ns, t1_ns - t0_ns);
+            if (spin_ns)
+                spin_until = t1_ns + spin_ns;
+        }
+    }
+
+    free(processableEvents);
+    free(worker_p->buffer);
+    free(worker_p->tls_buffer);
+    free(worker_p->udp_p);
+    dgram_flows_free(&worker_p->flows);
+    if (args_p->sink == SINK_SPLICE)
+    {
+        close(worker_p->pipe_fds[0]);
+        close(worker_p->pipe_fds[1]);
+        close(worker_p->null_fd);
+    }
+    close(epfd);
+
+    return status;
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *worker_p = arg;
+
+    if (worker_p->cpu >= 0)
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(worker_p->cpu, &cpuset);
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+        printf("worker %d: pthread_setaffinity_np(CPU %d) -> %s%s" NORMAL "\n",
+               worker_p->id, worker_p->cpu, rc ? RED : GREEN, strerror(rc));
+    }
+
+    // Workers run with every signal blocked, except SIGUSR1 which the
+    // main thread uses to kick them out of epoll_pwait() (or
+    // io_uring_enter()) on shutdown.
+    sigset_t    sigmsk;
+    sigfillset(&sigmsk);
+    sigdelset(&sigmsk, SIGUSR1);
+
+    // =================================================================
+    // Clients and their partial frames come out of per-worker pools, so
+    // accepting and receiving need no malloc() once the pools are warm.
+    const struct arguments *args_p = worker_p->args_p;
+    pool_init(&worker_p->conn_pool, sizeof(struct conn), 0, args_p->max_conns);
+    pool_init(&worker_p->buf_pool, args_p->recv_size > RX_POOL_BUF_MIN ? args_p->recv_size : RX_POOL_BUF_MIN, 0, 0);
+
+    // =================================================================
+    // The listeners live for the whole life of the worker.
+    // The --unix listener belongs to main(), which closes it.
+    struct conn *listeners_p[3];
+    int          nlisteners = 0;
+    listeners_p[nlisteners++] = new_listener(worker_p->listen_fds[0], "listensock4");
+    listeners_p[nlisteners++] = new_listener(worker_p->listen_fds[1], "listensock6");
+    if (unix_listen_fd >= 0)
+        listeners_p[nlisteners++] = new_listener(unix_listen_fd, "listensockun");
+
+    if (args_p->io == IO_URING)
+        worker_p->status = uring_loop(worker_p, listeners_p, nlisteners, &sigmsk);
+    else
+        worker_p->status = epoll_loop(worker_p, listeners_p, nlisteners, &sigmsk);
+
+    for (int i = 0; i < nlisteners; i++)
+    {
+        if (listeners_p[i]->fd != unix_listen_fd)
+            close(listeners_p[i]->fd);
+        free(listeners_p[i]);
+    }
+
+    // For the memory report of main(), once the thread is joined.
+    worker_p->stats.bufs_lent = worker_p->buf_pool.in_use;
+    pool_destroy(&worker_p->conn_pool);
+    pool_destroy(&worker_p->buf_pool);
+
+    return NULL;
+}
+
+// =============================================================================
+static const struct metric_desc worker_metrics[] =
+{
+    { "server_accepts_total",      "counter", "Clients accepted, including those dropped right away", offsetof(struct worker, stats.accepts) },
+    { "server_fastopen_total",     "counter", "Clients whose SYN carried data (--fastopen)",            offsetof(struct worker, stats.fastopen) },
+    { "server_cpu_local_total",    "counter", "Clients whose packets were processed on the worker's CPU (--steer)", offsetof(struct worker, stats.cpu_local) },
+    { "server_cpu_remote_total",   "counter", "Clients whose packets were processed on another CPU (--steer)", offsetof(struct worker, stats.cpu_remote) },
+    { "server_tls_handshakes_total", "counter", "TLS handshakes completed (--tls)",                     offsetof(struct worker, stats.handshakes) },
+    { "server_tls_handshake_failures_total", "counter", "Clients closed because their TLS handshake failed (--tls)", offsetof(struct worker, stats.handshake_failures) },
+    { "server_closes_total",       "counter", "Clients closed",                                         offsetof(struct worker, stats.closes) },
+    { "server_active_connections", "gauge",   "Clients currently open",                                 offsetof(struct worker, stats.active) },
+    { "server_dropped_total",      "counter", "Clients closed at accept time (--max-conns)",            offsetof(struct worker, stats.dropped) },
+    { "server_timeouts_total",     "counter", "Clients reaped by --idle-timeout or --read-timeout",     offsetof(struct worker, stats.timeouts) },
+    { "server_bytes_in_total",     "counter", "Payload bytes received",                                 offsetof(struct worker, stats.bytes_in) },
+    { "server_bytes_out_total",    "counter", "Echoed bytes handed to the kernel",                      offsetof(struct worker, stats.bytes_out) },
+    { "server_frames_in_total",    "counter", "Complete frames received (--framed)",                    offsetof(struct worker, stats.frames_in) },
+    { "server_datagrams_in_total", "counter", "Datagrams received (--udp)",                             offsetof(struct worker, stats.dgrams_in) },
+    { "server_datagram_buffers_total", "counter", "Buffers filled by recvmmsg(), several datagrams each with UDP_GRO (--udp)", offsetof(struct worker, stats.dgram_bufs) },
+    { "server_datagrams_lost",     "gauge",   "Datagrams skipped by their flow and not received since (--udp)", offsetof(struct worker, stats.dgrams_lost) },
+    { "server_datagrams_late_total", "counter", "Datagrams received after a later one of their flow (--udp)", offsetof(struct worker, stats.dgrams_late) },
+    { "server_datagrams_bad_total", "counter", "Datagrams too short, truncated or without our header (--udp)", offsetof(struct worker, stats.dgrams_bad) },
+    { "server_crc_checked_total",  "counter", "Messages whose CRC32C was checked (--crc)",              offsetof(struct worker, stats.crc_checked) },
+    { "server_crc_errors_total",   "counter", "Messages whose CRC32C did not match, or frames without one (--crc)", offsetof(struct worker, stats.crc_errors) },
+    { "server_captured_total",     "counter", "Messages recorded (--capture)",                          offsetof(struct worker, stats.captured) },
+    { "server_capture_dropped_total", "counter", "Messages not recorded because the --capture file was full", offsetof(struct worker, stats.capture_dropped) },
+    { "server_recv_calls_total",   "counter", "recv(), recvmmsg() or splice() calls, or io_uring recv completions", offsetof(struct worker, stats.recv_calls) },
+    { "server_recv_eagain_total",  "counter", "recv() calls that found nothing to read",                offsetof(struct worker, stats.recv_eagain) },
+    { "server_send_calls_total",   "counter", "send() or sendmsg() calls (--echo)",                     offsetof(struct worker, stats.send_calls) },
+    { "server_send_full_total",    "counter", "Sends that left data queued because the socket was full", offsetof(struct worker, stats.send_full) },
+    { "server_idle_polls_total",   "counter", "--busy-poll: epoll_wait(timeout=0) calls that found nothing", offsetof(struct worker, stats.idle_polls) },
+};
+
+/**
+ * write_stats - publish a snapshot of every worker's counters
+ *
+ * Return 0, or -1 if --stats-file could not be written (errno is set).
+ */
+static int write_stats(const struct arguments *args_p, const struct worker *workers_p)
+{
+    FILE *fp = metrics_open(args_p->stats_file_p);
+    if (!fp)
+        return -1;
+
+    metrics_write(fp, worker_metrics, sizeof(worker_metrics) / sizeof(worker_metrics[0]), "worker",
+                  workers_p, sizeof(*workers_p), args_p->workers);
+    metrics_write_summary(fp, "server_batch_seconds", "Time spent handling one batch of events",
+                          &workers_p[0].batch_ns, sizeof(*workers_p), args_p->workers, 1e-9);
+    metrics_write_process(fp);
+
+    return metrics_close(fp, args_p->stats_file_p);
+}
+
+static void noop_handler(int signo)
+{
+}
+
+/**
+ * handover_collect - the descriptors --handover gives a successor
+ * @handover_fd: the listener on the --handover path
+ * @fds_p: room for 2 + 2 * --workers descriptors
+ *
+ * In the order handover.c describes.
+ *
+ * Return how many.
+ */
+static int handover_collect(const struct arguments *args_p, const struct worker *workers_p, int handover_fd, int *fds_p)
+{
+    int n = 0;
+
+    fds_p[n++] = handover_fd;
+    if (unix_listen_fd >= 0)
+        fds_p[n++] = unix_listen_fd;
+    for (int i = 0; i < args_p->workers; i++)
+    {
+        fds_p[n++] = workers_p[i].listen_fds[0];
+        fds_p[n++] = workers_p[i].listen_fds[1];
+    }
+
+    return n;
+}
+
+/**
+ * take_listeners - --handover: the listeners of the server running there
+ * @workers_p: their listen_fds are set
+ * @handover_fd_p: the listener on the --handover path, set
+ *
+ * Also sets unix_listen_fd with --unix. The old server keeps accepting
+ * until handover_ack().
+ *
+ * Return the connection to ack on, or -1 if no server listens on the
+ * --handover path: the caller then creates listeners of its own.
+ */
+static int take_listeners(const struct arguments *args_p, struct worker *workers_p, int *handover_fd_p)
+{
+    struct handover_hello hello;
+    int   room  = 2 + 2 * args_p->workers;
+    int   want  = 1 + (args_p->unix_path_p != NULL) + 2 * args_p->workers;
+    int  *fds_p = malloc(room * sizeof(*fds_p));
+    int   peer  = -1;
+    if (!fds_p)
+    {
+        fprintf(stderr, RED "Out of memory. Aborting!" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int got = handover_take(args_p->handover_p, &hello, fds_p, room, &peer);
+    if (got < 0)
+    {
+        fprintf(stderr, RED "--handover: cannot take over from %s: %m. Aborting!" NORMAL "\n", args_p->handover_p);
+        exit(EXIT_FAILURE);
+    }
+    if (got == 0)
+    {
+        free(fds_p);
+        return -1;
+    }
+
+    // The workers find their listeners by position. Exiting leaves the
+    // old server without an answer, so it keeps serving.
+    if (hello.port != args_p->port || hello.workers != args_p->workers ||
+        !hello.unix_listener != !args_p->unix_path_p || hello.nfds != want || got != want)
+    {
+        fprintf(stderr, RED "--handover: the server on %s has port %u, %u worker(s) and %s --unix listener: "
+                "restart with the same. Aborting!" NORMAL "\n",
+                args_p->handover_p, hello.port, hello.workers, hello.unix_listener ? "a" : "no");
+        exit(EXIT_FAILURE);
+    }
+
+    int n = 0;
+    *handover_fd_p = fds_p[n++];
+    if (args_p->unix_path_p)
+        unix_listen_fd = fds_p[n++];
+    for (int i = 0; i < args_p->workers; i++)
+    {
+        workers_p[i].listen_fds[0] = fds_p[n++];
+        workers_p[i].listen_fds[1] = fds_p[n++];
+    }
+
+    free(fds_p);
+    return peer;
+}
+
+int main(int argc, char *argv[])
+{
+    struct arguments arguments;
+
+    arguments.port              = 0;
+    arguments.unix_path_p       = NULL;
+    arguments.workers           = 1;
+    arguments.pin_cpu           = -1;
+    arguments.backlog           = SOMAXCONN;
+    arguments.fastopen_qlen     = 0;
+    arguments.defer_accept_s    = 0;
+    arguments.steer             = STEER_NONE;
+    arguments.max_events        = 64;
+    arguments.edge_triggered    = 0;
+    arguments.io                = IO_EPOLL;
+    arguments.echo              = 0;
+    arguments.framed            = 0;
+    arguments.udp               = 0;
+    arguments.crc               = 0;
+    arguments.crc_size          = 0;
+    arguments.cork              = 0;
+    arguments.busy_poll_us      = 0;
+    arguments.sink              = SINK_BUFFER;
+    arguments.recv_size         = 0;       /* default depends on --sink */
+    arguments.tls               = TLS_OFF;
+    arguments.tls_cert_p        = NULL;
+    arguments.tls_key_p         = NULL;
+    arguments.capture_p         = NULL;
+    arguments.capture_size      = CAPTURE_SIZE_DEFAULT;
+    arguments.idle_timeout_ms   = 0;
+    arguments.read_timeout_ms   = 0;
+    arguments.max_conns         = 0;
+    arguments.handover_p        = NULL;
+    arguments.drain_timeout_ms  = 10000;
+    arguments.stats_file_p      = NULL;
+    arguments.stats_interval_ms = 1000;
+    arguments.trace_level       = -1;      /* default depends on --capture and --udp */
+    arguments.trace_file_p      = NULL;
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    if (arguments.sink == SINK_SPLICE && (arguments.echo || arguments.framed || arguments.io != IO_EPOLL))
+    {
+        fprintf(stderr, RED "--sink=splice cannot be combined with --echo, --framed or --io=uring" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.cork && (!arguments.echo || arguments.io != IO_EPOLL))
+    {
+        fprintf(stderr, RED "--cork requires --echo and --io=epoll" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.busy_poll_us)
+    {
+        if (arguments.io != IO_EPOLL)
+        {
+            fprintf(stderr, RED "--busy-poll requires --io=epoll" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // Not fatal: the user-space spin works without it.
+        int fd    = socket(AF_INET, SOCK_STREAM, 0);
+        int usecs = (int)arguments.busy_poll_us;
+        if (fd >= 0 && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) != 0)
+            fprintf(stderr, RED "SO_BUSY_POLL: %m (raising it above net.core.busy_read needs CAP_NET_ADMIN)" NORMAL "\n");
+        if (fd >= 0)
+            close(fd);
+    }
+
+    if (arguments.steer != STEER_NONE && arguments.pin_cpu < 0)
+        arguments.pin_cpu = 0;
+
+    if (arguments.fastopen_qlen)
+    {
+        // Not fatal: clients then fall back to a regular handshake.
+        int   mode = 0;
+        FILE *fp   = fopen("/proc/sys/net/ipv4/tcp_fastopen", "r");
+        if (fp)
+        {
+            if (fscanf(fp, "%i", &mode) != 1)
+                mode = 0;
+            fclose(fp);
+        }
+        if (!(mode & 2))
+            fprintf(stderr, RED "--fastopen: net.ipv4.tcp_fastopen is %d, the server side (2) is disabled" NORMAL "\n", mode);
+    }
+
+    if (arguments.tls != TLS_OFF)
+    {
+        if (arguments.io != IO_EPOLL || (arguments.tls == TLS_USER && arguments.sink == SINK_SPLICE))
+        {
+            fprintf(stderr, RED "--tls requires --io=epoll, and --tls=user --sink=buffer" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if (!arguments.tls_cert_p != !arguments.tls_key_p)
+        {
+            fprintf(stderr, RED "--tls-cert and --tls-key go together" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if (arguments.tls == TLS_KTLS && !tls_ktls_available())
+        {
+            fprintf(stderr, RED "--tls=ktls: this kernel has no TLS support (modprobe tls), try --tls=user" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+
+        tls_ctx_p = tls_server_ctx(arguments.tls_cert_p, arguments.tls_key_p);
+        if (!tls_ctx_p)
+        {
+            fprintf(stderr, RED "Cannot set up TLS. Aborting!" NORMAL "\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (arguments.tls_cert_p || arguments.tls_key_p)
+    {
+        fprintf(stderr, RED "--tls-cert and --tls-key require --tls" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.read_timeout_ms && !arguments.framed)
+    {
+        fprintf(stderr, RED "--read-timeout requires --framed" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.capture_p && arguments.sink == SINK_SPLICE)
+    {
+        fprintf(stderr, RED "--capture needs the data in user space: no --sink=splice" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.crc && (arguments.framed ? arguments.crc_size != 0 : arguments.crc_size == 0))
+    {
+        fprintf(stderr, RED "--crc: frames say where they end, raw streams do not: --crc with --framed, "
+                "--crc=BYTES (the clients' --msg-size) without" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.crc && (arguments.udp || arguments.sink == SINK_SPLICE))
+    {
+        fprintf(stderr, RED "--crc needs the data of TCP or Unix-domain clients in user space: no --udp or --sink=splice" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.handover_p && (arguments.io != IO_EPOLL || arguments.udp))
+    {
+        fprintf(stderr, RED "--handover requires --io=epoll, and TCP or Unix-domain clients: no --udp" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.udp && (arguments.io != IO_EPOLL || arguments.echo || arguments.framed || arguments.tls != TLS_OFF ||
+                          arguments.unix_path_p || arguments.sink != SINK_BUFFER || arguments.capture_p ||
+                          arguments.steer != STEER_NONE || arguments.fastopen_qlen || arguments.defer_accept_s ||
+                          arguments.busy_poll_us || arguments.idle_timeout_ms || arguments.max_conns))
+    {
+        fprintf(stderr, RED "--udp has no clients to accept, echo, time out or steer: it only combines with "
+                "--workers, --pin, --max-events, --recv-size, --stats-file and --trace" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Recording is what --capture is for, and --udp is about packet
+    // rates: printing every message as well would only slow them down.
+    if (arguments.trace_level < 0)
+        arguments.trace_level = arguments.capture_p || arguments.udp ? TRACE_EVENTS : TRACE_DATA;
+
+    if (arguments.capture_p && !(capture_p = capture_create(arguments.capture_p, arguments.capture_size)))
+    {
+        fprintf(stderr, RED "Cannot create %s: %m" NORMAL "\n", arguments.capture_p);
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments.recv_size == 0)
+        arguments.recv_size = arguments.sink == SINK_SPLICE || arguments.udp ? 65536 : 1024;
+
+    // The limit is enforced by each worker's connection pool.
+    arguments.max_conns = (arguments.max_conns + arguments.workers - 1) / arguments.workers;
+
+    // Every client is a descriptor: raise the soft limit to the hard one.
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    // Block everything while the workers are created so that they inherit
+    // a fully blocked mask. Only the main thread ever takes SIGINT.
+    sigset_t    sigmsk;
+    sigfillset(&sigmsk);
+    sigprocmask(SIG_SETMASK, &sigmsk, NULL);
+    signal(SIGINT, sig_handler); // CTRL-c
+    signal(SIGUSR1, noop_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct cpustat cpu_begin, cpu_end;
+    cpustat_open();
+    cpustat_sample(&cpu_begin);
+
+    trace_init(arguments.trace_level, arguments.trace_file_p);
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus < 1) ncpus = 1;
+
+    if (arguments.crc)
+        printf("CRC32C: %s\n", crc32c_init());
+
+    if (arguments.busy_poll_us && (arguments.pin_cpu < 0 || ncpus < arguments.workers + 1))
+        fprintf(stderr, RED "--busy-poll: without a core of its own (--pin, and a spare CPU), a spinning worker "
+                "delays whatever shares its CPU, clients included" NORMAL "\n");
+
+    // Cache-line aligned, so that no two workers share a line of counters.
+    struct worker *workers_p = NULL;
+    if (posix_memalign((void **)&workers_p, CACHE_LINE, arguments.workers * sizeof(*workers_p)) != 0)
+    {
+        fprintf(stderr, RED "Out of memory. Aborting!" NORMAL "\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(workers_p, 0, arguments.workers * sizeof(*workers_p));
+
+    // --handover: a server already running hands its listeners over (a
+    // --steer=cpu program included), so that the port never closes.
+    int handover_fd   = -1;
+    int handover_peer = arguments.handover_p ? take_listeners(&arguments, workers_p, &handover_fd) : -1;
+
+    if (handover_peer < 0)
+    {
+        if (arguments.unix_path_p)
+            unix_listen_fd = get_listen_sock_unix(arguments.unix_path_p, arguments.backlog);
+
+        // One listener per worker and family, in worker order: the position
+        // in the reuseport group is the order of the listen() calls.
+        for (int i = 0; i < arguments.workers; i++)
+        {
+            workers_p[i].listen_fds[0] = get_listen_sock4(&arguments);
+            workers_p[i].listen_fds[1] = get_listen_sock6(&arguments);
+        }
+        if (arguments.steer == STEER_CPU)
+        {
+            steer_to_cpu(workers_p[0].listen_fds[0], &arguments, ncpus);
+            steer_to_cpu(workers_p[0].listen_fds[1], &arguments, ncpus);
+        }
+
+        if (arguments.handover_p && (handover_fd = handover_listen(arguments.handover_p)) < 0)
+        {
+            fprintf(stderr, RED "--handover: cannot listen on %s: %m. Aborting!" NORMAL "\n", arguments.handover_p);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int i = 0; i < arguments.workers; i++)
+    {
+        workers_p[i].id          = i;
+        workers_p[i].cpu         = arguments.pin_cpu < 0 ? -1 : (int)((arguments.pin_cpu + i) % ncpus);
+        workers_p[i].args_p      = &arguments;
+        workers_p[i].status      = EXIT_SUCCESS;
+        workers_p[i].buffer_size = arguments.recv_size;
+        workers_p[i].capture_p   = capture_p;
+        hist_init(&workers_p[i].batch_ns);
+
+        int rc = pthread_create(&workers_p[i].tid, NULL, worker_main, &workers_p[i]);
+        if (rc != 0)
+        {
+            fprintf(stderr, RED "pthread_create() failed: %s" NORMAL "\n", strerror(rc));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Baseline of the memory report: whatever the workers allocate up
+    // front, before any client shows up.
+    for (int tries = 0; __atomic_load_n(&workers_ready, __ATOMIC_ACQUIRE) < arguments.workers && tries < 200; tries++)
+        usleep(10000);
+    size_t rss_base = metrics_rss_bytes();
+
+    // The workers wait on the listeners: the old server can stop accepting.
+    if (handover_peer >= 0)
+    {
+        int rc = handover_ack(handover_peer);
+        printf("handover: listeners taken over, old server told to drain -> %d\n", rc);
+    }
+
+    if (arguments.stats_file_p && write_stats(&arguments, workers_p) != 0)
+    {
+        fprintf(stderr, RED "Cannot write %s: %m. Aborting!" NORMAL "\n", arguments.stats_file_p);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("\n-------------------------------------------------------------------------------\n");
+
+    struct timespec interval =
+    {
+        .tv_sec  = arguments.stats_interval_ms / 1000,
+        .tv_nsec = (arguments.stats_interval_ms % 1000) * 1000000L,
+    };
+
+    // --handover: a successor may show up at any time. Once it has the
+    // listeners the stats file is its own, and this process only waits
+    // for its workers to see their last client out.
+    struct timespec drain_poll = { .tv_sec = 0, .tv_nsec = DRAIN_POLL_MS * 1000000L };
+    struct pollfd   pfd        = { .fd = handover_fd, .events = POLLIN };
+    uint64_t        drain_end  = 0;
+
+    // Without --stats-file or --handover this is a plain sigsuspend().
+    sigdelset(&sigmsk, SIGINT);
+    while (!stop)
+    {
+        int n = ppoll(&pfd, handover_fd >= 0 ? 1 : 0,
+                      drain_end ? &drain_poll : arguments.stats_file_p ? &interval : NULL, &sigmsk);
+        if (stop)
+            break;
+
+        if (n > 0 && (pfd.revents & POLLIN))
+        {
+            int fds[2 + 2 * arguments.workers];
+            struct handover_hello hello =
+            {
+                .magic         = HANDOVER_MAGIC,
+                .port          = arguments.port,
+                .workers       = (uint16_t)arguments.workers,
+                .unix_listener = unix_listen_fd >= 0,
+                .nfds          = (uint16_t)handover_collect(&arguments, workers_p, handover_fd, fds),
+            };
+
+            if (handover_give(handover_fd, &hello, fds) == 0)
+            {
+                close(handover_fd);
+                handover_fd = -1;
+                drain_end   = timer_now_ms() + arguments.drain_timeout_ms;
+                draining    = 1;
+                for (int i = 0; i < arguments.workers; i++)
+                    pthread_kill(workers_p[i].tid, SIGUSR1);
+            }
+        }
+
+        if (drain_end)
+        {
+            if (__atomic_load_n(&workers_drained, __ATOMIC_ACQUIRE) == arguments.workers || timer_now_ms() >= drain_end)
+                break;
+        }
+        else if (arguments.stats_file_p)
+            write_stats(&arguments, workers_p);
+    }
+    stop = 1;   /* --handover: also ends the drain */
+
+    // Sampled before the workers tear their pools down. The clients
+    // they still hold are counted once they are joined.
+    size_t rss_end = metrics_rss_bytes();
+    size_t open    = 0;
+    size_t lent    = 0;
+
+    int      status  = EXIT_SUCCESS;
+    uint64_t bytes   = 0;
+    uint64_t frames  = 0;
+    uint64_t t_first = UINT64_MAX;
+    uint64_t t_last  = 0;
+    uint64_t reaped  = 0;
+    uint64_t dropped = 0;
+    uint64_t idle    = 0;
+    uint64_t accepts = 0;
+    uint64_t tfo     = 0;
+    uint64_t local   = 0;
+    uint64_t remote  = 0;
+    uint64_t tls_ok  = 0;
+    uint64_t tls_bad = 0;
+    uint64_t recs    = 0;
+    uint64_t lost    = 0;
+    uint64_t dgrams  = 0;
+    uint64_t bufs    = 0;
+    uint64_t calls   = 0;
+    uint64_t missing = 0;
+    uint64_t late    = 0;
+    uint64_t bad     = 0;
+    uint64_t crc_ok  = 0;
+    uint64_t crc_bad = 0;
+    for (int i = 0; i < arguments.workers; i++)
+    {
+        pthread_kill(workers_p[i].tid, SIGUSR1);
+        pthread_join(workers_p[i].tid, NULL);
+        if (workers_p[i].status != EXIT_SUCCESS)
+            status = workers_p[i].status;
+        open    += workers_p[i].stats.active;
+        lent    += workers_p[i].stats.bufs_lent;
+        reaped  += workers_p[i].stats.timeouts;
+        dropped += workers_p[i].stats.dropped;
+        idle    += workers_p[i].stats.idle_polls;
+        accepts += workers_p[i].stats.accepts;
+        tfo     += workers_p[i].stats.fastopen;
+        local   += workers_p[i].stats.cpu_local;
+        remote  += workers_p[i].stats.cpu_remote;
+        tls_ok  += workers_p[i].stats.handshakes;
+        tls_bad += workers_p[i].stats.handshake_failures;
+        recs    += workers_p[i].stats.captured;
+        lost    += workers_p[i].stats.capture_dropped;
+        dgrams  += workers_p[i].stats.dgrams_in;
+        bufs    += workers_p[i].stats.dgram_bufs;
+        calls   += workers_p[i].stats.recv_calls - workers_p[i].stats.recv_eagain;
+        missing += workers_p[i].stats.dgrams_lost;
+        late    += workers_p[i].stats.dgrams_late;
+        bad     += workers_p[i].stats.dgrams_bad;
+        crc_ok  += workers_p[i].stats.crc_checked;
+        crc_bad += workers_p[i].stats.crc_errors;
+
+        if (workers_p[i].stats.bytes_in == 0)
+            continue;
+        bytes  += workers_p[i].stats.bytes_in;
+        frames += workers_p[i].stats.frames_in;
+        if (workers_p[i].t_first_ns < t_first) t_first = workers_p[i].t_first_ns;
+        if (workers_p[i].t_last_ns  > t_last)  t_last  = workers_p[i].t_last_ns;
+    }
+
+    // Final totals, for whoever scrapes the file after the run.
+    if (arguments.stats_file_p && !draining)
+        write_stats(&arguments, workers_p);
+
+    free(workers_p);
+    trace_exit();
+    SSL_CTX_free(tls_ctx_p);
+
+    size_t capture_bytes = capture_p ? capture_used(capture_p) : 0;
+    if (capture_close(capture_p) != 0)
+        fprintf(stderr, RED "Cannot trim %s: %m" NORMAL "\n", arguments.capture_p);
+
+    // After a handover the paths are the successor's.
+    if (unix_listen_fd >= 0)
+    {
+        close(unix_listen_fd);
+        if (arguments.unix_path_p[0] != '@' && !draining)
+            unlink(arguments.unix_path_p);
+    }
+    if (handover_fd >= 0)
+    {
+        close(handover_fd);
+        if (arguments.handover_p[0] != '@')
+            unlink(arguments.handover_p);
+    }
+    cpustat_sample(&cpu_end);
+
+    if (bytes > 0)
+    {
+        double elapsed = (t_last - t_first) / 1e9;
+        if (elapsed <= 0) elapsed = 1e-9;
+
+        printf("\nReceived:    %llu bytes in %.3f s (first to last byte), " GREEN "%.3f Gbit/s" NORMAL "\n",
+               (unsigned long long)bytes, elapsed, bytes * 8.0 / elapsed / 1e9);
+        if (arguments.framed)
+            printf("Frames:      %llu (%.0f frames/s)\n", (unsigned long long)frames, frames / elapsed);
+        if (arguments.udp)
+        {
+            printf("Datagrams:   %llu (" GREEN "%.0f datagrams/s" NORMAL ") in %llu recvmmsg() call(s): "
+                   "%.1f buffer(s) per call, %.1f datagram(s) per buffer\n",
+                   (unsigned long long)dgrams, dgrams / elapsed, (unsigned long long)calls,
+                   calls ? (double)bufs / calls : 0.0, bufs ? (double)dgrams / bufs : 0.0);
+            printf("Loss:        %s%llu lost (%.3f%%)" NORMAL ", %llu reordered, %llu malformed\n",
+                   missing ? RED : GREEN, (unsigned long long)missing,
+                   dgrams + missing ? missing * 100.0 / (dgrams + missing) : 0.0,
+                   (unsigned long long)late, (unsigned long long)bad);
+        }
+        if (arguments.crc)
+            printf("Integrity:   %llu message(s) checked with CRC32C (%s), %s%llu corrupted" NORMAL "\n",
+                   (unsigned long long)crc_ok, crc32c_init(), crc_bad ? RED : GREEN, (unsigned long long)crc_bad);
+        cpustat_print(&cpu_begin, &cpu_end, elapsed, bytes);
+    }
+
+    if (arguments.idle_timeout_ms || arguments.read_timeout_ms)
+        printf("Timeouts:    %llu client(s) reaped\n", (unsigned long long)reaped);
+
+    if (arguments.busy_poll_us)
+        printf("Busy-poll:   %llu idle epoll_wait() call(s) within a %u usec spin budget\n",
+               (unsigned long long)idle, arguments.busy_poll_us);
+
+    if (arguments.fastopen_qlen)
+        printf("Fast Open:   %llu of %llu client(s) sent data in the SYN\n",
+               (unsigned long long)tfo, (unsigned long long)accepts);
+
+    if (arguments.steer != STEER_NONE)
+        printf("Steering:    %s, %llu client(s) on the CPU of their worker, %llu elsewhere (%.1f%% local)\n",
+               arguments.steer == STEER_CPU ? "cpu" : "hash", (unsigned long long)local, (unsigned long long)remote,
+               local + remote ? local * 100.0 / (local + remote) : 0.0);
+
+    if (arguments.tls != TLS_OFF)
+        printf("TLS:         %llu handshake(s), %llu failed, records by %s\n", (unsigned long long)tls_ok,
+               (unsigned long long)tls_bad, arguments.tls == TLS_KTLS ? "the kernel" : "OpenSSL");
+
+    if (arguments.capture_p)
+    {
+        printf("Capture:     %llu message(s), %.1f MiB in %s\n",
+               (unsigned long long)recs, capture_bytes / 1048576.0, arguments.capture_p);
+        if (lost > 0)
+            printf(RED "             %llu message(s) not recorded: the file was full (see --capture-size)" NORMAL "\n",
+                   (unsigned long long)lost);
+    }
+
+    if (dropped > 0)
+        printf("Dropped:     %llu client(s) over --max-conns or out of memory\n", (unsigned long long)dropped);
+
+    if (draining)
+        printf("Handover:    listeners handed to a new server, %s" NORMAL "\n",
+               workers_drained == arguments.workers ? GREEN "every client served to the end"
+                                                    : RED "the clients left closed at --drain-timeout");
+
+    if (open > 0)
+    {
+        double per_conn = rss_end > rss_base ? (double)(rss_end - rss_base) / open : 0;
+        printf("Memory:      %zu client(s) open, RSS %.1f MiB (+%.1f MiB): %.0f bytes/client "
+               "(struct conn: %zu bytes, %zu receive buffer(s) lent)\n",
+               open, rss_end / 1048576.0, (rss_end > rss_base ? rss_end - rss_base : 0) / 1048576.0,
+               per_conn, sizeof(struct conn), lent);
+    }
+
+    exit(status);
+}
@@ -0,0 +1,389 @@
+// SERVER - declarations shared by the event loop back-ends
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>     /* uint16_t */
+#include <stddef.h>     /* size_t */
+#include <signal.h>     /* sigset_t */
+#include <pthread.h>    /* pthread_t */
+#include <sys/socket.h> /* struct sockaddr_storage */
+#include <arpa/inet.h>  /* INET6_ADDRSTRLEN */
+#include <time.h>       /* clock_gettime() */
+
+#include "frame.h"
+#include "timer.h"
+#include "pool.h"
+#include "wqueue.h"
+#include "metrics.h"
+#include "histogram.h"
+#include "shmring.h"
+#include "tlsconn.h"
+#include "capture.h"
+#include "dgram.h"
+#include "crc32c.h"
+
+#define RED     "\x1b[1;31m"
+#define GREEN   "\x1b[1;32m"
+#define CYAN    "\x1b[1;36m"
+#define NORMAL  "\x1b[0m"
+
+#define ECHO_HIGH_WATER (256u << 10)    /* epoll: stop reading a client with this much echo queued */
+#define ECHO_MAX_QUEUED (16u << 20)     /* close a client that lets more than this pile up */
+
+#define HANDOVER_MAGIC      0x48414e44u /* "HAND" */
+#define HANDOVER_TIMEOUT_S  10          /* --handover: longest wait for the other process */
+
+enum io_backend
+{
+    IO_EPOLL,       /* epoll_pwait() + recv() (default) */
+    IO_URING,       /* io_uring multishot accept/recv with provided buffers */
+};
+
+enum steer
+{
+    STEER_NONE,     /* kernel hash, SO_INCOMING_CPU not checked (default) */
+    STEER_HASH,     /* kernel hash, SO_INCOMING_CPU checked on every client */
+    STEER_CPU,      /* cBPF: the worker pinned to the CPU that took the SYN */
+};
+
+enum sink
+{
+    SINK_BUFFER,    /* recv() into a reusable user buffer (default) */
+    SINK_SPLICE,    /* splice() socket -> pipe -> /dev/null, no user copy */
+};
+
+struct arguments
+{
+    uint16_t        port;
+    const char     *unix_path_p;        /* NULL: TCP only */
+    int             workers;
+    int             pin_cpu;   /* -1: no pinning */
+    int             backlog;
+    int             fastopen_qlen;      /* TCP_FASTOPEN queue, 0: off */
+    int             defer_accept_s;     /* TCP_DEFER_ACCEPT, 0: off */
+    enum steer      steer;
+    int             max_events;
+    int             edge_triggered;
+    enum io_backend io;
+    int             echo;
+    int             framed;
+    int             udp;                /* UDP datagrams instead of TCP clients */
+    int             crc;                /* check the CRC32C clients end their messages with */
+    size_t          crc_size;           /* --crc on raw streams: the clients' --msg-size */
+    int             cork;
+    unsigned        busy_poll_us;       /* 0: block in epoll_pwait() */
+    enum sink       sink;
+    size_t          recv_size;
+    enum tls_mode   tls;
+    const char     *tls_cert_p;         /* NULL: self-signed, in memory */
+    const char     *tls_key_p;
+    const char     *capture_p;          /* NULL: received data is not recorded */
+    size_t          capture_size;
+    unsigned        idle_timeout_ms;    /* 0: never */
+    unsigned        read_timeout_ms;    /* 0: never */
+    const char     *stats_file_p;       /* NULL: no live metrics */
+    unsigned        stats_interval_ms;
+    size_t          max_conns;          /* per worker, 0: no limit */
+    const char     *handover_p;         /* NULL: a restart refuses clients while the port is closed */
+    unsigned        drain_timeout_ms;   /* --handover: longest the old process serves its clients */
+    int             trace_level;
+    const char     *trace_file_p;
+};
+
+/**
+ * struct cork_buf - --cork: echoes of a read pass, in a buffer of the
+ *      worker's buf_pool
+ * @next_p: the next buffer of the pass
+ * @len: bytes in @data
+ * @data: the echoes
+ */
+struct cork_buf
+{
+    struct cork_buf *next_p;
+    size_t           len;
+    char             data[];
+};
+
+/**
+ * struct conn - per-descriptor state registered with the event loop
+ * @fd: socket descriptor
+ * @listener: true for listen sockets (--udp: the UDP sockets), false for
+ *      accepted clients
+ * @name: printable name ("listensock4", or the peer "ADDR:PORT" or
+ *      "unix:pid=PID")
+ * @rx: --framed: bytes received but not parsed yet (a partial frame).
+ *      Holds a buffer from the worker's pool only while a frame is
+ *      incomplete.
+ * @timer: next idle or read deadline, re-armed lazily (see conn_touch())
+ * @last_rx_ms: time of the last receive, or of the accept
+ * @partial_ms: --framed: time the partial frame in @rx started, 0 if none
+ * @wq: --echo: what the socket did not take yet
+ * @events: epoll: events currently registered
+ * @corked: --cork: echoes are only staged until the end of the read
+ * @polling: io_uring: a POLLOUT request references this connection
+ * @closing: closed, to be freed when the poll request completes (io_uring)
+ *      or at the end of the batch of events (epoll)
+ * @closed_next_p: epoll: next connection closed during the same batch
+ * @hello: epoll: a Unix-domain client whose first read may be a
+ *      shared-memory offer (struct shm_hello)
+ * @shm_p: the client's shared-memory channel, if it took one. Data then
+ *      goes through the rings; the socket is only watched for EOF.
+ * @tls_p: --tls: the client's TLS connection (TCP clients only)
+ * @handshake: --tls: the TLS handshake is not over yet
+ * @id: number of the client, unique within the process (--capture)
+ * @crc_off: --crc=BYTES: bytes of the current message received so far
+ * @crc: --crc=BYTES: their CRC32C
+ * @cork_p: --cork: the echoes of the current read pass, staged in
+ *      buffers of the worker's pool until they are sent; NULL between
+ *      passes, or while @wq holds data (the echoes then go after it)
+ * @cork_tail_p: --cork: the last buffer of @cork_p
+ * @cork_bufs: --cork: the number of buffers in @cork_p
+ *
+ * A pointer to this structure is stored in epoll_event.data.ptr (or in
+ * the io_uring user_data) so that the event loop can tell listeners from
+ * clients without any lookup. Clients are allocated from the worker's
+ * connection pool.
+ */
+struct conn
+{
+    int     fd;
+    int     listener;
+    char    name[INET6_ADDRSTRLEN + 8];
+    struct frame_buf rx;
+    struct timer     timer;
+    uint64_t         last_rx_ms;
+    uint64_t         partial_ms;
+    struct wqueue    wq;
+    uint32_t         events;
+    uint8_t          corked;
+    uint8_t          polling;
+    uint8_t          closing;
+    uint8_t          hello;
+    uint8_t          handshake;
+    uint32_t         id;
+    uint32_t         crc_off;
+    uint32_t         crc;
+    struct cork_buf *cork_p;
+    struct cork_buf *cork_tail_p;
+    uint32_t         cork_bufs;
+    struct shm_chan *shm_p;
+    SSL             *tls_p;
+    struct conn     *closed_next_p;
+};
+
+/**
+ * struct worker_stats - what one worker counts, exported with --stats-file
+ * @accepts: clients accepted (including the ones dropped right away)
+ * @fastopen: --fastopen: clients whose SYN carried data that was accepted
+ * @cpu_local: --steer: clients whose packets were processed on the worker's CPU
+ * @cpu_remote: --steer: ... on another CPU (SO_INCOMING_CPU)
+ * @handshakes: --tls: TLS handshakes completed
+ * @handshake_failures: --tls: clients closed because their handshake failed
+ * @closes: clients closed, whatever the reason
+ * @active: clients currently open
+ * @dropped: clients closed at accept time because of --max-conns
+ * @timeouts: clients reaped because a deadline expired
+ * @bytes_in: payload bytes received
+ * @bytes_out: --echo: bytes handed to the kernel
+ * @frames_in: --framed: complete frames received
+ * @dgrams_in: --udp: datagrams received with a valid header
+ * @dgram_bufs: --udp: buffers filled by recvmmsg(), each holding one
+ *      datagram or, with UDP_GRO, several of the same flow
+ * @dgrams_lost: --udp: datagrams skipped by their flow and not seen since
+ * @dgrams_late: --udp: datagrams that came after a later one of their flow
+ * @dgrams_bad: --udp: datagrams too short, truncated or not ours
+ * @crc_checked: --crc: messages whose CRC32C was checked
+ * @crc_errors: --crc: ... that did not match, or frames without one
+ * @captured: --capture: messages recorded
+ * @capture_dropped: --capture: messages not recorded, the file being full
+ * @recv_calls: recv(), recvmmsg() or splice() calls, or io_uring recv
+ *      completions
+ * @recv_eagain: recv() calls that found nothing to read
+ * @send_calls: --echo: send() or sendmsg() calls
+ * @send_full: --echo: sends that left data queued, the socket being full
+ * @idle_polls: --busy-poll: epoll_wait(timeout=0) calls that found nothing
+ * @bufs_lent: receive buffers still lent to clients when the event loop
+ *      ended, recorded before the pools are destroyed
+ *
+ * Only the worker writes these; see metrics.h for how they are read.
+ */
+struct worker_stats
+{
+    uint64_t    accepts;
+    uint64_t    fastopen;
+    uint64_t    cpu_local;
+    uint64_t    cpu_remote;
+    uint64_t    handshakes;
+    uint64_t    handshake_failures;
+    uint64_t    closes;
+    uint64_t    active;
+    uint64_t    dropped;
+    uint64_t    timeouts;
+    uint64_t    bytes_in;
+    uint64_t    bytes_out;
+    uint64_t    frames_in;
+    uint64_t    dgrams_in;
+    uint64_t    dgram_bufs;
+    uint64_t    dgrams_lost;
+    uint64_t    dgrams_late;
+    uint64_t    dgrams_bad;
+    uint64_t    crc_checked;
+    uint64_t    crc_errors;
+    uint64_t    captured;
+    uint64_t    capture_dropped;
+    uint64_t    recv_calls;
+    uint64_t    recv_eagain;
+    uint64_t    send_calls;
+    uint64_t    send_full;
+    uint64_t    idle_polls;
+    uint64_t    bufs_lent;
+} __attribute__((aligned(CACHE_LINE)));
+
+/**
+ * struct worker - one event loop thread
+ * @id: worker index, 0..N-1
+ * @cpu: CPU the thread is pinned to, or -1 to let the scheduler decide
+ * @args_p: command-line configuration shared by all workers
+ * @listen_fds: the worker's IPv4 and IPv6 listeners, created by main()
+ * @tid: thread ID
+ * @status: exit status of the event loop
+ * @epfd: the worker's epoll set (listeners and clients)
+ * @buffer: receive buffer shared by all the worker's clients
+ * @buffer_size: size of @buffer (--recv-size)
+ * @tls_buffer: --tls=user: ciphertext on its way from a socket to OpenSSL,
+ *      @buffer_size bytes
+ * @pipe_fds: --sink=splice: pipe between the sockets and /dev/null
+ * @null_fd: --sink=splice: /dev/null
+ * @udp_p: --udp: the recvmmsg() batch
+ * @flows: --udp: the flows of the datagrams received by the worker
+ * @capture_p: --capture: the file shared by all the workers
+ * @next_conn_id: how many clients the worker numbered, see conn_new()
+ * @stats: counters, on cache lines of their own
+ * @batch_ns: time spent handling each batch of events, in nanoseconds
+ * @t_first_ns: CLOCK_MONOTONIC time of the first received byte
+ * @t_last_ns: CLOCK_MONOTONIC time of the last received byte
+ * @wheel: idle and read deadlines of the worker's clients
+ * @closed_p: epoll: clients closed during the current batch of events,
+ *      freed once it is over, see close_client()
+ * @conn_pool: struct conn slab for the worker's clients
+ * @buf_pool: receive buffers lent to clients holding a partial frame
+ *
+ * Every worker owns a private pair of SO_REUSEPORT listeners and a
+ * private epoll set. The kernel hashes each incoming connection to one
+ * of the listeners of the reuseport group, so workers never share an
+ * accept queue or a lock. main() creates the listeners in worker order,
+ * so that worker i is socket i of each group, which is what a --steer=cpu
+ * program returns. The --unix listener is the exception: there is
+ * one for the whole process, and every worker waits on it.
+ *
+ * With --udp the "listeners" are reuseport UDP sockets: the kernel
+ * hashes each sender to one of them, so a flow stays with one worker
+ * and its loss and order can be told without sharing anything.
+ */
+struct worker
+{
+    int         id;
+    int         cpu;
+    const struct arguments *args_p;
+    int         listen_fds[2];
+    pthread_t   tid;
+    int         status;
+    int         epfd;
+    char       *buffer;
+    size_t      buffer_size;
+    char       *tls_buffer;
+    int         pipe_fds[2];
+    int         null_fd;
+    struct udp_batch  *udp_p;
+    struct dgram_flows flows;
+    struct capture *capture_p;
+    uint32_t    next_conn_id;
+    struct worker_stats stats;
+    struct histogram batch_ns;
+    uint64_t    t_first_ns;
+    uint64_t    t_last_ns;
+    struct timer_wheel wheel;
+    struct conn *closed_p;
+    struct pool conn_pool;
+    struct pool buf_pool;
+};
+
+/**
+ * struct handover_hello - what comes with each message of a handover
+ * @magic: HANDOVER_MAGIC
+ * @port: the TCP port of the listeners
+ * @workers: the number of workers, 2 listeners each
+ * @unix_listener: whether a --unix listener is part of it
+ * @nfds: the number of descriptors in all the messages
+ *
+ * See handover.c for the order of the descriptors.
+ */
+struct handover_hello
+{
+    uint32_t    magic;
+    uint16_t    port;
+    uint16_t    workers;
+    uint16_t    unix_listener;
+    uint16_t    nfds;
+};
+
+extern volatile int stop;
+extern int          workers_ready;
+
+static inline uint64_t worker_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline void worker_count_rx(struct worker *worker_p, size_t n)
+{
+    worker_p->t_last_ns = worker_now_ns();
+    if (worker_p->stats.bytes_in == 0)
+        worker_p->t_first_ns = worker_p->t_last_ns;
+    worker_p->stats.bytes_in += n;
+}
+
+/* --capture: record a message, received at worker_count_rx() time. */
+static inline void worker_capture(struct worker *worker_p, const struct conn *conn_p, const char *data_p, size_t len)
+{
+    if (!worker_p->capture_p)
+        return;
+
+    if (capture_write(worker_p->capture_p, conn_p->id, worker_p->t_last_ns, data_p, len) == 0)
+        worker_p->stats.captured++;
+    else
+        worker_p->stats.capture_dropped++;
+}
+
+/* A send() or sendmsg() that handed @sent bytes to the kernel. */
+static inline void worker_count_tx(struct worker *worker_p, int rc, size_t sent)
+{
+    worker_p->stats.send_calls++;
+    worker_p->stats.bytes_out += sent;
+    if (rc > 0)
+        worker_p->stats.send_full++;
+}
+
+struct conn *conn_new(struct worker *worker_p, int fd);
+void         conn_free(struct worker *worker_p, struct conn *conn_p);
+void         conn_drop(struct worker *worker_p, int fd);
+void         conn_set_name(struct conn *conn_p, const struct sockaddr_storage *addr_p);
+void         conn_accept_checks(struct worker *worker_p, int fd);
+int          echo(struct worker *worker_p, struct conn *conn_p, const char *data_p, size_t len);
+int          conn_frames(struct worker *worker_p, struct conn *conn_p, const char *data_p, size_t len);
+void         conn_crc(struct worker *worker_p, struct conn *conn_p, const char *data_p, size_t len);
+void         conn_touch(struct worker *worker_p, struct conn *conn_p);
+void         conn_timers_run(struct worker *worker_p, void (*reap_fn)(struct worker *, struct conn *));
+
+int handover_listen(const char *path_p);
+int handover_take(const char *path_p, struct handover_hello *hello_p, int *fds_p, int room, int *peer_p);
+int handover_ack(int peer);
+int handover_give(int listen_fd, const struct handover_hello *hello_p, const int *fds_p);
+
+int uring_loop(struct worker *worker_p, struct conn **listeners_pp, int nlisteners,
+               const sigset_t *sigmsk_p);
+
+#endif /* SERVER_H */
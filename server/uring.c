@@ -0,0 +1,580 @@
+// SERVER - io_uring back-end
+//
+// Same job as the epoll loop in main.c, but with the syscall count per
+// message taken out of the picture:
+//
+//   - One multishot accept per listener posts a completion for every
+//     new connection without being re-armed.
+//   - One multishot recv per client posts a completion for every chunk
+//     of data, --recv-size bytes at most. The kernel picks the
+//     destination from a provided buffer ring, so no buffer is tied to
+//     an idle connection.
+//   - All the SQEs queued while processing a batch of completions are
+//     submitted by the same io_uring_enter() that waits for the next
+//     batch. With client deadlines, that wait is bounded by the nearest
+//     one (IORING_ENTER_EXT_ARG), and expired clients are shut down so
+//     that their pending recv completes and closes them.
+//   - An echo the socket does not take right away stays in the client's
+//     write queue, and a one-shot POLLOUT request flushes it later.
+//   - --unix clients are served like TCP ones, but their shared-memory
+//     offers go unanswered: that transport is epoll only.
+//
+// liburing is not required: the rings are mapped and driven directly
+// with the raw syscalls.
+#define _GNU_SOURCE
+#include <stdio.h>      /* printf() */
+#include <stdlib.h>     /* calloc(), free(), exit() */
+#include <unistd.h>     /* syscall(), close() */
+#include <errno.h>      /* errno */
+#include <string.h>     /* memset(), strerror() */
+#include <poll.h>       /* POLLOUT */
+#include <sys/mman.h>   /* mmap(), munmap() */
+#include <sys/syscall.h>/* __NR_io_uring_setup, ... */
+#include <linux/io_uring.h>
+
+#include "server.h"
+#include "trace.h"
+
+#define URING_ENTRIES   1024    /* SQ size, the CQ is 4 times larger */
+#define URING_BUFS      1024    /* provided buffers of --recv-size bytes, must be a power of 2 */
+#define URING_BGID      0
+#define URING_POLL_TAG  1       /* user_data bit: POLLOUT completion, not recv */
+
+struct uring
+{
+    int                     fd;
+    unsigned                features;   /* IORING_FEAT_* */
+
+    unsigned               *sq_head;
+    unsigned               *sq_tail;
+    unsigned                sq_mask;
+    unsigned                sq_entries;
+    struct io_uring_sqe    *sqes;
+    unsigned                sqe_head;   /* first SQE not yet submitted */
+    unsigned                sqe_tail;   /* next SQE to hand out */
+
+    unsigned               *cq_head;
+    unsigned               *cq_tail;
+    unsigned                cq_mask;
+    struct io_uring_cqe    *cqes;
+
+    void                   *sq_ptr;
+    size_t                  sq_size;
+    void                   *cq_ptr;
+    size_t                  cq_size;
+    size_t                  sqes_size;
+
+    struct io_uring_buf_ring *br;
+    size_t                  br_size;
+    char                   *bufs;
+    size_t                  buf_size;   /* --recv-size */
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags, const sigset_t *sig)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, sig, _NSIG / 8);
+}
+
+/**
+ * uring_wait - submit and wait for at least one completion
+ * @timeout: milliseconds, or -1 to wait forever
+ *
+ * A timeout needs the extended argument, which carries the signal mask
+ * along with it. Return -1 with errno ETIME when the timeout expires.
+ */
+static int uring_wait(struct uring *ring_p, unsigned to_submit, const sigset_t *sigmsk_p, int timeout)
+{
+    if (timeout < 0)
+        return sys_io_uring_enter(ring_p->fd, to_submit, 1, IORING_ENTER_GETEVENTS, sigmsk_p);
+
+    struct __kernel_timespec      ts;
+    struct io_uring_getevents_arg arg;
+
+    ts.tv_sec  = timeout / 1000;
+    ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask    = (uintptr_t)sigmsk_p;
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts         = (uintptr_t)&ts;
+
+    return (int)syscall(__NR_io_uring_enter, ring_p->fd, to_submit, 1,
+                        IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int uring_init(struct uring *ring_p, size_t buf_size)
+{
+    struct io_uring_params params;
+
+    memset(ring_p, 0, sizeof(*ring_p));
+    ring_p->buf_size = buf_size;
+    memset(&params, 0, sizeof(params));
+    params.flags      = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL |
+                        IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+    params.cq_entries = 4 * URING_ENTRIES;
+
+    printf("io_uring_setup(%d, &params) -> ", URING_ENTRIES);
+    ring_p->fd = sys_io_uring_setup(URING_ENTRIES, &params);
+    if (ring_p->fd < 0 && errno == EINVAL)
+    {
+        // Older kernel: retry without the optional setup flags
+        memset(&params, 0, sizeof(params));
+        ring_p->fd = sys_io_uring_setup(URING_ENTRIES, &params);
+    }
+    printf("%d\n", ring_p->fd);
+    if (ring_p->fd < 0)
+    {
+        fprintf(stderr, RED "io_uring_setup() failed: %m" NORMAL "\n");
+        return -1;
+    }
+
+    ring_p->features = params.features;
+
+    ring_p->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring_p->cq_size = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring_p->cq_size > ring_p->sq_size)
+            ring_p->sq_size = ring_p->cq_size;
+        ring_p->cq_size = ring_p->sq_size;
+    }
+
+    ring_p->sq_ptr = mmap(NULL, ring_p->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ring_p->fd, IORING_OFF_SQ_RING);
+    if (ring_p->sq_ptr == MAP_FAILED)
+    {
+        fprintf(stderr, RED "mmap(IORING_OFF_SQ_RING) failed: %m" NORMAL "\n");
+        return -1;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring_p->cq_ptr = ring_p->sq_ptr;
+    }
+    else
+    {
+        ring_p->cq_ptr = mmap(NULL, ring_p->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                              ring_p->fd, IORING_OFF_CQ_RING);
+        if (ring_p->cq_ptr == MAP_FAILED)
+        {
+            fprintf(stderr, RED "mmap(IORING_OFF_CQ_RING) failed: %m" NORMAL "\n");
+            return -1;
+        }
+    }
+
+    ring_p->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring_p->sqes = mmap(NULL, ring_p->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring_p->fd, IORING_OFF_SQES);
+    if (ring_p->sqes == MAP_FAILED)
+    {
+        fprintf(stderr, RED "mmap(IORING_OFF_SQES) failed: %m" NORMAL "\n");
+        return -1;
+    }
+
+    char *sq = ring_p->sq_ptr;
+    char *cq = ring_p->cq_ptr;
+    ring_p->sq_head    = (unsigned *)(sq + params.sq_off.head);
+    ring_p->sq_tail    = (unsigned *)(sq + params.sq_off.tail);
+    ring_p->sq_mask    = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring_p->sq_entries = params.sq_entries;
+    ring_p->cq_head    = (unsigned *)(cq + params.cq_off.head);
+    ring_p->cq_tail    = (unsigned *)(cq + params.cq_off.tail);
+    ring_p->cq_mask    = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring_p->cqes       = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // SQEs are always consumed in order: map SQ slot i to SQE i once.
+    unsigned *sq_array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++)
+        sq_array[i] = i;
+
+    ring_p->sqe_head = ring_p->sqe_tail = *ring_p->sq_tail;
+
+    // =================================================================
+    // Provided buffer ring: the kernel picks a buffer for each recv
+    // completion and reports its ID in cqe->flags.
+    ring_p->br_size = URING_BUFS * sizeof(struct io_uring_buf);
+    ring_p->br = mmap(NULL, ring_p->br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring_p->br == MAP_FAILED)
+    {
+        fprintf(stderr, RED "mmap(buffer ring) failed: %m" NORMAL "\n");
+        return -1;
+    }
+
+    ring_p->bufs = malloc(URING_BUFS * ring_p->buf_size);
+    if (!ring_p->bufs)
+    {
+        fprintf(stderr, RED "Out of memory. Aborting!" NORMAL "\n");
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (uintptr_t)ring_p->br;
+    reg.ring_entries = URING_BUFS;
+    reg.bgid         = URING_BGID;
+
+    printf("io_uring_register(IORING_REGISTER_PBUF_RING, %d x %zu bytes) -> ", URING_BUFS, ring_p->buf_size);
+    int rc = sys_io_uring_register(ring_p->fd, IORING_REGISTER_PBUF_RING, &reg, 1);
+    printf("%d\n", rc);
+    if (rc < 0)
+    {
+        fprintf(stderr, RED "IORING_REGISTER_PBUF_RING failed: %m" NORMAL "\n");
+        return -1;
+    }
+
+    for (unsigned bid = 0; bid < URING_BUFS; bid++)
+    {
+        struct io_uring_buf *buf_p = &ring_p->br->bufs[bid];
+        buf_p->addr = (uintptr_t)(ring_p->bufs + (size_t)bid * ring_p->buf_size);
+        buf_p->len  = ring_p->buf_size;
+        buf_p->bid  = bid;
+    }
+    __atomic_store_n(&ring_p->br->tail, URING_BUFS, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static void uring_exit(struct uring *ring_p)
+{
+    if (ring_p->fd >= 0)
+        close(ring_p->fd);
+    if (ring_p->br && ring_p->br != MAP_FAILED)
+        munmap(ring_p->br, ring_p->br_size);
+    if (ring_p->sqes && ring_p->sqes != MAP_FAILED)
+        munmap(ring_p->sqes, ring_p->sqes_size);
+    if (ring_p->cq_ptr && ring_p->cq_ptr != MAP_FAILED && ring_p->cq_ptr != ring_p->sq_ptr)
+        munmap(ring_p->cq_ptr, ring_p->cq_size);
+    if (ring_p->sq_ptr && ring_p->sq_ptr != MAP_FAILED)
+        munmap(ring_p->sq_ptr, ring_p->sq_size);
+    free(ring_p->bufs);
+}
+
+/**
+ * uring_flush - make the queued SQEs visible to the kernel
+ *
+ * Return the number of SQEs to pass to io_uring_enter().
+ */
+static unsigned uring_flush(struct uring *ring_p)
+{
+    unsigned to_submit = ring_p->sqe_tail - ring_p->sqe_head;
+
+    __atomic_store_n(ring_p->sq_tail, ring_p->sqe_tail, __ATOMIC_RELEASE);
+    ring_p->sqe_head = ring_p->sqe_tail;
+
+    return to_submit;
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *ring_p)
+{
+    unsigned head = __atomic_load_n(ring_p->sq_head, __ATOMIC_ACQUIRE);
+    if (ring_p->sqe_tail - head >= ring_p->sq_entries)
+    {
+        // SQ full: submit what we have without waiting.
+        sys_io_uring_enter(ring_p->fd, uring_flush(ring_p), 0, 0, NULL);
+        head = __atomic_load_n(ring_p->sq_head, __ATOMIC_ACQUIRE);
+        if (ring_p->sqe_tail - head >= ring_p->sq_entries)
+            return NULL;
+    }
+
+    struct io_uring_sqe *sqe = &ring_p->sqes[ring_p->sqe_tail & ring_p->sq_mask];
+    ring_p->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+static void uring_recycle_buf(struct uring *ring_p, unsigned bid)
+{
+    unsigned short       tail  = ring_p->br->tail;
+    struct io_uring_buf *buf_p = &ring_p->br->bufs[tail & (URING_BUFS - 1)];
+
+    buf_p->addr = (uintptr_t)(ring_p->bufs + (size_t)bid * ring_p->buf_size);
+    buf_p->len  = ring_p->buf_size;
+    buf_p->bid  = bid;
+    __atomic_store_n(&ring_p->br->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+static void arm_accept(struct uring *ring_p, struct conn *listener_p)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring_p);
+    if (!sqe)
+    {
+        fprintf(stderr, RED "%s: submission queue full" NORMAL "\n", listener_p->name);
+        return;
+    }
+
+    sqe->opcode       = IORING_OP_ACCEPT;
+    sqe->fd           = listener_p->fd;
+    sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data    = (uintptr_t)listener_p;
+}
+
+static int arm_recv(struct uring *ring_p, struct conn *conn_p)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring_p);
+    if (!sqe)
+        return -1;
+
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = conn_p->fd;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = (uintptr_t)conn_p;
+
+    return 0;
+}
+
+static int arm_poll(struct uring *ring_p, struct conn *conn_p)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring_p);
+    if (!sqe)
+        return -1;
+
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = conn_p->fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data     = (uintptr_t)conn_p | URING_POLL_TAG;
+    conn_p->polling    = 1;
+
+    return 0;
+}
+
+/*
+ * Called once the recv is over. A pending POLLOUT request still
+ * references the connection: it completes as soon as the socket is shut
+ * down, and handle_poll() frees the connection then.
+ */
+static void close_client(struct worker *worker_p, struct conn *conn_p)
+{
+    TRACE(TRACE_EVENTS, TC_CLOSE, conn_p->fd, 0, 0, conn_p->name, strlen(conn_p->name));
+    timer_del(&worker_p->wheel, &conn_p->timer);
+    if (conn_p->polling)
+    {
+        shutdown(conn_p->fd, SHUT_RDWR);
+        close(conn_p->fd);
+        conn_p->closing = 1;
+        return;
+    }
+    close(conn_p->fd);
+    conn_free(worker_p, conn_p);
+}
+
+/*
+ * The multishot recv still references the connection: closing it here
+ * would leave the completion pointing at freed memory. A shutdown makes
+ * the recv complete with 0, and handle_recv() closes the client then.
+ */
+static void shutdown_client(struct worker *worker_p, struct conn *conn_p)
+{
+    shutdown(conn_p->fd, SHUT_RDWR);
+}
+
+static void handle_accept(struct worker *worker_p, struct uring *ring_p, struct conn *listener_p,
+                          struct io_uring_cqe *cqe)
+{
+    if (cqe->res >= 0)
+    {
+        worker_p->stats.accepts++;
+
+        struct conn *conn_p = conn_new(worker_p, cqe->res);
+        if (!conn_p)
+        {
+            conn_drop(worker_p, cqe->res);
+        }
+        else
+        {
+            struct sockaddr_storage client_addr;
+            socklen_t               addrlen = sizeof(client_addr);
+
+            memset(&client_addr, 0, sizeof(client_addr));
+            getpeername(cqe->res, (struct sockaddr *)&client_addr, &addrlen);
+
+            conn_set_name(conn_p, &client_addr);
+            if (client_addr.ss_family != AF_UNIX)
+                conn_accept_checks(worker_p, conn_p->fd);
+
+            TRACE(TRACE_EVENTS, TC_ACCEPT, listener_p->fd, conn_p->fd, 0, conn_p->name, strlen(conn_p->name));
+
+            if (arm_recv(ring_p, conn_p) != 0)
+            {
+                fprintf(stderr, RED "%s: submission queue full. Dropping client" NORMAL "\n", conn_p->name);
+                close_client(worker_p, conn_p);
+            }
+            else
+                conn_touch(worker_p, conn_p);
+        }
+    }
+    else
+    {
+        TRACE(TRACE_EVENTS, TC_ACCEPT, listener_p->fd, -1, -cqe->res, NULL, 0);
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE) && !stop)
+        arm_accept(ring_p, listener_p);
+}
+
+static void handle_recv(struct worker *worker_p, struct uring *ring_p, struct conn *conn_p, struct io_uring_cqe *cqe)
+{
+    int n = cqe->res;
+
+    worker_p->stats.recv_calls++;
+    if (n > 0)
+    {
+        unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        char    *data_p = ring_p->bufs + (size_t)bid * ring_p->buf_size;
+        TRACE(TRACE_SYSCALLS, TC_RECV, conn_p->fd, n, 0, data_p, n);
+        worker_count_rx(worker_p, n);
+
+        if (!worker_p->args_p->framed)
+        {
+            worker_capture(worker_p, conn_p, data_p, n);
+            if (worker_p->args_p->crc)
+                conn_crc(worker_p, conn_p, data_p, n);
+        }
+
+        // The echo is a plain send(): io_uring sends to the same socket
+        // may complete out of order once one of them goes asynchronous.
+        int rc = worker_p->args_p->framed ? conn_frames(worker_p, conn_p, data_p, n)
+               : worker_p->args_p->echo   ? echo(worker_p, conn_p, data_p, n) : 0;
+        uring_recycle_buf(ring_p, bid);
+        if (rc == 0 && wq_pending(&conn_p->wq) && !conn_p->polling)
+            rc = arm_poll(ring_p, conn_p);
+        if (rc != 0)
+        {
+            // The connection can only be freed once the recv is over.
+            if (cqe->flags & IORING_CQE_F_MORE)
+                shutdown_client(worker_p, conn_p);
+            else
+                close_client(worker_p, conn_p);
+            return;
+        }
+        conn_touch(worker_p, conn_p);
+    }
+    else if (n == 0)
+    {
+        TRACE(TRACE_SYSCALLS, TC_RECV, conn_p->fd, 0, 0, NULL, 0);
+        close_client(worker_p, conn_p);
+        return;
+    }
+    else if (n == -ENOBUFS)
+    {
+        // Every provided buffer is in use. The multishot recv was
+        // terminated; it is re-armed below now that buffers were recycled.
+        TRACE(TRACE_SYSCALLS, TC_RECV, conn_p->fd, -1, -n, NULL, 0);
+    }
+    else
+    {
+        TRACE(TRACE_EVENTS, TC_RECV, conn_p->fd, -1, -n, NULL, 0);
+        close_client(worker_p, conn_p);
+        return;
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE) && arm_recv(ring_p, conn_p) != 0)
+    {
+        fprintf(stderr, RED "%s: submission queue full. Dropping client" NORMAL "\n", conn_p->name);
+        close_client(worker_p, conn_p);
+    }
+}
+
+/* The socket of a client with queued echoes became writable (or failed). */
+static void handle_poll(struct worker *worker_p, struct uring *ring_p, struct conn *conn_p, struct io_uring_cqe *cqe)
+{
+    conn_p->polling = 0;
+    if (conn_p->closing)
+    {
+        conn_free(worker_p, conn_p);
+        return;
+    }
+
+    size_t queued = wq_pending(&conn_p->wq);
+    int    rc     = cqe->res < 0 ? -1 : wq_flush(&conn_p->wq, conn_p->fd, 0);
+    TRACE(TRACE_SYSCALLS, TC_SEND, conn_p->fd, rc < 0 ? -1 : (ssize_t)(queued - wq_pending(&conn_p->wq)),
+          cqe->res < 0 ? -cqe->res : errno, NULL, 0);
+    if (cqe->res >= 0 && rc >= 0)
+        worker_count_tx(worker_p, rc, queued - wq_pending(&conn_p->wq));
+
+    if (rc < 0 || (rc > 0 && arm_poll(ring_p, conn_p) != 0))
+        shutdown_client(worker_p, conn_p);
+}
+
+int uring_loop(struct worker *worker_p, struct conn **listeners_pp, int nlisteners,
+               const sigset_t *sigmsk_p)
+{
+    struct uring ring;
+    int          status = EXIT_SUCCESS;
+
+    if (uring_init(&ring, worker_p->args_p->recv_size) != 0)
+    {
+        uring_exit(&ring);
+        return EXIT_FAILURE;
+    }
+
+    const struct arguments *args_p = worker_p->args_p;
+    if ((args_p->idle_timeout_ms || args_p->read_timeout_ms) && !(ring.features & IORING_FEAT_EXT_ARG))
+    {
+        fprintf(stderr, RED "This kernel's io_uring cannot wait with a timeout: use --io=epoll" NORMAL "\n");
+        uring_exit(&ring);
+        return EXIT_FAILURE;
+    }
+
+    timer_wheel_init(&worker_p->wheel, timer_now_ms());
+
+    for (int i = 0; i < nlisteners; i++)
+        arm_accept(&ring, listeners_pp[i]);
+    __atomic_add_fetch(&workers_ready, 1, __ATOMIC_RELEASE);
+
+    while (!stop)
+    {
+        // Submit everything queued by the previous batch and wait for at
+        // least one completion or the nearest deadline, all in one syscall.
+        int timeout = timer_wheel_timeout(&worker_p->wheel, timer_now_ms());
+        int rc      = uring_wait(&ring, uring_flush(&ring), sigmsk_p, timeout);
+
+        if (stop) break;
+
+        if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY && errno != ETIME)
+        {
+            fprintf(stderr, RED "Serious error in io_uring setup: io_uring_enter() returned < 0 status! %m" NORMAL "\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        uint64_t t0_ns = worker_now_ns();
+        unsigned head  = *ring.cq_head;
+        unsigned tail  = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        int      busy  = head != tail;
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe *cqe    = &ring.cqes[head & ring.cq_mask];
+            struct conn         *conn_p = (struct conn *)(uintptr_t)(cqe->user_data & ~(__u64)URING_POLL_TAG);
+
+            if (cqe->user_data & URING_POLL_TAG)
+                handle_poll(worker_p, &ring, conn_p, cqe);
+            else if (conn_p->listener)
+                handle_accept(worker_p, &ring, conn_p, cqe);
+            else
+                handle_recv(worker_p, &ring, conn_p, cqe);
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+        conn_timers_run(worker_p, shutdown_client);
+        if (busy)
+            hist_record(&worker_p->batch_ns, worker_now_ns() - t0_ns);
+    }
+
+    uring_exit(&ring);
+
+    return status;
+}